@@ -31,6 +31,26 @@
 %include "controller_mellinger.h"
 %include "power_distribution.h"
 
+// Neighbor positions for collisionAvoidanceUpdateSetpointWrap, as a flat
+// sequence [x0, y0, z0, x1, y1, z1, ...]
+%typemap(in) (int nOthers, float const *otherPositions) {
+    if (!PySequence_Check($input)) {
+        PyErr_SetString(PyExc_TypeError, "expected a sequence of positions");
+        SWIG_fail;
+    }
+    $1 = PySequence_Length($input);
+    float *positions = malloc(sizeof(float) * ($1 > 0 ? $1 : 1));
+    for (int i = 0; i < $1; i++) {
+        PyObject *o = PySequence_GetItem($input, i);
+        positions[i] = (float)PyFloat_AsDouble(o);
+        Py_DECREF(o);
+    }
+    $2 = positions;
+}
+%typemap(freearg) (int nOthers, float const *otherPositions) {
+    free((void *)$2);
+}
+
 %inline %{
 struct poly4d* piecewise_get(struct piecewise_traj *pp, int i)
 {
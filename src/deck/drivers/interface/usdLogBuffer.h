@@ -0,0 +1,117 @@
+/**
+ *    ||          ____  _ __
+ * +------+      / __ )(_) /_______________ _____  ___
+ * | 0xBC |     / __  / / __/ ___/ ___/ __ `/_  / / _ \
+ * +------+    / /_/ / / /_/ /__/ /  / /_/ / / /_/  __/
+ *  ||  ||    /_____/_/\__/\___/_/   \__,_/ /___/\___/
+ *
+ * Crazyflie control firmware
+ *
+ * Copyright (C) 2016-2021 Bitcraze AB
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * usdLogBuffer.h: event buffer of the micro SD deck logger, with pre-trigger
+ * capture and overrun records. Does not lock, the caller holds the buffer mutex.
+ */
+
+#ifndef __USDLOGBUFFER_H__
+#define __USDLOGBUFFER_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define USD_LOG_OVERRUN_EVENT_ID          (0xFFFE)
+
+// Ring buffer
+typedef struct ringBuffer_s {
+  uint8_t* buffer;        // pointer to buffer
+  uint16_t capacity;      // total capacity of buffer
+  uint16_t size;          // used size of buffer
+  uint8_t* readPtr;       // pointer for read/pop
+  uint8_t* writePtr;      // pointer for write/push
+  uint16_t popSize;       // size for ongoing pop operation
+} ringBuffer_t;
+
+void ringBuffer_init(ringBuffer_t* b, uint8_t *buffer, uint16_t capacity);
+void ringBuffer_reset(ringBuffer_t *b);
+uint16_t ringBuffer_availableSpace(const ringBuffer_t* b);
+bool ringBuffer_push(ringBuffer_t* b, const void* data, uint16_t size);
+
+// copy data at "offset" from the read position, without removing it
+bool ringBuffer_peek(const ringBuffer_t* b, uint16_t offset, void* data, uint16_t size);
+
+// remove "size" bytes at the read position, must not be used during a pop operation
+void ringBuffer_discard(ringBuffer_t* b, uint16_t size);
+
+// get the next contiguous block of data, it is removed by ringBuffer_pop_done()
+bool ringBuffer_pop_start(ringBuffer_t* b, const uint8_t** buf, uint16_t* size);
+void ringBuffer_pop_done(ringBuffer_t *b);
+
+// Written to the log file before the next event of a block when events of the block have been lost
+typedef struct __attribute__((packed)) usdLogOverrunRecord_s {
+  uint16_t eventId;
+  uint64_t ticks;
+  uint16_t lostEventId;
+  uint32_t count;
+} usdLogOverrunRecord_t;
+
+// Returns the size of a record of "eventId" in the buffer, 0 if the event id is unknown
+typedef uint16_t (*usdLogRecordSize_t)(uint16_t eventId);
+
+typedef struct usdLogBuffer_s {
+  ringBuffer_t ring;
+  usdLogRecordSize_t recordSize;
+
+  // pre-trigger capture: keep the latest data in the buffer and write it when the trigger event fires
+  bool hasTrigger;
+  uint32_t preTriggerTime;  // ms
+  uint32_t postTriggerTime; // ms
+  // set when the trigger event fires, cleared by usdLogBufferReset()
+  volatile bool isTriggered;
+  uint64_t triggerTicks;
+} usdLogBuffer_t;
+
+void usdLogBufferInit(usdLogBuffer_t* b, uint8_t* data, uint16_t capacity, usdLogRecordSize_t recordSize);
+
+// Enable pre-trigger capture, times are in ms
+void usdLogBufferSetTrigger(usdLogBuffer_t* b, uint32_t preTriggerTime, uint32_t postTriggerTime);
+
+// Empty the buffer and arm the trigger
+void usdLogBufferReset(usdLogBuffer_t* b);
+
+// Fire the trigger at "ticks" (us), does nothing if it has already fired
+void usdLogBufferTrigger(usdLogBuffer_t* b, uint64_t ticks);
+
+// True while data is kept in the buffer until the trigger fires
+bool usdLogBufferIsWaitingForTrigger(const usdLogBuffer_t* b);
+
+// True when the time to log after the trigger has passed at "ticks" (us)
+bool usdLogBufferIsPostTriggerDone(const usdLogBuffer_t* b, uint64_t ticks);
+
+// Pre-trigger capture: drop the oldest records to make room for "dataSize" bytes and to only keep
+// the pre-trigger time before "ticks" (us). Returns the number of dropped records.
+uint32_t usdLogBufferDiscardOldEvents(usdLogBuffer_t* b, uint64_t ticks, uint16_t dataSize);
+
+// Push the event id and ticks of a record of "recordSize" bytes, the caller pushes the rest of it.
+// After the trigger, a record of the "pendingOverruns" lost events of the block is pushed first.
+// Returns false, without pushing anything, if the record does not fit.
+bool usdLogBufferBeginRecord(usdLogBuffer_t* b, uint16_t eventId, uint64_t ticks, uint16_t recordSize, uint32_t* pendingOverruns);
+
+#endif //__USDLOGBUFFER_H__
@@ -0,0 +1,247 @@
+/**
+ *    ||          ____  _ __
+ * +------+      / __ )(_) /_______________ _____  ___
+ * | 0xBC |     / __  / / __/ ___/ ___/ __ `/_  / / _ \
+ * +------+    / /_/ / / /_/ /__/ /  / /_/ / / /_/  __/
+ *  ||  ||    /_____/_/\__/\___/_/   \__,_/ /___/\___/
+ *
+ * Crazyflie control firmware
+ *
+ * Copyright (C) 2016-2021 Bitcraze AB
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * usdLogBuffer.c: event buffer of the micro SD deck logger, with pre-trigger
+ * capture and overrun records.
+ */
+
+#include <string.h>
+
+#include "usdLogBuffer.h"
+
+void ringBuffer_init(ringBuffer_t* b, uint8_t *buffer, uint16_t capacity)
+{
+  b->buffer = buffer;
+  b->capacity = capacity;
+  b->size = 0;
+  b->readPtr = buffer;
+  b->writePtr = buffer;
+  b->popSize = 0;
+}
+
+void ringBuffer_reset(ringBuffer_t *b)
+{
+  b->size = 0;
+  b->readPtr = b->buffer;
+  b->writePtr = b->buffer;
+  b->popSize = 0;
+}
+
+uint16_t ringBuffer_availableSpace(const ringBuffer_t* b)
+{
+  return b->capacity - b->size;
+}
+
+bool ringBuffer_push(ringBuffer_t* b, const void* data, uint16_t size)
+{
+  if (ringBuffer_availableSpace(b) < size) {
+    return false;
+  }
+  const uint8_t* dataTyped = (const uint8_t*)data;
+  // copy in at most two chunks, up to the end of the buffer and from the start
+  uint16_t untilEnd = b->buffer + b->capacity - b->writePtr;
+  uint16_t firstSize = size < untilEnd ? size : untilEnd;
+  memcpy(b->writePtr, dataTyped, firstSize);
+  memcpy(b->buffer, dataTyped + firstSize, size - firstSize);
+  b->writePtr += firstSize;
+  if (b->writePtr == b->buffer + b->capacity) {
+    b->writePtr = b->buffer + (size - firstSize);
+  }
+  b->size += size;
+  return true;
+}
+
+bool ringBuffer_peek(const ringBuffer_t* b, uint16_t offset, void* data, uint16_t size)
+{
+  if (b->size < offset + size) {
+    return false;
+  }
+  uint8_t* dataTyped = (uint8_t*)data;
+  const uint8_t* ptr = b->readPtr + offset;
+  if (ptr >= b->buffer + b->capacity) {
+    ptr -= b->capacity;
+  }
+  uint16_t untilEnd = b->buffer + b->capacity - ptr;
+  uint16_t firstSize = size < untilEnd ? size : untilEnd;
+  memcpy(dataTyped, ptr, firstSize);
+  memcpy(dataTyped + firstSize, b->buffer, size - firstSize);
+  return true;
+}
+
+void ringBuffer_discard(ringBuffer_t* b, uint16_t size)
+{
+  if (size > b->size) {
+    size = b->size;
+  }
+  b->readPtr += size;
+  if (b->readPtr >= b->buffer + b->capacity) {
+    b->readPtr -= b->capacity;
+  }
+  b->size -= size;
+}
+
+bool ringBuffer_pop_start(ringBuffer_t* b, const uint8_t** buf, uint16_t* size)
+{
+  if (b->size == 0) {
+    return false;
+  }
+
+  *buf = b->readPtr;
+  if (b->writePtr > b->readPtr) {
+    // writer did not wrap around yet
+    *size = b->writePtr - b->readPtr;
+    b->readPtr = b->writePtr;
+  } else {
+    // wrap around -> read until end of buffer, only
+    *size = b->buffer + b->capacity - b->readPtr;
+    b->readPtr = b->buffer;
+  }
+  b->popSize = *size;
+  return true;
+}
+
+void ringBuffer_pop_done(ringBuffer_t *b)
+{
+  b->size -= b->popSize;
+  b->popSize = 0;
+}
+
+void usdLogBufferInit(usdLogBuffer_t* b, uint8_t* data, uint16_t capacity, usdLogRecordSize_t recordSize)
+{
+  ringBuffer_init(&b->ring, data, capacity);
+  b->recordSize = recordSize;
+  b->hasTrigger = false;
+  b->preTriggerTime = 0;
+  b->postTriggerTime = 0;
+  b->isTriggered = false;
+  b->triggerTicks = 0;
+}
+
+void usdLogBufferSetTrigger(usdLogBuffer_t* b, uint32_t preTriggerTime, uint32_t postTriggerTime)
+{
+  b->hasTrigger = true;
+  b->preTriggerTime = preTriggerTime;
+  b->postTriggerTime = postTriggerTime;
+}
+
+void usdLogBufferReset(usdLogBuffer_t* b)
+{
+  ringBuffer_reset(&b->ring);
+  b->isTriggered = false;
+}
+
+void usdLogBufferTrigger(usdLogBuffer_t* b, uint64_t ticks)
+{
+  if (b->hasTrigger && !b->isTriggered) {
+    // the writer task reads isTriggered without the mutex, set the time first
+    b->triggerTicks = ticks;
+    b->isTriggered = true;
+  }
+}
+
+bool usdLogBufferIsWaitingForTrigger(const usdLogBuffer_t* b)
+{
+  return b->hasTrigger && !b->isTriggered;
+}
+
+bool usdLogBufferIsPostTriggerDone(const usdLogBuffer_t* b, uint64_t ticks)
+{
+  return b->hasTrigger && b->isTriggered && b->triggerTicks < ticks
+      && ticks - b->triggerTicks > (uint64_t)b->postTriggerTime * 1000;
+}
+
+static uint16_t recordSizeOf(const usdLogBuffer_t* b, uint16_t eventId)
+{
+  if (eventId == USD_LOG_OVERRUN_EVENT_ID) {
+    return sizeof(usdLogOverrunRecord_t);
+  }
+  return b->recordSize(eventId);
+}
+
+uint32_t usdLogBufferDiscardOldEvents(usdLogBuffer_t* b, uint64_t ticks, uint16_t dataSize)
+{
+  const uint64_t maxAge = (uint64_t)b->preTriggerTime * 1000;
+  uint32_t discarded = 0;
+
+  while (b->ring.size > 0) {
+    uint16_t eventId;
+    uint64_t eventTicks;
+    ringBuffer_peek(&b->ring, 0, &eventId, sizeof(eventId));
+    ringBuffer_peek(&b->ring, sizeof(eventId), &eventTicks, sizeof(eventTicks));
+
+    // an event that is newer than "ticks" is not old
+    const bool isTooOld = eventTicks < ticks && ticks - eventTicks > maxAge;
+    if (ringBuffer_availableSpace(&b->ring) >= dataSize && !isTooOld) {
+      break;
+    }
+
+    const uint16_t size = recordSizeOf(b, eventId);
+    if (size > 0) {
+      ringBuffer_discard(&b->ring, size);
+      if (eventId != USD_LOG_OVERRUN_EVENT_ID) {
+        ++discarded;
+      }
+    } else {
+      ringBuffer_reset(&b->ring);
+    }
+  }
+
+  return discarded;
+}
+
+bool usdLogBufferBeginRecord(usdLogBuffer_t* b, uint16_t eventId, uint64_t ticks, uint16_t recordSize, uint32_t* pendingOverruns)
+{
+  // no overrun records are written before the trigger
+  const bool writeOverrun = *pendingOverruns > 0 && !usdLogBufferIsWaitingForTrigger(b);
+
+  int dataSize = recordSize;
+  if (writeOverrun) {
+    dataSize += sizeof(usdLogOverrunRecord_t);
+  }
+
+  if (ringBuffer_availableSpace(&b->ring) < dataSize) {
+    return false;
+  }
+
+  /* account for events of this block that were lost */
+  if (writeOverrun) {
+    usdLogOverrunRecord_t overrun = {
+      .eventId = USD_LOG_OVERRUN_EVENT_ID,
+      .ticks = ticks,
+      .lostEventId = eventId,
+      .count = *pendingOverruns,
+    };
+    ringBuffer_push(&b->ring, &overrun, sizeof(overrun));
+    *pendingOverruns = 0;
+  }
+
+  ringBuffer_push(&b->ring, &eventId, sizeof(eventId));
+  ringBuffer_push(&b->ring, &ticks, sizeof(ticks));
+  return true;
+}
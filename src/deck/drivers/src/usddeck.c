@@ -49,6 +49,7 @@
 
 #include "deck.h"
 #include "usddeck.h"
+#include "usdLogBuffer.h"
 #include "system.h"
 #include "sensors.h"
 #include "debug.h"
@@ -94,6 +95,7 @@
 #define MAX_USD_LOG_EVENTS                (20)
 #define FIXED_FREQUENCY_EVENT_ID          (0xFFFF)
 #define FIXED_FREQUENCY_EVENT_NAME        "fixedFrequency"
+#define OVERRUN_EVENT_NAME                "overrun"
 
 
 /* set to true when graceful shutdown is triggered */
@@ -103,7 +105,12 @@ typedef struct usdLogEventConfig_s {
   uint16_t eventId;
   uint8_t numVars;
   uint16_t numBytes;
+  uint8_t payloadSize;
   logVarId_t varIds[MAX_USD_LOG_VARIABLES_PER_EVENT];
+
+  // events that did not fit in the buffer, in total and since the last overrun record was written
+  uint32_t overruns;
+  uint32_t pendingOverruns;
 } usdLogEventConfig_t;
 
 typedef struct usdLogConfig_s {
@@ -116,89 +123,20 @@ typedef struct usdLogConfig_s {
   uint32_t numEventConfigs;
   usdLogEventConfig_t eventConfigs[MAX_USD_LOG_EVENTS];
   uint8_t fixedFrequencyEventIdx;
+
+  // pre-trigger capture: keep the latest data in the buffer and write it when the trigger event fires
+  bool hasTrigger;
+  uint16_t triggerEventId;
+  uint32_t preTriggerTime;  // ms
+  uint32_t postTriggerTime; // ms
 } usdLogConfig_t;
 
 typedef struct usdLogStats_s {
   uint32_t eventsRequested;
   uint32_t eventsWritten;
+  uint32_t overruns;
 } usdLogStats_t;
 
-// Ring buffer
-typedef struct ringBuffer_s {
-  uint8_t* buffer;        // pointer to buffer
-  uint16_t capacity;      // total capacity of buffer
-  uint16_t size;          // used size of buffer
-  uint8_t* readPtr;       // pointer for read/pop
-  uint8_t* writePtr;      // pointer for write/push
-  uint16_t popSize;       // size for ongoing pop operation
-} ringBuffer_t;
-
-void ringBuffer_init(ringBuffer_t* b, uint8_t *buffer, uint16_t capacity)
-{
-  b->buffer = buffer;
-  b->capacity = capacity;
-  b->size = 0;
-  b->readPtr = buffer;
-  b->writePtr = buffer;
-  b->popSize = 0;
-}
-
-void ringBuffer_reset(ringBuffer_t *b)
-{
-  b->size = 0;
-  b->readPtr = b->buffer;
-  b->writePtr = b->buffer;
-  b->popSize = 0;
-}
-
-uint16_t ringBuffer_availableSpace(const ringBuffer_t* b)
-{
-  return b->capacity - b->size;
-}
-
-bool ringBuffer_push(ringBuffer_t* b, const void* data, uint16_t size)
-{
-  if (ringBuffer_availableSpace(b) < size) {
-    return false;
-  }
-  const uint8_t* dataTyped = (const uint8_t*)data;
-  for (uint16_t i = 0; i < size; ++i) {
-    *(b->writePtr) = dataTyped[i];
-    ++b->writePtr;
-    if (b->writePtr ==  b->buffer + b->capacity) {
-      b->writePtr = b->buffer;
-    }
-  }
-  b->size += size;
-  return true;
-}
-
-bool ringBuffer_pop_start(ringBuffer_t* b, const uint8_t** buf, uint16_t* size)
-{
-  if (b->size == 0) {
-    return false;
-  }
-
-  *buf = b->readPtr;
-  if (b->writePtr > b->readPtr) {
-    // writer did not wrap around yet
-    *size = b->writePtr - b->readPtr;
-    b->readPtr = b->writePtr;
-  } else {
-    // wrap around -> read until end of buffer, only
-    *size = b->buffer + b->capacity - b->readPtr;
-    b->readPtr = b->buffer;
-  }
-  b->popSize = *size;
-  return true;
-}
-
-void ringBuffer_pop_done(ringBuffer_t *b)
-{
-  b->size -= b->popSize;
-  b->popSize = 0;
-}
-
 // FATFS low lever driver functions.
 static void initSpi(void);
 static void setSlowSpiMode(void);
@@ -234,7 +172,7 @@ static FIL logFile;
 static SemaphoreHandle_t logFileMutex;
 
 static SemaphoreHandle_t logBufferMutex;
-static ringBuffer_t logBuffer;
+static usdLogBuffer_t logBuffer;
 static TaskHandle_t xHandleWriteTask;
 
 static bool enableLogging;
@@ -474,10 +412,29 @@ static void usdInit(DeckInfo *info)
   isInit = true;
 }
 
-static void usddeckWriteEventData(const usdLogEventConfig_t* cfg, const uint8_t* payload, uint8_t payloadSize)
+static int eventRecordSize(const usdLogEventConfig_t* cfg)
 {
-  uint64_t ticks = usecTimestamp();
+  return sizeof(cfg->eventId) + sizeof(uint64_t) + cfg->payloadSize + cfg->numBytes;
+}
+
+static const usdLogEventConfig_t* findEventConfig(uint16_t eventId)
+{
+  for (uint8_t i = 0; i < usdLogConfig.numEventConfigs; ++i) {
+    if (usdLogConfig.eventConfigs[i].eventId == eventId) {
+      return &usdLogConfig.eventConfigs[i];
+    }
+  }
+  return 0;
+}
 
+static uint16_t eventRecordSizeById(uint16_t eventId)
+{
+  const usdLogEventConfig_t* cfg = findEventConfig(eventId);
+  return cfg ? eventRecordSize(cfg) : 0;
+}
+
+static void usddeckWriteEventData(usdLogEventConfig_t* cfg, const uint8_t* payload, uint8_t payloadSize)
+{
   if (!enableLogging) {
     return;
   }
@@ -486,21 +443,28 @@ static void usddeckWriteEventData(const usdLogEventConfig_t* cfg, const uint8_t*
 
   xSemaphoreTake(logBufferMutex, portMAX_DELAY);
 
+  // read the time with the mutex held to keep the records in the buffer in time order
+  uint64_t ticks = usecTimestamp();
+
+  const bool waitingForTrigger = usdLogBufferIsWaitingForTrigger(&logBuffer);
+
   // trigger writing once there is some data
-  if (logBuffer.size > 0 && xHandleWriteTask) {
+  if (logBuffer.ring.size > 0 && xHandleWriteTask && !waitingForTrigger) {
     vTaskResume(xHandleWriteTask);
   }
 
-  int dataSize = sizeof(cfg->eventId) + sizeof(ticks) + payloadSize + cfg->numBytes;
+  int dataSize = eventRecordSize(cfg);
+
+  if (waitingForTrigger) {
+    // discarded events are never written to the file
+    usdLogStats.eventsWritten -= usdLogBufferDiscardOldEvents(&logBuffer, ticks, dataSize);
+  }
 
   // only write if we have enough space
-  if (ringBuffer_availableSpace(&logBuffer) >= dataSize) {
+  if (usdLogBufferBeginRecord(&logBuffer, cfg->eventId, ticks, dataSize, &cfg->pendingOverruns)) {
     /* write data into buffer */
-    uint16_t event_id = cfg->eventId;
-    ringBuffer_push(&logBuffer, &event_id, sizeof(event_id));
-    ringBuffer_push(&logBuffer, &ticks, sizeof(ticks));
     if (payloadSize) {
-      ringBuffer_push(&logBuffer, payload, payloadSize);
+      ringBuffer_push(&logBuffer.ring, payload, payloadSize);
     }
 
     for (int i = 0; i < cfg->numVars; ++i) {
@@ -508,16 +472,16 @@ static void usddeckWriteEventData(const usdLogEventConfig_t* cfg, const uint8_t*
       switch (logGetType(varid)) {
       case LOG_UINT8:
       case LOG_INT8:
-        ringBuffer_push(&logBuffer, logGetAddress(varid), sizeof(uint8_t));
+        ringBuffer_push(&logBuffer.ring, logGetAddress(varid), sizeof(uint8_t));
         break;
       case LOG_UINT16:
       case LOG_INT16:
-        ringBuffer_push(&logBuffer, logGetAddress(varid), sizeof(uint16_t));
+        ringBuffer_push(&logBuffer.ring, logGetAddress(varid), sizeof(uint16_t));
         break;
       case LOG_UINT32:
       case LOG_INT32:
       case LOG_FLOAT:
-        ringBuffer_push(&logBuffer, logGetAddress(varid), sizeof(uint32_t));
+        ringBuffer_push(&logBuffer.ring, logGetAddress(varid), sizeof(uint32_t));
         break;
       default:
         ASSERT(false);
@@ -525,6 +489,10 @@ static void usddeckWriteEventData(const usdLogEventConfig_t* cfg, const uint8_t*
       }
     }
     ++usdLogStats.eventsWritten;
+  } else {
+    ++cfg->overruns;
+    ++cfg->pendingOverruns;
+    ++usdLogStats.overruns;
   }
   xSemaphoreGive(logBufferMutex);
 }
@@ -538,6 +506,17 @@ static void usddeckEventtriggerCallback(const eventtrigger *event)
       break;
     }
   }
+
+  if (usdLogConfig.hasTrigger && eventId == usdLogConfig.triggerEventId && enableLogging) {
+    xSemaphoreTake(logBufferMutex, portMAX_DELAY);
+    usdLogBufferTrigger(&logBuffer, usecTimestamp());
+    xSemaphoreGive(logBufferMutex);
+
+    // start writing the captured data
+    if (xHandleWriteTask) {
+      vTaskResume(xHandleWriteTask);
+    }
+  }
 }
 
 static void usdGracefulShutdownCallback()
@@ -600,6 +579,7 @@ static void usdLogTask(void* prm)
       usdLogConfig.numEventConfigs = 0;
       usdLogConfig.fixedFrequencyEventIdx = MAX_USD_LOG_EVENTS;
       usdLogConfig.frequency = 10; // use non-zero default value for task loop below
+      usdLogConfig.hasTrigger = false;
       usdLogEventConfig_t *cfg = &usdLogConfig.eventConfigs[0];
       const char* eventName = 0;
       line = f_gets_without_comments(readBuffer, sizeof(readBuffer), &logFile);
@@ -616,6 +596,7 @@ static void usdLogTask(void* prm)
             if (!line) break;
             usdLogConfig.mode = strtol(line, &endptr, 10);
             cfg->eventId = FIXED_FREQUENCY_EVENT_ID;
+            cfg->payloadSize = 0;
             eventName = FIXED_FREQUENCY_EVENT_NAME;
             usdLogConfig.fixedFrequencyEventIdx = usdLogConfig.numEventConfigs;
           } else {
@@ -623,6 +604,7 @@ static void usdLogTask(void* prm)
             const eventtrigger *et = eventtriggerGetByName(&line[3]);
             if (et) {
               cfg->eventId = eventtriggerGetId(et);
+              cfg->payloadSize = et->payloadSize;
               eventName = et->name;
             } else {
               DEBUG_PRINT("Unknown event %s\n", &line[3]);
@@ -636,7 +618,7 @@ static void usdLogTask(void* prm)
           cfg->numBytes = 0;
           while (true) {
             line = f_gets_without_comments(readBuffer, sizeof(readBuffer), &logFile);
-            if (!line || strncmp(line, "on:", 3) == 0)
+            if (!line || strncmp(line, "on:", 3) == 0 || strncmp(line, "trigger:", 8) == 0)
               break;
             char *group = line;
             char *name = 0;
@@ -669,6 +651,24 @@ static void usdLogTask(void* prm)
             DEBUG_PRINT("Skip config after event %s (out of storage)\n", eventName);
             break;
           }
+        } else if (strncmp(line, "trigger:", 8) == 0) {
+          // pre-trigger capture "trigger:<name>"
+          const eventtrigger *et = eventtriggerGetByName(&line[8]);
+          if (et) {
+            usdLogConfig.triggerEventId = eventtriggerGetId(et);
+            usdLogConfig.hasTrigger = true;
+          } else {
+            DEBUG_PRINT("Unknown trigger event %s\n", &line[8]);
+          }
+          // time to keep before the trigger
+          line = f_gets_without_comments(readBuffer, sizeof(readBuffer), &logFile);
+          if (!line) break;
+          usdLogConfig.preTriggerTime = strtol(line, &endptr, 10);
+          // time to log after the trigger
+          line = f_gets_without_comments(readBuffer, sizeof(readBuffer), &logFile);
+          if (!line) break;
+          usdLogConfig.postTriggerTime = strtol(line, &endptr, 10);
+          line = f_gets_without_comments(readBuffer, sizeof(readBuffer), &logFile);
         } else {
           line = f_gets_without_comments(readBuffer, sizeof(readBuffer), &logFile);
         }
@@ -701,7 +701,10 @@ static void usdLogTask(void* prm)
       DEBUG_PRINT("[FAIL].\n");
       break;
     }
-    ringBuffer_init(&logBuffer, logBufferData, usdLogConfig.bufferSize);
+    usdLogBufferInit(&logBuffer, logBufferData, usdLogConfig.bufferSize, eventRecordSizeById);
+    if (usdLogConfig.hasTrigger) {
+      usdLogBufferSetTrigger(&logBuffer, usdLogConfig.preTriggerTime, usdLogConfig.postTriggerTime);
+    }
 
     /* create queue to hand over pointer to usdLogData */
     // usdLogQueue = xQueueCreate(usdLogConfig.queueSize, sizeof(uint8_t*));
@@ -728,6 +731,12 @@ static void usdLogTask(void* prm)
       if (enableLogging && usdLogConfig.mode == usddeckLoggingMode_Asynchronous) {
         usddeckTriggerLogging();
       }
+
+      // pre-trigger capture: stop logging when the time after the trigger has passed
+      if (enableLogging && usdLogBufferIsPostTriggerDone(&logBuffer, usecTimestamp())) {
+        enableLogging = false;
+        vTaskResume(xHandleWriteTask);
+      }
       lastEnableLogging = enableLogging;
     }
   }
@@ -822,11 +831,16 @@ static void usdWriteTask(void* prm)
     if (enableLogging) {
       // reset stats
       usdLogStats.eventsRequested = 0;
-      usdLogStats.eventsWritten = 0;
+      usdLogStats.overruns = 0;
 
-      // reset the buffer
+      // reset the buffer and arm the trigger, eventsWritten counts the events in the buffer that are not discarded
       xSemaphoreTake(logBufferMutex, portMAX_DELAY);
-      ringBuffer_reset(&logBuffer);
+      usdLogBufferReset(&logBuffer);
+      usdLogStats.eventsWritten = 0;
+      for (uint8_t i = 0; i < usdLogConfig.numEventConfigs; ++i) {
+        usdLogConfig.eventConfigs[i].overruns = 0;
+        usdLogConfig.eventConfigs[i].pendingOverruns = 0;
+      }
       xSemaphoreGive(logBufferMutex);
 
       xSemaphoreTake(logFileMutex, portMAX_DELAY);
@@ -869,10 +883,19 @@ static void usdWriteTask(void* prm)
         uint16_t version = 2;
         usdWriteData(&version, sizeof(version));
 
-        uint16_t numEventTypes = usdLogConfig.numEventConfigs;
+        // the event types from the config and the overrun event
+        uint16_t numEventTypes = usdLogConfig.numEventConfigs + 1;
         usdWriteData(&numEventTypes, sizeof(numEventTypes));
 
-        for (int i = 0; i < numEventTypes; ++i) {
+        uint16_t overrunEventId = USD_LOG_OVERRUN_EVENT_ID;
+        uint16_t numOverrunVariables = 2;
+        usdWriteData(&overrunEventId, sizeof(overrunEventId));
+        usdWriteData(OVERRUN_EVENT_NAME, strlen(OVERRUN_EVENT_NAME) + 1);
+        usdWriteData(&numOverrunVariables, sizeof(numOverrunVariables));
+        usdWriteData("eventId(H)", 11);
+        usdWriteData("count(I)", 9);
+
+        for (uint8_t i = 0; i < usdLogConfig.numEventConfigs; ++i) {
           usdLogEventConfig_t* cfg = &usdLogConfig.eventConfigs[i];
           const eventtrigger *et = eventtriggerGetById(cfg->eventId);
           uint16_t numVariables = cfg->numVars;
@@ -968,11 +991,16 @@ static void usdWriteTask(void* prm)
           /* sleep */
           vTaskSuspend(NULL);
 
+          // keep the data in the buffer until the trigger fires
+          if (usdLogBufferIsWaitingForTrigger(&logBuffer)) {
+            continue;
+          }
+
           // check if we have anything to write
           xSemaphoreTake(logBufferMutex, portMAX_DELAY);
           const uint8_t* buf;
           uint16_t size;
-          bool hasData = ringBuffer_pop_start(&logBuffer, &buf, &size);
+          bool hasData = ringBuffer_pop_start(&logBuffer.ring, &buf, &size);
           xSemaphoreGive(logBufferMutex);
 
           // execute the actual write operation
@@ -980,7 +1008,7 @@ static void usdWriteTask(void* prm)
             usdWriteData(buf, size);
 
             xSemaphoreTake(logBufferMutex, portMAX_DELAY);
-            ringBuffer_pop_done(&logBuffer);
+            ringBuffer_pop_done(&logBuffer.ring);
             xSemaphoreGive(logBufferMutex);
           }
         }
@@ -989,10 +1017,10 @@ static void usdWriteTask(void* prm)
         while (true) {
           const uint8_t *buf;
           uint16_t size;
-          bool hasData = ringBuffer_pop_start(&logBuffer, &buf, &size);
+          bool hasData = ringBuffer_pop_start(&logBuffer.ring, &buf, &size);
           if (hasData) {
             usdWriteData(buf, size);
-            ringBuffer_pop_done(&logBuffer);
+            ringBuffer_pop_done(&logBuffer.ring);
           } else {
             break;
           }
@@ -1017,6 +1045,12 @@ static void usdWriteTask(void* prm)
           usdLogConfig.filename,
           usdLogStats.eventsWritten,
           usdLogStats.eventsRequested);
+        for (uint8_t i = 0; i < usdLogConfig.numEventConfigs; ++i) {
+          const usdLogEventConfig_t* cfg = &usdLogConfig.eventConfigs[i];
+          if (cfg->overruns > 0) {
+            DEBUG_PRINT("Lost %ld events of event id %d (buffer full)\n", cfg->overruns, cfg->eventId);
+          }
+        }
 
         xSemaphoreGive(logFileMutex);
       } else {
@@ -1115,4 +1149,8 @@ STATS_CNT_RATE_LOG_ADD(spiReBps, &spiReadRate)
  * @brief Data write rate to the SD card [bytes/s]
  */
 STATS_CNT_RATE_LOG_ADD(fatWrBps, &fatWriteRate)
+/**
+ * @brief Number of events that were lost since logging was started, since they did not fit in the buffer
+ */
+LOG_ADD(LOG_UINT32, overruns, &usdLogStats.overruns)
 LOG_GROUP_STOP(usd)
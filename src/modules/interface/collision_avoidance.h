@@ -92,6 +92,13 @@ typedef struct collision_avoidance_params_s
   // Most users should not need to tune this.
   int voronoiProjectionMaxIters;
 
+  // Max number of neighbors used to construct our Voronoi cell. Neighbors that
+  // are too far away to constrain the cell within the planning horizon are
+  // always left out. If more neighbors remain, only the ones with the closest
+  // cell faces are used. This bounds the computation time in dense swarms, at
+  // the cost of ignoring some neighbors. If zero or negative, there is no limit.
+  int maxNeighbors;
+
 } collision_avoidance_params_t;
 
 
@@ -105,6 +112,10 @@ typedef struct collision_avoidance_state_s
   // state as a setpoint.
   struct vec lastFeasibleSetPosition;
 
+  // Number of neighbors that were used to construct our Voronoi cell in the
+  // last update. Only for diagnostics, it is not read by the algorithm.
+  int nNeighbors;
+
 } collision_avoidance_state_t;
 
 
@@ -51,6 +51,7 @@ Header file for high-level commander that computes smooth setpoints based on hig
 typedef enum {
   CRTP_CHL_TRAJECTORY_TYPE_POLY4D = 0, // struct poly4d, see pptraj.h
   CRTP_CHL_TRAJECTORY_TYPE_POLY4D_COMPRESSED = 1, // see pptraj_compressed.h
+  CRTP_CHL_TRAJECTORY_TYPE_POLY4D_STREAMING = 2, // ring of struct poly4d that is appended to while flying, see crtpCommanderHighLevelAppendTrajectory()
   // Future types might include versions without yaw
 } crtpCommanderTrajectoryType_t;
 
@@ -202,6 +203,24 @@ int crtpCommanderHighLevelStartTrajectory(const uint8_t trajectoryId, const floa
  */
 int crtpCommanderHighLevelDefineTrajectory(const uint8_t trajectoryId, const crtpCommanderTrajectoryType_t type, const uint32_t offset, const uint8_t nPieces);
 
+/**
+ * @brief Append pieces to a streaming trajectory. A streaming trajectory is defined with the type
+ *        CRTP_CHL_TRAJECTORY_TYPE_POLY4D_STREAMING, where nPieces is the number of pieces that fit in the ring at offset.
+ *        The pieces are written to the ring in order, wrapping around at the end, and are then appended with this
+ *        function. Pieces can be appended before and while the trajectory is played, as long as there are free slots in
+ *        the ring (see the hlStream log group). Slots are freed when the pieces have been played.
+ *
+ *        If the trajectory runs out of pieces before the last piece has been appended, the high-level commander
+ *        smoothly stops and hovers. When the last piece has been played, it hovers at the end of the trajectory and the
+ *        ring can be defined again.
+ *
+ * @param trajectoryId The id of the streaming trajectory
+ * @param nPieces      Nr of pieces to append
+ * @param last         set to True if this is the end of the trajectory
+ * @return zero if the command succeeded, an error code otherwise
+ */
+int crtpCommanderHighLevelAppendTrajectory(const uint8_t trajectoryId, const uint8_t nPieces, const bool last);
+
 /**
  * @brief Get the size of the allocated trajectory memory
  *
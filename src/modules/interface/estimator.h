@@ -53,11 +53,13 @@ typedef enum {
   MeasurementTypeGyroscope,
   MeasurementTypeAcceleration,
   MeasurementTypeBarometer,
+  MeasurementTypeCount,
 } MeasurementType;
 
 typedef struct
 {
   MeasurementType type;
+  uint64_t timestamp; // Time when the measurement was enqueued, from usecTimestamp(). Set by estimatorEnqueue()
   union
   {
     tdoaMeasurement_t tdoa;
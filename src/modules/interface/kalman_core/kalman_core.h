@@ -55,6 +55,7 @@
 
 #include "cf_math.h"
 #include "stabilizer_types.h"
+#include "autoconf.h"
 
 // Indexes to access the quad's state, stored as a column vector
 typedef enum
@@ -63,6 +64,32 @@ typedef enum
 } kalmanCoreStateIdx_t;
 
 
+// The number of unique elements in the (symmetric) covariance matrix
+#define KC_PACKED_DIM (KC_STATE_DIM * (KC_STATE_DIM + 1) / 2)
+
+// Index of element (i, j), i <= j, in packed covariance storage. The upper triangle is stored row by row.
+#define KC_PACKED_INDEX_UPPER(i, j) ((i) * (2 * KC_STATE_DIM - (i) - 1) / 2 + (j))
+#define KC_PACKED_INDEX(i, j) ((int)(i) <= (int)(j) ? KC_PACKED_INDEX_UPPER(i, j) : KC_PACKED_INDEX_UPPER(j, i))
+
+// Access element (i, j) of the covariance matrix, independent of the storage layout
+#ifdef CONFIG_ESTIMATOR_KALMAN_PACKED_COVARIANCE
+#define KC_COV(this, i, j) ((this)->P[KC_PACKED_INDEX(i, j)])
+#else
+#define KC_COV(this, i, j) ((this)->P[i][j])
+#endif
+
+// The maximum number of scalar measurements that are fused in one batch update
+#define KC_BATCH_MAX_ROWS 8
+
+// Scalar measurements collected for a joint (batch) update. Each row is one scalar
+// measurement with the same meaning as the arguments to kalmanCoreScalarUpdate()
+typedef struct {
+  float h[KC_BATCH_MAX_ROWS][KC_STATE_DIM];
+  float error[KC_BATCH_MAX_ROWS];
+  float stdMeasNoise[KC_BATCH_MAX_ROWS];
+  int rows;
+} kalmanCoreBatch_t;
+
 // The data used by the kalman core implementation.
 typedef struct {
   /**
@@ -85,14 +112,23 @@ typedef struct {
   // The quad's attitude as a rotation matrix (used by the prediction, updated by the finalization)
   float R[3][3];
 
+#ifdef CONFIG_ESTIMATOR_KALMAN_PACKED_COVARIANCE
+  // The covariance matrix, only the upper triangle is stored since it is symmetric. Use KC_COV() to access elements.
+  float P[KC_PACKED_DIM];
+#else
   // The covariance matrix
   __attribute__((aligned(4))) float P[KC_STATE_DIM][KC_STATE_DIM];
   arm_matrix_instance_f32 Pm;
+#endif
 
   float baroReferenceHeight;
 
   // Quaternion used for initial orientation [w,x,y,z]
   float initialQuaternion[4];
+
+  // When set, scalar updates are collected in the batch instead of being applied directly,
+  // see kalmanCoreBatchBegin()
+  kalmanCoreBatch_t* batch;
 } kalmanCoreData_t;
 
 // The parameters used by the filter
@@ -153,6 +189,42 @@ void kalmanCoreExternalizeState(const kalmanCoreData_t* this, state_t *state, co
 
 void kalmanCoreDecoupleXY(kalmanCoreData_t* this);
 
+/*  - Copy the covariance matrix to a full NxN matrix, independent of the storage layout */
+void kalmanCoreGetCovarianceMatrix(const kalmanCoreData_t* this, float P[KC_STATE_DIM][KC_STATE_DIM]);
+
+/*  - Set the covariance matrix from a full NxN matrix. The matrix is symmetrized and bounded. */
+void kalmanCoreSetCovarianceMatrix(kalmanCoreData_t* this, float P[KC_STATE_DIM][KC_STATE_DIM]);
+
+/*  - Scalar measurement update. Uses the sparse implementation unless CONFIG_ESTIMATOR_KALMAN_DENSE_SCALAR_UPDATE is set */
 void kalmanCoreScalarUpdate(kalmanCoreData_t* this, arm_matrix_instance_f32 *Hm, float error, float stdMeasNoise);
 
+/*  - Scalar measurement update using full matrix multiplications for the covariance update, O(N^3).
+ *    Not available with CONFIG_ESTIMATOR_KALMAN_PACKED_COVARIANCE */
+void kalmanCoreScalarUpdateDense(kalmanCoreData_t* this, arm_matrix_instance_f32 *Hm, float error, float stdMeasNoise);
+
+/*  - Scalar measurement update that only uses the non-zero elements of H and a rank-1 covariance update, O(N^2).
+ *    Numerically equivalent to the dense version as long as P is symmetric. The measurement models all go through
+ *    kalmanCoreScalarUpdate(), the implementation is selected globally and batching is bypassed when calling the
+ *    dense or sparse version directly. */
+void kalmanCoreScalarUpdateSparse(kalmanCoreData_t* this, arm_matrix_instance_f32 *Hm, float error, float stdMeasNoise);
+
+/**
+ * Batch updates
+ *
+ * Between kalmanCoreBatchBegin() and kalmanCoreBatchEnd(), calls to kalmanCoreScalarUpdate() (and thus the measurement
+ * models) only add a row to the batch. The rows are fused in one joint update when the batch is flushed, ended or full.
+ * All rows in a batch are linearized around the same state, which is the state at the time of the last flush.
+ */
+void kalmanCoreBatchBegin(kalmanCoreData_t* this, kalmanCoreBatch_t* batch);
+
+/*  - Fuse all collected rows, collection of new rows continues. Must be called before updates that do not go through
+ *    kalmanCoreScalarUpdate(), for instance the robust measurement models. */
+void kalmanCoreBatchFlush(kalmanCoreData_t* this);
+
+/*  - Fuse all collected rows and go back to applying scalar updates directly */
+void kalmanCoreBatchEnd(kalmanCoreData_t* this);
+
+/*  - Joint update with all rows in the batch, using one pass over the covariance matrix */
+void kalmanCoreUpdateBatch(kalmanCoreData_t* this, const kalmanCoreBatch_t* batch);
+
 void kalmanCoreUpdateWithPKE(kalmanCoreData_t* this, arm_matrix_instance_f32 *Hm, arm_matrix_instance_f32 *Km, arm_matrix_instance_f32 *P_w_m, float error);
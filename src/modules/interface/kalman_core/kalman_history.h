@@ -0,0 +1,140 @@
+/**
+ * ,---------,       ____  _ __
+ * |  ,-^-,  |      / __ )(_) /_______________ _____  ___
+ * | (  O  ) |     / __  / / __/ ___/ ___/ __ `/_  / / _ \
+ * | / ,--'  |    / /_/ / / /_/ /__/ /  / /_/ / / /_/  __/
+ *    +------`   /_____/_/\__/\___/_/   \__,_/ /___/\___/
+ *
+ * Crazyflie control firmware
+ *
+ * Copyright (C) 2023 Bitcraze AB
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, in version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * kalman_history.h - History of the kalman filter, used to fuse delayed measurements at the time they were taken
+ *
+ * The history keeps a snapshot of the filter and the inputs for the most recent prediction steps, together with the
+ * measurements that have been fused. A measurement that is older than the latest prediction step is fused by rewinding
+ * the filter to the prediction step before the measurement was taken, and replaying the prediction steps and
+ * measurements up to the current time. The outlier filters are saved with each snapshot and rewound with the filter,
+ * so that a replay validates every measurement once, in the order the measurements were taken.
+ *
+ * RAM usage is dominated by the KALMAN_HISTORY_STEPS snapshots of kalmanCoreData_t and the KALMAN_HISTORY_MEASUREMENTS
+ * copies of measurement_t, around 6.5 kB in total.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "kalman_core.h"
+#include "estimator.h"
+#include "outlierFilter.h"
+
+// The number of prediction steps in the history, this is the maximum delay (in prediction periods) that can be handled
+#define KALMAN_HISTORY_STEPS 8
+
+// The number of fused measurements that are kept for replay
+#define KALMAN_HISTORY_MEASUREMENTS 32
+
+// Fuse one measurement into the filter. Returns true if the filter was updated.
+typedef bool (*kalmanHistoryFuse_t)(kalmanCoreData_t* coreData, measurement_t* measurement);
+
+typedef struct {
+  // Time of the prediction step [us]
+  uint64_t timestamp;
+
+  // The filter just before the prediction step
+  kalmanCoreData_t coreData;
+
+  // Inputs to the prediction step
+  Axis3f acc;
+  Axis3f gyro;
+  float dt;
+  bool quadIsFlying;
+
+  // The process noise that was added to the variances between this and the next prediction step
+  float processNoise[KC_STATE_DIM];
+
+  // The outlier filters just before the prediction step
+  OutlierFilterLhState_t sweepOutlierFilter;
+  OutlierFilterTdoaState_t tdoaOutlierFilter;
+} kalmanHistoryStep_t;
+
+typedef struct {
+  kalmanHistoryStep_t steps[KALMAN_HISTORY_STEPS];
+  int stepCount;
+  int latestStep;
+
+  // Fused measurements, timestamps are the time the measurement was taken
+  measurement_t measurements[KALMAN_HISTORY_MEASUREMENTS];
+  int measurementCount;
+  int nextMeasurement;
+
+  // The latest timestamp of a measurement that has been dropped from the history. It is not possible to rewind to a
+  // point in time before this, since the dropped measurement could not be replayed.
+  uint64_t horizon;
+
+  bool rewindPending;
+  uint64_t rewindTimestamp;
+
+  kalmanHistoryFuse_t fuse;
+  OutlierFilterLhState_t* sweepOutlierFilterState;
+
+  // Statistics
+  uint32_t replayCount;
+  uint32_t tooOldCount;
+} kalmanHistory_t;
+
+/**
+ * @brief Initialize (or reset) the history
+ *
+ * @param this The history
+ * @param fuse Function used to fuse measurements into the filter
+ * @param sweepOutlierFilterState The lighthouse outlier filter used by fuse, saved and restored with the filter
+ */
+void kalmanHistoryInit(kalmanHistory_t* this, kalmanHistoryFuse_t fuse, OutlierFilterLhState_t* sweepOutlierFilterState);
+
+/**
+ * @brief Record a prediction step in the history and predict the filter forward, see kalmanCorePredict()
+ *
+ * @param timestamp The time of the prediction step [us]
+ */
+void kalmanHistoryPredict(kalmanHistory_t* this, kalmanCoreData_t* coreData, const Axis3f* acc, const Axis3f* gyro, float dt, bool quadIsFlying, uint64_t timestamp);
+
+/**
+ * @brief Add process noise to the filter and record it in the history, see kalmanCoreAddProcessNoise()
+ */
+void kalmanHistoryAddProcessNoise(kalmanHistory_t* this, kalmanCoreData_t* coreData, const kalmanCoreParams_t* params, float dt);
+
+/**
+ * @brief Add a measurement to the history. Measurements that were taken after the latest prediction step are fused
+ * directly, older measurements are fused in the next call to kalmanHistoryReplay().
+ *
+ * Measurements that are older than the history are fused at the oldest possible point in time.
+ *
+ * @param measurement The measurement, the timestamp is the time when the measurement was enqueued [us]
+ * @param delay Time from when the measurement was taken until it was enqueued [us]. Measurements with zero delay are
+ * considered to be current and never trigger a replay.
+ * @return true if the filter was updated, or an update is pending
+ */
+bool kalmanHistoryAddMeasurement(kalmanHistory_t* this, kalmanCoreData_t* coreData, const measurement_t* measurement, uint32_t delay);
+
+/**
+ * @brief Fuse delayed measurements that have been added since the last call, by rewinding the filter and replaying
+ * the history from the oldest delayed measurement. The filter is not finalized after the last step.
+ *
+ * @return true if the filter was rewound and replayed
+ */
+bool kalmanHistoryReplay(kalmanHistory_t* this, kalmanCoreData_t* coreData);
@@ -0,0 +1,101 @@
+/**
+ * ,---------,       ____  _ __
+ * |  ,-^-,  |      / __ )(_) /_______________ _____  ___
+ * | (  O  ) |     / __  / / __/ ___/ ___/ __ `/_  / / _ \
+ * | / ,--'  |    / /_/ / / /_/ /__/ /  / /_/ / / /_/  __/
+ *    +------`   /_____/_/\__/\___/_/   \__,_/ /___/\___/
+ *
+ * Crazyflie control firmware
+ *
+ * Copyright (C) 2023 Bitcraze AB
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, in version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * log_compression.h - Delta encoding of log blocks
+ *
+ * The variables of a compressed log block are sent as the difference to the value that was sent in the previous
+ * packet, encoded as zig-zag varints. The difference is computed on the raw little endian representation of the log
+ * type, a float is for instance treated as its 32 bit pattern. Slowly changing variables logged as integers or FP16
+ * typically use one byte per variable.
+ *
+ * Every LOG_COMPRESSION_KEYFRAME_INTERVAL packets, a keyframe is sent where the variables are encoded as the
+ * difference to zero, that is, as absolute values. A receiver that missed a packet detects it from the sequence
+ * number and waits for the next keyframe.
+ *
+ * All variables do not always fit in a packet. The encoder then stops at the last variable that fits and the next
+ * packet starts with the variable after that. Variables that were not sent keep their previous value on the receiving
+ * side, and a keyframe that does not fit in one packet is continued in the following packets.
+ *
+ * Packet format, after the block id and the time stamp:
+ *
+ *   +-------+-------+------------+------------+--//
+ *   | FLAGS | FIRST | VARIABLE n | VARIABLE n+1 | ...
+ *   +-------+-------+------------+------------+--//
+ *       1       1     1 to 5       1 to 5
+ *
+ *   FLAGS: bit 7 is set for keyframes, bits 0-6 is the sequence number of the packet
+ *   FIRST: index n of the first variable in the packet. Variables follow in order and wrap around to index 0.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+// Maximum number of variables in a compressed block
+#define LOG_COMPRESSION_MAX_VARIABLES 32
+// Maximum total length of the variables of a compressed block, in their log types
+#define LOG_COMPRESSION_MAX_LEN 64
+// Number of packets between keyframes
+#define LOG_COMPRESSION_KEYFRAME_INTERVAL 10
+
+#define LOG_COMPRESSION_HEADER_LEN 2
+#define LOG_COMPRESSION_KEYFRAME_FLAG 0x80
+#define LOG_COMPRESSION_SEQUENCE_MASK 0x7f
+
+// Longest encoding of one variable
+#define LOG_COMPRESSION_MAX_VARINT_LEN 5
+
+typedef struct {
+  // The values that were last sent, in the layout of the uncompressed block
+  uint8_t previous[LOG_COMPRESSION_MAX_LEN];
+
+  // Layout of the variables, length and offset in bytes
+  uint8_t length[LOG_COMPRESSION_MAX_VARIABLES];
+  uint8_t offset[LOG_COMPRESSION_MAX_VARIABLES];
+  uint8_t count;
+
+  uint8_t nextVariable;
+  uint8_t sequence;
+  uint8_t keyframeVariablesLeft;
+  uint8_t packetsSinceKeyframe;
+} logCompressionState_t;
+
+/**
+ * @brief Initialize the encoder of a block. The first packet is a keyframe.
+ *
+ * @param state The state of the encoder
+ * @param length The length in bytes of each variable, 1, 2 or 4
+ * @param count The number of variables
+ */
+void logCompressionInit(logCompressionState_t* state, const uint8_t* length, const int count);
+
+/**
+ * @brief Encode the variables of a block into a packet
+ *
+ * @param state The state of the encoder
+ * @param values The variables in the layout of the uncompressed block
+ * @param out Buffer for the encoded packet
+ * @param maxLength Size of the buffer, at least LOG_COMPRESSION_HEADER_LEN + LOG_COMPRESSION_MAX_VARINT_LEN
+ * @return int The number of bytes written to out
+ */
+int logCompressionEncode(logCompressionState_t* state, const uint8_t* values, uint8_t* out, const int maxLength);
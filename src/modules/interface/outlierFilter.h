@@ -30,6 +30,17 @@
 bool outlierFilterValidateTdoaSimple(const tdoaMeasurement_t* tdoa);
 bool outlierFilterValidateTdoaSteps(const tdoaMeasurement_t* tdoa, const float error, const vector_t* jacobian, const point_t* estPos);
 
+#define OUTLIER_FILTER_TDOA_LEVELS 5
+
+// The state of the TDoA steps filter, used to save and restore the filter when measurements are fused again
+typedef struct {
+    int bucket[OUTLIER_FILTER_TDOA_LEVELS];
+    int filterCloseDelayCounter;
+    int previousFilterIndex;
+} OutlierFilterTdoaState_t;
+void outlierFilterTdoaGetState(OutlierFilterTdoaState_t* state);
+void outlierFilterTdoaSetState(const OutlierFilterTdoaState_t* state);
+
 typedef struct {
     uint32_t openingTime;
     int32_t openingWindow;
@@ -2,6 +2,7 @@
 #define __PEER_LOCALIZATION_H__
 
 #include <stdbool.h>
+#include "autoconf.h"
 #include "math3d.h"
 #include "stabilizer_types.h"
 
@@ -11,9 +12,23 @@
 // of other Crazyflies on the same radio "for free". In the future, other
 // methods of peer localization such as peer-to-peer sharing could be added.
 
-// The maximum number of other Crazyflie ID's to track. This constant may be
-// needed for static allocations in other modules, e.g. collision avoidance.
+// The maximum number of other Crazyflie ID's to track, set with
+// CONFIG_PEER_LOCALIZATION_MAX_NEIGHBORS. This constant is also used for static
+// allocations in other modules, e.g. the workspace of collision avoidance.
+#ifdef CONFIG_PEER_LOCALIZATION_MAX_NEIGHBORS
+#define PEER_LOCALIZATION_MAX_NEIGHBORS CONFIG_PEER_LOCALIZATION_MAX_NEIGHBORS
+#else
 #define PEER_LOCALIZATION_MAX_NEIGHBORS 10
+#endif
+
+// The slot of a radio ID is stored in a uint8_t
+#if PEER_LOCALIZATION_MAX_NEIGHBORS > 255
+#error "PEER_LOCALIZATION_MAX_NEIGHBORS can not be larger than 255"
+#endif
+
+// Positions older than this (millisecs) are stale. The entry of a stale
+// neighbor is reused when a new neighbor is added to a full table.
+#define PEER_LOCALIZATION_STALE_AGE 1000
 
 // Initialize and test the module.
 void peerLocalizationInit();
@@ -26,18 +41,39 @@ typedef struct peerLocalizationOtherPosition_s {
 
 // Tell the peer localization system the position of another Crazyflie.
 // Should be called when the position is already known with high accuracy,
-// e.g. when a motion capture measurement packet is received.
+// e.g. when a motion capture measurement packet is received. Returns false if
+// the id is 0, or if the table is full and no neighbor is stale.
 bool peerLocalizationTellPosition(int id, positionMeasurement_t const *pos);
 
-// Returns true if we have a position value for the given radio ID.
+// Returns true if we have a position value for the given radio ID that is not
+// stale.
 bool peerLocalizationIsIDActive(uint8_t id);
 
 // Returns the position value for the given radio ID, or NULL if none exists.
-// Performs a linear search.
+// Runs in constant time, the position may be stale.
 peerLocalizationOtherPosition_t *peerLocalizationGetPositionByID(uint8_t id);
 
 // Returns the position value based on index, uncorrelated with radio ID. More
 // efficient if iterating over all peers is needed.
 peerLocalizationOtherPosition_t *peerLocalizationGetPositionByIdx(uint8_t idx);
 
+// Iterator over the neighbors with a recent position, usage:
+//
+//   peerLocalizationIterator_t it;
+//   peerLocalizationIteratorInit(&it, maxAge);
+//   peerLocalizationOtherPosition_t const *other;
+//   while ((other = peerLocalizationIteratorNext(&it)) != NULL) { ... }
+typedef struct peerLocalizationIterator_s {
+  uint8_t idx;
+  uint32_t now;
+  uint32_t maxAge;
+} peerLocalizationIterator_t;
+
+// Start an iteration over the neighbors with a position that is at most maxAge
+// millisecs old.
+void peerLocalizationIteratorInit(peerLocalizationIterator_t *it, uint32_t maxAge);
+
+// Returns the next neighbor, or NULL at the end of the iteration.
+peerLocalizationOtherPosition_t const *peerLocalizationIteratorNext(peerLocalizationIterator_t *it);
+
 #endif // __PEER_LOCALIZATION_H__
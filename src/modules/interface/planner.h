@@ -62,6 +62,21 @@ enum trajectory_type
 	TRAJECTORY_TYPE_PIECEWISE_COMPRESSED = 1
 };
 
+// trajectories with more pieces than this are evaluated without a start time table
+#define PLAN_MAX_INDEXED_PIECES 64
+
+// size of the memory that trajectories are uploaded to (bytes)
+#define TRAJECTORY_MEMORY_SIZE 4096
+
+// a compressed trajectory that fills the trajectory memory with the smallest
+// possible pieces is indexed sparsely, such that a lookup decodes at most this
+// many pieces from an index entry. see piecewise_compressed_build_index().
+#define PLAN_COMPRESSED_INDEX_MAX_STRIDE 16
+
+// compressed trajectories with more pieces than this are indexed sparsely
+#define PLAN_MAX_INDEXED_COMPRESSED_PIECES \
+	((TRAJECTORY_MEMORY_SIZE / PIECEWISE_COMPRESSED_MIN_PIECE_SIZE + PLAN_COMPRESSED_INDEX_MAX_STRIDE - 1) / PLAN_COMPRESSED_INDEX_MAX_STRIDE)
+
 struct planner
 {
 	enum trajectory_state state;	// current state
@@ -69,12 +84,20 @@ struct planner
 	bool reversed;					// true, if trajectory should be evaluated in reverse
 
 	union {
-		const struct piecewise_traj* trajectory; // pointer to trajectory
+		struct piecewise_traj* trajectory; // pointer to trajectory
 		struct piecewise_traj_compressed* compressed_trajectory; // pointer to compressed trajectory
 	};
 
 	struct piecewise_traj planned_trajectory; // trajectory for on-board planning
 	struct poly4d pieces[1]; // the on-board planner requires a single piece, only
+	float planned_piece_start[2]; // start time table of planned_trajectory
+
+	// index of the current trajectory, depending on its type
+	union {
+		float piece_start[PLAN_MAX_INDEXED_PIECES + 1]; // see piecewise_build_index()
+		struct piecewise_traj_compressed_index_entry compressed_index[PLAN_MAX_INDEXED_COMPRESSED_PIECES + 1]; // see piecewise_compressed_build_index()
+	};
+	struct piecewise_cursor cursor; // piece lookup state of trajectory, see piecewise_eval_with_cursor()
 };
 
 // initialize the planner
@@ -117,8 +140,13 @@ int plan_go_to_from(struct planner *p, const struct traj_eval *curr_eval, bool r
 // start trajectory. start_from param is ignored if relative == false.
 int plan_start_trajectory(struct planner *p, struct piecewise_traj* trajectory, bool reversed, bool relative, struct vec start_from);
 
+// update the planner after the pieces, number of pieces or start time of the
+// current piecewise trajectory have been changed, for instance when streaming.
+void plan_update_trajectory(struct planner *p);
+
 // start compressed trajectory. start_from param is ignored if relative == false.
-int plan_start_compressed_trajectory(struct planner *p, struct piecewise_traj_compressed* trajectory, bool relative, struct vec start_from);
+// the start time and timescale of the trajectory must be set before.
+int plan_start_compressed_trajectory(struct planner *p, struct piecewise_traj_compressed* trajectory, bool reversed, bool relative, struct vec start_from);
 
 // Query if the trjectory is finished
 bool plan_is_finished(struct planner *p, float t);
@@ -0,0 +1,85 @@
+/*
+ *    ______
+ *   / ____/________ _____  __  ________      ______ __________ ___
+ *  / /   / ___/ __ `/_  / / / / / ___/ | /| / / __ `/ ___/ __ `__ \
+ * / /___/ /  / /_/ / / /_/ /_/ (__  )| |/ |/ / /_/ / /  / / / / / /
+ * \____/_/   \__,_/ /___/\__, /____/ |__/|__/\__,_/_/  /_/ /_/ /_/
+ *                       /____/
+ *
+ * Crazyswarm advanced control firmware for Crazyflie
+ *
+
+The MIT License (MIT)
+
+Copyright (c) 2018 Wolfgang Hoenig and James Alan Preiss
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/*
+Streaming trajectories for the planning state machine
+*/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "planner.h"
+
+// Streaming trajectories are played from a ring of pieces in the trajectory memory, while the ground station writes new
+// pieces to the free slots of the ring. The played trajectory is a window of the ring that starts at the piece that is
+// currently played, and ends at the last appended piece or at the end of the ring.
+struct planner_stream
+{
+	uint8_t trajectoryId;   // id of the definition of the ring, set by the owner
+	struct poly4d* slots;
+	uint8_t capacity;       // number of slots in the ring
+	uint8_t head;           // slot of the oldest piece that has not been played
+	uint8_t count;          // number of appended pieces that have not been played
+	bool closed;            // true when the last piece of the trajectory has been appended
+	bool isPlaying;         // true while the planner plays the stream, until it ends, runs out of pieces or is preempted
+
+	struct piecewise_traj trajectory; // the played window
+
+	// statistics
+	uint8_t freeSlots;      // number of free slots in the ring
+	uint32_t playedPieces;  // total number of pieces that have been played
+	uint16_t underruns;     // number of times the stream has run out of pieces
+	float bufferedTime;     // time left of the appended pieces (s)
+};
+
+// time to stop and hover when a streaming trajectory ends or runs out of pieces (s)
+#define PLAN_STREAM_STOP_DURATION 1.0f
+
+// use capacity slots as an empty ring. must not be called while the stream is playing.
+void plan_stream_define(struct planner_stream *s, struct poly4d* slots, uint8_t capacity);
+
+// start to play the appended pieces at time t. at least one piece must have been appended.
+int plan_stream_start(struct planner_stream *s, struct planner *p, float timescale, bool relative, struct vec start_from, float t);
+
+// append n_pieces pieces, that have been written to the free slots after the last appended piece.
+// last is true if these are the last pieces of the trajectory. the caller checks that there is room in the ring and
+// that the stream is not closed.
+void plan_stream_append(struct planner_stream *s, struct planner *p, uint8_t n_pieces, bool last);
+
+// release the pieces that have been played at time t, and detect if the stream has ended or run out of pieces.
+// in both cases the planner is told to stop smoothly and hover, it is finished when the hover position is reached.
+// must be called before the planner is evaluated, or asked if it is finished, at time t.
+void plan_stream_advance(struct planner_stream *s, struct planner *p, float t);
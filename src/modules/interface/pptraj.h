@@ -136,6 +136,11 @@ bool is_traj_eval_valid(struct traj_eval const *ev);
 // evaluate a single polynomial piece
 struct traj_eval poly4d_eval(struct poly4d const *p, float t);
 
+// compute the output from the flat variables x, y, z and yaw.
+// each array holds the value and its first three time derivatives.
+struct traj_eval traj_eval_from_derivatives(
+	float const x[4], float const y[4], float const z[4], float const yaw[4]);
+
 
 
 // ----------------------------------//
@@ -149,10 +154,41 @@ struct piecewise_traj
 	struct vec shift;
 	unsigned char n_pieces;
 	struct poly4d* pieces;
+
+	// optional index, see piecewise_build_index().
+	// piece_start[i] is the start time of piece i, before applying timescale.
+	// piece_start has n_pieces + 1 entries, the last one is the total duration.
+	// set piece_start to NULL if there is no index.
+	float* piece_start;
+};
+
+// lookup state for evaluating an indexed trajectory, owned by the caller so
+// that evaluation does not change the trajectory. a cursor belongs to one
+// trajectory at a time and must be reset when the trajectory, its index,
+// shift or timescale changes.
+struct piecewise_cursor
+{
+	// the piece that was found in the latest lookup.
+	unsigned char piece;
+	// number of lookups that missed the cursor and the piece after it, and
+	// needed a binary search.
+	unsigned int searches;
+
+	// the piece of the latest evaluation, shifted and stretched in time, and
+	// reflected in time if reversed.
+	struct poly4d cached_piece;
+	short cached_index; // -1 if nothing is cached
+	bool cached_reversed;
 };
 
+void piecewise_cursor_reset(struct piecewise_cursor *cursor);
+
 static inline float piecewise_duration(struct piecewise_traj const *pp)
 {
+	if (pp->piece_start) {
+		return pp->piece_start[pp->n_pieces] * pp->timescale;
+	}
+
 	float total_dur = 0;
 	for (int i = 0; i < pp->n_pieces; ++i) {
 		total_dur += pp->pieces[i].duration;
@@ -168,12 +204,27 @@ void piecewise_plan_7th_order_no_jerk(struct piecewise_traj *p, float duration,
 	struct vec p0, float y0, struct vec v0, float dy0, struct vec a0,
 	struct vec p1, float y1, struct vec v1, float dy1, struct vec a1);
 
+// build the start time table of a trajectory, used for piece lookup in
+// constant time when t increases monotonically and a cursor is used, and in
+// logarithmic time for random access. piece_start must have room for
+// n_pieces + 1 entries and must be rebuilt if the pieces change.
+void piecewise_build_index(struct piecewise_traj *traj, float *piece_start);
+
+// evaluate the trajectory at time t.
 struct traj_eval piecewise_eval(
 	struct piecewise_traj const *traj, float t);
 
 struct traj_eval piecewise_eval_reversed(
 	struct piecewise_traj const *traj, float t);
 
+// evaluate an indexed trajectory at time t, using and updating the lookup
+// cursor. trajectories without an index are evaluated as above.
+struct traj_eval piecewise_eval_with_cursor(
+	struct piecewise_traj const *traj, struct piecewise_cursor *cursor, float t);
+
+struct traj_eval piecewise_eval_reversed_with_cursor(
+	struct piecewise_traj const *traj, struct piecewise_cursor *cursor, float t);
+
 
 static inline bool piecewise_is_finished(struct piecewise_traj const *traj, float t)
 {
@@ -27,6 +27,7 @@
 #pragma once
 
 #include "pptraj.h"
+#include <stdint.h>
 #include <stdio.h>
 
 enum piecewise_traj_storage_type {
@@ -40,6 +41,22 @@ enum piecewise_traj_storage_type {
 // compressed piecewise polynomial trajectories //
 // ---------------------------------------------//
 
+// size of the smallest piece of a compressed trajectory (bytes), a piece
+// where all coordinates are constant only stores its header
+#define PIECEWISE_COMPRESSED_MIN_PIECE_SIZE 3
+
+// entry of the optional piece index of a compressed trajectory, see
+// piecewise_compressed_build_index(). Since each piece starts where the
+// previous one ended, the start point is stored in the same units as the
+// compressed data so that a piece can be decoded without decoding the pieces
+// before it.
+struct piecewise_traj_compressed_index_entry
+{
+	uint32_t t_begin_msec;  // start time of the piece, before applying timescale
+	uint16_t offset;        // offset of the piece from the start of the data
+	int16_t start[4];       // x, y, z [mm] and yaw [1/10 deg] at the start of the piece
+};
+
 struct piecewise_traj_compressed
 {
 	float t_begin;
@@ -48,6 +65,12 @@ struct piecewise_traj_compressed
 	struct vec shift;
 	const void* data;
 
+	// optional index with one entry per indexed piece and one for the end of
+	// the trajectory, see piecewise_compressed_build_index(). NULL if there is
+	// no index.
+	const struct piecewise_traj_compressed_index_entry* index;
+	uint16_t n_index_entries;
+
 	// mutable part of the data structure. We plan to mess around with this part
 	// but keep the rest untouched (i.e. supplied by the user)
 	struct {
@@ -58,15 +81,25 @@ struct piecewise_traj_compressed
 		// the entire trajectory
 		float t_begin_relative;
 
-		// poly4d representation of the current piece
-		struct poly4d poly4d;
+		// duration of the current piece, stretched with the timescale
+		float duration;
+
+		// timescale that the current piece was decoded with
+		float timescale;
+
+		// control points of the x, y, z and yaw Bezier curves of the current
+		// piece in the stored units, including the start point. Constant
+		// coordinates have a single control point.
+		int16_t control_points[4][PP_SIZE];
+		uint8_t n_control_points[4];
 	} current_piece;
 };
 
-// Returns the total duration of a compressed trajectory. The total duration
-// is pre-calculated and cached in the trajectory itself.
-static float piecewise_compressed_duration(struct piecewise_traj_compressed const *traj) {
-	return traj->duration;
+// Returns the total duration of a compressed trajectory, including the
+// timescale. The total duration is pre-calculated and cached in the trajectory
+// itself.
+static inline float piecewise_compressed_duration(struct piecewise_traj_compressed const *traj) {
+	return traj->duration * traj->timescale;
 }
 
 // Returns whether we have finished flying the trajectory
@@ -76,10 +109,31 @@ static inline bool piecewise_compressed_is_finished(
 	return (t - traj->t_begin) >= piecewise_compressed_duration(traj);
 }
 
-// Evaluates the trajectory at the given time instant.
+// Evaluates the trajectory at the given time instant. The current piece is
+// evaluated directly from its stored control points with de Casteljau's
+// algorithm in fixed point, with an error below 0.1 mm in position. Without an index,
+// evaluation is cheap when t increases monotonically but going back in time
+// decodes the trajectory from the start. With an index, any piece is found
+// in logarithmic time.
 struct traj_eval piecewise_compressed_eval(
 	struct piecewise_traj_compressed *traj, float t);
 
+// Evaluates the trajectory backwards at the given time instant, i.e. the
+// trajectory starts at its end point and finishes at its start point. Should
+// be used with an index since every piece change goes back in time.
+struct traj_eval piecewise_compressed_eval_reversed(
+	struct piecewise_traj_compressed *traj, float t);
+
+// Builds the piece index of a loaded trajectory. The index has one entry per
+// piece plus one for the end of the trajectory. If the trajectory has more
+// pieces than max_entries - 1, only every k-th piece is indexed, with the
+// smallest k that fits, and a lookup decodes up to k - 1 pieces forward from
+// an entry. Returns the number of entries used, or -1 if max_entries is less
+// than 2, in which case the trajectory is used without an index. The index
+// does not depend on the start time, shift or timescale of the trajectory.
+int piecewise_compressed_build_index(struct piecewise_traj_compressed *traj,
+	struct piecewise_traj_compressed_index_entry* index, int max_entries);
+
 // Loads the compressed trajectory at the given pointer
 void piecewise_compressed_load(
 	struct piecewise_traj_compressed *traj, const void* data);
@@ -106,44 +106,71 @@ void collisionAvoidanceUpdateSetpointCore(
   // Part 1: Construct the polytope inequalities in A, b.
   //
 
-  int const nRows = nOthers + 6;
+  // The rows are laid out for all neighbors, but only the neighbors that can
+  // constrain the cell are used.
+  int const maxRows = nOthers + 6;
   float *A = workspace;
-  float *B = workspace + 3 * nRows;
-  float *projectionWorkspace = workspace + 4 * nRows;
+  float *B = workspace + 3 * maxRows;
+  float *projectionWorkspace = workspace + 4 * maxRows;
 
   // Compute the cell in a stretched coordinate system for downwash awareness.
   // See header for details.
   struct vec const radiiInv = veltrecip(params->ellipsoidRadii);
   struct vec const ourPos = vec2svec(state->position);
 
-  // We could do some optimizations here to reduce the number of rows, like
-  // leave out very far away neighbors. It would help the average case
-  // complexity, but not the worst case - so we skip it for now.
+  // The box faces below keep the cell within maxDist of our position in the
+  // infinity-norm. A neighbor whose face does not cut that cube cannot
+  // constrain the cell, so we leave it out. This does not change the cell.
+  float const maxDist = params->horizonSecs * params->maxSpeed;
+
+  int nNeighbors = 0;
   for (int i = 0; i < nOthers; ++i) {
     struct vec peerPos = vloadf(otherPositions + 3 * i);
     struct vec const toPeerStretched = veltmul(vsub(peerPos, ourPos), radiiInv);
     float const dist = vmag(toPeerStretched);
     struct vec const a = vdiv(veltmul(toPeerStretched, radiiInv), dist);
     float const b = dist / 2.0f - 1.0f;
+    if (b >= maxDist * vnorm1(a)) {
+      continue;
+    }
     float scale = 1.0f / vmag(a);
-    vstoref(vscl(scale, a), A + 3 * i);
-    B[i] = scale * b;
+    // Row i is not written before position i is read, see the header.
+    vstoref(vscl(scale, a), A + 3 * nNeighbors);
+    B[nNeighbors] = scale * b;
+    ++nNeighbors;
+  }
+
+  // Bound the worst case cost by only keeping the neighbors with the closest
+  // faces.
+  if (params->maxNeighbors > 0) {
+    while (nNeighbors > params->maxNeighbors) {
+      int farthest = 0;
+      for (int i = 1; i < nNeighbors; ++i) {
+        if (B[i] > B[farthest]) {
+          farthest = i;
+        }
+      }
+      --nNeighbors;
+      memcpy(A + 3 * farthest, A + 3 * nNeighbors, 3 * sizeof(float));
+      B[farthest] = B[nNeighbors];
+    }
   }
 
+  collisionState->nNeighbors = nNeighbors;
+  int const nRows = nNeighbors + 6;
+
   // Add the bounding box polytope faces. We also use the box faces to enforce
   // max speed in the infinity-norm.
-  float const maxDist = params->horizonSecs * params->maxSpeed;
-
-  memset(A + 3 * nOthers, 0, 18 * sizeof(float));
+  memset(A + 3 * nNeighbors, 0, 18 * sizeof(float));
 
   for (int dim = 0; dim < 3; ++dim) {
     float boxMax = vindex(params->bboxMax, dim) - vindex(ourPos, dim);
-    A[3 * (nOthers + dim) + dim] = 1.0f;
-    B[nOthers + dim] = fminf(maxDist, boxMax);
+    A[3 * (nNeighbors + dim) + dim] = 1.0f;
+    B[nNeighbors + dim] = fminf(maxDist, boxMax);
 
     float boxMin = vindex(params->bboxMin, dim) - vindex(ourPos, dim);
-    A[3 * (nOthers + dim + 3) + dim] = -1.0f;
-    B[nOthers + dim + 3] = -fmaxf(-maxDist, boxMin);
+    A[3 * (nNeighbors + dim + 3) + dim] = -1.0f;
+    B[nNeighbors + dim + 3] = -fmaxf(-maxDist, boxMin);
   }
 
   //
@@ -279,10 +306,12 @@ static collision_avoidance_params_t params = {
   .maxPeerLocAgeMillis = 5000,  // Probably longer than desired in most applications.
   .voronoiProjectionTolerance = 1e-5,
   .voronoiProjectionMaxIters = 100,
+  .maxNeighbors = 0,
 };
 
 static collision_avoidance_state_t collisionState = {
   .lastFeasibleSetPosition = { .x = NAN, .y = NAN, .z = NAN },
+  .nNeighbors = 0,
 };
 
 void collisionAvoidanceInit()
@@ -317,18 +346,11 @@ void collisionAvoidanceUpdateSetpoint(
   // Counts the actual number of neighbors after we filter stale measurements.
   int nOthers = 0;
 
-  for (int i = 0; i < PEER_LOCALIZATION_MAX_NEIGHBORS; ++i) {
-
-    peerLocalizationOtherPosition_t const *otherPos = peerLocalizationGetPositionByIdx(i);
-
-    if (otherPos == NULL || otherPos->id == 0) {
-      continue;
-    }
-
-    if (doAgeFilter && (time - otherPos->pos.timestamp > params.maxPeerLocAgeMillis)) {
-      continue;
-    }
+  peerLocalizationIterator_t it;
+  peerLocalizationIteratorInit(&it, doAgeFilter ? (uint32_t)params.maxPeerLocAgeMillis : UINT32_MAX);
 
+  peerLocalizationOtherPosition_t const *otherPos;
+  while ((otherPos = peerLocalizationIteratorNext(&it)) != NULL) {
     workspace[3 * nOthers + 0] = otherPos->pos.x;
     workspace[3 * nOthers + 1] = otherPos->pos.y;
     workspace[3 * nOthers + 2] = otherPos->pos.z;
@@ -342,6 +364,7 @@ void collisionAvoidanceUpdateSetpoint(
 
 LOG_GROUP_START(colAv)
   LOG_ADD(LOG_UINT32, latency, &latency)
+  LOG_ADD(LOG_INT32, nNeighbors, &collisionState.nNeighbors)
 LOG_GROUP_STOP(colAv)
 
 
@@ -425,6 +448,7 @@ PARAM_GROUP_START(colAv)
   PARAM_ADD(PARAM_INT32, maxPeerLocAge, &params.maxPeerLocAgeMillis)
   PARAM_ADD(PARAM_FLOAT, vorTol, &params.voronoiProjectionTolerance)
   PARAM_ADD(PARAM_INT32, vorIters, &params.voronoiProjectionMaxIters)
+  PARAM_ADD(PARAM_INT32, maxNeighbors, &params.maxNeighbors)
 PARAM_GROUP_STOP(colAv)
 
 #endif  // CRAZYFLIE_FW
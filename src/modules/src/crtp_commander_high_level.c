@@ -50,6 +50,7 @@ such as: take-off, landing, polynomial trajectories.
 #include "crtp.h"
 #include "crtp_commander_high_level.h"
 #include "planner.h"
+#include "planner_stream.h"
 #include "log.h"
 #include "param.h"
 #include "static_mem.h"
@@ -78,10 +79,9 @@ struct trajectoryDescription
   } trajectoryIdentifier;
 } __attribute__((packed));
 
-// allocate memory to store trajectories
+// allocate memory to store trajectories, see TRAJECTORY_MEMORY_SIZE in planner.h
 // 4k allows us to store 31 poly4d pieces
 // other (compressed) formats might be added in the future
-#define TRAJECTORY_MEMORY_SIZE 4096
 
 #define ALL_GROUPS 0
 
@@ -103,6 +103,9 @@ static float yaw; // last known setpoint yaw (yaw [rad])
 static struct piecewise_traj trajectory;
 static struct piecewise_traj_compressed  compressed_trajectory;
 
+// streaming trajectory, see append_trajectory()
+static struct planner_stream stream = { .trajectoryId = NUM_TRAJECTORY_DEFINITIONS };
+
 // makes sure that we don't evaluate the trajectory while it is being changed
 static xSemaphoreHandle lockTraj;
 static StaticSemaphore_t lockTrajBuffer;
@@ -139,6 +142,7 @@ enum TrajectoryCommand_e {
   COMMAND_LAND_2                  = 8,
   COMMAND_TAKEOFF_WITH_VELOCITY   = 9,
   COMMAND_LAND_WITH_VELOCITY      = 10,
+  COMMAND_APPEND_TRAJECTORY       = 11,
 };
 
 struct data_set_group_mask {
@@ -232,6 +236,13 @@ struct data_define_trajectory {
   struct trajectoryDescription description;
 } __attribute__((packed));
 
+// appends pieces, that have been written to the ring, to a streaming trajectory
+struct data_append_trajectory {
+  uint8_t trajectoryId; // id of the streaming trajectory (previously defined by COMMAND_DEFINE_TRAJECTORY)
+  uint8_t nPieces;      // number of pieces to append
+  uint8_t last;         // set to true, if these are the last pieces of the trajectory
+} __attribute__((packed));
+
 // Private functions
 static void crtpCommanderHighLevelTask(void * prm);
 
@@ -246,6 +257,7 @@ static int stop(const struct data_stop* data);
 static int go_to(const struct data_go_to* data);
 static int start_trajectory(const struct data_start_trajectory* data);
 static int define_trajectory(const struct data_define_trajectory* data);
+static int append_trajectory(const struct data_append_trajectory* data);
 
 // Helper functions
 static struct vec state2vec(struct vec3_s v)
@@ -306,6 +318,7 @@ bool crtpCommanderHighLevelGetSetpoint(setpoint_t* setpoint, const state_t *stat
 
   xSemaphoreTake(lockTraj, portMAX_DELAY);
   float t = usecTimestamp() / 1e6;
+  plan_stream_advance(&stream, &planner, t);
   struct traj_eval ev = plan_current_goal(&planner, t);
   xSemaphoreGive(lockTraj);
 
@@ -401,6 +414,9 @@ static int handleCommand(const enum TrajectoryCommand_e command, const uint8_t*
     case COMMAND_DEFINE_TRAJECTORY:
       ret = define_trajectory((const struct data_define_trajectory*)data);
       break;
+    case COMMAND_APPEND_TRAJECTORY:
+      ret = append_trajectory((const struct data_append_trajectory*)data);
+      break;
     default:
       ret = ENOEXEC;
       break;
@@ -596,24 +612,34 @@ int start_trajectory(const struct data_start_trajectory* data)
         trajectory.n_pieces = trajDesc->trajectoryIdentifier.mem.n_pieces;
         trajectory.pieces = (struct poly4d*)&trajectories_memory[trajDesc->trajectoryIdentifier.mem.offset];
         result = plan_start_trajectory(&planner, &trajectory, data->reversed, data->relative, pos);
+        stream.isPlaying = false;
         xSemaphoreGive(lockTraj);
       } else if (trajDesc->trajectoryLocation == TRAJECTORY_LOCATION_MEM
           && trajDesc->trajectoryType == CRTP_CHL_TRAJECTORY_TYPE_POLY4D_COMPRESSED) {
 
-        if (data->timescale != 1 || data->reversed) {
+        xSemaphoreTake(lockTraj, portMAX_DELAY);
+        float t = usecTimestamp() / 1e6;
+        piecewise_compressed_load(
+          &compressed_trajectory,
+          &trajectories_memory[trajDesc->trajectoryIdentifier.mem.offset]
+        );
+        compressed_trajectory.t_begin = t;
+        compressed_trajectory.timescale = data->timescale;
+        result = plan_start_compressed_trajectory(&planner, &compressed_trajectory, data->reversed, data->relative, pos);
+        stream.isPlaying = false;
+        xSemaphoreGive(lockTraj);
+
+      } else if (trajDesc->trajectoryLocation == TRAJECTORY_LOCATION_MEM
+          && trajDesc->trajectoryType == CRTP_CHL_TRAJECTORY_TYPE_POLY4D_STREAMING) {
+
+        xSemaphoreTake(lockTraj, portMAX_DELAY);
+        if (data->reversed || data->trajectoryId != stream.trajectoryId || stream.count == 0) {
           result = ENOEXEC;
         } else {
-          xSemaphoreTake(lockTraj, portMAX_DELAY);
           float t = usecTimestamp() / 1e6;
-          piecewise_compressed_load(
-            &compressed_trajectory,
-            &trajectories_memory[trajDesc->trajectoryIdentifier.mem.offset]
-          );
-          compressed_trajectory.t_begin = t;
-          result = plan_start_compressed_trajectory(&planner, &compressed_trajectory, data->relative, pos);
-          xSemaphoreGive(lockTraj);
+          result = plan_stream_start(&stream, &planner, data->timescale, data->relative, pos, t);
         }
-
+        xSemaphoreGive(lockTraj);
       }
     }
   }
@@ -625,8 +651,51 @@ int define_trajectory(const struct data_define_trajectory* data)
   if (data->trajectoryId >= NUM_TRAJECTORY_DEFINITIONS) {
     return ENOEXEC;
   }
-  trajectory_descriptions[data->trajectoryId] = data->description;
-  return 0;
+
+  int result = 0;
+  xSemaphoreTake(lockTraj, portMAX_DELAY);
+  plan_stream_advance(&stream, &planner, usecTimestamp() / 1e6);
+  if (stream.isPlaying && (data->trajectoryId == stream.trajectoryId ||
+      data->description.trajectoryType == CRTP_CHL_TRAJECTORY_TYPE_POLY4D_STREAMING)) {
+    // the ring is in use
+    result = EBUSY;
+  } else if (data->description.trajectoryType == CRTP_CHL_TRAJECTORY_TYPE_POLY4D_STREAMING) {
+    uint32_t offset = data->description.trajectoryIdentifier.mem.offset;
+    uint8_t capacity = data->description.trajectoryIdentifier.mem.n_pieces;
+    if (capacity == 0 || offset + capacity * sizeof(struct poly4d) > sizeof(trajectories_memory)) {
+      result = ENOMEM;
+    } else {
+      stream.trajectoryId = data->trajectoryId;
+      plan_stream_define(&stream, (struct poly4d*)&trajectories_memory[offset], capacity);
+    }
+  } else if (data->trajectoryId == stream.trajectoryId) {
+    // the streaming trajectory is replaced by another type
+    stream.trajectoryId = NUM_TRAJECTORY_DEFINITIONS;
+    stream.freeSlots = 0;
+  }
+
+  if (result == 0) {
+    trajectory_descriptions[data->trajectoryId] = data->description;
+  }
+  xSemaphoreGive(lockTraj);
+
+  return result;
+}
+
+int append_trajectory(const struct data_append_trajectory* data)
+{
+  int result = 0;
+  xSemaphoreTake(lockTraj, portMAX_DELAY);
+  if (data->trajectoryId != stream.trajectoryId || stream.closed) {
+    result = ENOEXEC;
+  } else if (data->nPieces > stream.capacity - stream.count) {
+    result = ENOMEM;
+  } else {
+    plan_stream_append(&stream, &planner, data->nPieces, data->last);
+  }
+  xSemaphoreGive(lockTraj);
+
+  return result;
 }
 
 static bool handleMemRead(const uint32_t memAddr, const uint8_t readLen, uint8_t* buffer) {
@@ -774,6 +843,18 @@ int crtpCommanderHighLevelStartTrajectory(const uint8_t trajectoryId, const floa
   return handleCommand(COMMAND_START_TRAJECTORY, (const uint8_t*)&data);
 }
 
+int crtpCommanderHighLevelAppendTrajectory(const uint8_t trajectoryId, const uint8_t nPieces, const bool last)
+{
+  struct data_append_trajectory data =
+  {
+    .trajectoryId = trajectoryId,
+    .nPieces = nPieces,
+    .last = last,
+  };
+
+  return handleCommand(COMMAND_APPEND_TRAJECTORY, (const uint8_t*)&data);
+}
+
 int crtpCommanderHighLevelDefineTrajectory(const uint8_t trajectoryId, const crtpCommanderTrajectoryType_t type, const uint32_t offset, const uint8_t nPieces)
 {
   struct data_define_trajectory data =
@@ -793,13 +874,37 @@ uint32_t crtpCommanderHighLevelTrajectoryMemSize()
   return sizeof(trajectories_memory);
 }
 
+// Check if a write to the trajectory memory would modify pieces of the streaming trajectory that have been appended
+// but not yet played. Must be called with lockTraj taken.
+static bool isWriteToAppendedPieces(const uint32_t offset, const uint32_t length)
+{
+  if (stream.trajectoryId >= NUM_TRAJECTORY_DEFINITIONS) {
+    return false;
+  }
+
+  uint32_t ringOffset = (uint8_t*)stream.slots - trajectories_memory;
+  for (int i = 0; i < stream.count; i++) {
+    uint32_t slotStart = ringOffset + ((stream.head + i) % stream.capacity) * sizeof(struct poly4d);
+    uint32_t slotEnd = slotStart + sizeof(struct poly4d);
+    if (offset < slotEnd && offset + length > slotStart) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
 bool crtpCommanderHighLevelWriteTrajectory(const uint32_t offset, const uint32_t length, const uint8_t* data)
 {
   bool result = false;
 
   if ((offset + length) <= sizeof(trajectories_memory)) {
-    memcpy(&(trajectories_memory[offset]), data, length);
-    result = true;
+    xSemaphoreTake(lockTraj, portMAX_DELAY);
+    if (!isWriteToAppendedPieces(offset, length)) {
+      memcpy(&(trajectories_memory[offset]), data, length);
+      result = true;
+    }
+    xSemaphoreGive(lockTraj);
   }
 
   return result;
@@ -817,8 +922,13 @@ bool crtpCommanderHighLevelReadTrajectory(const uint32_t offset, const uint32_t
 }
 
 bool crtpCommanderHighLevelIsTrajectoryFinished() {
+  xSemaphoreTake(lockTraj, portMAX_DELAY);
   float t = usecTimestamp() / 1e6;
-  return plan_is_finished(&planner, t);
+  plan_stream_advance(&stream, &planner, t);
+  bool result = plan_is_finished(&planner, t);
+  xSemaphoreGive(lockTraj);
+
+  return result;
 }
 
 /**
@@ -838,3 +948,30 @@ PARAM_ADD_CORE(PARAM_FLOAT, vtoff, &defaultTakeoffVelocity)
 PARAM_ADD_CORE(PARAM_FLOAT, vland, &defaultLandingVelocity)
 
 PARAM_GROUP_STOP(hlCommander)
+
+/**
+ * Streaming trajectories, see crtpCommanderHighLevelAppendTrajectory()
+ */
+LOG_GROUP_START(hlStream)
+
+/**
+ * @brief Number of free slots in the ring of the streaming trajectory
+ */
+LOG_ADD(LOG_UINT8, free, &stream.freeSlots)
+
+/**
+ * @brief Total number of pieces of streaming trajectories that have been played
+ */
+LOG_ADD(LOG_UINT32, played, &stream.playedPieces)
+
+/**
+ * @brief Number of times a streaming trajectory has run out of pieces
+ */
+LOG_ADD(LOG_UINT16, underrun, &stream.underruns)
+
+/**
+ * @brief Time left of the appended pieces of the streaming trajectory (s)
+ */
+LOG_ADD(LOG_FLOAT, buffered, &stream.bufferedTime)
+
+LOG_GROUP_STOP(hlStream)
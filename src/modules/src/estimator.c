@@ -1,5 +1,5 @@
 #include "FreeRTOS.h"
-#include "queue.h"
+#include "task.h"
 #include "static_mem.h"
 
 #define DEBUG_MODULE "ESTIMATOR"
@@ -13,20 +13,64 @@
 #include "statsCnt.h"
 #include "eventtrigger.h"
 #include "quatcompress.h"
+#include "usec_time.h"
 
 #define DEFAULT_ESTIMATOR complementaryEstimator
 static StateEstimatorType currentEstimator = anyEstimator;
 
 
-#define MEASUREMENTS_QUEUE_SIZE (20)
-static xQueueHandle measurementsQueue;
-STATIC_MEM_QUEUE_ALLOC(measurementsQueue, MEASUREMENTS_QUEUE_SIZE, sizeof(measurement_t));
+// Measurements are passed to the estimator through lock free single producer, single consumer rings. Each producer
+// task claims a ring of its own the first time it enqueues a measurement, the estimator drains all rings in time order.
+// Interrupts, and tasks that enqueue when all rings are claimed, share a ring where the producer side is protected by a
+// critical section. The rings are sized with CONFIG_ESTIMATOR_MEASUREMENT_RING_SIZE and
+// CONFIG_ESTIMATOR_MEASUREMENT_PRODUCER_RINGS.
+#ifdef CONFIG_ESTIMATOR_MEASUREMENT_RING_SIZE
+#define MEASUREMENT_RING_SIZE CONFIG_ESTIMATOR_MEASUREMENT_RING_SIZE
+#else
+#define MEASUREMENT_RING_SIZE (16)
+#endif
+
+#ifdef CONFIG_ESTIMATOR_MEASUREMENT_PRODUCER_RINGS
+#define MEASUREMENT_PRODUCER_RINGS CONFIG_ESTIMATOR_MEASUREMENT_PRODUCER_RINGS
+#else
+#define MEASUREMENT_PRODUCER_RINGS (6)
+#endif
+
+#if (MEASUREMENT_RING_SIZE & (MEASUREMENT_RING_SIZE - 1)) != 0
+#error "The measurement ring size must be a power of 2"
+#endif
+
+typedef struct {
+  measurement_t measurements[MEASUREMENT_RING_SIZE];
+  uint32_t head; // Only written by the producer
+  uint32_t tail; // Only written by the consumer
+} measurementRing_t;
+
+NO_DMA_CCM_SAFE_ZERO_INIT static measurementRing_t producerRings[MEASUREMENT_PRODUCER_RINGS];
+static TaskHandle_t producerRingOwners[MEASUREMENT_PRODUCER_RINGS];
+NO_DMA_CCM_SAFE_ZERO_INIT static measurementRing_t sharedRing;
+static bool ringsAreInitialized = false;
+
+// The maximum number of measurements that have been in any producer ring, and in the shared ring. The producer high
+// water mark is updated by all producer tasks without locking, an update can occasionally be lost.
+static uint8_t producerHighWaterMark;
+static uint8_t sharedHighWaterMark;
 
 // Statistics
 #define ONE_SECOND 1000
 static STATS_CNT_RATE_DEFINE(measurementAppendedCounter, ONE_SECOND);
 static STATS_CNT_RATE_DEFINE(measurementNotAppendedCounter, ONE_SECOND);
 
+// Statistics per measurement type. Measurements are dropped when the ring of the producer is full. The enqueued and
+// consumed totals are plain counters to keep the RAM and log TOC cost low, rates are computed by the client.
+typedef struct {
+  statsCntRateLogger_t dropped;
+  uint32_t enqueued;
+  uint32_t consumed;
+} measurementTypeStats_t;
+
+static measurementTypeStats_t measurementStats[MeasurementTypeCount];
+
 // events
 EVENTTRIGGER(estTDOA, uint8, idA, uint8, idB, float, distanceDiff)
 EVENTTRIGGER(estPosition, uint8, source)
@@ -90,7 +134,11 @@ static EstimatorFcns estimatorFunctions[] = {
 };
 
 void stateEstimatorInit(StateEstimatorType estimator) {
-  measurementsQueue = STATIC_MEM_QUEUE_CREATE(measurementsQueue);
+  for (int i = 0; i < MeasurementTypeCount; i++) {
+    STATS_CNT_RATE_INIT(&measurementStats[i].dropped, ONE_SECOND);
+  }
+
+  ringsAreInitialized = true;
   stateEstimatorSwitchTo(estimator);
 }
 
@@ -156,29 +204,105 @@ const char* stateEstimatorGetName() {
 }
 
 
+// Add a measurement to a ring, only called by the producer of the ring
+static bool ringPush(measurementRing_t* ring, uint8_t* highWaterMark, const measurement_t* measurement, const uint64_t timestamp) {
+  const uint32_t head = ring->head;
+  const uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+  const uint32_t used = head - tail;
+  if (used >= MEASUREMENT_RING_SIZE) {
+    return false;
+  }
+
+  if (used + 1 > *highWaterMark) {
+    *highWaterMark = used + 1;
+  }
+
+  measurement_t* slot = &ring->measurements[head & (MEASUREMENT_RING_SIZE - 1)];
+  *slot = *measurement;
+  slot->timestamp = timestamp;
+
+  // Publish the measurement to the consumer
+  __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+  return true;
+}
+
+// The oldest measurement in a ring, or NULL if the ring is empty. Only called by the consumer.
+static const measurement_t* ringPeek(const measurementRing_t* ring) {
+  const uint32_t tail = ring->tail;
+  if (tail == __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE)) {
+    return NULL;
+  }
+
+  return &ring->measurements[tail & (MEASUREMENT_RING_SIZE - 1)];
+}
+
+// Remove the oldest measurement from a ring, only called by the consumer
+static void ringPop(measurementRing_t* ring) {
+  __atomic_store_n(&ring->tail, ring->tail + 1, __ATOMIC_RELEASE);
+}
+
+// The index of the ring owned by the calling task, a free ring is claimed the first time a task enqueues a measurement.
+// Returns -1 if all rings are claimed by other tasks.
+static int ringOfCurrentTask(const TaskHandle_t task) {
+  for (int i = 0; i < MEASUREMENT_PRODUCER_RINGS; i++) {
+    TaskHandle_t owner = __atomic_load_n(&producerRingOwners[i], __ATOMIC_ACQUIRE);
+    if (owner == NULL) {
+      // Rings are claimed in order, the first free ring is also the first one another task could claim
+      if (__atomic_compare_exchange_n(&producerRingOwners[i], &owner, task, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        return i;
+      }
+    }
+
+    if (owner == task) {
+      return i;
+    }
+  }
+
+  return -1;
+}
+
 void estimatorEnqueue(const measurement_t *measurement) {
-  if (!measurementsQueue) {
+  if (!ringsAreInitialized) {
     return;
   }
 
-  portBASE_TYPE result;
+  // Stamp the measurement with the time of arrival
+  const uint64_t timestamp = usecTimestamp();
+
+  bool result;
   bool isInInterrupt = (SCB->ICSR & SCB_ICSR_VECTACTIVE_Msk) != 0;
-  if (isInInterrupt) {
-    portBASE_TYPE xHigherPriorityTaskWoken = pdFALSE;
-    result = xQueueSendFromISR(measurementsQueue, measurement, &xHigherPriorityTaskWoken);
-    if (xHigherPriorityTaskWoken == pdTRUE) {
-      portYIELD();
-    }
+  int ring = -1;
+  if (!isInInterrupt && xTaskGetSchedulerState() == taskSCHEDULER_RUNNING) {
+    ring = ringOfCurrentTask(xTaskGetCurrentTaskHandle());
+  }
+
+  if (ring >= 0) {
+    result = ringPush(&producerRings[ring], &producerHighWaterMark, measurement, timestamp);
+  } else if (isInInterrupt) {
+    UBaseType_t savedInterruptStatus = taskENTER_CRITICAL_FROM_ISR();
+    result = ringPush(&sharedRing, &sharedHighWaterMark, measurement, timestamp);
+    taskEXIT_CRITICAL_FROM_ISR(savedInterruptStatus);
   } else {
-    result = xQueueSend(measurementsQueue, measurement, 0);
+    taskENTER_CRITICAL();
+    result = ringPush(&sharedRing, &sharedHighWaterMark, measurement, timestamp);
+    taskEXIT_CRITICAL();
   }
 
-  if (result == pdTRUE) {
+  if (result) {
     STATS_CNT_RATE_EVENT(&measurementAppendedCounter);
   } else {
     STATS_CNT_RATE_EVENT(&measurementNotAppendedCounter);
   }
 
+  if (measurement->type < MeasurementTypeCount) {
+    measurementTypeStats_t* stats = &measurementStats[measurement->type];
+    if (result) {
+      stats->enqueued++;
+    } else {
+      STATS_CNT_RATE_EVENT(&stats->dropped);
+    }
+  }
+
   // events
   switch (measurement->type) {
     case MeasurementTypeTDOA:
@@ -242,11 +366,196 @@ void estimatorEnqueue(const measurement_t *measurement) {
   }
 }
 
+// Only one estimator is active at a time and it is the only consumer of the rings
 bool estimatorDequeue(measurement_t *measurement) {
-  return pdTRUE == xQueueReceive(measurementsQueue, measurement, 0);
+  // Merge the rings by taking the oldest measurement at the head of any ring
+  measurementRing_t* oldestRing = NULL;
+  const measurement_t* oldest = NULL;
+
+  for (int i = 0; i <= MEASUREMENT_PRODUCER_RINGS; i++) {
+    measurementRing_t* ring = (i < MEASUREMENT_PRODUCER_RINGS) ? &producerRings[i] : &sharedRing;
+    const measurement_t* candidate = ringPeek(ring);
+    if (candidate && (!oldest || candidate->timestamp < oldest->timestamp)) {
+      oldest = candidate;
+      oldestRing = ring;
+    }
+  }
+
+  if (!oldest) {
+    return false;
+  }
+
+  *measurement = *oldest;
+  ringPop(oldestRing);
+
+  if (measurement->type < MeasurementTypeCount) {
+    measurementStats[measurement->type].consumed++;
+  }
+
+  return true;
 }
 
 LOG_GROUP_START(estimator)
   STATS_CNT_RATE_LOG_ADD(rtApnd, &measurementAppendedCounter)
   STATS_CNT_RATE_LOG_ADD(rtRej, &measurementNotAppendedCounter)
+  /**
+   * @brief Total number of TDoA measurements dropped since the measurement ring was full
+   */
+  LOG_ADD(LOG_UINT32, dropTdoa, &measurementStats[MeasurementTypeTDOA].dropped.rateCounter.count)
+  /**
+   * @brief Total number of position measurements dropped since the measurement ring was full
+   */
+  LOG_ADD(LOG_UINT32, dropPos, &measurementStats[MeasurementTypePosition].dropped.rateCounter.count)
+  /**
+   * @brief Total number of pose measurements dropped since the measurement ring was full
+   */
+  LOG_ADD(LOG_UINT32, dropPose, &measurementStats[MeasurementTypePose].dropped.rateCounter.count)
+  /**
+   * @brief Total number of distance (TWR) measurements dropped since the measurement ring was full
+   */
+  LOG_ADD(LOG_UINT32, dropDist, &measurementStats[MeasurementTypeDistance].dropped.rateCounter.count)
+  /**
+   * @brief Total number of TOF measurements dropped since the measurement ring was full
+   */
+  LOG_ADD(LOG_UINT32, dropTof, &measurementStats[MeasurementTypeTOF].dropped.rateCounter.count)
+  /**
+   * @brief Total number of absolute height measurements dropped since the measurement ring was full
+   */
+  LOG_ADD(LOG_UINT32, dropHeight, &measurementStats[MeasurementTypeAbsoluteHeight].dropped.rateCounter.count)
+  /**
+   * @brief Total number of flow measurements dropped since the measurement ring was full
+   */
+  LOG_ADD(LOG_UINT32, dropFlow, &measurementStats[MeasurementTypeFlow].dropped.rateCounter.count)
+  /**
+   * @brief Total number of yaw error measurements dropped since the measurement ring was full
+   */
+  LOG_ADD(LOG_UINT32, dropYaw, &measurementStats[MeasurementTypeYawError].dropped.rateCounter.count)
+  /**
+   * @brief Total number of sweep angle measurements dropped since the measurement ring was full
+   */
+  LOG_ADD(LOG_UINT32, dropSweep, &measurementStats[MeasurementTypeSweepAngle].dropped.rateCounter.count)
+  /**
+   * @brief Total number of gyroscope measurements dropped since the measurement ring was full
+   */
+  LOG_ADD(LOG_UINT32, dropGyro, &measurementStats[MeasurementTypeGyroscope].dropped.rateCounter.count)
+  /**
+   * @brief Total number of accelerometer measurements dropped since the measurement ring was full
+   */
+  LOG_ADD(LOG_UINT32, dropAcc, &measurementStats[MeasurementTypeAcceleration].dropped.rateCounter.count)
+  /**
+   * @brief Total number of barometer measurements dropped since the measurement ring was full
+   */
+  LOG_ADD(LOG_UINT32, dropBaro, &measurementStats[MeasurementTypeBarometer].dropped.rateCounter.count)
 LOG_GROUP_STOP(estimator)
+
+/**
+ * Statistics for the measurement rings. "In" is the total number of measurements of a type that have been enqueued
+ * and "Out" the total number that have been consumed by the estimator. The number of dropped measurements per type
+ * is logged in the estimator group.
+ */
+LOG_GROUP_START(estMeas)
+  /**
+   * @brief Maximum number of measurements that have been in any of the producer rings
+   */
+  LOG_ADD(LOG_UINT8, hwm, &producerHighWaterMark)
+  /**
+   * @brief Maximum number of measurements that have been in the ring shared by interrupts and additional tasks
+   */
+  LOG_ADD(LOG_UINT8, hwmShared, &sharedHighWaterMark)
+  /**
+   * @brief Total number of TDoA measurements enqueued
+   */
+  LOG_ADD(LOG_UINT32, tdoaIn, &measurementStats[MeasurementTypeTDOA].enqueued)
+  /**
+   * @brief Total number of TDoA measurements consumed by the estimator
+   */
+  LOG_ADD(LOG_UINT32, tdoaOut, &measurementStats[MeasurementTypeTDOA].consumed)
+  /**
+   * @brief Total number of position measurements enqueued
+   */
+  LOG_ADD(LOG_UINT32, posIn, &measurementStats[MeasurementTypePosition].enqueued)
+  /**
+   * @brief Total number of position measurements consumed by the estimator
+   */
+  LOG_ADD(LOG_UINT32, posOut, &measurementStats[MeasurementTypePosition].consumed)
+  /**
+   * @brief Total number of pose measurements enqueued
+   */
+  LOG_ADD(LOG_UINT32, poseIn, &measurementStats[MeasurementTypePose].enqueued)
+  /**
+   * @brief Total number of pose measurements consumed by the estimator
+   */
+  LOG_ADD(LOG_UINT32, poseOut, &measurementStats[MeasurementTypePose].consumed)
+  /**
+   * @brief Total number of distance (TWR) measurements enqueued
+   */
+  LOG_ADD(LOG_UINT32, distIn, &measurementStats[MeasurementTypeDistance].enqueued)
+  /**
+   * @brief Total number of distance (TWR) measurements consumed by the estimator
+   */
+  LOG_ADD(LOG_UINT32, distOut, &measurementStats[MeasurementTypeDistance].consumed)
+  /**
+   * @brief Total number of TOF measurements enqueued
+   */
+  LOG_ADD(LOG_UINT32, tofIn, &measurementStats[MeasurementTypeTOF].enqueued)
+  /**
+   * @brief Total number of TOF measurements consumed by the estimator
+   */
+  LOG_ADD(LOG_UINT32, tofOut, &measurementStats[MeasurementTypeTOF].consumed)
+  /**
+   * @brief Total number of absolute height measurements enqueued
+   */
+  LOG_ADD(LOG_UINT32, heightIn, &measurementStats[MeasurementTypeAbsoluteHeight].enqueued)
+  /**
+   * @brief Total number of absolute height measurements consumed by the estimator
+   */
+  LOG_ADD(LOG_UINT32, heightOut, &measurementStats[MeasurementTypeAbsoluteHeight].consumed)
+  /**
+   * @brief Total number of flow measurements enqueued
+   */
+  LOG_ADD(LOG_UINT32, flowIn, &measurementStats[MeasurementTypeFlow].enqueued)
+  /**
+   * @brief Total number of flow measurements consumed by the estimator
+   */
+  LOG_ADD(LOG_UINT32, flowOut, &measurementStats[MeasurementTypeFlow].consumed)
+  /**
+   * @brief Total number of yaw error measurements enqueued
+   */
+  LOG_ADD(LOG_UINT32, yawIn, &measurementStats[MeasurementTypeYawError].enqueued)
+  /**
+   * @brief Total number of yaw error measurements consumed by the estimator
+   */
+  LOG_ADD(LOG_UINT32, yawOut, &measurementStats[MeasurementTypeYawError].consumed)
+  /**
+   * @brief Total number of sweep angle measurements enqueued
+   */
+  LOG_ADD(LOG_UINT32, sweepIn, &measurementStats[MeasurementTypeSweepAngle].enqueued)
+  /**
+   * @brief Total number of sweep angle measurements consumed by the estimator
+   */
+  LOG_ADD(LOG_UINT32, sweepOut, &measurementStats[MeasurementTypeSweepAngle].consumed)
+  /**
+   * @brief Total number of gyroscope measurements enqueued
+   */
+  LOG_ADD(LOG_UINT32, gyroIn, &measurementStats[MeasurementTypeGyroscope].enqueued)
+  /**
+   * @brief Total number of gyroscope measurements consumed by the estimator
+   */
+  LOG_ADD(LOG_UINT32, gyroOut, &measurementStats[MeasurementTypeGyroscope].consumed)
+  /**
+   * @brief Total number of accelerometer measurements enqueued
+   */
+  LOG_ADD(LOG_UINT32, accIn, &measurementStats[MeasurementTypeAcceleration].enqueued)
+  /**
+   * @brief Total number of accelerometer measurements consumed by the estimator
+   */
+  LOG_ADD(LOG_UINT32, accOut, &measurementStats[MeasurementTypeAcceleration].consumed)
+  /**
+   * @brief Total number of barometer measurements enqueued
+   */
+  LOG_ADD(LOG_UINT32, baroIn, &measurementStats[MeasurementTypeBarometer].enqueued)
+  /**
+   * @brief Total number of barometer measurements consumed by the estimator
+   */
+  LOG_ADD(LOG_UINT32, baroOut, &measurementStats[MeasurementTypeBarometer].consumed)
+LOG_GROUP_STOP(estMeas)
@@ -76,6 +76,7 @@
 
 #include "statsCnt.h"
 #include "rateSupervisor.h"
+#include "usec_time.h"
 
 // Measurement models
 #include "mm_distance.h"
@@ -91,6 +92,10 @@
 #include "mm_tdoa_robust.h"
 #include "mm_distance_robust.h"
 
+#ifdef CONFIG_ESTIMATOR_KALMAN_DELAYED_MEASUREMENTS
+#include "kalman_history.h"
+#endif
+
 #define DEBUG_MODULE "ESTKALMAN"
 #include "debug.h"
 
@@ -111,6 +116,7 @@ static StaticSemaphore_t dataMutexBuffer;
  * Tuning parameters
  */
 #define PREDICT_RATE RATE_100_HZ // this is slower than the IMU update rate of 500Hz
+#define PREDICT_INTERVAL_US (1000000 / PREDICT_RATE)
 // The bounds on the covariance, these shouldn't be hit, but sometimes are... why?
 #define MAX_COVARIANCE (100)
 #define MIN_COVARIANCE (1e-6f)
@@ -120,6 +126,25 @@ static StaticSemaphore_t dataMutexBuffer;
 static bool robustTwr = false;
 static bool robustTdoa = false;
 
+// Fuse all scalar measurements that are dequeued in one estimator cycle with a joint update, off by default but can be
+// turned on through a parameter. Reduces CPU usage at high measurement rates (lighthouse sweeps, TDoA bursts).
+static bool batchUpdate = false;
+NO_DMA_CCM_SAFE_ZERO_INIT static kalmanCoreBatch_t measurementBatch;
+
+#ifdef CONFIG_ESTIMATOR_KALMAN_DELAYED_MEASUREMENTS
+// Fuse delayed measurements at the time they were taken, off by default but can be turned on through a parameter.
+// The delay is the time from when a measurement is taken until it is enqueued [ms], per measurement type. Measurement
+// types with zero delay are fused as current measurements.
+static bool delayCompensation = false;
+static bool historyIsActive = false;
+static uint16_t delayTdoa = 0;
+static uint16_t delayPosition = 0;
+static uint16_t delayPose = 0;
+static uint16_t delayDistance = 0;
+static uint16_t delaySweepAngle = 0;
+NO_DMA_CCM_SAFE_ZERO_INIT static kalmanHistory_t history;
+#endif
+
 /**
  * Quadrocopter State
  *
@@ -167,6 +192,11 @@ static STATS_CNT_RATE_DEFINE(finalizeCounter, ONE_SECOND);
 
 static rateSupervisor_t rateSupervisorContext;
 
+// Timing of the estimator loop, in microseconds
+static uint32_t predictionIntervalUs;
+static uint32_t predictionJitterUs;
+static uint32_t measurementMaxAgeUs;
+
 #define WARNING_HOLD_BACK_TIME M2T(2000)
 static uint32_t warningBlockTime = 0;
 
@@ -177,8 +207,10 @@ static const bool useBaroUpdate = false;
 #endif
 
 static void kalmanTask(void* parameters);
-static bool predictStateForward(uint32_t osTick, float dt);
-static bool updateQueuedMeasurements(const uint32_t tick);
+static bool predictStateForward(uint64_t nowUs, float dt);
+static void addProcessNoise(float dt);
+static bool updateQueuedMeasurements(const uint64_t nowUs);
+static bool fuseMeasurement(kalmanCoreData_t* this, measurement_t* m);
 
 STATIC_MEM_TASK_ALLOC_STACK_NO_DMA_CCM_SAFE(kalmanTask, 3 * configMINIMAL_STACK_SIZE);
 
@@ -204,9 +236,12 @@ bool estimatorKalmanTaskTest() {
 static void kalmanTask(void* parameters) {
   systemWaitStart();
 
-  uint32_t lastPrediction = xTaskGetTickCount();
   uint32_t nextPrediction = xTaskGetTickCount();
-  uint32_t lastPNUpdate = xTaskGetTickCount();
+
+  // The time steps are based on the microsecond timer, the os tick is only used for scheduling.
+  // A 1 ms tick would quantize dt by 10% at the prediction rate.
+  uint64_t lastPredictionUs = usecTimestamp();
+  uint64_t lastPNUpdateUs = lastPredictionUs;
 
   rateSupervisorInit(&rateSupervisorContext, xTaskGetTickCount(), ONE_SECOND, PREDICT_RATE - 1, PREDICT_RATE + 1, 1);
 
@@ -219,10 +254,19 @@ static void kalmanTask(void* parameters) {
       resetEstimation = false;
     }
 
+#ifdef CONFIG_ESTIMATOR_KALMAN_DELAYED_MEASUREMENTS
+    // Start from an empty history when the delay compensation is activated
+    if (delayCompensation && !historyIsActive) {
+      kalmanHistoryInit(&history, fuseMeasurement, &sweepOutlierFilterState);
+    }
+    historyIsActive = delayCompensation;
+#endif
+
     // Tracks whether an update to the state has been made, and the state therefore requires finalization
     bool doneUpdate = false;
 
-    uint32_t osTick = xTaskGetTickCount(); // would be nice if this had a precision higher than 1ms...
+    uint32_t osTick = xTaskGetTickCount();
+    uint64_t nowUs = usecTimestamp();
 
   #ifdef KALMAN_DECOUPLE_XY
     kalmanCoreDecoupleXY(&coreData);
@@ -230,9 +274,12 @@ static void kalmanTask(void* parameters) {
 
     // Run the system dynamics to predict the state forward.
     if (osTick >= nextPrediction) { // update at the PREDICT_RATE
-      float dt = T2S(osTick - lastPrediction);
-      if (predictStateForward(osTick, dt)) {
-        lastPrediction = osTick;
+      uint32_t intervalUs = (uint32_t)(nowUs - lastPredictionUs);
+      float dt = intervalUs * 1e-6f;
+      if (predictStateForward(nowUs, dt)) {
+        lastPredictionUs = nowUs;
+        predictionIntervalUs = intervalUs;
+        predictionJitterUs = (intervalUs > PREDICT_INTERVAL_US) ? intervalUs - PREDICT_INTERVAL_US : PREDICT_INTERVAL_US - intervalUs;
         doneUpdate = true;
         STATS_CNT_RATE_EVENT(&predictionCounter);
       }
@@ -248,15 +295,15 @@ static void kalmanTask(void* parameters) {
      * Add process noise every loop, rather than every prediction
      */
     {
-      float dt = T2S(osTick - lastPNUpdate);
+      float dt = (nowUs - lastPNUpdateUs) * 1e-6f;
       if (dt > 0.0f) {
-        kalmanCoreAddProcessNoise(&coreData, &coreParams, dt);
-        lastPNUpdate = osTick;
+        addProcessNoise(dt);
+        lastPNUpdateUs = nowUs;
       }
     }
 
     {
-      if(updateQueuedMeasurements(osTick)) {
+      if(updateQueuedMeasurements(nowUs)) {
         doneUpdate = true;
       }
     }
@@ -307,7 +354,7 @@ void estimatorKalman(state_t *state, const uint32_t tick)
   xSemaphoreGive(runTaskSemaphore);
 }
 
-static bool predictStateForward(uint32_t osTick, float dt) {
+static bool predictStateForward(uint64_t nowUs, float dt) {
   if (gyroAccumulatorCount == 0
       || accAccumulatorCount == 0)
   {
@@ -333,71 +380,71 @@ static bool predictStateForward(uint32_t osTick, float dt) {
   gyroAccumulatorCount = 0;
 
   quadIsFlying = supervisorIsFlying();
+
+#ifdef CONFIG_ESTIMATOR_KALMAN_DELAYED_MEASUREMENTS
+  if (historyIsActive) {
+    kalmanHistoryPredict(&history, &coreData, &accAverage, &gyroAverage, dt, quadIsFlying, nowUs);
+    return true;
+  }
+#endif
+
   kalmanCorePredict(&coreData, &accAverage, &gyroAverage, dt, quadIsFlying);
 
   return true;
 }
 
+static void addProcessNoise(float dt) {
+#ifdef CONFIG_ESTIMATOR_KALMAN_DELAYED_MEASUREMENTS
+  if (historyIsActive) {
+    kalmanHistoryAddProcessNoise(&history, &coreData, &coreParams, dt);
+    return;
+  }
+#endif
+
+  kalmanCoreAddProcessNoise(&coreData, &coreParams, dt);
+}
+
+#ifdef CONFIG_ESTIMATOR_KALMAN_DELAYED_MEASUREMENTS
+static uint32_t measurementDelayUs(const MeasurementType type) {
+  switch (type) {
+    case MeasurementTypeTDOA:
+      return delayTdoa * 1000;
+    case MeasurementTypePosition:
+      return delayPosition * 1000;
+    case MeasurementTypePose:
+      return delayPose * 1000;
+    case MeasurementTypeDistance:
+      return delayDistance * 1000;
+    case MeasurementTypeSweepAngle:
+      return delaySweepAngle * 1000;
+    default:
+      return 0;
+  }
+}
+#endif
 
-static bool updateQueuedMeasurements(const uint32_t tick) {
+
+static bool updateQueuedMeasurements(const uint64_t nowUs) {
   bool doneUpdate = false;
+  uint32_t maxAgeUs = 0;
   /**
    * Sensor measurements can come in sporadically and faster than the stabilizer loop frequency,
    * we therefore consume all measurements since the last loop, rather than accumulating
    */
 
+  if (batchUpdate) {
+    kalmanCoreBatchBegin(&coreData, &measurementBatch);
+  }
+
   // Pull the latest sensors values of interest; discard the rest
   measurement_t m;
   while (estimatorDequeue(&m)) {
+    // Measurements enqueued after nowUs was sampled are considered to have no delay
+    if (nowUs > m.timestamp && nowUs - m.timestamp > maxAgeUs) {
+      maxAgeUs = (uint32_t)(nowUs - m.timestamp);
+    }
+
     switch (m.type) {
-      case MeasurementTypeTDOA:
-        if(robustTdoa){
-          // robust KF update with TDOA measurements
-          kalmanCoreRobustUpdateWithTDOA(&coreData, &m.data.tdoa);
-        }else{
-          // standard KF update
-          kalmanCoreUpdateWithTDOA(&coreData, &m.data.tdoa);
-        }
-        doneUpdate = true;
-        break;
-      case MeasurementTypePosition:
-        kalmanCoreUpdateWithPosition(&coreData, &m.data.position);
-        doneUpdate = true;
-        break;
-      case MeasurementTypePose:
-        kalmanCoreUpdateWithPose(&coreData, &m.data.pose);
-        doneUpdate = true;
-        break;
-      case MeasurementTypeDistance:
-        if(robustTwr){
-            // robust KF update with UWB TWR measurements
-            kalmanCoreRobustUpdateWithDistance(&coreData, &m.data.distance);
-        }else{
-            // standard KF update
-            kalmanCoreUpdateWithDistance(&coreData, &m.data.distance);
-        }
-        doneUpdate = true;
-        break;
-      case MeasurementTypeTOF:
-        kalmanCoreUpdateWithTof(&coreData, &m.data.tof);
-        doneUpdate = true;
-        break;
-      case MeasurementTypeAbsoluteHeight:
-        kalmanCoreUpdateWithAbsoluteHeight(&coreData, &m.data.height);
-        doneUpdate = true;
-        break;
-      case MeasurementTypeFlow:
-        kalmanCoreUpdateWithFlow(&coreData, &m.data.flow, &gyroLatest);
-        doneUpdate = true;
-        break;
-      case MeasurementTypeYawError:
-        kalmanCoreUpdateWithYawError(&coreData, &m.data.yawError);
-        doneUpdate = true;
-        break;
-      case MeasurementTypeSweepAngle:
-        kalmanCoreUpdateWithSweepAngles(&coreData, &m.data.sweepAngle, tick, &sweepOutlierFilterState);
-        doneUpdate = true;
-        break;
       case MeasurementTypeGyroscope:
         gyroAccumulator.x += m.data.gyroscope.gyro.x;
         gyroAccumulator.y += m.data.gyroscope.gyro.y;
@@ -412,17 +459,100 @@ static bool updateQueuedMeasurements(const uint32_t tick) {
         accLatest = m.data.acceleration.acc;
         accAccumulatorCount++;
         break;
-      case MeasurementTypeBarometer:
-        if (useBaroUpdate) {
-          kalmanCoreUpdateWithBaro(&coreData, &coreParams, m.data.barometer.baro.asl, quadIsFlying);
+      default:
+#ifdef CONFIG_ESTIMATOR_KALMAN_DELAYED_MEASUREMENTS
+        if (historyIsActive) {
+          if (kalmanHistoryAddMeasurement(&history, &coreData, &m, measurementDelayUs(m.type))) {
+            doneUpdate = true;
+          }
+          break;
+        }
+#endif
+        if (fuseMeasurement(&coreData, &m)) {
           doneUpdate = true;
         }
         break;
-      default:
-        break;
     }
   }
 
+#ifdef CONFIG_ESTIMATOR_KALMAN_DELAYED_MEASUREMENTS
+  if (historyIsActive && kalmanHistoryReplay(&history, &coreData)) {
+    doneUpdate = true;
+  }
+#endif
+
+  kalmanCoreBatchEnd(&coreData);
+  measurementMaxAgeUs = maxAgeUs;
+
+  return doneUpdate;
+}
+
+// Fuse one measurement (other than IMU data) into the filter, returns true if the filter was updated
+static bool fuseMeasurement(kalmanCoreData_t* this, measurement_t* m) {
+  bool doneUpdate = false;
+
+  switch (m->type) {
+    case MeasurementTypeTDOA:
+      if(robustTdoa){
+        // robust KF update with TDOA measurements
+        kalmanCoreBatchFlush(this);
+        kalmanCoreRobustUpdateWithTDOA(this, &m->data.tdoa);
+      }else{
+        // standard KF update
+        kalmanCoreUpdateWithTDOA(this, &m->data.tdoa);
+      }
+      doneUpdate = true;
+      break;
+    case MeasurementTypePosition:
+      kalmanCoreUpdateWithPosition(this, &m->data.position);
+      doneUpdate = true;
+      break;
+    case MeasurementTypePose:
+      kalmanCoreUpdateWithPose(this, &m->data.pose);
+      doneUpdate = true;
+      break;
+    case MeasurementTypeDistance:
+      if(robustTwr){
+          // robust KF update with UWB TWR measurements
+          kalmanCoreBatchFlush(this);
+          kalmanCoreRobustUpdateWithDistance(this, &m->data.distance);
+      }else{
+          // standard KF update
+          kalmanCoreUpdateWithDistance(this, &m->data.distance);
+      }
+      doneUpdate = true;
+      break;
+    case MeasurementTypeTOF:
+      kalmanCoreUpdateWithTof(this, &m->data.tof);
+      doneUpdate = true;
+      break;
+    case MeasurementTypeAbsoluteHeight:
+      kalmanCoreUpdateWithAbsoluteHeight(this, &m->data.height);
+      doneUpdate = true;
+      break;
+    case MeasurementTypeFlow:
+      kalmanCoreUpdateWithFlow(this, &m->data.flow, &gyroLatest);
+      doneUpdate = true;
+      break;
+    case MeasurementTypeYawError:
+      kalmanCoreUpdateWithYawError(this, &m->data.yawError);
+      doneUpdate = true;
+      break;
+    case MeasurementTypeSweepAngle:
+      // The outlier filter uses the time the measurement was enqueued (or taken, when compensating for delays) [ms]
+      kalmanCoreUpdateWithSweepAngles(this, &m->data.sweepAngle, (uint32_t)(m->timestamp / 1000), &sweepOutlierFilterState);
+      doneUpdate = true;
+      break;
+    case MeasurementTypeBarometer:
+      if (useBaroUpdate) {
+        kalmanCoreUpdateWithBaro(this, &coreParams, m->data.barometer.baro.asl, quadIsFlying);
+        doneUpdate = true;
+      }
+      break;
+    default:
+      break;
+  }
+
   return doneUpdate;
 }
 
@@ -437,6 +567,11 @@ void estimatorKalmanInit(void)
   outlierFilterReset(&sweepOutlierFilterState, 0);
 
   kalmanCoreInit(&coreData, &coreParams);
+
+#ifdef CONFIG_ESTIMATOR_KALMAN_DELAYED_MEASUREMENTS
+  // The history refers to the filter before the reset
+  kalmanHistoryInit(&history, fuseMeasurement, &sweepOutlierFilterState);
+#endif
 }
 
 bool estimatorKalmanTest(void)
@@ -515,39 +650,39 @@ LOG_GROUP_START(kalman)
   /**
   * @brief Covariance matrix position x
   */
-  LOG_ADD(LOG_FLOAT, varX, &coreData.P[KC_STATE_X][KC_STATE_X])
+  LOG_ADD(LOG_FLOAT, varX, &KC_COV(&coreData, KC_STATE_X, KC_STATE_X))
   /**
   * @brief Covariance matrix position y
   */
-  LOG_ADD(LOG_FLOAT, varY, &coreData.P[KC_STATE_Y][KC_STATE_Y])
+  LOG_ADD(LOG_FLOAT, varY, &KC_COV(&coreData, KC_STATE_Y, KC_STATE_Y))
   /**
   * @brief Covariance matrix position z
   */
-  LOG_ADD(LOG_FLOAT, varZ, &coreData.P[KC_STATE_Z][KC_STATE_Z])
+  LOG_ADD(LOG_FLOAT, varZ, &KC_COV(&coreData, KC_STATE_Z, KC_STATE_Z))
   /**
   * @brief Covariance matrix velocity x
   */
-  LOG_ADD(LOG_FLOAT, varPX, &coreData.P[KC_STATE_PX][KC_STATE_PX])
+  LOG_ADD(LOG_FLOAT, varPX, &KC_COV(&coreData, KC_STATE_PX, KC_STATE_PX))
   /**
   * @brief Covariance matrix velocity y
   */
-  LOG_ADD(LOG_FLOAT, varPY, &coreData.P[KC_STATE_PY][KC_STATE_PY])
+  LOG_ADD(LOG_FLOAT, varPY, &KC_COV(&coreData, KC_STATE_PY, KC_STATE_PY))
   /**
   * @brief Covariance matrix velocity z
   */
-  LOG_ADD(LOG_FLOAT, varPZ, &coreData.P[KC_STATE_PZ][KC_STATE_PZ])
+  LOG_ADD(LOG_FLOAT, varPZ, &KC_COV(&coreData, KC_STATE_PZ, KC_STATE_PZ))
   /**
   * @brief Covariance matrix attitude error roll
   */
-  LOG_ADD(LOG_FLOAT, varD0, &coreData.P[KC_STATE_D0][KC_STATE_D0])
+  LOG_ADD(LOG_FLOAT, varD0, &KC_COV(&coreData, KC_STATE_D0, KC_STATE_D0))
   /**
   * @brief Covariance matrix attitude error pitch
   */
-  LOG_ADD(LOG_FLOAT, varD1, &coreData.P[KC_STATE_D1][KC_STATE_D1])
+  LOG_ADD(LOG_FLOAT, varD1, &KC_COV(&coreData, KC_STATE_D1, KC_STATE_D1))
   /**
   * @brief Covariance matrix attitude error yaw
   */
-  LOG_ADD(LOG_FLOAT, varD2, &coreData.P[KC_STATE_D2][KC_STATE_D2])
+  LOG_ADD(LOG_FLOAT, varD2, &KC_COV(&coreData, KC_STATE_D2, KC_STATE_D2))
   /**
   * @brief Estimated Attitude quarternion w
   */
@@ -576,6 +711,28 @@ LOG_GROUP_START(kalman)
   * @brief Statistics rate full estimation step
   */
   STATS_CNT_RATE_LOG_ADD(rtFinal, &finalizeCounter)
+  /**
+  * @brief Time between the two latest prediction steps [us]
+  */
+  LOG_ADD(LOG_UINT32, predDtUs, &predictionIntervalUs)
+  /**
+  * @brief Deviation of the latest prediction interval from the nominal interval [us]
+  */
+  LOG_ADD(LOG_UINT32, predJitUs, &predictionJitterUs)
+  /**
+  * @brief Time from enqueueing to processing of the oldest measurement in the latest estimator cycle [us]
+  */
+  LOG_ADD(LOG_UINT32, measAgeUs, &measurementMaxAgeUs)
+#ifdef CONFIG_ESTIMATOR_KALMAN_DELAYED_MEASUREMENTS
+  /**
+  * @brief Number of times the filter has been rewound to fuse delayed measurements
+  */
+  LOG_ADD(LOG_UINT32, histReplay, &history.replayCount)
+  /**
+  * @brief Number of delayed measurements that were older than the history, fused at the oldest possible time
+  */
+  LOG_ADD(LOG_UINT32, histOld, &history.tooOldCount)
+#endif
 LOG_GROUP_STOP(kalman)
 
 LOG_GROUP_START(outlierf)
@@ -600,6 +757,36 @@ PARAM_GROUP_START(kalman)
  * @brief Nonzero to use robust TWR method (default: 0)
  */
   PARAM_ADD_CORE(PARAM_UINT8, robustTwr, &robustTwr)
+/**
+ * @brief Nonzero to fuse the measurements of one estimator cycle in a joint batch update (default: 0)
+ */
+  PARAM_ADD(PARAM_UINT8, batchUpdate, &batchUpdate)
+#ifdef CONFIG_ESTIMATOR_KALMAN_DELAYED_MEASUREMENTS
+/**
+ * @brief Nonzero to fuse delayed measurements at the time they were taken (default: 0)
+ */
+  PARAM_ADD(PARAM_UINT8, delayComp, &delayCompensation)
+/**
+ * @brief Delay of TDoA measurements, from when they are taken until they are enqueued [ms]
+ */
+  PARAM_ADD(PARAM_UINT16, dlyTdoa, &delayTdoa)
+/**
+ * @brief Delay of position measurements, from when they are taken until they are enqueued [ms]
+ */
+  PARAM_ADD(PARAM_UINT16, dlyPos, &delayPosition)
+/**
+ * @brief Delay of pose measurements, from when they are taken until they are enqueued [ms]
+ */
+  PARAM_ADD(PARAM_UINT16, dlyPose, &delayPose)
+/**
+ * @brief Delay of distance (TWR) measurements, from when they are taken until they are enqueued [ms]
+ */
+  PARAM_ADD(PARAM_UINT16, dlyTwr, &delayDistance)
+/**
+ * @brief Delay of lighthouse sweep angle measurements, from when they are taken until they are enqueued [ms]
+ */
+  PARAM_ADD(PARAM_UINT16, dlySweep, &delaySweepAngle)
+#endif
 /**
  * @brief Process noise for x and y acceleration
  */
@@ -101,7 +101,7 @@ static void assertStateNotNaN(const kalmanCoreData_t* this) {
   for(int i=0; i<KC_STATE_DIM; i++) {
     for(int j=0; j<KC_STATE_DIM; j++)
     {
-      if (isnan(this->P[i][j]))
+      if (isnan(KC_COV(this, i, j)))
       {
         ASSERT(false);
       }
@@ -123,6 +123,117 @@ static void assertStateNotNaN(const kalmanCoreData_t* this)
 // Small number epsilon, to prevent dividing by zero
 #define EPS (1e-6f)
 
+// Store element (i, j), i <= j, of the symmetric covariance matrix
+static inline void setCovariance(kalmanCoreData_t* this, int i, int j, float p)
+{
+#ifdef CONFIG_ESTIMATOR_KALMAN_PACKED_COVARIANCE
+  this->P[KC_PACKED_INDEX_UPPER(i, j)] = p;
+#else
+  this->P[i][j] = this->P[j][i] = p;
+#endif
+}
+
+// Store element (i, j), i <= j, of the symmetric covariance matrix and ensure it stays bounded
+// TODO: Why would it hit these bounds? Needs to be investigated.
+static inline void setBoundedCovariance(kalmanCoreData_t* this, int i, int j, float p)
+{
+  if (isnan(p) || p > MAX_COVARIANCE) {
+    p = MAX_COVARIANCE;
+  } else if ( i==j && p < MIN_COVARIANCE ) {
+    p = MIN_COVARIANCE;
+  }
+
+  setCovariance(this, i, j, p);
+}
+
+// Enforce symmetry of the covariance matrix, and ensure the values stay bounded.
+// The packed covariance is symmetric by construction and is only bounded.
+static void enforceCovarianceBoundsAndSymmetry(kalmanCoreData_t* this)
+{
+  for (int i=0; i<KC_STATE_DIM; i++) {
+    for (int j=i; j<KC_STATE_DIM; j++) {
+#ifdef CONFIG_ESTIMATOR_KALMAN_PACKED_COVARIANCE
+      float p = this->P[KC_PACKED_INDEX_UPPER(i, j)];
+#else
+      float p = 0.5f*this->P[i][j] + 0.5f*this->P[j][i];
+#endif
+      setBoundedCovariance(this, i, j, p);
+    }
+  }
+}
+
+#ifdef CONFIG_ESTIMATOR_KALMAN_PACKED_COVARIANCE
+// P = A P A' on the packed covariance, only the upper triangle of the result is computed
+static void transformPackedCovariance(kalmanCoreData_t* this, float A[KC_STATE_DIM][KC_STATE_DIM])
+{
+  NO_DMA_CCM_SAFE_ZERO_INIT static float AP[KC_STATE_DIM][KC_STATE_DIM];
+
+  for (int i=0; i<KC_STATE_DIM; i++) {
+    for (int j=0; j<KC_STATE_DIM; j++) {
+      float sum = 0;
+      for (int k=0; k<KC_STATE_DIM; k++) {
+        sum += A[i][k] * KC_COV(this, k, j);
+      }
+      AP[i][j] = sum;
+    }
+  }
+
+  for (int i=0; i<KC_STATE_DIM; i++) {
+    for (int j=i; j<KC_STATE_DIM; j++) {
+      float sum = 0;
+      for (int k=0; k<KC_STATE_DIM; k++) {
+        sum += AP[i][k] * A[j][k];
+      }
+      this->P[KC_PACKED_INDEX_UPPER(i, j)] = sum;
+    }
+  }
+}
+#endif
+
+// First state of the 3x3 block (position, body-frame velocity or attitude error) that state i belongs to
+#define BLOCK_START(i) ((i) - (i) % 3)
+
+/* P = A P A' for the linearized dynamics of kalmanCorePredict(). A is block upper triangular, with an identity
+ * block for position:
+ *
+ *     | I  Axp  Axd |
+ * A = | 0  App  Apd |
+ *     | 0   0   Add |
+ *
+ * Only the non-trivial blocks of A are used and only the upper triangle of the result is computed, which is about
+ * a third of the multiply-adds of the dense product. Elements of A below the block diagonal are never read.
+ */
+static void predictCovarianceBlockSparse(kalmanCoreData_t* this, float A[KC_STATE_DIM][KC_STATE_DIM])
+{
+  NO_DMA_CCM_SAFE_ZERO_INIT static float AP[KC_STATE_DIM][KC_STATE_DIM];
+
+  // A P, only the blocks on and right of the block diagonal are needed below
+  for (int i=0; i<KC_STATE_DIM; i++) {
+    const int block = BLOCK_START(i);
+    const int kStart = (block == KC_STATE_X) ? KC_STATE_PX : block;
+    for (int j=block; j<KC_STATE_DIM; j++) {
+      float sum = (block == KC_STATE_X) ? KC_COV(this, i, j) : 0;
+      for (int k=kStart; k<KC_STATE_DIM; k++) {
+        sum += A[i][k] * KC_COV(this, k, j);
+      }
+      AP[i][j] = sum;
+    }
+  }
+
+  // (A P) A', upper triangle
+  for (int i=0; i<KC_STATE_DIM; i++) {
+    for (int j=i; j<KC_STATE_DIM; j++) {
+      const int block = BLOCK_START(j);
+      const int kStart = (block == KC_STATE_X) ? KC_STATE_PX : block;
+      float sum = (block == KC_STATE_X) ? AP[i][j] : 0;
+      for (int k=kStart; k<KC_STATE_DIM; k++) {
+        sum += AP[i][k] * A[j][k];
+      }
+      setCovariance(this, i, j, sum);
+    }
+  }
+}
+
 void kalmanCoreDefaultParams(kalmanCoreParams_t* params)
 {
   // Initial variances, uncertain of position, but know we're stationary and roughly flat
@@ -182,31 +293,59 @@ void kalmanCoreInit(kalmanCoreData_t *this, const kalmanCoreParams_t *params)
 
   for (int i=0; i< KC_STATE_DIM; i++) {
     for (int j=0; j < KC_STATE_DIM; j++) {
-      this->P[i][j] = 0; // set covariances to zero (diagonals will be changed from zero in the next section)
+      KC_COV(this, i, j) = 0; // set covariances to zero (diagonals will be changed from zero in the next section)
     }
   }
 
   // initialize state variances
-  this->P[KC_STATE_X][KC_STATE_X]  = powf(params->stdDevInitialPosition_xy, 2);
-  this->P[KC_STATE_Y][KC_STATE_Y]  = powf(params->stdDevInitialPosition_xy, 2);
-  this->P[KC_STATE_Z][KC_STATE_Z]  = powf(params->stdDevInitialPosition_z, 2);
+  KC_COV(this, KC_STATE_X, KC_STATE_X)  = powf(params->stdDevInitialPosition_xy, 2);
+  KC_COV(this, KC_STATE_Y, KC_STATE_Y)  = powf(params->stdDevInitialPosition_xy, 2);
+  KC_COV(this, KC_STATE_Z, KC_STATE_Z)  = powf(params->stdDevInitialPosition_z, 2);
 
-  this->P[KC_STATE_PX][KC_STATE_PX] = powf(params->stdDevInitialVelocity, 2);
-  this->P[KC_STATE_PY][KC_STATE_PY] = powf(params->stdDevInitialVelocity, 2);
-  this->P[KC_STATE_PZ][KC_STATE_PZ] = powf(params->stdDevInitialVelocity, 2);
+  KC_COV(this, KC_STATE_PX, KC_STATE_PX) = powf(params->stdDevInitialVelocity, 2);
+  KC_COV(this, KC_STATE_PY, KC_STATE_PY) = powf(params->stdDevInitialVelocity, 2);
+  KC_COV(this, KC_STATE_PZ, KC_STATE_PZ) = powf(params->stdDevInitialVelocity, 2);
 
-  this->P[KC_STATE_D0][KC_STATE_D0] = powf(params->stdDevInitialAttitude_rollpitch, 2);
-  this->P[KC_STATE_D1][KC_STATE_D1] = powf(params->stdDevInitialAttitude_rollpitch, 2);
-  this->P[KC_STATE_D2][KC_STATE_D2] = powf(params->stdDevInitialAttitude_yaw, 2);
+  KC_COV(this, KC_STATE_D0, KC_STATE_D0) = powf(params->stdDevInitialAttitude_rollpitch, 2);
+  KC_COV(this, KC_STATE_D1, KC_STATE_D1) = powf(params->stdDevInitialAttitude_rollpitch, 2);
+  KC_COV(this, KC_STATE_D2, KC_STATE_D2) = powf(params->stdDevInitialAttitude_yaw, 2);
 
+#ifndef CONFIG_ESTIMATOR_KALMAN_PACKED_COVARIANCE
   this->Pm.numRows = KC_STATE_DIM;
   this->Pm.numCols = KC_STATE_DIM;
   this->Pm.pData = (float*)this->P;
+#endif
 
   this->baroReferenceHeight = 0.0;
 }
 
 void kalmanCoreScalarUpdate(kalmanCoreData_t* this, arm_matrix_instance_f32 *Hm, float error, float stdMeasNoise)
+{
+  if (this->batch) {
+    kalmanCoreBatch_t* batch = this->batch;
+    ASSERT(Hm->numRows == 1);
+    ASSERT(Hm->numCols == KC_STATE_DIM);
+
+    memcpy(batch->h[batch->rows], Hm->pData, sizeof(batch->h[0]));
+    batch->error[batch->rows] = error;
+    batch->stdMeasNoise[batch->rows] = stdMeasNoise;
+    batch->rows++;
+
+    if (batch->rows == KC_BATCH_MAX_ROWS) {
+      kalmanCoreBatchFlush(this);
+    }
+    return;
+  }
+
+#if defined(CONFIG_ESTIMATOR_KALMAN_DENSE_SCALAR_UPDATE) && !defined(CONFIG_ESTIMATOR_KALMAN_PACKED_COVARIANCE)
+  kalmanCoreScalarUpdateDense(this, Hm, error, stdMeasNoise);
+#else
+  kalmanCoreScalarUpdateSparse(this, Hm, error, stdMeasNoise);
+#endif
+}
+
+#ifndef CONFIG_ESTIMATOR_KALMAN_PACKED_COVARIANCE
+void kalmanCoreScalarUpdateDense(kalmanCoreData_t* this, arm_matrix_instance_f32 *Hm, float error, float stdMeasNoise)
 {
   // The Kalman gain as a column vector
   NO_DMA_CCM_SAFE_ZERO_INIT static float K[KC_STATE_DIM];
@@ -258,18 +397,220 @@ void kalmanCoreScalarUpdate(kalmanCoreData_t* this, arm_matrix_instance_f32 *Hm,
   mat_mult(&tmpNN3m, &tmpNN2m, &this->Pm); // (KH - I)*P*(KH - I)'
   assertStateNotNaN(this);
   // add the measurement variance and ensure boundedness and symmetry
-  // TODO: Why would it hit these bounds? Needs to be investigated.
   for (int i=0; i<KC_STATE_DIM; i++) {
     for (int j=i; j<KC_STATE_DIM; j++) {
       float v = K[i] * R * K[j];
       float p = 0.5f*this->P[i][j] + 0.5f*this->P[j][i] + v; // add measurement noise
-      if (isnan(p) || p > MAX_COVARIANCE) {
-        this->P[i][j] = this->P[j][i] = MAX_COVARIANCE;
-      } else if ( i==j && p < MIN_COVARIANCE ) {
-        this->P[i][j] = this->P[j][i] = MIN_COVARIANCE;
-      } else {
-        this->P[i][j] = this->P[j][i] = p;
+      setBoundedCovariance(this, i, j, p);
+    }
+  }
+
+  assertStateNotNaN(this);
+}
+#endif
+
+void kalmanCoreScalarUpdateSparse(kalmanCoreData_t* this, arm_matrix_instance_f32 *Hm, float error, float stdMeasNoise)
+{
+  // PH' as a column vector. Since P is symmetric this is also (HP)'
+  float PHT[KC_STATE_DIM];
+
+  // The Kalman gain as a column vector
+  float K[KC_STATE_DIM];
+
+  // Indexes of the non-zero elements of H, most measurement models only touch 1-3 states
+  uint8_t nz[KC_STATE_DIM];
+  int nzCount = 0;
+
+  ASSERT(Hm->numRows == 1);
+  ASSERT(Hm->numCols == KC_STATE_DIM);
+
+  const float* h = Hm->pData;
+  for (int i=0; i<KC_STATE_DIM; i++) {
+    if (h[i] != 0.0f) {
+      nz[nzCount++] = i;
+    }
+  }
+
+  // ====== INNOVATION COVARIANCE ======
+  for (int i=0; i<KC_STATE_DIM; i++) {
+    float sum = 0;
+    for (int k=0; k<nzCount; k++) {
+      sum += KC_COV(this, i, nz[k]) * h[nz[k]];
+    }
+    PHT[i] = sum;
+  }
+
+  float R = stdMeasNoise*stdMeasNoise;
+  float HPHR = R; // HPH' + R
+  for (int k=0; k<nzCount; k++) {
+    HPHR += h[nz[k]] * PHT[nz[k]];
+  }
+  ASSERT(!isnan(HPHR));
+
+  // ====== MEASUREMENT UPDATE ======
+  // Calculate the Kalman gain and perform the state update
+  for (int i=0; i<KC_STATE_DIM; i++) {
+    K[i] = PHT[i]/HPHR; // kalman gain = (PH' (HPH' + R )^-1)
+    this->S[i] = this->S[i] + K[i] * error; // state update
+  }
+  assertStateNotNaN(this);
+
+  // ====== COVARIANCE UPDATE ======
+  // The Joseph form (KH - I)*P*(KH - I)' + KRK' expanded for a single row H and a symmetric P:
+  //   P - K(PH')' - (PH')K' + K(HPH' + R)K'
+  // Only the upper triangle is computed, the result is mirrored to keep P symmetric.
+  for (int i=0; i<KC_STATE_DIM; i++) {
+    for (int j=i; j<KC_STATE_DIM; j++) {
+      float p = KC_COV(this, i, j) - K[i] * PHT[j] - PHT[i] * K[j] + K[i] * HPHR * K[j];
+      setBoundedCovariance(this, i, j, p);
+    }
+  }
+
+  assertStateNotNaN(this);
+}
+
+void kalmanCoreBatchBegin(kalmanCoreData_t* this, kalmanCoreBatch_t* batch)
+{
+  batch->rows = 0;
+  this->batch = batch;
+}
+
+void kalmanCoreBatchFlush(kalmanCoreData_t* this)
+{
+  kalmanCoreBatch_t* batch = this->batch;
+  if (batch && batch->rows > 0) {
+    kalmanCoreUpdateBatch(this, batch);
+    batch->rows = 0;
+  }
+}
+
+void kalmanCoreBatchEnd(kalmanCoreData_t* this)
+{
+  kalmanCoreBatchFlush(this);
+  this->batch = 0;
+}
+
+void kalmanCoreUpdateBatch(kalmanCoreData_t* this, const kalmanCoreBatch_t* batch)
+{
+  const int m = batch->rows;
+
+  // U = PH' (N x m), computed using only the non-zero elements of each row of H
+  float U[KC_STATE_DIM][KC_BATCH_MAX_ROWS];
+
+  // Innovation covariance HPH' + R (m x m), factorized in place to its Cholesky factor L
+  float L[KC_BATCH_MAX_ROWS][KC_BATCH_MAX_ROWS];
+
+  // W = U L^-T (N x m), the update of the covariance is P - WW'
+  float W[KC_STATE_DIM][KC_BATCH_MAX_ROWS];
+
+  // Whitened innovation z = L^-1 error
+  float z[KC_BATCH_MAX_ROWS];
+
+  ASSERT(m <= KC_BATCH_MAX_ROWS);
+  if (m == 0) {
+    return;
+  }
+
+  for (int r=0; r<m; r++) {
+    const float* h = batch->h[r];
+    uint8_t nz[KC_STATE_DIM];
+    int nzCount = 0;
+    for (int k=0; k<KC_STATE_DIM; k++) {
+      if (h[k] != 0.0f) {
+        nz[nzCount++] = k;
+      }
+    }
+
+    for (int i=0; i<KC_STATE_DIM; i++) {
+      float sum = 0;
+      for (int k=0; k<nzCount; k++) {
+        sum += KC_COV(this, i, nz[k]) * h[nz[k]];
+      }
+      U[i][r] = sum;
+    }
+
+    // Lower triangle of HPH' + R
+    for (int c=0; c<=r; c++) {
+      float sum = 0;
+      for (int k=0; k<nzCount; k++) {
+        sum += h[nz[k]] * U[nz[k]][c];
+      }
+      L[r][c] = sum;
+    }
+    L[r][r] += batch->stdMeasNoise[r] * batch->stdMeasNoise[r];
+  }
+
+  // ====== INNOVATION COVARIANCE FACTORIZATION ======
+  for (int j=0; j<m; j++) {
+    float d = L[j][j];
+    for (int k=0; k<j; k++) {
+      d -= L[j][k] * L[j][k];
+    }
+
+    if (isnan(d) || d <= EPS) {
+      // Not positive definite due to numerical problems, fall back to sequential updates. The errors were
+      // computed for the state before the batch and are corrected for the change of state of earlier rows.
+      kalmanCoreBatch_t* activeBatch = this->batch;
+      this->batch = 0;
+
+      float S0[KC_STATE_DIM];
+      memcpy(S0, this->S, sizeof(S0));
+      for (int r=0; r<m; r++) {
+        float error = batch->error[r];
+        for (int k=0; k<KC_STATE_DIM; k++) {
+          error -= batch->h[r][k] * (this->S[k] - S0[k]);
+        }
+        arm_matrix_instance_f32 Hm = {1, KC_STATE_DIM, (float*)batch->h[r]};
+        kalmanCoreScalarUpdate(this, &Hm, error, batch->stdMeasNoise[r]);
+      }
+
+      this->batch = activeBatch;
+      return;
+    }
+
+    L[j][j] = arm_sqrt(d);
+    for (int i=j+1; i<m; i++) {
+      float sum = L[i][j];
+      for (int k=0; k<j; k++) {
+        sum -= L[i][k] * L[j][k];
+      }
+      L[i][j] = sum / L[j][j];
+    }
+  }
+
+  // ====== MEASUREMENT UPDATE ======
+  // z = L^-1 error, W = U L^-T, K error = U (LL')^-1 error = W z
+  for (int j=0; j<m; j++) {
+    float sum = batch->error[j];
+    for (int k=0; k<j; k++) {
+      sum -= L[j][k] * z[k];
+    }
+    z[j] = sum / L[j][j];
+  }
+
+  for (int i=0; i<KC_STATE_DIM; i++) {
+    float ds = 0;
+    for (int j=0; j<m; j++) {
+      float sum = U[i][j];
+      for (int k=0; k<j; k++) {
+        sum -= L[j][k] * W[i][k];
+      }
+      W[i][j] = sum / L[j][j];
+      ds += W[i][j] * z[j];
+    }
+    this->S[i] = this->S[i] + ds; // state update
+  }
+  assertStateNotNaN(this);
+
+  // ====== COVARIANCE UPDATE ======
+  // P - PH'(HPH' + R)^-1 HP = P - WW', only the upper triangle is computed and mirrored
+  for (int i=0; i<KC_STATE_DIM; i++) {
+    for (int j=i; j<KC_STATE_DIM; j++) {
+      float p = KC_COV(this, i, j);
+      for (int k=0; k<m; k++) {
+        p -= W[i][k] * W[j][k];
       }
+      setBoundedCovariance(this, i, j, p);
     }
   }
 
@@ -292,20 +633,11 @@ void kalmanCoreUpdateWithPKE(kalmanCoreData_t* this, arm_matrix_instance_f32 *Hm
     float Ppo[KC_STATE_DIM][KC_STATE_DIM]={0};
     arm_matrix_instance_f32 Ppom = {KC_STATE_DIM, KC_STATE_DIM, (float *)Ppo};
     mat_mult(&tmpNN1m, P_w_m, &Ppom);          // Pm = (I-KH)*P_w_m
-    memcpy(this->P, Ppo, sizeof(this->P));
-
-    assertStateNotNaN(this);
 
     for (int i=0; i<KC_STATE_DIM; i++) {
         for (int j=i; j<KC_STATE_DIM; j++) {
-        float p = 0.5f*this->P[i][j] + 0.5f*this->P[j][i];
-        if (isnan(p) || p > MAX_COVARIANCE) {
-            this->P[i][j] = this->P[j][i] = MAX_COVARIANCE;
-        } else if ( i==j && p < MIN_COVARIANCE ) {
-            this->P[i][j] = this->P[j][i] = MIN_COVARIANCE;
-        } else {
-            this->P[i][j] = this->P[j][i] = p;
-            }
+            float p = 0.5f*Ppo[i][j] + 0.5f*Ppo[j][i];
+            setBoundedCovariance(this, i, j, p);
         }
     }
     assertStateNotNaN(this);
@@ -353,14 +685,6 @@ void kalmanCorePredict(kalmanCoreData_t* this, Axis3f *acc, Axis3f *gyro, float
 
   // The linearized update matrix
   NO_DMA_CCM_SAFE_ZERO_INIT static float A[KC_STATE_DIM][KC_STATE_DIM];
-  static __attribute__((aligned(4))) arm_matrix_instance_f32 Am = { KC_STATE_DIM, KC_STATE_DIM, (float *)A}; // linearized dynamics for covariance update;
-
-  // Temporary matrices for the covariance updates
-  NO_DMA_CCM_SAFE_ZERO_INIT static float tmpNN1d[KC_STATE_DIM * KC_STATE_DIM];
-  static __attribute__((aligned(4))) arm_matrix_instance_f32 tmpNN1m = { KC_STATE_DIM, KC_STATE_DIM, tmpNN1d};
-
-  NO_DMA_CCM_SAFE_ZERO_INIT static float tmpNN2d[KC_STATE_DIM * KC_STATE_DIM];
-  static __attribute__((aligned(4))) arm_matrix_instance_f32 tmpNN2m = { KC_STATE_DIM, KC_STATE_DIM, tmpNN2d};
 
   float dt2 = dt*dt;
 
@@ -464,9 +788,7 @@ void kalmanCorePredict(kalmanCoreData_t* this, Axis3f *acc, Axis3f *gyro, float
 
 
   // ====== COVARIANCE UPDATE ======
-  mat_mult(&Am, &this->Pm, &tmpNN1m); // A P
-  mat_trans(&Am, &tmpNN2m); // A'
-  mat_mult(&tmpNN1m, &tmpNN2m, &this->Pm); // A P A'
+  predictCovarianceBlockSparse(this, A); // A P A'
   // Process noise is added after the return from the prediction step
 
   // ====== PREDICTION STEP ======
@@ -567,31 +889,20 @@ void kalmanCoreAddProcessNoise(kalmanCoreData_t *this, const kalmanCoreParams_t
 {
   if (dt>0)
   {
-    this->P[KC_STATE_X][KC_STATE_X] += powf(params->procNoiseAcc_xy*dt*dt + params->procNoiseVel*dt + params->procNoisePos, 2);  // add process noise on position
-    this->P[KC_STATE_Y][KC_STATE_Y] += powf(params->procNoiseAcc_xy*dt*dt + params->procNoiseVel*dt + params->procNoisePos, 2);  // add process noise on position
-    this->P[KC_STATE_Z][KC_STATE_Z] += powf(params->procNoiseAcc_z*dt*dt + params->procNoiseVel*dt + params->procNoisePos, 2);  // add process noise on position
+    KC_COV(this, KC_STATE_X, KC_STATE_X) += powf(params->procNoiseAcc_xy*dt*dt + params->procNoiseVel*dt + params->procNoisePos, 2);  // add process noise on position
+    KC_COV(this, KC_STATE_Y, KC_STATE_Y) += powf(params->procNoiseAcc_xy*dt*dt + params->procNoiseVel*dt + params->procNoisePos, 2);  // add process noise on position
+    KC_COV(this, KC_STATE_Z, KC_STATE_Z) += powf(params->procNoiseAcc_z*dt*dt + params->procNoiseVel*dt + params->procNoisePos, 2);  // add process noise on position
 
-    this->P[KC_STATE_PX][KC_STATE_PX] += powf(params->procNoiseAcc_xy*dt + params->procNoiseVel, 2); // add process noise on velocity
-    this->P[KC_STATE_PY][KC_STATE_PY] += powf(params->procNoiseAcc_xy*dt + params->procNoiseVel, 2); // add process noise on velocity
-    this->P[KC_STATE_PZ][KC_STATE_PZ] += powf(params->procNoiseAcc_z*dt + params->procNoiseVel, 2); // add process noise on velocity
+    KC_COV(this, KC_STATE_PX, KC_STATE_PX) += powf(params->procNoiseAcc_xy*dt + params->procNoiseVel, 2); // add process noise on velocity
+    KC_COV(this, KC_STATE_PY, KC_STATE_PY) += powf(params->procNoiseAcc_xy*dt + params->procNoiseVel, 2); // add process noise on velocity
+    KC_COV(this, KC_STATE_PZ, KC_STATE_PZ) += powf(params->procNoiseAcc_z*dt + params->procNoiseVel, 2); // add process noise on velocity
 
-    this->P[KC_STATE_D0][KC_STATE_D0] += powf(params->measNoiseGyro_rollpitch * dt + params->procNoiseAtt, 2);
-    this->P[KC_STATE_D1][KC_STATE_D1] += powf(params->measNoiseGyro_rollpitch * dt + params->procNoiseAtt, 2);
-    this->P[KC_STATE_D2][KC_STATE_D2] += powf(params->measNoiseGyro_yaw * dt + params->procNoiseAtt, 2);
+    KC_COV(this, KC_STATE_D0, KC_STATE_D0) += powf(params->measNoiseGyro_rollpitch * dt + params->procNoiseAtt, 2);
+    KC_COV(this, KC_STATE_D1, KC_STATE_D1) += powf(params->measNoiseGyro_rollpitch * dt + params->procNoiseAtt, 2);
+    KC_COV(this, KC_STATE_D2, KC_STATE_D2) += powf(params->measNoiseGyro_yaw * dt + params->procNoiseAtt, 2);
   }
 
-  for (int i=0; i<KC_STATE_DIM; i++) {
-    for (int j=i; j<KC_STATE_DIM; j++) {
-      float p = 0.5f*this->P[i][j] + 0.5f*this->P[j][i];
-      if (isnan(p) || p > MAX_COVARIANCE) {
-        this->P[i][j] = this->P[j][i] = MAX_COVARIANCE;
-      } else if ( i==j && p < MIN_COVARIANCE ) {
-        this->P[i][j] = this->P[j][i] = MIN_COVARIANCE;
-      } else {
-        this->P[i][j] = this->P[j][i] = p;
-      }
-    }
-  }
+  enforceCovarianceBoundsAndSymmetry(this);
 
   assertStateNotNaN(this);
 }
@@ -602,6 +913,8 @@ void kalmanCoreFinalize(kalmanCoreData_t* this, uint32_t tick)
 {
   // Matrix to rotate the attitude covariances once updated
   NO_DMA_CCM_SAFE_ZERO_INIT static float A[KC_STATE_DIM][KC_STATE_DIM];
+
+#ifndef CONFIG_ESTIMATOR_KALMAN_PACKED_COVARIANCE
   static arm_matrix_instance_f32 Am = {KC_STATE_DIM, KC_STATE_DIM, (float *)A};
 
   // Temporary matrices for the covariance updates
@@ -610,6 +923,7 @@ void kalmanCoreFinalize(kalmanCoreData_t* this, uint32_t tick)
 
   NO_DMA_CCM_SAFE_ZERO_INIT static float tmpNN2d[KC_STATE_DIM * KC_STATE_DIM];
   static arm_matrix_instance_f32 tmpNN2m = {KC_STATE_DIM, KC_STATE_DIM, tmpNN2d};
+#endif
 
   // Incorporate the attitude error (Kalman filter state) with the attitude
   float v0 = this->S[KC_STATE_D0];
@@ -672,9 +986,13 @@ void kalmanCoreFinalize(kalmanCoreData_t* this, uint32_t tick)
     A[KC_STATE_D2][KC_STATE_D1] = -d0 + d1*d2/2;
     A[KC_STATE_D2][KC_STATE_D2] = 1 - d0*d0/2 - d1*d1/2;
 
+#ifdef CONFIG_ESTIMATOR_KALMAN_PACKED_COVARIANCE
+    transformPackedCovariance(this, A); // APA'
+#else
     mat_trans(&Am, &tmpNN1m); // A'
     mat_mult(&Am, &this->Pm, &tmpNN2m); // AP
     mat_mult(&tmpNN2m, &tmpNN1m, &this->Pm); //APA'
+#endif
   }
 
   // convert the new attitude to a rotation matrix, such that we can rotate body-frame velocity and acc
@@ -696,18 +1014,7 @@ void kalmanCoreFinalize(kalmanCoreData_t* this, uint32_t tick)
   this->S[KC_STATE_D2] = 0;
 
   // enforce symmetry of the covariance matrix, and ensure the values stay bounded
-  for (int i=0; i<KC_STATE_DIM; i++) {
-    for (int j=i; j<KC_STATE_DIM; j++) {
-      float p = 0.5f*this->P[i][j] + 0.5f*this->P[j][i];
-      if (isnan(p) || p > MAX_COVARIANCE) {
-        this->P[i][j] = this->P[j][i] = MAX_COVARIANCE;
-      } else if ( i==j && p < MIN_COVARIANCE ) {
-        this->P[i][j] = this->P[j][i] = MIN_COVARIANCE;
-      } else {
-        this->P[i][j] = this->P[j][i] = p;
-      }
-    }
-  }
+  enforceCovarianceBoundsAndSymmetry(this);
 
   assertStateNotNaN(this);
 }
@@ -772,11 +1079,11 @@ static void decoupleState(kalmanCoreData_t* this, kalmanCoreStateIdx_t state)
 {
   // Set all covariance to 0
   for(int i=0; i<KC_STATE_DIM; i++) {
-    this->P[state][i] = 0;
-    this->P[i][state] = 0;
+    KC_COV(this, state, i) = 0;
+    KC_COV(this, i, state) = 0;
   }
   // Set state variance to maximum
-  this->P[state][state] = MAX_COVARIANCE;
+  KC_COV(this, state, state) = MAX_COVARIANCE;
   // set state to zero
   this->S[state] = 0;
 }
@@ -788,3 +1095,21 @@ void kalmanCoreDecoupleXY(kalmanCoreData_t* this)
   decoupleState(this, KC_STATE_Y);
   decoupleState(this, KC_STATE_PY);
 }
+
+void kalmanCoreGetCovarianceMatrix(const kalmanCoreData_t* this, float P[KC_STATE_DIM][KC_STATE_DIM])
+{
+  for (int i=0; i<KC_STATE_DIM; i++) {
+    for (int j=0; j<KC_STATE_DIM; j++) {
+      P[i][j] = KC_COV(this, i, j);
+    }
+  }
+}
+
+void kalmanCoreSetCovarianceMatrix(kalmanCoreData_t* this, float P[KC_STATE_DIM][KC_STATE_DIM])
+{
+  for (int i=0; i<KC_STATE_DIM; i++) {
+    for (int j=i; j<KC_STATE_DIM; j++) {
+      setBoundedCovariance(this, i, j, 0.5f*P[i][j] + 0.5f*P[j][i]);
+    }
+  }
+}
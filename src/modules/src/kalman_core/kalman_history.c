@@ -0,0 +1,245 @@
+/**
+ * ,---------,       ____  _ __
+ * |  ,-^-,  |      / __ )(_) /_______________ _____  ___
+ * | (  O  ) |     / __  / / __/ ___/ ___/ __ `/_  / / _ \
+ * | / ,--'  |    / /_/ / / /_/ /__/ /  / /_/ / / /_/  __/
+ *    +------`   /_____/_/\__/\___/_/   \__,_/ /___/\___/
+ *
+ * Crazyflie control firmware
+ *
+ * Copyright (C) 2023 Bitcraze AB
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, in version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * kalman_history.c - History of the kalman filter, used to fuse delayed measurements at the time they were taken
+ */
+
+#include <string.h>
+
+#include "kalman_history.h"
+
+static int oldestStep(const kalmanHistory_t* this) {
+  return (this->latestStep - this->stepCount + 1 + KALMAN_HISTORY_STEPS) % KALMAN_HISTORY_STEPS;
+}
+
+static int nextStep(const int step) {
+  return (step + 1) % KALMAN_HISTORY_STEPS;
+}
+
+// The oldest point in time that the filter can be rewound to
+static uint64_t earliestReplayTime(const kalmanHistory_t* this) {
+  int step = oldestStep(this);
+  for (int i = 0; i < this->stepCount; i++) {
+    if (this->steps[step].timestamp > this->horizon) {
+      return this->steps[step].timestamp;
+    }
+    step = nextStep(step);
+  }
+
+  return this->steps[this->latestStep].timestamp;
+}
+
+// Restore the filter from a snapshot, the batch belongs to the caller and is not part of the history
+static void restoreCoreData(kalmanCoreData_t* coreData, const kalmanCoreData_t* snapshot) {
+  kalmanCoreBatch_t* batch = coreData->batch;
+  if (batch) {
+    // Rows in the batch are measurements in the history, they are fused again in the replay
+    batch->rows = 0;
+  }
+
+  memcpy(coreData, snapshot, sizeof(kalmanCoreData_t));
+#ifndef CONFIG_ESTIMATOR_KALMAN_PACKED_COVARIANCE
+  coreData->Pm.pData = (float*)coreData->P;
+#endif
+  coreData->batch = batch;
+}
+
+// The outlier filters are stateful, they are rewound together with the filter so that replayed measurements do not
+// advance them a second time
+static void saveOutlierFilters(const kalmanHistory_t* this, kalmanHistoryStep_t* step) {
+  step->sweepOutlierFilter = *this->sweepOutlierFilterState;
+  outlierFilterTdoaGetState(&step->tdoaOutlierFilter);
+}
+
+static void restoreOutlierFilters(kalmanHistory_t* this, const kalmanHistoryStep_t* step) {
+  *this->sweepOutlierFilterState = step->sweepOutlierFilter;
+  outlierFilterTdoaSetState(&step->tdoaOutlierFilter);
+}
+
+// Sort the measurements in the history by timestamp, oldest first
+static int sortMeasurements(const kalmanHistory_t* this, uint8_t* order) {
+  const int count = this->measurementCount;
+  for (int i = 0; i < count; i++) {
+    const uint8_t index = (this->nextMeasurement - count + i + KALMAN_HISTORY_MEASUREMENTS) % KALMAN_HISTORY_MEASUREMENTS;
+    const uint64_t timestamp = this->measurements[index].timestamp;
+
+    int j = i;
+    while (j > 0 && this->measurements[order[j - 1]].timestamp > timestamp) {
+      order[j] = order[j - 1];
+      j--;
+    }
+    order[j] = index;
+  }
+
+  return count;
+}
+
+void kalmanHistoryInit(kalmanHistory_t* this, kalmanHistoryFuse_t fuse, OutlierFilterLhState_t* sweepOutlierFilterState) {
+  this->stepCount = 0;
+  this->latestStep = KALMAN_HISTORY_STEPS - 1;
+  this->measurementCount = 0;
+  this->nextMeasurement = 0;
+  this->horizon = 0;
+  this->rewindPending = false;
+  this->rewindTimestamp = 0;
+  this->fuse = fuse;
+  this->sweepOutlierFilterState = sweepOutlierFilterState;
+  this->replayCount = 0;
+  this->tooOldCount = 0;
+}
+
+void kalmanHistoryPredict(kalmanHistory_t* this, kalmanCoreData_t* coreData, const Axis3f* acc, const Axis3f* gyro, float dt, bool quadIsFlying, uint64_t timestamp) {
+  this->latestStep = nextStep(this->latestStep);
+  if (this->stepCount < KALMAN_HISTORY_STEPS) {
+    this->stepCount++;
+  }
+
+  kalmanHistoryStep_t* step = &this->steps[this->latestStep];
+  step->timestamp = timestamp;
+  memcpy(&step->coreData, coreData, sizeof(kalmanCoreData_t));
+  step->acc = *acc;
+  step->gyro = *gyro;
+  step->dt = dt;
+  step->quadIsFlying = quadIsFlying;
+  memset(step->processNoise, 0, sizeof(step->processNoise));
+  saveOutlierFilters(this, step);
+
+  kalmanCorePredict(coreData, &step->acc, &step->gyro, dt, quadIsFlying);
+}
+
+void kalmanHistoryAddProcessNoise(kalmanHistory_t* this, kalmanCoreData_t* coreData, const kalmanCoreParams_t* params, float dt) {
+  float variance[KC_STATE_DIM];
+  for (int i = 0; i < KC_STATE_DIM; i++) {
+    variance[i] = KC_COV(coreData, i, i);
+  }
+
+  kalmanCoreAddProcessNoise(coreData, params, dt);
+
+  if (this->stepCount > 0) {
+    kalmanHistoryStep_t* step = &this->steps[this->latestStep];
+    for (int i = 0; i < KC_STATE_DIM; i++) {
+      step->processNoise[i] += KC_COV(coreData, i, i) - variance[i];
+    }
+  }
+}
+
+bool kalmanHistoryAddMeasurement(kalmanHistory_t* this, kalmanCoreData_t* coreData, const measurement_t* measurement, uint32_t delay) {
+  const uint64_t latestStepTime = (this->stepCount > 0) ? this->steps[this->latestStep].timestamp : 0;
+
+  uint64_t timestamp = measurement->timestamp;
+  if (delay == 0 || timestamp < delay) {
+    // Current measurement, fused after the latest prediction step
+    if (timestamp < latestStepTime) {
+      timestamp = latestStepTime;
+    }
+  } else {
+    timestamp -= delay;
+    if (timestamp < latestStepTime) {
+      const uint64_t earliest = earliestReplayTime(this);
+      if (timestamp < earliest) {
+        timestamp = earliest;
+        this->tooOldCount++;
+      }
+    }
+  }
+
+  // Store the measurement, dropping the oldest one if the history is full
+  measurement_t* stored = &this->measurements[this->nextMeasurement];
+  if (this->measurementCount == KALMAN_HISTORY_MEASUREMENTS) {
+    if (stored->timestamp > this->horizon) {
+      this->horizon = stored->timestamp;
+    }
+  } else {
+    this->measurementCount++;
+  }
+  this->nextMeasurement = (this->nextMeasurement + 1) % KALMAN_HISTORY_MEASUREMENTS;
+
+  memcpy(stored, measurement, sizeof(measurement_t));
+  stored->timestamp = timestamp;
+
+  if (!this->rewindPending && timestamp >= latestStepTime) {
+    return this->fuse(coreData, stored);
+  }
+
+  if (!this->rewindPending || timestamp < this->rewindTimestamp) {
+    this->rewindTimestamp = timestamp;
+  }
+  this->rewindPending = true;
+
+  return true;
+}
+
+bool kalmanHistoryReplay(kalmanHistory_t* this, kalmanCoreData_t* coreData) {
+  if (!this->rewindPending) {
+    return false;
+  }
+  this->rewindPending = false;
+
+  // Find the latest prediction step before the oldest delayed measurement
+  int step = oldestStep(this);
+  for (int i = 1; i < this->stepCount; i++) {
+    const int next = nextStep(step);
+    if (this->steps[next].timestamp > this->rewindTimestamp) {
+      break;
+    }
+    step = next;
+  }
+
+  uint8_t order[KALMAN_HISTORY_MEASUREMENTS];
+  const int count = sortMeasurements(this, order);
+  int m = 0;
+  while (m < count && this->measurements[order[m]].timestamp < this->steps[step].timestamp) {
+    m++;
+  }
+
+  restoreCoreData(coreData, &this->steps[step].coreData);
+  restoreOutlierFilters(this, &this->steps[step]);
+
+  while (true) {
+    kalmanHistoryStep_t* current = &this->steps[step];
+    const bool isLatest = (step == this->latestStep);
+
+    kalmanCorePredict(coreData, &current->acc, &current->gyro, current->dt, current->quadIsFlying);
+    for (int i = 0; i < KC_STATE_DIM; i++) {
+      KC_COV(coreData, i, i) += current->processNoise[i];
+    }
+
+    const uint64_t end = isLatest ? UINT64_MAX : this->steps[nextStep(step)].timestamp;
+    for (; m < count && this->measurements[order[m]].timestamp < end; m++) {
+      this->fuse(coreData, &this->measurements[order[m]]);
+    }
+    kalmanCoreBatchFlush(coreData);
+
+    if (isLatest) {
+      break;
+    }
+
+    kalmanCoreFinalize(coreData, (uint32_t)(current->timestamp / 1000));
+    step = nextStep(step);
+    memcpy(&this->steps[step].coreData, coreData, sizeof(kalmanCoreData_t));
+    saveOutlierFilters(this, &this->steps[step]);
+  }
+
+  this->replayCount++;
+  return true;
+}
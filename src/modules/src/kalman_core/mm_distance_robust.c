@@ -117,7 +117,7 @@ void kalmanCoreRobustUpdateWithDistance(kalmanCoreData_t* this, distanceMeasurem
     static arm_matrix_instance_f32 x_errm = {KC_STATE_DIM, 1, x_err};
     static float X_state[KC_STATE_DIM] = {0.0};
     float P_iter[KC_STATE_DIM][KC_STATE_DIM];
-    memcpy(P_iter, this->P, sizeof(P_iter));
+    kalmanCoreGetCovarianceMatrix(this, P_iter);
 
     float R_iter = d->stdDev * d->stdDev;                     // measurement covariance
     memcpy(X_state, this->S, sizeof(X_state));
@@ -132,7 +132,7 @@ void kalmanCoreRobustUpdateWithTDOA(kalmanCoreData_t* this, tdoaMeasurement_t *t
         static arm_matrix_instance_f32 x_errm = {KC_STATE_DIM, 1, x_err};
         static float X_state[KC_STATE_DIM] = {0.0};
         float P_iter[KC_STATE_DIM][KC_STATE_DIM];
-        memcpy(P_iter, this->P, sizeof(P_iter));                 // init P_iter as P_prior
+        kalmanCoreGetCovarianceMatrix(this, P_iter);  // init P_iter as P_prior
 
         float R_iter = tdoa->stdDev * tdoa->stdDev;                    // measurement covariance
         memcpy(X_state, this->S, sizeof(X_state));                     // copy Xpr to X_State and then update in each iterations
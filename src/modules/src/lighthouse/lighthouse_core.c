@@ -210,14 +210,10 @@ void lighthouseCoreSetSystemType(const lighthouseBaseStationType_t type)
   lighthouseUpdateSystemType();
 }
 
-TESTABLE_STATIC bool getUartFrameRaw(lighthouseUartFrame_t *frame) {
-  static char data[UART_FRAME_LENGTH];
+TESTABLE_STATIC bool decodeUartFrame(const char data[], lighthouseUartFrame_t *frame) {
   int syncCounter = 0;
 
   for(int i = 0; i < UART_FRAME_LENGTH; i++) {
-    while(!uart1GetDataWithTimeout((uint8_t*)&data[i], 2)) {
-      lighthouseTransmitProcessTimeout();
-    }
     if ((unsigned char)data[i] == 0xff) {
       syncCounter += 1;
     }
@@ -242,6 +238,20 @@ TESTABLE_STATIC bool getUartFrameRaw(lighthouseUartFrame_t *frame) {
   bool isPaddingZero = (((data[5] | data[8]) & 0xfe) == 0);
   bool isFrameValid = (isPaddingZero || frame->isSyncFrame);
 
+  return isFrameValid;
+}
+
+TESTABLE_STATIC bool getUartFrameRaw(lighthouseUartFrame_t *frame) {
+  static char data[UART_FRAME_LENGTH];
+
+  for(int i = 0; i < UART_FRAME_LENGTH; i++) {
+    while(!uart1GetDataWithTimeout((uint8_t*)&data[i], 2)) {
+      lighthouseTransmitProcessTimeout();
+    }
+  }
+
+  const bool isFrameValid = decodeUartFrame(data, frame);
+
   STATS_CNT_RATE_EVENT(&serialFrameRate);
 
   return isFrameValid;
@@ -275,7 +285,7 @@ void lighthouseCoreSetLeds(lighthouseCoreLedState_t red, lighthouseCoreLedState_
 
 
 // Method used to estimate position
-// 0 = Position calculated outside the estimator using intersection point of beams.
+// 0 = Position calculated outside the estimator using the point closest to the beams from all visible base stations.
 //     Yaw error calculated outside the estimator. Position and yaw error is pushed to the
 //     estimator as pre-calculated.
 // 1 = Sweep angles pushed into the estimator. Yaw error calculated outside the estimator
@@ -288,16 +298,19 @@ static uint8_t estimationMethod = 1;
 
 
 static void usePulseResultCrossingBeams(pulseProcessor_t *appState, pulseProcessorResult_t* angles, int basestation) {
-  pulseProcessorClearOutdated(appState, angles, basestation);
-
-  if (basestation == 1) {
+  // A repeated sweep from the same base station means that we have received a full cycle from all visible base
+  // stations. Estimate the position using all of them, including the new data from this base station.
+  if (appState->receivedBsSweep[basestation]) {
     STATS_CNT_RATE_EVENT(&cycleRate);
 
-    lighthousePositionEstimatePoseCrossingBeams(appState, angles, 1);
+    lighthousePositionEstimatePoseCrossingBeams(appState, angles, basestation);
 
-    pulseProcessorProcessed(angles, 0);
-    pulseProcessorProcessed(angles, 1);
+    for (int bs = 0; bs < CONFIG_DECK_LIGHTHOUSE_MAX_N_BS; bs++) {
+      pulseProcessorProcessed(angles, bs);
+    }
   }
+
+  pulseProcessorClearOutdated(appState, angles, basestation);
 }
 
 
@@ -311,7 +324,7 @@ static void usePulseResultSweeps(pulseProcessor_t *appState, pulseProcessorResul
   pulseProcessorProcessed(angles, basestation);
 }
 
-static void convertV2AnglesToV1Angles(pulseProcessorResult_t* angles) {
+TESTABLE_STATIC void convertV2AnglesToV1Angles(pulseProcessorResult_t* angles) {
   for (int sensor = 0; sensor < PULSE_PROCESSOR_N_SENSORS; sensor++) {
     for (int bs = 0; bs < CONFIG_DECK_LIGHTHOUSE_MAX_N_BS; bs++) {
       pulseProcessorBaseStationMeasuremnt_t* from = &angles->sensorMeasurementsLh2[sensor].baseStatonMeasurements[bs];
@@ -453,6 +466,27 @@ static void updateSystemStatus(const uint32_t now_ms) {
   }
 }
 
+// Handles one frame from the deck, the same way for sync frames and pulse frames as they are received from the UART
+TESTABLE_STATIC void processUartFrame(pulseProcessor_t *appState, pulseProcessorResult_t* angles, const lighthouseUartFrame_t* frame, const bool previousWasSyncFrame, const uint32_t now_ms) {
+  // If a sync frame is getting through, we are only receiving sync frames. So nothing else. Reset state
+  if(frame->isSyncFrame && previousWasSyncFrame) {
+      pulseProcessorAllClear(angles);
+  }
+  // Now we are receiving items
+  else if(!frame->isSyncFrame) {
+    STATS_CNT_RATE_EVENT(&frameRate);
+    lighthouseTransmitProcessFrame(frame);
+
+    deckHealthCheck(appState, frame, now_ms);
+    lighthouseUpdateSystemType();
+    if (pulseProcessorProcessPulse) {
+      processFrame(appState, angles, frame);
+    }
+  }
+
+  updateSystemStatus(now_ms);
+}
+
 void lighthouseCoreTask(void *param) {
   bool isUartFrameValid = false;
 
@@ -485,26 +519,8 @@ void lighthouseCoreTask(void *param) {
 
     while((isUartFrameValid = getUartFrameRaw(&frame))) {
       const uint32_t now_ms = T2M(xTaskGetTickCount());
-
-      // If a sync frame is getting through, we are only receiving sync frames. So nothing else. Reset state
-      if(frame.isSyncFrame && previousWasSyncFrame) {
-          pulseProcessorAllClear(&angles);
-      }
-      // Now we are receiving items
-      else if(!frame.isSyncFrame) {
-        STATS_CNT_RATE_EVENT(&frameRate);
-	lighthouseTransmitProcessFrame(&frame);
-
-        deckHealthCheck(&lighthouseCoreState, &frame, now_ms);
-        lighthouseUpdateSystemType();
-        if (pulseProcessorProcessPulse) {
-          processFrame(&lighthouseCoreState, &angles, &frame);
-        }
-      }
-
+      processUartFrame(&lighthouseCoreState, &angles, &frame, previousWasSyncFrame, now_ms);
       previousWasSyncFrame = frame.isSyncFrame;
-
-      updateSystemStatus(now_ms);
     }
 
     uartSynchronized = false;
@@ -825,7 +841,7 @@ LOG_GROUP_STOP(lighthouse)
  */
 PARAM_GROUP_START(lighthouse)
 /**
- * @brief Estimation Method: 0:CrossingBeam,  1:Sweep in EKF (default: 1)
+ * @brief Estimation Method: 0:CrossingBeam (all base stations),  1:Sweep in EKF (default: 1)
  */
 PARAM_ADD_CORE(PARAM_UINT8, method, &estimationMethod)
 /**
@@ -30,6 +30,7 @@
 #include "estimator_kalman.h"
 #include "math.h"
 #include "cf_math.h"
+#include "physicalConstants.h"
 
 #include "log.h"
 #include "param.h"
@@ -163,6 +164,11 @@ static bool handleMemWrite(const uint32_t memAddr, const uint8_t writeLen, const
 void lighthousePositionCalibrationDataWritten(const uint8_t baseStation) {
   if (baseStation < CONFIG_DECK_LIGHTHOUSE_MAX_N_BS) {
     modifyBit(&lighthouseCoreState.baseStationCalibValidMap, baseStation, lighthouseCoreState.bsCalibration[baseStation].valid);
+
+    #ifdef CONFIG_DECK_LIGHTHOUSE_CALIBRATION_TABLE
+    // Only valid calibration data is used, partial writes from the client are ignored
+    lighthouseCalibrationTableInitV2(&lighthouseCoreState.bsCalibrationTable[baseStation], &lighthouseCoreState.bsCalibration[baseStation]);
+    #endif
   }
 }
 
@@ -218,50 +224,72 @@ static positionMeasurement_t ext_pos;
 static float sweepStd = 0.0004;
 static float sweepStdLh2 = 0.001;
 
-static vec3d position;
 static vec3d positionLog;
 static float deltaLog;
 
+// Rays further than this from the estimated position are rejected as outliers, for instance reflections
+static float maxRayResidual = 0.05;
+
+// One ray per sensor and base station
+#define MAX_N_RAYS (PULSE_PROCESSOR_N_SENSORS * CONFIG_DECK_LIGHTHOUSE_MAX_N_BS)
+static vec3d rayOrigins[MAX_N_RAYS];
+static vec3d rayDirections[MAX_N_RAYS];
+static uint8_t rayBaseStations[MAX_N_RAYS];
+static float rayWeights[MAX_N_RAYS];
+
 static void estimatePositionCrossingBeams(const pulseProcessor_t *state, pulseProcessorResult_t* angles, int baseStation) {
   memset(&ext_pos, 0, sizeof(ext_pos));
-  uint8_t sensorsUsed = 0;
-  float deltaSum = 0;
-  float delta;
-
-  // Average over all sensors with valid data
-  for (size_t sensor = 0; sensor < PULSE_PROCESSOR_N_SENSORS; sensor++) {
-      // LH2 angles are converted to LH1 angles, so it is OK to use sensorMeasurementsLh1
-      pulseProcessorBaseStationMeasuremnt_t* bs0Measurement = &angles->sensorMeasurementsLh1[sensor].baseStatonMeasurements[0];
-      pulseProcessorBaseStationMeasuremnt_t* bs1Measurement = &angles->sensorMeasurementsLh1[sensor].baseStatonMeasurements[1];
 
-      if (bs0Measurement->validCount == PULSE_PROCESSOR_N_SWEEPS && bs1Measurement->validCount == PULSE_PROCESSOR_N_SWEEPS) {
-        lighthouseGeometryGetPositionFromRayIntersection(state->bsGeometry, bs0Measurement->correctedAngles, bs1Measurement->correctedAngles, position, &delta);
+  // The sensors are not in the center of the deck, use the current estimated rotation to move the origin of each ray
+  // by the offset of the sensor. The offset is small, an error in the rotation has little effect on the position.
+  float R[3][3];
+  estimatorKalmanGetEstimatedRot((float*)R);
+  arm_matrix_instance_f32 RR = {3, 3, (float*)R};
+  vec3d sensorOffsets[PULSE_PROCESSOR_N_SENSORS];
+  const vec3d zero = {0};
+  for (int sensor = 0; sensor < PULSE_PROCESSOR_N_SENSORS; sensor++) {
+    lighthouseGeometryGetSensorPosition(zero, &RR, sensorDeckPositions[sensor], sensorOffsets[sensor]);
+  }
 
-        deltaSum += delta;
+  // Collect rays from all sensors and all base stations with valid data
+  int rayCount = 0;
+  for (int bs = 0; bs < CONFIG_DECK_LIGHTHOUSE_MAX_N_BS; bs++) {
+    if (!state->bsGeometry[bs].valid) {
+      continue;
+    }
 
-        ext_pos.x += position[0];
-        ext_pos.y += position[1];
-        ext_pos.z += position[2];
-        sensorsUsed++;
+    vec3d baseStationPos;
+    lighthouseGeometryGetBaseStationPosition(&state->bsGeometry[bs], baseStationPos);
 
-        STATS_CNT_RATE_EVENT(&positionRate);
+    for (size_t sensor = 0; sensor < PULSE_PROCESSOR_N_SENSORS; sensor++) {
+      // LH2 angles are converted to LH1 angles, so it is OK to use sensorMeasurementsLh1
+      const pulseProcessorBaseStationMeasuremnt_t* bsMeasurement = &angles->sensorMeasurementsLh1[sensor].baseStatonMeasurements[bs];
+      if (bsMeasurement->validCount == PULSE_PROCESSOR_N_SWEEPS) {
+        for (int axis = 0; axis < 3; axis++) {
+          rayOrigins[rayCount][axis] = baseStationPos[axis] - sensorOffsets[sensor][axis];
+        }
+        lighthouseGeometryGetRay(&state->bsGeometry[bs], bsMeasurement->correctedAngles[0], bsMeasurement->correctedAngles[1], rayDirections[rayCount]);
+        rayBaseStations[rayCount] = bs;
+        rayWeights[rayCount] = 1.0f;
+        rayCount++;
+      }
     }
   }
 
-  // Only use measurement if we got all sensors, otherwise we would need to know the exact orientation
-  // of the Crazyflie in the world frame in order to correctly estimate the position
+  // No position is estimated if the rays, after rejecting outliers, come from one base station only
+  float residual = 0;
+  const int raysUsed = lighthouseGeometryGetPositionFromRays(rayOrigins, rayDirections, rayBaseStations, rayWeights, rayCount, maxRayResidual, ext_pos.pos, &residual);
+
   // We shouldn't use the kalman filter here, since crossing beam method should not make any assumptions about
   // robot dynamics.
-  if (sensorsUsed == PULSE_PROCESSOR_N_SENSORS) {
-    deltaLog = deltaSum / sensorsUsed;
-    ext_pos.x /= sensorsUsed;
-    ext_pos.y /= sensorsUsed;
-    ext_pos.z /= sensorsUsed;
-
+  if (raysUsed > 0) {
+    deltaLog = residual;
     positionLog[0] = ext_pos.x;
     positionLog[1] = ext_pos.y;
     positionLog[2] = ext_pos.z;
 
+    STATS_CNT_RATE_EVENT(&positionRate);
+
     // Make sure we feed sane data into the estimator
     if (isfinite(ext_pos.pos[0]) && isfinite(ext_pos.pos[1]) && isfinite(ext_pos.pos[2])) {
       ext_pos.stdDev = 0.01;
@@ -450,11 +478,9 @@ static void estimateYaw(const pulseProcessor_t *state, pulseProcessorResult_t* a
 }
 
 void lighthousePositionEstimatePoseCrossingBeams(const pulseProcessor_t *state, pulseProcessorResult_t* angles, int baseStation) {
-  if (state->bsGeometry[0].valid && state->bsGeometry[1].valid) {
-    estimatePositionCrossingBeams(state, angles, baseStation);
+  estimatePositionCrossingBeams(state, angles, baseStation);
+  if (state->bsGeometry[baseStation].valid) {
     estimateYaw(state, angles, baseStation);
-  } else {
-    deltaLog = 0;
   }
 }
 
@@ -491,4 +517,8 @@ PARAM_ADD_CORE(PARAM_FLOAT, sweepStd, &sweepStd)
  * @brief Standard deviation Sweep angles Lighthouse V2
  */
 PARAM_ADD_CORE(PARAM_FLOAT, sweepStd2, &sweepStdLh2)
+/**
+ * @brief Rays further than this from the position are rejected in the crossing beam method [m]
+ */
+PARAM_ADD(PARAM_FLOAT, maxRayResid, &maxRayResidual)
 PARAM_GROUP_STOP(lighthouse)
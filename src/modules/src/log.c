@@ -49,6 +49,9 @@
 #include "cfassert.h"
 #include "debug.h"
 #include "static_mem.h"
+#include "param.h"
+#include "usec_time.h"
+#include "log_compression.h"
 
 #if 0
 #define LOG_DEBUG(fmt, ...) DEBUG_PRINT("D/log " fmt, ## __VA_ARGS__)
@@ -91,19 +94,87 @@ struct log_ops {
   acquisitionType_t acquisitionType;
 };
 
+/* Compiled form of the ops of a block, see blockCompile() */
+typedef enum {
+  logOpCopy = 0,     // Copy the variables as they are stored
+  logOpConvert = 1,  // Read a variable from memory and convert it to the log type
+  logOpFunction = 2, // Acquire a variable by function and convert it to the log type
+} logOpKind_t;
+
+struct log_program_op {
+  void * address;
+  uint8_t length;  // Number of bytes written to the packet
+  uint8_t kind;
+  uint8_t storageType : 4;
+  uint8_t logType     : 4;
+};
+
+// An uncompressed block never holds more variables than it holds bytes
+#define LOG_MAX_PROGRAM_OPS LOG_MAX_LEN
+
+/* Encoder states of the compressed blocks, see log_compression.h */
+#define LOG_MAX_COMPRESSED_BLOCKS 4
+
+// A compressed block holds more variables, its program is allocated with its
+// encoder state instead of in the block, see blockProgram()
+#define LOG_MAX_COMPRESSED_PROGRAM_OPS LOG_COMPRESSION_MAX_VARIABLES
+
 struct log_block {
   int id;
   xTimerHandle timer;
   StaticTimer_t timerBuffer;
   uint32_t droppedPackets;
   struct log_ops * ops;
+  struct log_program_op program[LOG_MAX_PROGRAM_OPS]; // uncompressed blocks, see blockProgram()
+  uint8_t programLength;
+  bool programValid;
+
+  // NULL if the block is not compressed
+  logCompressionState_t * compression;
+
+  // Handshake between logRunBlock() and the control functions that modify
+  // the block, see blockBeginModify()
+  bool running;
+  bool modifying;
+
+  // Timing of the block, see blockUpdateJitter()
+  unsigned int period;  // ms, 0 if not started periodically
+  uint64_t lastRun;     // us, 0 if the block has not run since it was started
+  int32_t jitter;       // us
+  uint32_t jitterMax;   // us
+
+  // On change mode, see blockHasChanged()
+  unsigned int maxInterval;  // ms, 0 if the block is sent every period
+  unsigned int lastSent;     // ms
+  uint32_t lastHash;
+  bool sendNext;
 };
 
 NO_DMA_CCM_SAFE_ZERO_INIT static struct log_ops logOps[LOG_MAX_OPS];
 NO_DMA_CCM_SAFE_ZERO_INIT static struct log_block logBlocks[LOG_MAX_BLOCKS];
+NO_DMA_CCM_SAFE_ZERO_INIT static logCompressionState_t logCompressionStates[LOG_MAX_COMPRESSED_BLOCKS];
+NO_DMA_CCM_SAFE_ZERO_INIT static struct log_program_op logCompressedPrograms[LOG_MAX_COMPRESSED_BLOCKS][LOG_MAX_COMPRESSED_PROGRAM_OPS];
+static bool logCompressionStateInUse[LOG_MAX_COMPRESSED_BLOCKS];
+
+/* Index of the TOC, see buildTocIndex() */
+#define LOG_TOC_MAX_VARIABLES 1024
+#define LOG_TOC_MAX_GROUPS 128
+
+// Maps the id of a variable to its index in the TOC
+NO_DMA_CCM_SAFE_ZERO_INIT static uint16_t logIndexById[LOG_TOC_MAX_VARIABLES];
+// Index of the start of each group in the TOC, sorted by group name. Group names
+// are not unique, groups with the same name are kept in TOC order.
+NO_DMA_CCM_SAFE_ZERO_INIT static uint16_t logGroups[LOG_TOC_MAX_GROUPS];
+static int logGroupsLen;
 static xSemaphoreHandle logLock;
 static StaticSemaphore_t logLockBuffer;
 
+/* Jitter of the log blocks, exposed in the logBlock log group */
+#define LOG_MONITOR_ALL_BLOCKS 255
+static uint8_t monitoredBlockId = LOG_MONITOR_ALL_BLOCKS;
+static int32_t monitoredJitter;
+static uint32_t monitoredJitterMax;
+
 struct ops_setting {
     uint8_t logType;
     uint8_t id;
@@ -132,6 +203,8 @@ struct ops_setting_v2 {
 #define CONTROL_RESET           5
 #define CONTROL_CREATE_BLOCK_V2 6
 #define CONTROL_APPEND_BLOCK_V2 7
+#define CONTROL_CREATE_BLOCK_COMPRESSED 8
+#define CONTROL_START_BLOCK_ON_CHANGE   9
 
 #define BLOCK_ID_FREE -1
 
@@ -161,12 +234,20 @@ static bool isInit = false;
 static int logAppendBlock(int id, struct ops_setting * settings, int len);
 static int logAppendBlockV2(int id, struct ops_setting_v2 * settings, int len);
 static int logCreateBlock(unsigned char id, struct ops_setting * settings, int len);
-static int logCreateBlockV2(unsigned char id, struct ops_setting_v2 * settings, int len);
+static int logCreateBlockV2(unsigned char id, struct ops_setting_v2 * settings, int len, bool compressed);
 static int logDeleteBlock(int id);
-static int logStartBlock(int id, unsigned int period);
+static int logStartBlock(int id, unsigned int period, unsigned int maxInterval);
 static int logStopBlock(int id);
 static void logReset();
 static acquisitionType_t acquisitionTypeFromLogType(uint8_t logType);
+static void buildTocIndex(void);
+static int variableGetIndex(int id);
+static char* variableGetGroup(int index);
+static void blockCompile(struct log_block * block);
+static struct log_program_op * blockProgram(struct log_block * block);
+static void blockBeginModify(struct log_block * block);
+static void blockFreeCompression(struct log_block * block);
+static void blockEndModify(struct log_block * block);
 
 STATIC_MEM_TASK_ALLOC_STACK_NO_DMA_CCM_SAFE(logTask, LOG_TASK_STACKSIZE);
 
@@ -209,7 +290,8 @@ void logInit(void)
     logsCrc = crc32CalculateBuffer(p.data, len);
   }
 
-  // Big lock that protects the log datastructures
+  // Serializes the control commands that modify the log blocks. Running
+  // blocks do not take the lock, see blockBeginModify().
   logLock = xSemaphoreCreateMutexStatic(&logLockBuffer);
 
   for (i=0; i<logsLen; i++)
@@ -218,6 +300,8 @@ void logInit(void)
       logsCount++;
   }
 
+  buildTocIndex();
+
   //Manually free all log blocks
   for(i=0; i<LOG_MAX_BLOCKS; i++)
     logBlocks[i].id = BLOCK_ID_FREE;
@@ -231,6 +315,47 @@ void logInit(void)
   isInit = true;
 }
 
+// Build the index used to look up variables by id in constant time and by
+// name in logarithmic time. The linker does not sort the TOC, the groups are
+// sorted here.
+static void buildTocIndex(void)
+{
+  uint16_t id = 0;
+
+  logGroupsLen = 0;
+  for (int i = 0; i < logsLen; i++)
+  {
+    if (logs[i].type & LOG_GROUP) {
+      if (logs[i].type & LOG_START) {
+        if (logGroupsLen >= LOG_TOC_MAX_GROUPS) {
+          LOG_ERROR("Too many log groups, increase LOG_TOC_MAX_GROUPS\n");
+          ASSERT_FAILED();
+          return;
+        }
+        logGroups[logGroupsLen++] = i;
+      }
+    } else {
+      if (id >= LOG_TOC_MAX_VARIABLES) {
+        LOG_ERROR("Too many log variables, increase LOG_TOC_MAX_VARIABLES\n");
+        ASSERT_FAILED();
+        return;
+      }
+      logIndexById[id++] = i;
+    }
+  }
+
+  for (int i = 1; i < logGroupsLen; i++)
+  {
+    uint16_t group = logGroups[i];
+    int j = i;
+    while (j > 0 && strcmp(logs[logGroups[j - 1]].name, logs[group].name) > 0) {
+      logGroups[j] = logGroups[j - 1];
+      j--;
+    }
+    logGroups[j] = group;
+  }
+}
+
 bool logTest(void)
 {
   return isInit;
@@ -243,12 +368,14 @@ void logTask(void * prm)
 	while(1) {
 		crtpReceivePacketBlock(CRTP_PORT_LOG, &p);
 
-		xSemaphoreTake(logLock, portMAX_DELAY);
 		if (p.channel==TOC_CH)
 		  logTOCProcess(p.data[0]);
 		if (p.channel==CONTROL_CH)
+		{
+		  xSemaphoreTake(logLock, portMAX_DELAY);
 		  logControlProcess();
-		xSemaphoreGive(logLock);
+		  xSemaphoreGive(logLock);
+		}
 	}
 }
 
@@ -281,21 +408,12 @@ void logTOCProcess(int command)
     break;
   case CMD_GET_ITEM:  //Get log variable
     LOG_DEBUG("Packet is TOC_GET_ITEM Id: %d\n", p.data[1]);
-    for (ptr=0; ptr<logsLen; ptr++) //Ptr points a group
-    {
-      if (logs[ptr].type & LOG_GROUP)
-      {
-        if (logs[ptr].type & LOG_START)
-          group = logs[ptr].name;
-        else
-          group = "";
-      }
-      else                          //Ptr points a variable
-      {
-        if (n==p.data[1])
-          break;
-        n++;
-      }
+    n = p.data[1];
+    ptr = variableGetIndex(n);
+    if (ptr >= 0) {
+      group = variableGetGroup(ptr);
+    } else {
+      ptr = logsLen;
     }
 
     if (ptr<logsLen)
@@ -334,21 +452,11 @@ void logTOCProcess(int command)
   case CMD_GET_ITEM_V2:  //Get log variable
     memcpy(&logId, &p.data[1], 2);
     LOG_DEBUG("Packet is TOC_GET_ITEM Id: %d\n", logId);
-    for (ptr=0; ptr<logsLen; ptr++) //Ptr points a group
-    {
-      if (logs[ptr].type & LOG_GROUP)
-      {
-        if (logs[ptr].type & LOG_START)
-          group = logs[ptr].name;
-        else
-          group = "";
-      }
-      else                          //Ptr points a variable
-      {
-        if (n==logId)
-          break;
-        n++;
-      }
+    ptr = variableGetIndex(logId);
+    if (ptr >= 0) {
+      group = variableGetGroup(ptr);
+    } else {
+      ptr = logsLen;
     }
 
     if (ptr<logsLen)
@@ -394,7 +502,7 @@ void logControlProcess()
       ret = logDeleteBlock( p.data[1] );
       break;
     case CONTROL_START_BLOCK:
-      ret = logStartBlock( p.data[1], p.data[2]*10);
+      ret = logStartBlock( p.data[1], p.data[2]*10, 0);
       break;
     case CONTROL_STOP_BLOCK:
       ret = logStopBlock( p.data[1] );
@@ -406,13 +514,28 @@ void logControlProcess()
     case CONTROL_CREATE_BLOCK_V2:
       ret = logCreateBlockV2( p.data[1],
                             (struct ops_setting_v2*)&p.data[2],
-                            (p.size-2)/sizeof(struct ops_setting_v2) );
+                            (p.size-2)/sizeof(struct ops_setting_v2), false );
       break;
     case CONTROL_APPEND_BLOCK_V2:
       ret = logAppendBlockV2( p.data[1],
                             (struct ops_setting_v2*)&p.data[2],
                             (p.size-2)/sizeof(struct ops_setting_v2) );
       break;
+    case CONTROL_START_BLOCK_ON_CHANGE:
+    {
+      uint16_t minInterval;
+      uint16_t maxInterval;
+      memcpy(&minInterval, &p.data[2], 2);
+      memcpy(&maxInterval, &p.data[4], 2);
+      ret = (minInterval > 0 && maxInterval >= minInterval) ?
+            logStartBlock( p.data[1], minInterval, maxInterval) : EINVAL;
+      break;
+    }
+    case CONTROL_CREATE_BLOCK_COMPRESSED:
+      ret = logCreateBlockV2( p.data[1],
+                            (struct ops_setting_v2*)&p.data[2],
+                            (p.size-2)/sizeof(struct ops_setting_v2), true );
+      break;
   }
 
   //Commands answer
@@ -434,10 +557,15 @@ static int logCreateBlock(unsigned char id, struct ops_setting * settings, int l
   if (i == LOG_MAX_BLOCKS)
     return ENOMEM;
 
+  blockBeginModify(&logBlocks[i]);
   logBlocks[i].id = id;
   logBlocks[i].timer = xTimerCreateStatic("logTimer", M2T(1000), pdTRUE,
     &logBlocks[i], logBlockTimed, &logBlocks[i].timerBuffer);
   logBlocks[i].ops = NULL;
+  logBlocks[i].programValid = false;
+  logBlocks[i].compression = NULL;
+  logBlocks[i].period = 0;
+  blockEndModify(&logBlocks[i]);
 
   if (logBlocks[i].timer == NULL)
   {
@@ -450,9 +578,10 @@ static int logCreateBlock(unsigned char id, struct ops_setting * settings, int l
   return logAppendBlock(id, settings, len);
 }
 
-static int logCreateBlockV2(unsigned char id, struct ops_setting_v2 * settings, int len)
+static int logCreateBlockV2(unsigned char id, struct ops_setting_v2 * settings, int len, bool compressed)
 {
   int i;
+  logCompressionState_t * compression = NULL;
 
   for (i=0; i<LOG_MAX_BLOCKS; i++)
     if (id == logBlocks[i].id) return EEXIST;
@@ -463,14 +592,34 @@ static int logCreateBlockV2(unsigned char id, struct ops_setting_v2 * settings,
   if (i == LOG_MAX_BLOCKS)
     return ENOMEM;
 
+  if (compressed)
+  {
+    int j;
+
+    for (j=0; j<LOG_MAX_COMPRESSED_BLOCKS; j++)
+      if (!logCompressionStateInUse[j]) break;
+
+    if (j == LOG_MAX_COMPRESSED_BLOCKS)
+      return ENOMEM;
+
+    logCompressionStateInUse[j] = true;
+    compression = &logCompressionStates[j];
+  }
+
+  blockBeginModify(&logBlocks[i]);
   logBlocks[i].id = id;
   logBlocks[i].timer = xTimerCreateStatic("logTimer", M2T(1000), pdTRUE,
     &logBlocks[i], logBlockTimed, &logBlocks[i].timerBuffer);
   logBlocks[i].ops = NULL;
+  logBlocks[i].programValid = false;
+  logBlocks[i].compression = compression;
+  logBlocks[i].period = 0;
+  blockEndModify(&logBlocks[i]);
 
   if (logBlocks[i].timer == NULL)
   {
   logBlocks[i].id = BLOCK_ID_FREE;
+  blockFreeCompression(&logBlocks[i]);
   return ENOMEM;
   }
 
@@ -480,14 +629,19 @@ static int logCreateBlockV2(unsigned char id, struct ops_setting_v2 * settings,
 }
 
 static int blockCalcLength(struct log_block * block);
+static int blockMaxLength(struct log_block * block);
+static int blockMaxOps(struct log_block * block);
+static int blockCountOps(struct log_block * block);
 static struct log_ops * opsMalloc();
 static void opsFree(struct log_ops * ops);
 static void blockAppendOps(struct log_block * block, struct log_ops * ops);
-static int variableGetIndex(int id);
+static int blockAppend(struct log_block * block, struct ops_setting * settings, int len);
+static int blockAppendV2(struct log_block * block, struct ops_setting_v2 * settings, int len);
 
 static int logAppendBlock(int id, struct ops_setting * settings, int len)
 {
   int i;
+  int ret;
   struct log_block * block;
 
   LOG_DEBUG("Appending %d variable to block %d\n", len, id);
@@ -502,14 +656,28 @@ static int logAppendBlock(int id, struct ops_setting * settings, int len)
 
   block = &logBlocks[i];
 
+  blockBeginModify(block);
+  ret = blockAppend(block, settings, len);
+  blockEndModify(block);
+
+  return ret;
+}
+
+static int blockAppend(struct log_block * block, struct ops_setting * settings, int len)
+{
+  int i;
+
+  block->programValid = false;
+
   for (i=0; i<len; i++)
   {
     int currentLength = blockCalcLength(block);
     struct log_ops * ops;
     int varId;
 
-    if ((currentLength + typeLength[settings[i].logType & LOG_TYPE_MASK])>LOG_MAX_LEN) {
-      LOG_ERROR("Trying to append a full block. Block id %d.\n", id);
+    if ((currentLength + typeLength[settings[i].logType & LOG_TYPE_MASK])>blockMaxLength(block) ||
+        blockCountOps(block) >= blockMaxOps(block)) {
+      LOG_ERROR("Trying to append a full block. Block id %d.\n", block->id);
       return E2BIG;
     }
 
@@ -534,7 +702,7 @@ static int logAppendBlock(int id, struct ops_setting * settings, int len)
       ops->logType     = settings[i].logType & LOG_TYPE_MASK;
       ops->acquisitionType = acquisitionTypeFromLogType(logs[varId].type);
 
-      LOG_DEBUG("Appended variable %d to block %d\n", settings[i].id, id);
+      LOG_DEBUG("Appended variable %d to block %d\n", settings[i].id, block->id);
     } else {                     //Memory variable
       //TODO: Check that the address is in ram
       ops->variable    = (void*)(&settings[i]+1);
@@ -543,7 +711,7 @@ static int logAppendBlock(int id, struct ops_setting * settings, int len)
       ops->acquisitionType = acqType_memory;
       i += 2;
 
-      LOG_DEBUG("Appended var addr 0x%x to block %d\n", (int)ops->variable, id);
+      LOG_DEBUG("Appended var addr 0x%x to block %d\n", (int)ops->variable, block->id);
     }
     blockAppendOps(block, ops);
 
@@ -556,6 +724,7 @@ static int logAppendBlock(int id, struct ops_setting * settings, int len)
 static int logAppendBlockV2(int id, struct ops_setting_v2 * settings, int len)
 {
   int i;
+  int ret;
   struct log_block * block;
 
   LOG_DEBUG("Appending %d variable to block %d\n", len, id);
@@ -570,14 +739,28 @@ static int logAppendBlockV2(int id, struct ops_setting_v2 * settings, int len)
 
   block = &logBlocks[i];
 
+  blockBeginModify(block);
+  ret = blockAppendV2(block, settings, len);
+  blockEndModify(block);
+
+  return ret;
+}
+
+static int blockAppendV2(struct log_block * block, struct ops_setting_v2 * settings, int len)
+{
+  int i;
+
+  block->programValid = false;
+
   for (i=0; i<len; i++)
   {
     int currentLength = blockCalcLength(block);
     struct log_ops * ops;
     int varId;
 
-    if ((currentLength + typeLength[settings[i].logType & LOG_TYPE_MASK])>LOG_MAX_LEN) {
-      LOG_ERROR("Trying to append a full block. Block id %d.\n", id);
+    if ((currentLength + typeLength[settings[i].logType & LOG_TYPE_MASK])>blockMaxLength(block) ||
+        blockCountOps(block) >= blockMaxOps(block)) {
+      LOG_ERROR("Trying to append a full block. Block id %d.\n", block->id);
       return E2BIG;
     }
 
@@ -602,7 +785,7 @@ static int logAppendBlockV2(int id, struct ops_setting_v2 * settings, int len)
       ops->logType     = settings[i].logType & LOG_TYPE_MASK;
       ops->acquisitionType = acquisitionTypeFromLogType(logs[varId].type);
 
-      LOG_DEBUG("Appended variable %d to block %d\n", settings[i].id, id);
+      LOG_DEBUG("Appended variable %d to block %d\n", settings[i].id, block->id);
     } else {                     //Memory variable
       //TODO: Check that the address is in ram
       ops->variable    = (void*)(&settings[i]+1);
@@ -611,7 +794,7 @@ static int logAppendBlockV2(int id, struct ops_setting_v2 * settings, int len)
       ops->acquisitionType = acqType_memory;
       i += 2;
 
-      LOG_DEBUG("Appended var addr 0x%x to block %d\n", (int)ops->variable, id);
+      LOG_DEBUG("Appended var addr 0x%x to block %d\n", (int)ops->variable, block->id);
     }
     blockAppendOps(block, ops);
 
@@ -635,6 +818,8 @@ static int logDeleteBlock(int id)
     return ENOENT;
   }
 
+  blockBeginModify(&logBlocks[i]);
+
   ops = logBlocks[i].ops;
   while (ops)
   {
@@ -642,6 +827,10 @@ static int logDeleteBlock(int id)
     opsFree(ops);
     ops = opsNext;
   }
+  logBlocks[i].ops = NULL;
+  logBlocks[i].programLength = 0;
+  logBlocks[i].programValid = true;
+  blockFreeCompression(&logBlocks[i]);
 
   if (logBlocks[i].timer != 0) {
     xTimerStop(logBlocks[i].timer, portMAX_DELAY);
@@ -650,10 +839,15 @@ static int logDeleteBlock(int id)
   }
 
   logBlocks[i].id = BLOCK_ID_FREE;
+  blockEndModify(&logBlocks[i]);
+
   return 0;
 }
 
-static int logStartBlock(int id, unsigned int period)
+/* Starts a block. If maxInterval is not 0 the block is acquired every period
+ * but only sent if it has changed, or if maxInterval ms have passed since it
+ * was last sent. */
+static int logStartBlock(int id, unsigned int period, unsigned int maxInterval)
 {
   int i;
 
@@ -667,6 +861,16 @@ static int logStartBlock(int id, unsigned int period)
 
   LOG_DEBUG("Starting block %d with period %dms\n", id, period);
 
+  blockBeginModify(&logBlocks[i]);
+  blockCompile(&logBlocks[i]);
+  logBlocks[i].period = period;
+  logBlocks[i].lastRun = 0;
+  logBlocks[i].jitter = 0;
+  logBlocks[i].jitterMax = 0;
+  logBlocks[i].maxInterval = maxInterval;
+  logBlocks[i].sendNext = true;
+  blockEndModify(&logBlocks[i]);
+
   if (period>0)
   {
     xTimerChangePeriod(logBlocks[i].timer, M2T(period), 100);
@@ -702,26 +906,201 @@ void logBlockTimed(xTimerHandle timer)
   workerSchedule(logRunBlock, pvTimerGetTimerID(timer));
 }
 
-/* Appends data to a packet if space is available; returns false on failure. */
-static bool appendToPacket(CRTPPacket * pk, const void * data, size_t n) {
-  if (pk->size <= CRTP_MAX_DATA_SIZE - n)
+/* Acquires the variable of a convert or function op and writes it to dest as the log type */
+static void logConvertValue(const struct log_program_op * op, unsigned int timestamp, uint8_t * dest)
+{
+  int valuei = 0;
+  float valuef = 0;
+
+  // FPU instructions must run on aligned data.
+  // We first copy the data to an (aligned) local variable, before assigning it
+  switch(op->storageType)
   {
-    memcpy(&pk->data[pk->size], data, n);
-    pk->size += n;
-    return true;
+    case LOG_UINT8:
+    {
+      uint8_t v;
+      if (op->kind == logOpFunction) {
+        logByFunction_t* logByFunction = (logByFunction_t*)op->address;
+        v = logByFunction->acquireUInt8(timestamp, logByFunction->data);
+      } else {
+        memcpy(&v, op->address, sizeof(v));
+      }
+      valuei = v;
+      break;
+    }
+    case LOG_INT8:
+    {
+      int8_t v;
+      if (op->kind == logOpFunction) {
+        logByFunction_t* logByFunction = (logByFunction_t*)op->address;
+        v = logByFunction->acquireInt8(timestamp, logByFunction->data);
+      } else {
+        memcpy(&v, op->address, sizeof(v));
+      }
+      valuei = v;
+      break;
+    }
+    case LOG_UINT16:
+    {
+      uint16_t v;
+      if (op->kind == logOpFunction) {
+        logByFunction_t* logByFunction = (logByFunction_t*)op->address;
+        v = logByFunction->acquireUInt16(timestamp, logByFunction->data);
+      } else {
+        memcpy(&v, op->address, sizeof(v));
+      }
+      valuei = v;
+      break;
+    }
+    case LOG_INT16:
+    {
+      int16_t v;
+      if (op->kind == logOpFunction) {
+        logByFunction_t* logByFunction = (logByFunction_t*)op->address;
+        v = logByFunction->acquireInt16(timestamp, logByFunction->data);
+      } else {
+        memcpy(&v, op->address, sizeof(v));
+      }
+      valuei = v;
+      break;
+    }
+    case LOG_UINT32:
+    {
+      uint32_t v;
+      if (op->kind == logOpFunction) {
+        logByFunction_t* logByFunction = (logByFunction_t*)op->address;
+        v = logByFunction->acquireUInt32(timestamp, logByFunction->data);
+      } else {
+        memcpy(&v, op->address, sizeof(v));
+      }
+      valuei = v;
+      break;
+    }
+    case LOG_INT32:
+    {
+      int32_t v;
+      if (op->kind == logOpFunction) {
+        logByFunction_t* logByFunction = (logByFunction_t*)op->address;
+        v = logByFunction->acquireInt32(timestamp, logByFunction->data);
+      } else {
+        memcpy(&v, op->address, sizeof(v));
+      }
+      valuei = v;
+      break;
+    }
+    case LOG_FLOAT:
+    {
+      float v;
+      if (op->kind == logOpFunction) {
+        logByFunction_t* logByFunction = (logByFunction_t*)op->address;
+        v = logByFunction->aquireFloat(timestamp, logByFunction->data);
+      } else {
+        memcpy(&v, op->address, sizeof(valuef));
+      }
+      valuei = v;
+      valuef = v;
+      break;
+    }
+  }
+
+  if (op->logType == LOG_FLOAT || op->logType == LOG_FP16)
+  {
+    if (op->storageType != LOG_FLOAT)
+    {
+      valuef = valuei;
+    }
+
+    if (op->logType == LOG_FLOAT)
+    {
+      memcpy(dest, &valuef, 4);
+    }
+    else
+    {
+      valuei = single2half(valuef);
+      memcpy(dest, &valuei, 2);
+    }
+  }
+  else  //logType is an integer
+  {
+    memcpy(dest, &valuei, op->length);
+  }
+}
+
+/* Updates the deviation of the time since the previous run of a block from its period */
+static void blockUpdateJitter(struct log_block * blk)
+{
+  const uint64_t now = usecTimestamp();
+
+  if (blk->period > 0 && blk->lastRun != 0)
+  {
+    const int32_t jitter = (int32_t)(now - blk->lastRun) - (int32_t)blk->period * 1000;
+    const uint32_t absJitter = jitter < 0 ? -jitter : jitter;
+
+    blk->jitter = jitter;
+    if (absJitter > blk->jitterMax)
+      blk->jitterMax = absJitter;
+
+    if (monitoredBlockId == LOG_MONITOR_ALL_BLOCKS)
+    {
+      monitoredJitter = jitter;
+      if (absJitter > monitoredJitterMax)
+        monitoredJitterMax = absJitter;
+    }
+    else if (blk->id == monitoredBlockId)
+    {
+      monitoredJitter = blk->jitter;
+      monitoredJitterMax = blk->jitterMax;
+    }
+  }
+
+  blk->lastRun = now;
+}
+
+/* Checks if the acquired values of a block in on change mode should be sent.
+ * Changes are detected with a hash of the values. */
+static bool blockHasChanged(struct log_block * blk, const uint8_t * values, int length, unsigned int timestamp)
+{
+  // FNV-1a
+  uint32_t hash = 2166136261u;
+  for (int i = 0; i < length; i++)
+  {
+    hash = (hash ^ values[i]) * 16777619u;
   }
-  else return false;
+
+  if (!blk->sendNext && hash == blk->lastHash && (timestamp - blk->lastSent) < blk->maxInterval)
+  {
+    return false;
+  }
+
+  blk->sendNext = false;
+  blk->lastHash = hash;
+  blk->lastSent = timestamp;
+  return true;
 }
 
 /* This function is usually called by the worker subsystem */
 void logRunBlock(void * arg)
 {
   struct log_block *blk = arg;
-  struct log_ops *ops = blk->ops;
   static CRTPPacket pk;
   unsigned int timestamp;
 
-  xSemaphoreTake(logLock, portMAX_DELAY);
+  // Skip this run if the block is being modified. Blocks are only run by the
+  // worker task, so the static packet is never shared between runs.
+  __atomic_store_n(&blk->running, true, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&blk->modifying, __ATOMIC_SEQ_CST) || blk->id == BLOCK_ID_FREE)
+  {
+    __atomic_store_n(&blk->running, false, __ATOMIC_RELEASE);
+    return;
+  }
+
+  blockUpdateJitter(blk);
+
+  // Variables appended to a running block are compiled on the next run
+  if (!blk->programValid)
+  {
+    blockCompile(blk);
+  }
 
   timestamp = ((long long)xTaskGetTickCount())/portTICK_RATE_MS;
 
@@ -732,136 +1111,52 @@ void logRunBlock(void * arg)
   pk.data[2] = (timestamp>>8)&0x0ff;
   pk.data[3] = (timestamp>>16)&0x0ff;
 
-  while (ops)
+  // Compressed blocks are acquired to a buffer and then encoded to the packet
+  static uint8_t values[LOG_COMPRESSION_MAX_LEN];
+  uint8_t * const start = blk->compression ? values : &pk.data[pk.size];
+  uint8_t * dest = start;
+
+  // The program is never longer than blockMaxLength(), see blockCompile()
+  const struct log_program_op * program = blockProgram(blk);
+  for (int i = 0; i < blk->programLength; i++)
   {
-    int valuei = 0;
-    float valuef = 0;
+    const struct log_program_op * op = &program[i];
 
-    // FPU instructions must run on aligned data.
-    // We first copy the data to an (aligned) local variable, before assigning it
-    switch(ops->storageType)
+    if (op->kind == logOpCopy)
     {
-      case LOG_UINT8:
-      {
-        uint8_t v;
-        if (ops->acquisitionType == acqType_function) {
-          logByFunction_t* logByFunction = (logByFunction_t*)ops->variable;
-          v = logByFunction->acquireUInt8(timestamp, logByFunction->data);
-        } else {
-          memcpy(&v, ops->variable, sizeof(v));
-        }
-        valuei = v;
-        break;
-      }
-      case LOG_INT8:
-      {
-        int8_t v;
-        if (ops->acquisitionType == acqType_function) {
-          logByFunction_t* logByFunction = (logByFunction_t*)ops->variable;
-          v = logByFunction->acquireInt8(timestamp, logByFunction->data);
-        } else {
-          memcpy(&v, ops->variable, sizeof(v));
-        }
-        valuei = v;
-        break;
-      }
-      case LOG_UINT16:
-      {
-        uint16_t v;
-        if (ops->acquisitionType == acqType_function) {
-          logByFunction_t* logByFunction = (logByFunction_t*)ops->variable;
-          v = logByFunction->acquireUInt16(timestamp, logByFunction->data);
-        } else {
-          memcpy(&v, ops->variable, sizeof(v));
-        }
-        valuei = v;
-        break;
-      }
-      case LOG_INT16:
-      {
-        int16_t v;
-        if (ops->acquisitionType == acqType_function) {
-          logByFunction_t* logByFunction = (logByFunction_t*)ops->variable;
-          v = logByFunction->acquireInt16(timestamp, logByFunction->data);
-        } else {
-          memcpy(&v, ops->variable, sizeof(v));
-        }
-        valuei = v;
-        break;
-      }
-      case LOG_UINT32:
-      {
-        uint32_t v;
-        if (ops->acquisitionType == acqType_function) {
-          logByFunction_t* logByFunction = (logByFunction_t*)ops->variable;
-          v = logByFunction->acquireUInt32(timestamp, logByFunction->data);
-        } else {
-          memcpy(&v, ops->variable, sizeof(v));
-        }
-        valuei = v;
-        break;
-      }
-      case LOG_INT32:
-      {
-        int32_t v;
-        if (ops->acquisitionType == acqType_function) {
-          logByFunction_t* logByFunction = (logByFunction_t*)ops->variable;
-          v = logByFunction->acquireInt32(timestamp, logByFunction->data);
-        } else {
-          memcpy(&v, ops->variable, sizeof(v));
-        }
-        valuei = v;
-        break;
-      }
-      case LOG_FLOAT:
-      {
-        float v;
-        if (ops->acquisitionType == acqType_function) {
-          logByFunction_t* logByFunction = (logByFunction_t*)ops->variable;
-          v = logByFunction->aquireFloat(timestamp, logByFunction->data);
-        } else {
-          memcpy(&v, ops->variable, sizeof(valuef));
-        }
-        valuei = v;
-        valuef = v;
-        break;
-      }
+      memcpy(dest, op->address, op->length);
     }
-
-    if (ops->logType == LOG_FLOAT || ops->logType == LOG_FP16)
+    else
     {
-      if (ops->storageType != LOG_FLOAT)
-      {
-        valuef = valuei;
-      }
-
-      // Try to append the next item to the packet.  If we run out of space,
-      // drop this and subsequent items.
-      if (ops->logType == LOG_FLOAT)
-      {
-        if (!appendToPacket(&pk, &valuef, 4)) break;
-      }
-      else
-      {
-        valuei = single2half(valuef);
-        if (!appendToPacket(&pk, &valuei, 2)) break;
-      }
-    }
-    else  //logType is an integer
-    {
-      if (!appendToPacket(&pk, &valuei, typeLength[ops->logType])) break;
+      logConvertValue(op, timestamp, dest);
     }
+    dest += op->length;
+  }
 
-    ops = ops->next;
+  if (blk->maxInterval > 0 && !blockHasChanged(blk, start, dest - start, timestamp))
+  {
+    __atomic_store_n(&blk->running, false, __ATOMIC_RELEASE);
+    return;
+  }
+
+  if (blk->compression)
+  {
+    pk.size += logCompressionEncode(blk->compression, values, &pk.data[pk.size], CRTP_MAX_DATA_SIZE - pk.size);
+  }
+  else
+  {
+    pk.size = dest - pk.data;
   }
 
-  xSemaphoreGive(logLock);
+  __atomic_store_n(&blk->running, false, __ATOMIC_RELEASE);
 
   // Check if the connection is still up, oherwise disable
   // all the logging and flush all the CRTP queues.
   if (!crtpIsConnected())
   {
+    xSemaphoreTake(logLock, portMAX_DELAY);
     logReset();
+    xSemaphoreGive(logLock);
     crtpReset();
   }
   else
@@ -880,23 +1175,24 @@ void logRunBlock(void * arg)
 
 static int variableGetIndex(int id)
 {
-  int i;
-  int n=0;
+  if (id < 0 || id >= logsCount)
+    return -1;
 
-  for (i=0; i<logsLen; i++)
-  {
-    if(!(logs[i].type & LOG_GROUP))
-    {
-      if(n==id)
-        break;
-      n++;
-    }
+  return logIndexById[id];
+}
+
+// Get the name of the group of the variable at the given index in the TOC
+static char* variableGetGroup(int index)
+{
+  while (index > 0 && !(logs[index].type & LOG_GROUP)) {
+    index--;
   }
 
-  if (i>=logsLen)
-    return -1;
+  if ((logs[index].type & LOG_GROUP) && (logs[index].type & LOG_START)) {
+    return logs[index].name;
+  }
 
-  return i;
+  return "";
 }
 
 static struct log_ops * opsMalloc()
@@ -928,6 +1224,124 @@ static int blockCalcLength(struct log_block * block)
   return len;
 }
 
+static int blockMaxLength(struct log_block * block)
+{
+  return block->compression ? LOG_COMPRESSION_MAX_LEN : LOG_MAX_LEN;
+}
+
+static int blockMaxOps(struct log_block * block)
+{
+  return block->compression ? LOG_MAX_COMPRESSED_PROGRAM_OPS : LOG_MAX_PROGRAM_OPS;
+}
+
+static struct log_program_op * blockProgram(struct log_block * block)
+{
+  if (block->compression)
+  {
+    return logCompressedPrograms[block->compression - logCompressionStates];
+  }
+
+  return block->program;
+}
+
+static int blockCountOps(struct log_block * block)
+{
+  struct log_ops * ops;
+  int count = 0;
+
+  for (ops = block->ops; ops; ops = ops->next)
+    count++;
+
+  return count;
+}
+
+/* Compiles the ops of a block to a flat program that is executed by
+ * logRunBlock(). Variables that are logged as they are stored and that are
+ * adjacent in memory are merged into a single copy op. Variables that do not
+ * fit in a packet are dropped. The encoder of a compressed block is reset. */
+static void blockCompile(struct log_block * block)
+{
+  struct log_ops * ops;
+  struct log_program_op * const program = blockProgram(block);
+  const int maxOps = blockMaxOps(block);
+  struct log_program_op * last = NULL;
+  uint8_t lengths[LOG_MAX_COMPRESSED_PROGRAM_OPS];
+  int count = 0;
+  int n = 0;
+  int len = 0;
+
+  for (ops = block->ops; ops && count < maxOps; ops = ops->next)
+  {
+    const uint8_t length = typeLength[ops->logType];
+    uint8_t kind;
+
+    if (len + length > blockMaxLength(block))
+      break;
+    len += length;
+    lengths[count++] = length;
+
+    if (ops->acquisitionType == acqType_function)
+    {
+      kind = logOpFunction;
+    }
+    else if (ops->storageType == ops->logType)
+    {
+      kind = logOpCopy;
+      if (last && last->kind == logOpCopy &&
+          (uint8_t*)last->address + last->length == (uint8_t*)ops->variable)
+      {
+        last->length += length;
+        continue;
+      }
+    }
+    else
+    {
+      kind = logOpConvert;
+    }
+
+    last = &program[n++];
+    last->address = ops->variable;
+    last->length = length;
+    last->kind = kind;
+    last->storageType = ops->storageType;
+    last->logType = ops->logType;
+  }
+
+  block->programLength = n;
+  block->programValid = true;
+
+  if (block->compression)
+  {
+    logCompressionInit(block->compression, lengths, count);
+  }
+}
+
+static void blockFreeCompression(struct log_block * block)
+{
+  if (block->compression)
+  {
+    logCompressionStateInUse[block->compression - logCompressionStates] = false;
+    block->compression = NULL;
+  }
+}
+
+/* Waits for a running block to finish and keeps it from running until
+ * blockEndModify() is called. Runs of the block in the meantime are skipped.
+ * Must be called with logLock held, and not from logRunBlock(). */
+static void blockBeginModify(struct log_block * block)
+{
+  __atomic_store_n(&block->modifying, true, __ATOMIC_SEQ_CST);
+  while (__atomic_load_n(&block->running, __ATOMIC_SEQ_CST))
+  {
+    vTaskDelay(1);
+  }
+}
+
+static void blockEndModify(struct log_block * block)
+{
+  __atomic_store_n(&block->modifying, false, __ATOMIC_RELEASE);
+}
+
 void blockAppendOps(struct log_block * block, struct log_ops * ops)
 {
   struct log_ops * o;
@@ -966,6 +1380,12 @@ static void logReset(void)
   //Force free the log ops
   for (i=0; i<LOG_MAX_OPS; i++)
     logOps[i].variable = NULL;
+
+  //Force free the encoders of the compressed blocks
+  for (i=0; i<LOG_MAX_BLOCKS; i++)
+    logBlocks[i].compression = NULL;
+  for (i=0; i<LOG_MAX_COMPRESSED_BLOCKS; i++)
+    logCompressionStateInUse[i] = false;
 }
 
 /* Public API to access log TOC from within the copter */
@@ -973,19 +1393,35 @@ static logVarId_t invalidVarId = 0xffffu;
 
 logVarId_t logGetVarId(const char* group, const char* name)
 {
-  int i;
-  logVarId_t varId = invalidVarId;
-  char * currgroup = "";
+  int lo = 0;
+  int hi = logGroupsLen - 1;
 
-  for(i=0; i<logsLen; i++)
+  // Binary search for the group, then a linear search in the group
+  while (lo <= hi)
   {
-    if (logs[i].type & LOG_GROUP) {
-      if (logs[i].type & LOG_START) {
-        currgroup = logs[i].name;
+    int mid = (lo + hi) / 2;
+    int groupIndex = logGroups[mid];
+    int cmp = strcmp(group, logs[groupIndex].name);
+    if (cmp < 0) {
+      hi = mid - 1;
+    } else if (cmp > 0) {
+      lo = mid + 1;
+    } else {
+      // Group names are not unique, search all groups with this name in TOC order
+      while (mid > 0 && !strcmp(group, logs[logGroups[mid - 1]].name)) {
+        mid--;
       }
-    } else if ((!strcmp(group, currgroup)) && (!strcmp(name, logs[i].name))) {
-      varId = (logVarId_t)i;
-      return varId;
+      for (; mid < logGroupsLen && !strcmp(group, logs[logGroups[mid]].name); mid++)
+      {
+        groupIndex = logGroups[mid];
+        for (int i = groupIndex + 1; i < logsLen && !(logs[i].type & LOG_GROUP); i++)
+        {
+          if (!strcmp(name, logs[i].name)) {
+            return (logVarId_t)i;
+          }
+        }
+      }
+      break;
     }
   }
 
@@ -999,22 +1435,12 @@ inline int logGetType(logVarId_t varid)
 
 void logGetGroupAndName(logVarId_t varid, char** group, char** name)
 {
-  char * currgroup = "";
   *group = 0;
   *name = 0;
 
-  for(int i=0; i<logsLen; i++) {
-    if (logs[i].type & LOG_GROUP) {
-      if (logs[i].type & LOG_START) {
-        currgroup = logs[i].name;
-      }
-    }
-
-    if (i == varid) {
-      *group = currgroup;
-      *name = logs[i].name;
-      break;
-    }
+  if (varid < logsLen) {
+    *group = variableGetGroup(varid);
+    *name = logs[varid].name;
   }
 }
 
@@ -1084,3 +1510,28 @@ static acquisitionType_t acquisitionTypeFromLogType(uint8_t logType) {
 
   return acqType_memory;
 }
+
+/**
+ * Timing of the log blocks. The jitter is the deviation of the time between
+ * two runs of a block from its period.
+ */
+LOG_GROUP_START(logBlock)
+/**
+ * @brief Jitter of the latest run of the monitored block [us]
+ */
+LOG_ADD(LOG_INT32, jitter, &monitoredJitter)
+/**
+ * @brief Largest absolute jitter of the monitored block since it was started [us]
+ */
+LOG_ADD(LOG_UINT32, jitterMax, &monitoredJitterMax)
+LOG_GROUP_STOP(logBlock)
+
+/**
+ * Timing of the log blocks
+ */
+PARAM_GROUP_START(logBlock)
+/**
+ * @brief Id of the log block to monitor in the logBlock log group, 255 to monitor all blocks (default: 255)
+ */
+PARAM_ADD(PARAM_UINT8, monitorId, &monitoredBlockId)
+PARAM_GROUP_STOP(logBlock)
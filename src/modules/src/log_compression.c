@@ -0,0 +1,129 @@
+/**
+ * ,---------,       ____  _ __
+ * |  ,-^-,  |      / __ )(_) /_______________ _____  ___
+ * | (  O  ) |     / __  / / __/ ___/ ___/ __ `/_  / / _ \
+ * | / ,--'  |    / /_/ / / /_/ /__/ /  / /_/ / / /_/  __/
+ *    +------`   /_____/_/\__/\___/_/   \__,_/ /___/\___/
+ *
+ * Crazyflie control firmware
+ *
+ * Copyright (C) 2023 Bitcraze AB
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, in version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * log_compression.c - Delta encoding of log blocks
+ */
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "log_compression.h"
+
+static uint32_t readValue(const uint8_t* data, const int length) {
+  uint32_t value = 0;
+  for (int i = length - 1; i >= 0; i--) {
+    value = (value << 8) | data[i];
+  }
+  return value;
+}
+
+// Difference between two values of a variable, sign extended from the length of the variable
+static int32_t difference(const uint32_t value, const uint32_t reference, const int length) {
+  const int shift = 32 - 8 * length;
+  return ((int32_t)((value - reference) << shift)) >> shift;
+}
+
+static uint32_t zigZag(const int32_t value) {
+  return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+static int varintLength(uint32_t value) {
+  int length = 1;
+  while (value >= 0x80) {
+    value >>= 7;
+    length++;
+  }
+  return length;
+}
+
+static void writeVarint(uint32_t value, uint8_t* out) {
+  while (value >= 0x80) {
+    *out++ = (value & 0x7f) | 0x80;
+    value >>= 7;
+  }
+  *out = value;
+}
+
+void logCompressionInit(logCompressionState_t* state, const uint8_t* length, const int count) {
+  int offset = 0;
+  for (int i = 0; i < count; i++) {
+    state->length[i] = length[i];
+    state->offset[i] = offset;
+    offset += length[i];
+  }
+  state->count = count;
+
+  memset(state->previous, 0, sizeof(state->previous));
+  state->nextVariable = 0;
+  state->sequence = 0;
+  state->keyframeVariablesLeft = count;
+  state->packetsSinceKeyframe = 0;
+}
+
+int logCompressionEncode(logCompressionState_t* state, const uint8_t* values, uint8_t* out, const int maxLength) {
+  if (state->keyframeVariablesLeft == 0 && state->packetsSinceKeyframe >= LOG_COMPRESSION_KEYFRAME_INTERVAL) {
+    state->keyframeVariablesLeft = state->count;
+  }
+  const bool isKeyframe = (state->keyframeVariablesLeft > 0);
+  if (isKeyframe) {
+    state->packetsSinceKeyframe = 0;
+  }
+
+  out[0] = (state->sequence & LOG_COMPRESSION_SEQUENCE_MASK) | (isKeyframe ? LOG_COMPRESSION_KEYFRAME_FLAG : 0);
+  out[1] = state->nextVariable;
+  int size = LOG_COMPRESSION_HEADER_LEN;
+
+  int variable = state->nextVariable;
+  int encoded = 0;
+  while (encoded < state->count) {
+    const int length = state->length[variable];
+    const int offset = state->offset[variable];
+    const uint32_t value = readValue(&values[offset], length);
+    const uint32_t reference = isKeyframe ? 0 : readValue(&state->previous[offset], length);
+    const uint32_t encodedValue = zigZag(difference(value, reference, length));
+
+    const int encodedLength = varintLength(encodedValue);
+    if (size + encodedLength > maxLength) {
+      break;
+    }
+
+    writeVarint(encodedValue, &out[size]);
+    size += encodedLength;
+    memcpy(&state->previous[offset], &values[offset], length);
+
+    encoded++;
+    variable++;
+    if (variable == state->count) {
+      variable = 0;
+    }
+  }
+
+  if (isKeyframe) {
+    state->keyframeVariablesLeft -= (encoded < state->keyframeVariablesLeft) ? encoded : state->keyframeVariablesLeft;
+  }
+  state->nextVariable = variable;
+  state->sequence = (state->sequence + 1) & LOG_COMPRESSION_SEQUENCE_MASK;
+  state->packetsSinceKeyframe++;
+
+  return size;
+}
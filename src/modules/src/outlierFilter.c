@@ -44,7 +44,7 @@ typedef struct {
   int bucket;
 } filterLevel_t;
 
-#define FILTER_LEVELS 5
+#define FILTER_LEVELS OUTLIER_FILTER_TDOA_LEVELS
 #define FILTER_NONE FILTER_LEVELS
 filterLevel_t filterLevels[FILTER_LEVELS] = {
   {.acceptanceLevel = 0.4},
@@ -102,6 +102,22 @@ bool outlierFilterValidateTdoaSteps(const tdoaMeasurement_t* tdoa, const float e
   return sampleIsGood;
 }
 
+void outlierFilterTdoaGetState(OutlierFilterTdoaState_t* state) {
+  for (int i = 0; i < FILTER_LEVELS; i++) {
+    state->bucket[i] = filterLevels[i].bucket;
+  }
+  state->filterCloseDelayCounter = filterCloseDelayCounter;
+  state->previousFilterIndex = previousFilterIndex;
+}
+
+void outlierFilterTdoaSetState(const OutlierFilterTdoaState_t* state) {
+  for (int i = 0; i < FILTER_LEVELS; i++) {
+    filterLevels[i].bucket = state->bucket[i];
+  }
+  filterCloseDelayCounter = state->filterCloseDelayCounter;
+  previousFilterIndex = state->previousFilterIndex;
+}
+
 
 #define LH_TICKS_PER_FRAME (1000 / 120)
 static const int32_t lhMinWindowTime = -2 * LH_TICKS_PER_FRAME;
@@ -32,6 +32,7 @@
 #include "crc32.h"
 #include "debug.h"
 #include "cfassert.h"
+#include "static_mem.h"
 #include "autoconf.h"
 
 #if 0
@@ -63,8 +64,20 @@ static const uint8_t typeLength[] = {
 
 #define PERSISTENT_PREFIX_STRING "prm/"
 
+// Size of the TOC index, see buildTocIndex()
+#define PARAM_TOC_MAX_VARIABLES 512
+#define PARAM_TOC_MAX_GROUPS 128
+
+typedef struct {
+  uint16_t index;   // Index of the group start in the TOC
+  uint16_t firstId; // Id of the first variable of the group
+} paramGroup_t;
+
 //Private functions
 static int variableGetIndex(int id);
+static int variableFind(const char* group, const char* name, uint16_t* id);
+static char* variableGetGroup(int index);
+static void buildTocIndex(void);
 static char paramWriteByNameProcess(char* group, char* name, int type, void *valptr);
 
 
@@ -85,6 +98,13 @@ static int paramsLen;
 static uint32_t paramsCrc;
 static uint16_t paramsCount = 0;
 
+// Index of the TOC. paramIndexById maps the id of a variable to its index in
+// the TOC and paramGroups holds the groups sorted by name. Group names are not
+// unique, groups with the same name are kept in TOC order.
+NO_DMA_CCM_SAFE_ZERO_INIT static uint16_t paramIndexById[PARAM_TOC_MAX_VARIABLES];
+NO_DMA_CCM_SAFE_ZERO_INIT static paramGroup_t paramGroups[PARAM_TOC_MAX_GROUPS];
+static int paramGroupsLen;
+
 // _sdata is from linker script and points to start of data section
 extern int _sdata;
 extern int _edata;
@@ -260,18 +280,64 @@ void paramLogicInit(void)
     paramsCrc = crc32CalculateBuffer(buf, len);
   }
 
+  paramsCount = 0;
   for (i=0; i<paramsLen; i++)
   {
     if(!(params[i].type & PARAM_GROUP))
       paramsCount++;
   }
+
+  buildTocIndex();
+}
+
+// Build the index used to look up variables by id in constant time and by
+// name in logarithmic time. The linker does not sort the TOC, the groups are
+// sorted here.
+static void buildTocIndex(void)
+{
+  uint16_t id = 0;
+
+  paramGroupsLen = 0;
+  for (int i = 0; i < paramsLen; i++)
+  {
+    if (params[i].type & PARAM_GROUP) {
+      if (params[i].type & PARAM_START) {
+        if (paramGroupsLen >= PARAM_TOC_MAX_GROUPS) {
+          PARAM_ERROR("Too many param groups, increase PARAM_TOC_MAX_GROUPS\n");
+          ASSERT_FAILED();
+          return;
+        }
+        paramGroups[paramGroupsLen].index = i;
+        paramGroups[paramGroupsLen].firstId = id;
+        paramGroupsLen++;
+      }
+    } else {
+      if (id >= PARAM_TOC_MAX_VARIABLES) {
+        PARAM_ERROR("Too many params, increase PARAM_TOC_MAX_VARIABLES\n");
+        ASSERT_FAILED();
+        return;
+      }
+      paramIndexById[id] = i;
+      id++;
+    }
+  }
+
+  for (int i = 1; i < paramGroupsLen; i++)
+  {
+    paramGroup_t group = paramGroups[i];
+    int j = i;
+    while (j > 0 && strcmp(params[paramGroups[j - 1].index].name, params[group.index].name) > 0) {
+      paramGroups[j] = paramGroups[j - 1];
+      j--;
+    }
+    paramGroups[j] = group;
+  }
 }
 
 void paramTOCProcess(CRTPPacket *p, int command)
 {
   int ptr = 0;
   char * group = "";
-  uint16_t n=0;
   uint16_t paramId=0;
 
   switch (command)
@@ -305,21 +371,11 @@ void paramTOCProcess(CRTPPacket *p, int command)
       break;
     case CMD_GET_ITEM_V2:  //Get param variable
       memcpy(&paramId, &p->data[1], 2);
-      for (ptr=0; ptr<paramsLen; ptr++) //Ptr points a group
-      {
-        if (params[ptr].type & PARAM_GROUP)
-        {
-          if (params[ptr].type & PARAM_START)
-            group = params[ptr].name;
-          else
-            group = "";
-        }
-        else                          //Ptr points a variable
-        {
-          if (n==paramId)
-            break;
-          n++;
-        }
+      ptr = variableGetIndex(paramId);
+      if (ptr >= 0) {
+        group = variableGetGroup(ptr);
+      } else {
+        ptr = paramsLen;
       }
 
       if (ptr<paramsLen)
@@ -374,26 +430,10 @@ void paramWriteProcess(CRTPPacket *p)
 }
 
 static char paramWriteByNameProcess(char* group, char* name, int type, void *valptr) {
-  int index;
-  char *pgroup = "";
-
-  for (index = 0; index < paramsLen; index++) //Ptr points a group
-  {
-    if (params[index].type & PARAM_GROUP)
-    {
-      if (params[index].type & PARAM_START)
-        pgroup = params[index].name;
-      else
-        pgroup = "";
-    }
-    else                          //Ptr points a variable
-    {
-      if (!strcmp(params[index].name, name) && !strcmp(pgroup, group))
-        break;
-    }
-  }
+  uint16_t id;
+  int index = variableFind(group, name, &id);
 
-  if (index >= paramsLen) {
+  if (index < 0) {
     return ENOENT;
   }
 
@@ -431,24 +471,63 @@ void paramReadProcess(CRTPPacket *p)
 
 static int variableGetIndex(int id)
 {
-  int i;
-  int n = 0;
+  if (id < 0 || id >= paramsCount)
+    return -1;
 
-  for (i = 0; i < paramsLen; i++)
+  return paramIndexById[id];
+}
+
+// Find a variable by group and name. Returns the index in the TOC, or -1 if
+// the variable does not exist.
+static int variableFind(const char* group, const char* name, uint16_t* id)
+{
+  int lo = 0;
+  int hi = paramGroupsLen - 1;
+
+  while (lo <= hi)
   {
-    if(!(params[i].type & PARAM_GROUP))
-    {
-      if(n == id) {
-        break;
+    int mid = (lo + hi) / 2;
+    const paramGroup_t* g = &paramGroups[mid];
+    int cmp = strcmp(group, params[g->index].name);
+    if (cmp < 0) {
+      hi = mid - 1;
+    } else if (cmp > 0) {
+      lo = mid + 1;
+    } else {
+      // Group names are not unique, search all groups with this name in TOC order
+      while (mid > 0 && !strcmp(group, params[paramGroups[mid - 1].index].name)) {
+        mid--;
+      }
+      for (; mid < paramGroupsLen && !strcmp(group, params[paramGroups[mid].index].name); mid++)
+      {
+        g = &paramGroups[mid];
+        for (int index = g->index + 1; index < paramsLen && !(params[index].type & PARAM_GROUP); index++)
+        {
+          if (!strcmp(name, params[index].name)) {
+            *id = g->firstId + (index - g->index - 1);
+            return index;
+          }
+        }
       }
-      n++;
+      return -1;
     }
   }
 
-  if (i >= paramsLen)
-    return -1;
+  return -1;
+}
+
+// Get the name of the group of the variable at the given index in the TOC
+static char* variableGetGroup(int index)
+{
+  while (index > 0 && !(params[index].type & PARAM_GROUP)) {
+    index--;
+  }
 
-  return i;
+  if ((params[index].type & PARAM_GROUP) && (params[index].type & PARAM_START)) {
+    return params[index].name;
+  }
+
+  return "";
 }
 
 /* Public API to access param TOC from within the copter */
@@ -472,29 +551,16 @@ paramVarId_t paramGetVarIdFromComplete(const char* completeName)
 
 paramVarId_t paramGetVarId(const char* group, const char* name)
 {
-  uint16_t index;
-  uint16_t id = 0;
   paramVarId_t varId = invalidVarId;
-  char * currgroup = "";
-
-  for(index = 0; index < paramsLen; index++)
-  {
-    if (params[index].type & PARAM_GROUP) {
-      if (params[index].type & PARAM_START) {
-        currgroup = params[index].name;
-      }
-    } else {
-      id += 1;
-    }
+  uint16_t id;
 
-    if ((!strcmp(group, currgroup)) && (!strcmp(name, params[index].name))) {
-      varId.index = index;
-      varId.id = id - 1;
-      return varId;
-    }
+  int index = variableFind(group, name, &id);
+  if (index >= 0) {
+    varId.index = index;
+    varId.id = id;
   }
 
-  return invalidVarId;
+  return varId;
 }
 
 int paramGetType(paramVarId_t varid)
@@ -504,22 +570,12 @@ int paramGetType(paramVarId_t varid)
 
 void paramGetGroupAndName(paramVarId_t varid, char** group, char** name)
 {
-  char * currgroup = "";
   *group = 0;
   *name = 0;
 
-  for(int index = 0; index < paramsLen; index++) {
-    if (params[index].type & PARAM_GROUP) {
-      if (params[index].type & PARAM_START) {
-        currgroup = params[index].name;
-      }
-    }
-
-    if (index == varid.index) {
-      *group = currgroup;
-      *name = params[index].name;
-      break;
-    }
+  if (varid.index < paramsLen) {
+    *group = variableGetGroup(varid.index);
+    *name = params[varid.index].name;
   }
 }
 
@@ -1,3 +1,5 @@
+#include <string.h>
+
 #include "config.h"
 #include "debug.h"
 #include "FreeRTOS.h"
@@ -5,10 +7,16 @@
 #include "peer_localization.h"
 
 
+// array of other's position
+static peerLocalizationOtherPosition_t other_positions[PEER_LOCALIZATION_MAX_NEIGHBORS];
+
+// index in other_positions + 1 for each radio ID, 0 if the ID is not tracked
+static uint8_t slot_by_id[256];
+
 void peerLocalizationInit()
 {
-  // All other_positions[in].id will be set to zero due to static initialization.
-  // If we ever switch to dynamic allocation, we need to set them to zero explicitly.
+  memset(other_positions, 0, sizeof(other_positions));
+  memset(slot_by_id, 0, sizeof(slot_by_id));
 }
 
 bool peerLocalizationTest()
@@ -16,42 +24,73 @@ bool peerLocalizationTest()
   return true;
 }
 
-// array of other's position
-static peerLocalizationOtherPosition_t other_positions[PEER_LOCALIZATION_MAX_NEIGHBORS];
+static bool isFresh(peerLocalizationOtherPosition_t const *other, uint32_t now, uint32_t maxAge)
+{
+  // a position that was updated after now was read is fresh too
+  int32_t const age = now - other->pos.timestamp;
+  return other->id != 0 && (age < 0 || (uint32_t)age <= maxAge);
+}
 
-bool peerLocalizationTellPosition(int cfid, positionMeasurement_t const *pos)
+// Finds an empty entry, or the oldest entry if it is stale. Returns -1 if the
+// table is full.
+static int findFreeSlot(uint32_t now)
 {
-  for (uint8_t i = 0; i < PEER_LOCALIZATION_MAX_NEIGHBORS; ++i) {
-    if (other_positions[i].id == 0 || other_positions[i].id == cfid) {
-      other_positions[i].id = cfid;
-      other_positions[i].pos.x = pos->x;
-      other_positions[i].pos.y = pos->y;
-      other_positions[i].pos.z = pos->z;
-      other_positions[i].pos.timestamp = xTaskGetTickCount();
-      return true;
+  int oldest = -1;
+  for (int i = 0; i < PEER_LOCALIZATION_MAX_NEIGHBORS; ++i) {
+    if (other_positions[i].id == 0) {
+      return i;
+    }
+    if (oldest < 0 || (int32_t)(other_positions[i].pos.timestamp - other_positions[oldest].pos.timestamp) < 0) {
+      oldest = i;
     }
   }
-  return false;
+
+  if (oldest >= 0 && !isFresh(&other_positions[oldest], now, PEER_LOCALIZATION_STALE_AGE)) {
+    return oldest;
+  }
+  return -1;
 }
 
-bool peerLocalizationIsIDActive(uint8_t cfid)
+bool peerLocalizationTellPosition(int cfid, positionMeasurement_t const *pos)
 {
-  for (uint8_t i = 0; i < PEER_LOCALIZATION_MAX_NEIGHBORS; ++i) {
-    if (other_positions[i].id == cfid) {
-      return true;
+  if (cfid <= 0 || cfid > 255) {
+    return false;
+  }
+
+  uint32_t const now = xTaskGetTickCount();
+  int slot = slot_by_id[cfid] - 1;
+
+  if (slot < 0) {
+    slot = findFreeSlot(now);
+    if (slot < 0) {
+      return false;
     }
+
+    // evict the stale neighbor, if any
+    slot_by_id[other_positions[slot].id] = 0;
+    other_positions[slot].id = cfid;
+    slot_by_id[cfid] = slot + 1;
   }
-  return false;
+
+  other_positions[slot].pos.x = pos->x;
+  other_positions[slot].pos.y = pos->y;
+  other_positions[slot].pos.z = pos->z;
+  other_positions[slot].pos.timestamp = now;
+  return true;
+}
+
+bool peerLocalizationIsIDActive(uint8_t cfid)
+{
+  peerLocalizationOtherPosition_t const *other = peerLocalizationGetPositionByID(cfid);
+  return other != NULL && isFresh(other, xTaskGetTickCount(), PEER_LOCALIZATION_STALE_AGE);
 }
 
 peerLocalizationOtherPosition_t *peerLocalizationGetPositionByID(uint8_t cfid)
 {
-  for (uint8_t i = 0; i < PEER_LOCALIZATION_MAX_NEIGHBORS; ++i) {
-    if (other_positions[i].id == cfid) {
-      return &other_positions[i];
-    }
+  if (cfid == 0 || slot_by_id[cfid] == 0) {
+    return NULL;
   }
-  return NULL;
+  return &other_positions[slot_by_id[cfid] - 1];
 }
 
 peerLocalizationOtherPosition_t *peerLocalizationGetPositionByIdx(uint8_t idx)
@@ -62,3 +101,22 @@ peerLocalizationOtherPosition_t *peerLocalizationGetPositionByIdx(uint8_t idx)
   }
   return NULL;
 }
+
+void peerLocalizationIteratorInit(peerLocalizationIterator_t *it, uint32_t maxAge)
+{
+  it->idx = 0;
+  it->now = xTaskGetTickCount();
+  it->maxAge = maxAge;
+}
+
+peerLocalizationOtherPosition_t const *peerLocalizationIteratorNext(peerLocalizationIterator_t *it)
+{
+  while (it->idx < PEER_LOCALIZATION_MAX_NEIGHBORS) {
+    peerLocalizationOtherPosition_t const *other = &other_positions[it->idx];
+    ++it->idx;
+    if (isFresh(other, it->now, it->maxAge)) {
+      return other;
+    }
+  }
+  return NULL;
+}
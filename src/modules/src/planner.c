@@ -48,6 +48,8 @@ static void plan_takeoff_or_landing(struct planner *p, struct vec curr_pos, floa
 	piecewise_plan_7th_order_no_jerk(&p->planned_trajectory, duration,
 		curr_pos,  curr_yaw,  vzero(), 0, vzero(),
 		hover_pos, hover_yaw, vzero(), 0, vzero());
+	piecewise_build_index(&p->planned_trajectory, p->planned_piece_start);
+	piecewise_cursor_reset(&p->cursor);
 }
 
 // ----------------- //
@@ -62,6 +64,7 @@ void plan_init(struct planner *p)
 	p->trajectory = NULL;
 	p->compressed_trajectory = NULL;
 	p->planned_trajectory.pieces = p->pieces;
+	piecewise_cursor_reset(&p->cursor);
 }
 
 void plan_stop(struct planner *p)
@@ -119,17 +122,16 @@ struct traj_eval plan_eval(struct planner *p, float t)
 	switch (p->type) {
 		case TRAJECTORY_TYPE_PIECEWISE:
 			if (p->reversed) {
-				return piecewise_eval_reversed(p->trajectory, t);
+				return piecewise_eval_reversed_with_cursor(p->trajectory, &p->cursor, t);
 			}
 			else {
-				return piecewise_eval(p->trajectory, t);
+				return piecewise_eval_with_cursor(p->trajectory, &p->cursor, t);
 			}
 			break;
 
 		case TRAJECTORY_TYPE_PIECEWISE_COMPRESSED:
 			if (p->reversed) {
-				/* not supported */
-				return traj_eval_invalid();
+				return piecewise_compressed_eval_reversed(p->compressed_trajectory, t);
 			}
 			else {
 				return piecewise_compressed_eval(p->compressed_trajectory, t);
@@ -181,6 +183,8 @@ int plan_go_to_from(struct planner *p, const struct traj_eval *curr_eval, bool r
 	piecewise_plan_7th_order_no_jerk(&p->planned_trajectory, duration,
 		curr_eval->pos, curr_eval->yaw, curr_eval->vel, curr_eval->omega.z, curr_eval->acc,
 		hover_pos,      hover_yaw,      vzero(),        0,                  vzero());
+	piecewise_build_index(&p->planned_trajectory, p->planned_piece_start);
+	piecewise_cursor_reset(&p->cursor);
 
 	p->reversed = false;
 	p->state = TRAJECTORY_STATE_FLYING;
@@ -203,6 +207,9 @@ int plan_start_trajectory(struct planner *p, struct piecewise_traj* trajectory,
 	p->type = TRAJECTORY_TYPE_PIECEWISE;
 	p->trajectory = trajectory;
 
+	// any previous index belongs to another trajectory, the index is built when the shift is known
+	trajectory->piece_start = NULL;
+
 	if (relative) {
 		struct traj_eval traj_init;
 		trajectory->shift = vzero();
@@ -219,21 +226,45 @@ int plan_start_trajectory(struct planner *p, struct piecewise_traj* trajectory,
 		trajectory->shift = vzero();
 	}
 
+	plan_update_trajectory(p);
+
 	return 0;
 }
 
-int plan_start_compressed_trajectory( struct planner *p, struct piecewise_traj_compressed* trajectory, bool relative, struct vec start_from)
+void plan_update_trajectory(struct planner *p)
 {
-	p->reversed = 0;
+	if (p->type != TRAJECTORY_TYPE_PIECEWISE) {
+		return;
+	}
+
+	if (p->trajectory->n_pieces <= PLAN_MAX_INDEXED_PIECES) {
+		piecewise_build_index(p->trajectory, p->piece_start);
+	}
+	else {
+		p->trajectory->piece_start = NULL;
+	}
+	piecewise_cursor_reset(&p->cursor);
+}
+
+int plan_start_compressed_trajectory( struct planner *p, struct piecewise_traj_compressed* trajectory, bool reversed, bool relative, struct vec start_from)
+{
+	p->reversed = reversed;
 	p->state = TRAJECTORY_STATE_FLYING;
 	p->type = TRAJECTORY_TYPE_PIECEWISE_COMPRESSED;
 	p->compressed_trajectory = trajectory;
 
+	// long trajectories are indexed sparsely, see PLAN_MAX_INDEXED_COMPRESSED_PIECES
+	piecewise_compressed_build_index(trajectory, p->compressed_index, PLAN_MAX_INDEXED_COMPRESSED_PIECES + 1);
+
 	if (relative) {
 		trajectory->shift = vzero();
-		struct traj_eval traj_init = piecewise_compressed_eval(
-			trajectory, trajectory->t_begin
-		);
+		struct traj_eval traj_init;
+		if (reversed) {
+			traj_init = piecewise_compressed_eval_reversed(trajectory, trajectory->t_begin);
+		}
+		else {
+			traj_init = piecewise_compressed_eval(trajectory, trajectory->t_begin);
+		}
 		struct vec shift_pos = vsub(start_from, traj_init.pos);
 		trajectory->shift = shift_pos;
 	} else {
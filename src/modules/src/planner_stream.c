@@ -0,0 +1,141 @@
+/*
+ *    ______
+ *   / ____/________ _____  __  ________      ______ __________ ___
+ *  / /   / ___/ __ `/_  / / / / / ___/ | /| / / __ `/ ___/ __ `__ \
+ * / /___/ /  / /_/ / / /_/ /_/ (__  )| |/ |/ / /_/ / /  / / / / / /
+ * \____/_/   \__,_/ /___/\__, /____/ |__/|__/\__,_/_/  /_/ /_/ /_/
+ *                       /____/
+ *
+ * Crazyswarm advanced control firmware for Crazyflie
+ *
+
+The MIT License (MIT)
+
+Copyright (c) 2018 Wolfgang Hoenig and James Alan Preiss
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/*
+implementation of streaming trajectories
+*/
+#include "planner_stream.h"
+
+// Set the played window, from the head of the ring to the last appended piece or the end of the ring
+static void plan_stream_update_window(struct planner_stream *s, struct planner *p)
+{
+	uint8_t contiguous = s->capacity - s->head;
+	s->trajectory.pieces = &s->slots[s->head];
+	s->trajectory.n_pieces = (s->count < contiguous) ? s->count : contiguous;
+	s->freeSlots = s->capacity - s->count;
+
+	if (s->isPlaying) {
+		plan_update_trajectory(p);
+	}
+}
+
+void plan_stream_define(struct planner_stream *s, struct poly4d* slots, uint8_t capacity)
+{
+	s->slots = slots;
+	s->capacity = capacity;
+	s->head = 0;
+	s->count = 0;
+	s->closed = false;
+	s->isPlaying = false;
+	s->freeSlots = capacity;
+	s->bufferedTime = 0;
+}
+
+int plan_stream_start(struct planner_stream *s, struct planner *p, float timescale, bool relative, struct vec start_from, float t)
+{
+	s->trajectory.t_begin = t;
+	s->trajectory.timescale = timescale;
+	s->isPlaying = false;
+	plan_stream_update_window(s, p);
+
+	int result = plan_start_trajectory(p, &s->trajectory, false, relative, start_from);
+	s->isPlaying = true;
+	return result;
+}
+
+void plan_stream_append(struct planner_stream *s, struct planner *p, uint8_t n_pieces, bool last)
+{
+	s->count += n_pieces;
+	s->closed = last;
+	plan_stream_update_window(s, p);
+}
+
+void plan_stream_advance(struct planner_stream *s, struct planner *p, float t)
+{
+	if (!s->isPlaying) {
+		return;
+	}
+
+	if (p->state != TRAJECTORY_STATE_FLYING || p->type != TRAJECTORY_TYPE_PIECEWISE ||
+			p->trajectory != &s->trajectory) {
+		// preempted by another command
+		s->isPlaying = false;
+		return;
+	}
+
+	// the last piece is kept, it is evaluated at the end of the trajectory
+	bool isWindowChanged = false;
+	while (s->count > 1) {
+		float end = s->trajectory.t_begin + s->slots[s->head].duration * s->trajectory.timescale;
+		if (t < end) {
+			break;
+		}
+
+		s->trajectory.t_begin = end;
+		s->head = (s->head + 1) % s->capacity;
+		s->count--;
+		s->playedPieces++;
+		isWindowChanged = true;
+	}
+
+	if (isWindowChanged) {
+		plan_stream_update_window(s, p);
+	}
+
+	float bufferedEnd = s->trajectory.t_begin;
+	for (int i = 0; i < s->count; i++) {
+		bufferedEnd += s->slots[(s->head + i) % s->capacity].duration * s->trajectory.timescale;
+	}
+	s->bufferedTime = bufferedEnd - t;
+
+	if (t < bufferedEnd) {
+		return;
+	}
+
+	// The stream has ended, or has run out of pieces before it was closed. Stop smoothly from the state at the end of
+	// the last piece and hover, so that the ring is free to be written and defined again.
+	struct traj_eval end = piecewise_eval(&s->trajectory, bufferedEnd);
+	struct vec hover_pos = vadd(end.pos, vscl(PLAN_STREAM_STOP_DURATION / 2.0f, end.vel));
+	plan_go_to_from(p, &end, false, hover_pos, end.yaw, PLAN_STREAM_STOP_DURATION, t);
+
+	if (!s->closed) {
+		s->underruns++;
+	}
+	s->head = (s->head + 1) % s->capacity;
+	s->count = 0;
+	s->playedPieces++;
+	s->freeSlots = s->capacity;
+	s->bufferedTime = 0;
+	s->isPlaying = false;
+}
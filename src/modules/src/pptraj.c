@@ -41,8 +41,6 @@ See Daniel Mellinger, Vijay Kumar: "Minimum snap trajectory generation and contr
 
 #define GRAV (9.81f)
 
-static struct poly4d poly4d_tmp;
-
 // polynomials are stored with ascending degree
 
 void polylinear(float p[PP_SIZE], float duration, float x0, float x1)
@@ -117,6 +115,21 @@ float polyval(float const p[PP_SIZE], float t)
 	return x;
 }
 
+// evaluate a polynomial and its first three derivatives using horner's rule.
+static void polyval_derivatives(float const p[PP_SIZE], float t, float d[4])
+{
+	d[0] = d[1] = d[2] = d[3] = 0;
+	for (int i = PP_DEGREE; i >= 0; --i) {
+		d[3] = d[3] * t + d[2];
+		d[2] = d[2] * t + d[1];
+		d[1] = d[1] * t + d[0];
+		d[0] = d[0] * t + p[i];
+	}
+	// d[k] holds the k:th derivative divided by k!
+	d[2] *= 2;
+	d[3] *= 6;
+}
+
 // compute derivative of a polynomial in place
 void polyder(float p[PP_SIZE])
 {
@@ -239,17 +252,12 @@ static struct vec polyval_xyz(struct poly4d const *p, float t)
 	return mkvec(polyval(p->p[0], t), polyval(p->p[1], t), polyval(p->p[2], t));
 }
 
-static float polyval_yaw(struct poly4d const *p, float t)
-{
-	return polyval(p->p[3], t);
-}
-
 // compute loose maximum of acceleration -
 // uses L1 norm instead of Euclidean, evaluates polynomial instead of root-finding
 float poly4d_max_accel_approx(struct poly4d const *p)
 {
-	struct poly4d* acc = &poly4d_tmp;
-	*acc = *p;
+	struct poly4d acc_poly = *p;
+	struct poly4d* acc = &acc_poly;
 	polyder4d(acc);
 	polyder4d(acc);
 	int steps = 10 * p->duration;
@@ -291,25 +299,26 @@ bool is_traj_eval_valid(struct traj_eval const *ev)
 
 struct traj_eval poly4d_eval(struct poly4d const *p, float t)
 {
-	// flat variables
-	struct traj_eval out;
-	out.pos = polyval_xyz(p, t);
-	out.yaw = polyval_yaw(p, t);
-
-	// 1st derivative
-	struct poly4d* deriv = &poly4d_tmp;
-	*deriv = *p;
-	polyder4d(deriv);
-	out.vel = polyval_xyz(deriv, t);
-	float dyaw = polyval_yaw(deriv, t);
-
-	// 2nd derivative
-	polyder4d(deriv);
-	out.acc = polyval_xyz(deriv, t);
+	// flat variables and their derivatives, in a single pass over the coefficients
+	float x[4], y[4], z[4], yaw[4];
+	polyval_derivatives(p->p[0], t, x);
+	polyval_derivatives(p->p[1], t, y);
+	polyval_derivatives(p->p[2], t, z);
+	polyval_derivatives(p->p[3], t, yaw);
+
+	return traj_eval_from_derivatives(x, y, z, yaw);
+}
 
-	// 3rd derivative
-	polyder4d(deriv);
-	struct vec jerk = polyval_xyz(deriv, t);
+struct traj_eval traj_eval_from_derivatives(
+	float const x[4], float const y[4], float const z[4], float const yaw[4])
+{
+	struct traj_eval out;
+	out.pos = mkvec(x[0], y[0], z[0]);
+	out.yaw = yaw[0];
+	out.vel = mkvec(x[1], y[1], z[1]);
+	float dyaw = yaw[1];
+	out.acc = mkvec(x[2], y[2], z[2]);
+	struct vec jerk = mkvec(x[3], y[3], z[3]);
 
 	struct vec thrust = vadd(out.acc, mkvec(0, 0, GRAV));
 	// float thrust_mag = mass * vmag(thrust);
@@ -334,25 +343,111 @@ struct traj_eval poly4d_eval(struct poly4d const *p, float t)
 //
 
 // piecewise eval
-struct traj_eval piecewise_eval(
-  struct piecewise_traj const *traj, float t)
+void piecewise_build_index(struct piecewise_traj *traj, float *piece_start)
 {
-	int cursor = 0;
-	t = t - traj->t_begin;
-	while (cursor < traj->n_pieces) {
-		struct poly4d const *piece = &(traj->pieces[cursor]);
-		if (t <= piece->duration * traj->timescale) {
-			poly4d_tmp = *piece;
-			poly4d_shift(&poly4d_tmp, traj->shift.x, traj->shift.y, traj->shift.z, 0);
-			poly4d_stretchtime(&poly4d_tmp, traj->timescale);
-			return poly4d_eval(&poly4d_tmp, t);
+	float t = 0;
+	for (int i = 0; i < traj->n_pieces; ++i) {
+		piece_start[i] = t;
+		t += traj->pieces[i].duration;
+	}
+	piece_start[traj->n_pieces] = t;
+
+	traj->piece_start = piece_start;
+}
+
+void piecewise_cursor_reset(struct piecewise_cursor *cursor)
+{
+	cursor->piece = 0;
+	cursor->searches = 0;
+	cursor->cached_index = -1;
+	cursor->cached_reversed = false;
+}
+
+// find the first piece that ends at or after the (unscaled) time u since the
+// start of the trajectory, or n_pieces if the trajectory has ended.
+// time usually moves forward by less than a piece between lookups, so the
+// piece of the previous lookup and the one after it are checked first.
+static int piecewise_find_piece(struct piecewise_traj const *traj,
+	struct piecewise_cursor *cursor, float u)
+{
+	float const *start = traj->piece_start;
+	int const n = traj->n_pieces;
+
+	if (cursor) {
+		int i = cursor->piece;
+		if (i < n && u <= start[i + 1] && (i == 0 || u > start[i])) {
+			return i;
 		}
-		t -= piece->duration * traj->timescale;
-		++cursor;
+		if (i + 1 < n && u > start[i + 1] && u <= start[i + 2]) {
+			cursor->piece = i + 1;
+			return i + 1;
+		}
+		++cursor->searches;
 	}
-	// if we get here, the trajectory has ended
-	struct poly4d const *end_piece = &(traj->pieces[traj->n_pieces - 1]);
-	struct traj_eval ev = poly4d_eval(end_piece, end_piece->duration);
+
+	// binary search for the first piece with u <= end of piece
+	int lo = 0;
+	int hi = n;
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if (u <= start[mid + 1]) {
+			hi = mid;
+		}
+		else {
+			lo = mid + 1;
+		}
+	}
+
+	if (cursor && lo < n) {
+		cursor->piece = lo;
+	}
+	return lo;
+}
+
+// shift and stretch a piece in time as given by the trajectory, and reflect it in time if reversed
+static void piecewise_transform_piece(struct piecewise_traj const *traj,
+	struct poly4d const *piece, bool reversed, struct poly4d *out)
+{
+	*out = *piece;
+	poly4d_shift(out, traj->shift.x, traj->shift.y, traj->shift.z, 0);
+	poly4d_stretchtime(out, traj->timescale);
+	if (reversed) {
+		for (int i = 0; i < 4; ++i) {
+			polyreflect(out->p[i]);
+		}
+	}
+}
+
+static struct traj_eval piecewise_eval_piece(
+	struct piecewise_traj const *traj, struct poly4d const *piece, float t, bool reversed)
+{
+	struct poly4d transformed;
+	piecewise_transform_piece(traj, piece, reversed, &transformed);
+	return poly4d_eval(&transformed, t);
+}
+
+// evaluate piece index of an indexed trajectory. with a cursor, the
+// transformed piece is cached, so it is only computed when moving to a new
+// piece.
+static struct traj_eval piecewise_eval_cached(struct piecewise_traj const *traj,
+	struct piecewise_cursor *cursor, int index, float t, bool reversed)
+{
+	if (!cursor) {
+		return piecewise_eval_piece(traj, &traj->pieces[index], t, reversed);
+	}
+
+	if (cursor->cached_index != index || cursor->cached_reversed != reversed) {
+		piecewise_transform_piece(traj, &traj->pieces[index], reversed, &cursor->cached_piece);
+		cursor->cached_index = index;
+		cursor->cached_reversed = reversed;
+	}
+	return poly4d_eval(&cursor->cached_piece, t);
+}
+
+static struct traj_eval piecewise_eval_end(
+	struct piecewise_traj const *traj, struct poly4d const *end_piece, float t)
+{
+	struct traj_eval ev = poly4d_eval(end_piece, t);
 	ev.pos = vadd(ev.pos, traj->shift);
 	ev.vel = vzero();
 	ev.acc = vzero();
@@ -360,34 +455,81 @@ struct traj_eval piecewise_eval(
 	return ev;
 }
 
+struct traj_eval piecewise_eval(
+  struct piecewise_traj const *traj, float t)
+{
+	return piecewise_eval_with_cursor(traj, NULL, t);
+}
+
 struct traj_eval piecewise_eval_reversed(
   struct piecewise_traj const *traj, float t)
 {
-	int cursor = traj->n_pieces - 1;
+	return piecewise_eval_reversed_with_cursor(traj, NULL, t);
+}
+
+struct traj_eval piecewise_eval_with_cursor(
+  struct piecewise_traj const *traj, struct piecewise_cursor *cursor, float t)
+{
+	t = t - traj->t_begin;
+
+	if (traj->piece_start) {
+		int index = piecewise_find_piece(traj, cursor, t / traj->timescale);
+		if (index < traj->n_pieces) {
+			float piece_t = t - traj->piece_start[index] * traj->timescale;
+			return piecewise_eval_cached(traj, cursor, index, piece_t, false);
+		}
+	}
+	else {
+		int index = 0;
+		while (index < traj->n_pieces) {
+			struct poly4d const *piece = &(traj->pieces[index]);
+			if (t <= piece->duration * traj->timescale) {
+				return piecewise_eval_piece(traj, piece, t, false);
+			}
+			t -= piece->duration * traj->timescale;
+			++index;
+		}
+	}
+
+	// if we get here, the trajectory has ended
+	struct poly4d const *end_piece = &(traj->pieces[traj->n_pieces - 1]);
+	return piecewise_eval_end(traj, end_piece, end_piece->duration);
+}
+
+struct traj_eval piecewise_eval_reversed_with_cursor(
+  struct piecewise_traj const *traj, struct piecewise_cursor *cursor, float t)
+{
 	t = t - traj->t_begin;
-	while (cursor >= 0) {
-		struct poly4d const *piece = &(traj->pieces[cursor]);
-		if (t <= piece->duration * traj->timescale) {
-			poly4d_tmp = *piece;
-			poly4d_shift(&poly4d_tmp, traj->shift.x, traj->shift.y, traj->shift.z, 0);
-			poly4d_stretchtime(&poly4d_tmp, traj->timescale);
-			for (int i = 0; i < 4; ++i) {
-				polyreflect(poly4d_tmp.p[i]);
+
+	if (traj->piece_start) {
+		// look up the piece at the corresponding time of the forward trajectory
+		float const total = traj->piece_start[traj->n_pieces];
+		float const u = total - t / traj->timescale;
+		if (u >= 0) {
+			int index = piecewise_find_piece(traj, cursor, u);
+			if (index >= traj->n_pieces) {
+				// before the start of the reversed trajectory
+				index = traj->n_pieces - 1;
 			}
-			t = t - piece->duration * traj->timescale;
-			return poly4d_eval(&poly4d_tmp, t);
+			float piece_t = t - (total - traj->piece_start[index]) * traj->timescale;
+			return piecewise_eval_cached(traj, cursor, index, piece_t, true);
 		}
-		t -= piece->duration * traj->timescale;
-		--cursor;
 	}
+	else {
+		int index = traj->n_pieces - 1;
+		while (index >= 0) {
+			struct poly4d const *piece = &(traj->pieces[index]);
+			if (t <= piece->duration * traj->timescale) {
+				t = t - piece->duration * traj->timescale;
+				return piecewise_eval_piece(traj, piece, t, true);
+			}
+			t -= piece->duration * traj->timescale;
+			--index;
+		}
+	}
+
 	// if we get here, the trajectory has ended
-	struct poly4d const *end_piece = &(traj->pieces[0]);
-	struct traj_eval ev = poly4d_eval(end_piece, 0.0f);
-	ev.pos = vadd(ev.pos, traj->shift);
-	ev.vel = vzero();
-	ev.acc = vzero();
-	ev.omega = vzero();
-	return ev;
+	return piecewise_eval_end(traj, &traj->pieces[0], 0.0f);
 }
 
 
@@ -401,6 +543,7 @@ void piecewise_plan_5th_order(struct piecewise_traj *pp, float duration,
 	pp->timescale = 1.0;
 	pp->shift = vzero();
 	pp->n_pieces = 1;
+	pp->piece_start = NULL;
 	poly5(p->p[0], duration, p0.x, v0.x, a0.x, p1.x, v1.x, a1.x);
 	poly5(p->p[1], duration, p0.y, v0.y, a0.y, p1.y, v1.y, a1.y);
 	poly5(p->p[2], duration, p0.z, v0.z, a0.z, p1.z, v1.z, a1.z);
@@ -417,6 +560,7 @@ void piecewise_plan_7th_order_no_jerk(struct piecewise_traj *pp, float duration,
 	pp->timescale = 1.0;
 	pp->shift = vzero();
 	pp->n_pieces = 1;
+	pp->piece_start = NULL;
 	poly7_nojerk(p->p[0], duration, p0.x, v0.x, a0.x, p1.x, v1.x, a1.x);
 	poly7_nojerk(p->p[1], duration, p0.y, v0.y, a0.y, p1.y, v1.y, a1.y);
 	poly7_nojerk(p->p[2], duration, p0.z, v0.z, a0.z, p1.z, v1.z, a1.z);
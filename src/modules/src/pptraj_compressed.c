@@ -38,6 +38,14 @@
 // In the stored version, we store angles in 1/10th degrees, hence this factor
 #define STORED_ANGLE_SCALE 0.1
 
+// Number of fractional bits of the fixed point numbers that the control points
+// are converted to during evaluation. De Casteljau's algorithm never leaves the
+// convex hull of the control points, so all intermediate points fit in 32 bits.
+#define CONTROL_POINT_FRACTION_BITS 8
+
+// Number of fractional bits of the curve parameter, which is in [0, 1]
+#define PARAMETER_FRACTION_BITS 16
+
 // Numbers of control points that we store for each storage method. Note that
 // we always store one less than the degree because the first control point of
 // each piece is the same as the last control point of the previous piece.
@@ -71,32 +79,116 @@ static inline float time_relative_to_start_of_current_piece(const struct piecewi
 
 static void piecewise_compressed_advance_playhead(struct piecewise_traj_compressed *traj);
 static void piecewise_compressed_rewind(struct piecewise_traj_compressed *traj);
-static void piecewise_compressed_update_current_poly4d(
-  struct piecewise_traj_compressed *traj, const struct traj_eval *end_of_previous_piece);
-
-// Calculates the coefficients of a 7D polynomial from the compressed
-// representation starting at the given pointer. Returns a pointer that
-// points to _after_ the part that has been processed.
-static compressed_piece_ptr calculate_polynomial_coefficients(
-  float *result, compressed_piece_ptr ptr,
-  enum piecewise_traj_storage_type storage_type,
-  float initial_condition, float duration, float scale)
+static void piecewise_compressed_seek(struct piecewise_traj_compressed *traj, float t);
+static void piecewise_compressed_decode_current_piece(
+  struct piecewise_traj_compressed *traj, const compressed_piece_coordinate start[4]);
+
+// Scale factors of the x, y, z and yaw coordinates
+static const float scale_by_coordinate[] = {
+  STORED_DISTANCE_SCALE, STORED_DISTANCE_SCALE, STORED_DISTANCE_SCALE, STORED_ANGLE_SCALE
+};
+
+// Interpolates linearly between two fixed point numbers. The error is less
+// than one unit in the last place.
+static inline int32_t lerp_fixed_point(int32_t a, int32_t b, int32_t s)
 {
-  compressed_piece_coordinate value;
+  return a + (int32_t)(((int64_t)(b - a) * s) >> PARAMETER_FRACTION_BITS);
+}
+
+// Evaluates one coordinate of the current piece and its first three time
+// derivatives at the curve parameter s, using de Casteljau's algorithm on the
+// stored control points. The differences of the points in the last levels of
+// the algorithm give the derivatives.
+static void evaluate_coordinate(
+  const compressed_piece_coordinate *control_points, uint8_t n,
+  int32_t s, float duration, float scale, float result[4])
+{
+  int32_t points[PP_SIZE];
+  int32_t differences[4] = { 0, 0, 0, 0 };
+  uint8_t degree = n - 1;
+  uint8_t count, i;
+  float factor;
+
+  for (i = 0; i < n; i++) {
+    points[i] = (int32_t)control_points[i] * (1 << CONTROL_POINT_FRACTION_BITS);
+  }
+
+  for (count = n; count > 1; count--) {
+    if (count == 4) {
+      differences[3] = points[3] - 3 * points[2] + 3 * points[1] - points[0];
+    } else if (count == 3) {
+      differences[2] = points[2] - 2 * points[1] + points[0];
+    } else if (count == 2) {
+      differences[1] = points[1] - points[0];
+    }
+
+    for (i = 0; i < count - 1; i++) {
+      points[i] = lerp_fixed_point(points[i], points[i + 1], s);
+    }
+  }
+  differences[0] = points[0];
+
+  /* The k-th derivative of a Bezier curve of degree n is n! / (n - k)! times
+   * the k-th difference of the control points, divided by duration^k */
+  factor = 1.0f / ((1 << CONTROL_POINT_FRACTION_BITS) * scale);
+  result[0] = differences[0] * factor;
+  for (i = 1; i < 4; i++) {
+    if (i <= degree) {
+      factor *= (degree - i + 1) / duration;
+      result[i] = differences[i] * factor;
+    } else {
+      result[i] = 0;
+    }
+  }
+}
+
+// Evaluates the current piece outside of its time span, which only happens
+// before the start of the trajectory. The polynomial is extrapolated, as for
+// uncompressed trajectories.
+static struct traj_eval extrapolate_current_piece(
+  const struct piecewise_traj_compressed *traj, float t)
+{
+  struct poly4d poly4d;
   float control_points[PP_SIZE];
-  uint8_t i, n;
+  uint8_t coordinate, i;
 
-  n = control_points_by_type[storage_type] + 1;
+  bzero(&poly4d, sizeof(poly4d));
+  poly4d.duration = traj->current_piece.duration;
+  for (coordinate = 0; coordinate < 4; coordinate++) {
+    for (i = 0; i < traj->current_piece.n_control_points[coordinate]; i++) {
+      control_points[i] = traj->current_piece.control_points[coordinate][i] / scale_by_coordinate[coordinate];
+    }
+    polybezier(poly4d.p[coordinate], poly4d.duration, control_points,
+      traj->current_piece.n_control_points[coordinate]);
+  }
+
+  return poly4d_eval(&poly4d, t);
+}
 
-  control_points[0] = initial_condition;
-  for (i = 1; i < n; i++) {
-    ptr = next_coordinate(ptr, &value);
-    control_points[i] = value / scale;
+// Evaluates the current piece at the given time, relative to its start
+static struct traj_eval evaluate_current_piece(
+  const struct piecewise_traj_compressed *traj, float t)
+{
+  float duration = traj->current_piece.duration;
+  float derivatives[4][4];
+  uint8_t coordinate;
+  int32_t s = 0;
+
+  if (duration > 0) {
+    if (t < 0 || t > duration) {
+      return extrapolate_current_piece(traj, t);
+    }
+    s = (int32_t)(t / duration * (1 << PARAMETER_FRACTION_BITS) + 0.5f);
   }
 
-  polybezier(result, duration, control_points, n);
+  for (coordinate = 0; coordinate < 4; coordinate++) {
+    evaluate_coordinate(
+      traj->current_piece.control_points[coordinate],
+      traj->current_piece.n_control_points[coordinate],
+      s, duration, scale_by_coordinate[coordinate], derivatives[coordinate]);
+  }
 
-  return ptr;
+  return traj_eval_from_derivatives(derivatives[0], derivatives[1], derivatives[2], derivatives[3]);
 }
 
 // Calculates the total duration of a compressed trajectory, starting at the
@@ -118,7 +210,7 @@ static float calculate_total_duration(compressed_piece_ptr ptr)
 
 // Returns the end time of the current piece being executed
 static inline float end_time_of_current_piece(const struct piecewise_traj_compressed *traj) {
-  return start_time_of_current_piece(traj) + traj->current_piece.poly4d.duration;
+  return start_time_of_current_piece(traj) + traj->current_piece.duration;
 }
 
 // Parses the two bytes pointed to by the given pointer as a signed 16-bit
@@ -205,15 +297,14 @@ struct traj_eval piecewise_compressed_eval(
 {
   struct traj_eval eval;
 
-  /* TODO(ntamas): timescale is currently limited to 1.
-   * We could support other timescales, but then we would need to update
-   * piecewise_compressed_update_current_poly4d() to stretch the time of
-   * the poly4d. The problem is that the user may set the timescale to
-   * a different value while the poly4d is already pre-calculated, and we
-   * have no way of detecting it */
-
-  if (t < start_time_of_current_piece(traj)) {
-    piecewise_compressed_rewind(traj);
+  /* The current piece is decoded with the timescale of the trajectory, decode
+   * it again if the timescale has been changed since then. With an index, any
+   * piece can be decoded directly, otherwise we have to start over if we go
+   * back in time. */
+  if (traj->current_piece.timescale != traj->timescale ||
+      t < start_time_of_current_piece(traj) ||
+      (traj->index && traj->current_piece.data && t >= end_time_of_current_piece(traj))) {
+    piecewise_compressed_seek(traj, t);
   }
 
   while (traj->current_piece.data && t >= end_time_of_current_piece(traj)) {
@@ -222,12 +313,115 @@ struct traj_eval piecewise_compressed_eval(
 
   t = time_relative_to_start_of_current_piece(traj, t);
 
-  eval = poly4d_eval(&traj->current_piece.poly4d, t);
+  eval = evaluate_current_piece(traj, t);
   eval.pos = vadd(eval.pos, traj->shift);
 
   return eval;
 }
 
+struct traj_eval piecewise_compressed_eval_reversed(
+  struct piecewise_traj_compressed *traj, float t)
+{
+  struct traj_eval eval;
+  float duration = piecewise_compressed_duration(traj);
+  float t_forward = traj->t_begin + duration - (t - traj->t_begin);
+
+  if (t_forward <= traj->t_begin) {
+    /* Hover at the start point when the reversed trajectory is finished */
+    eval = piecewise_compressed_eval(traj, traj->t_begin);
+    eval.vel = vzero();
+    eval.acc = vzero();
+    eval.omega = vzero();
+    return eval;
+  }
+
+  /* Playing a piece backwards flips the sign of all odd derivatives. The
+   * acceleration and the attitude are unchanged while the velocity and the
+   * angular velocity (which depends on jerk and yaw rate) change sign. */
+  eval = piecewise_compressed_eval(traj, t_forward);
+  eval.vel = vneg(eval.vel);
+  eval.omega = vneg(eval.omega);
+
+  return eval;
+}
+
+int piecewise_compressed_build_index(struct piecewise_traj_compressed *traj,
+  struct piecewise_traj_compressed_index_entry* index, int max_entries)
+{
+  struct compressed_piece_parsed_header header;
+  compressed_piece_coordinate start[4];
+  compressed_piece_ptr data = traj->data;
+  compressed_piece_ptr ptr = data;
+  uint32_t t_begin_msec = 0;
+  int n = 0;
+  int n_pieces = 0;
+  int stride;
+
+  traj->index = 0;
+  traj->n_index_entries = 0;
+
+  if (max_entries < 2) {
+    return -1;
+  }
+
+  for (int i = 0; i < 4; i++) {
+    ptr = next_coordinate(ptr, &start[i]);
+  }
+
+  /* Index every stride-th piece, such that the pieces and the end of the
+   * trajectory fit in max_entries */
+  for (compressed_piece_ptr piece = ptr; piece; piece = next_piece(piece)) {
+    n_pieces++;
+  }
+  n_pieces--; /* the terminator */
+  stride = (n_pieces + max_entries - 2) / (max_entries - 1);
+  if (stride < 1) {
+    stride = 1;
+  }
+
+  for (int piece = 0; ; piece++) {
+    if (ptr - data > UINT16_MAX) {
+      return -1;
+    }
+
+    if (piece % stride == 0 || piece == n_pieces) {
+      struct piecewise_traj_compressed_index_entry* entry = &index[n++];
+      entry->t_begin_msec = t_begin_msec;
+      entry->offset = ptr - data;
+      memcpy(entry->start, start, sizeof(start));
+    }
+
+    compressed_piece_ptr next = parse_header_of_current_piece(&header, ptr);
+    if (!next) {
+      /* The last entry marks the end of the trajectory */
+      break;
+    }
+
+    /* A piece ends at its last control point, or where it started if the
+     * coordinate is constant */
+    enum piecewise_traj_storage_type types[4] = {
+      header.x_type, header.y_type, header.z_type, header.yaw_type
+    };
+    compressed_piece_ptr body = header.body;
+    for (int i = 0; i < 4; i++) {
+      uint8_t count = control_points_by_type[types[i]];
+      if (count > 0) {
+        next_coordinate(body + (count - 1) * sizeof(compressed_piece_coordinate), &start[i]);
+      }
+      body += count * sizeof(compressed_piece_coordinate);
+    }
+
+    t_begin_msec += header.duration_in_msec;
+    ptr = next;
+  }
+
+  traj->index = index;
+  traj->n_index_entries = n;
+  traj->current_piece.timescale = 0; /* decode again from the index */
+
+  return n;
+}
+
 void piecewise_compressed_load(struct piecewise_traj_compressed *traj, const void* data)
 {
   traj->t_begin = 0;
@@ -235,6 +429,8 @@ void piecewise_compressed_load(struct piecewise_traj_compressed *traj, const voi
 
   traj->data = data;
   traj->shift = vzero();
+  traj->index = 0;
+  traj->n_index_entries = 0;
   piecewise_compressed_rewind(traj);
 
   traj->duration = calculate_total_duration(traj->current_piece.data);
@@ -242,57 +438,104 @@ void piecewise_compressed_load(struct piecewise_traj_compressed *traj, const voi
 
 static void piecewise_compressed_rewind(struct piecewise_traj_compressed *traj)
 {
-  struct traj_eval stopped;
-  compressed_piece_coordinate value;
+  compressed_piece_coordinate start[4];
   compressed_piece_ptr ptr;
 
   /* Parse header that stores the start coordinates */
-  bzero(&stopped, sizeof(stopped));
   ptr = traj->data;
-  ptr = next_coordinate(ptr, &value); stopped.pos.x = value / STORED_DISTANCE_SCALE;
-  ptr = next_coordinate(ptr, &value); stopped.pos.y = value / STORED_DISTANCE_SCALE;
-  ptr = next_coordinate(ptr, &value); stopped.pos.z = value / STORED_DISTANCE_SCALE;
-  ptr = next_coordinate(ptr, &value); stopped.yaw = value / STORED_ANGLE_SCALE;
+  ptr = next_coordinate(ptr, &start[0]);
+  ptr = next_coordinate(ptr, &start[1]);
+  ptr = next_coordinate(ptr, &start[2]);
+  ptr = next_coordinate(ptr, &start[3]);
   traj->current_piece.t_begin_relative = 0;
   traj->current_piece.data = ptr;
 
-  piecewise_compressed_update_current_poly4d(traj, &stopped);
+  piecewise_compressed_decode_current_piece(traj, start);
 }
 
-static void piecewise_compressed_update_current_poly4d(
-  struct piecewise_traj_compressed *traj, const struct traj_eval *prev_end)
+// Makes the piece at time t the current piece. Uses the index to find the
+// piece in logarithmic time, or starts over from the first piece if there is
+// no index.
+static void piecewise_compressed_seek(struct piecewise_traj_compressed *traj, float t)
 {
-  struct poly4d* poly4d = &traj->current_piece.poly4d;
-  compressed_piece_ptr ptr;
-  struct compressed_piece_parsed_header header;
+  const struct piecewise_traj_compressed_index_entry* index = traj->index;
+  float t_msec;
+  int lo, hi, mid;
+
+  if (!index) {
+    piecewise_compressed_rewind(traj);
+    return;
+  }
+
+  /* Find the last entry that starts at or before t */
+  t_msec = (t - traj->t_begin) / traj->timescale * STORED_DURATION_SCALE;
+  lo = 0;
+  hi = traj->n_index_entries - 1;
+  while (lo < hi) {
+    mid = (lo + hi + 1) / 2;
+    if (index[mid].t_begin_msec <= t_msec) {
+      lo = mid;
+    } else {
+      hi = mid - 1;
+    }
+  }
+
+  /* Pieces after an entry of a sparse index are found by decoding forward
+   * from it, continue from the current piece if it is on the way */
+  compressed_piece_ptr entry_data = (compressed_piece_ptr)traj->data + index[lo].offset;
+  if ((compressed_piece_ptr)traj->current_piece.data > entry_data && traj->current_piece.timescale == traj->timescale &&
+      t >= start_time_of_current_piece(traj)) {
+    return;
+  }
 
-  /* First, clear everything in the poly4d */
-  bzero(poly4d, sizeof(*poly4d));
+  traj->current_piece.t_begin_relative = index[lo].t_begin_msec / STORED_DURATION_SCALE * traj->timescale;
+  traj->current_piece.data = entry_data;
+
+  piecewise_compressed_decode_current_piece(traj, index[lo].start);
+}
+
+// Copies the control points of the current piece from the compressed data.
+// The first control point of each coordinate is where the piece starts.
+static void piecewise_compressed_decode_current_piece(
+  struct piecewise_traj_compressed *traj, const compressed_piece_coordinate start[4])
+{
+  struct compressed_piece_parsed_header header;
+  compressed_piece_ptr ptr;
+  uint8_t coordinate, i, n;
 
   /* Parse the header of the current piece, extract the storage types and the duration */
-  ptr = traj->current_piece.data;
-  parse_header_of_current_piece(&header, ptr);
-  poly4d->duration = header.duration_in_msec / STORED_DURATION_SCALE;
+  parse_header_of_current_piece(&header, traj->current_piece.data);
+  traj->current_piece.duration = header.duration_in_msec / STORED_DURATION_SCALE * traj->timescale;
+  traj->current_piece.timescale = traj->timescale;
 
   /* Process the body */
+  enum piecewise_traj_storage_type types[4] = {
+    header.x_type, header.y_type, header.z_type, header.yaw_type
+  };
   ptr = header.body;
-  ptr = calculate_polynomial_coefficients(
-    poly4d->p[0], ptr, header.x_type, prev_end->pos.x, poly4d->duration, STORED_DISTANCE_SCALE);
-  ptr = calculate_polynomial_coefficients(
-    poly4d->p[1], ptr, header.y_type, prev_end->pos.y, poly4d->duration, STORED_DISTANCE_SCALE);
-  ptr = calculate_polynomial_coefficients(
-    poly4d->p[2], ptr, header.z_type, prev_end->pos.z, poly4d->duration, STORED_DISTANCE_SCALE);
-  calculate_polynomial_coefficients(
-    poly4d->p[3], ptr, header.yaw_type, prev_end->yaw, poly4d->duration, STORED_ANGLE_SCALE);
+  for (coordinate = 0; coordinate < 4; coordinate++) {
+    n = control_points_by_type[types[coordinate]] + 1;
+    traj->current_piece.n_control_points[coordinate] = n;
+    traj->current_piece.control_points[coordinate][0] = start[coordinate];
+    for (i = 1; i < n; i++) {
+      ptr = next_coordinate(ptr, &traj->current_piece.control_points[coordinate][i]);
+    }
+  }
 }
 
 static void piecewise_compressed_advance_playhead(struct piecewise_traj_compressed *traj)
 {
-  float duration = traj->current_piece.poly4d.duration;
-  struct traj_eval end_of_previous_piece = poly4d_eval(&traj->current_piece.poly4d, duration);
+  compressed_piece_coordinate end_of_previous_piece[4];
+  uint8_t coordinate;
+
+  /* Each piece ends at its last control point */
+  for (coordinate = 0; coordinate < 4; coordinate++) {
+    uint8_t n = traj->current_piece.n_control_points[coordinate];
+    end_of_previous_piece[coordinate] = traj->current_piece.control_points[coordinate][n - 1];
+  }
 
-  traj->current_piece.t_begin_relative += duration;
+  traj->current_piece.t_begin_relative += traj->current_piece.duration;
   traj->current_piece.data = next_piece(traj->current_piece.data);
 
-  piecewise_compressed_update_current_poly4d(traj, &end_of_previous_piece);
+  piecewise_compressed_decode_current_piece(traj, end_of_previous_piece);
 }
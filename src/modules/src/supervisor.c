@@ -28,6 +28,7 @@
 #include <stdbool.h>
 #include <stdlib.h>
 
+#include "eventtrigger.h"
 #include "log.h"
 #include "motors.h"
 #include "pm.h"
@@ -44,6 +45,8 @@ static bool canFly;
 static bool isFlying;
 static bool isTumbled;
 
+EVENTTRIGGER(tumbled)
+
 bool supervisorCanFly()
 {
   return canFly;
@@ -116,7 +119,11 @@ void supervisorUpdate(const sensorData_t *data)
 {
   isFlying = isFlyingCheck();
 
+  const bool wasTumbled = isTumbled;
   isTumbled = isTumbledCheck(data);
+  if (isTumbled && !wasTumbled) {
+    eventTrigger(&eventTrigger_tumbled);
+  }
   if (isTumbled && isFlying) {
     stabilizerSetEmergencyStop();
   }
@@ -1,8 +1,27 @@
 #pragma once
 
+#include <stdbool.h>
+
 #include "ootx_decoder.h"
 #include "lighthouse_types.h"
 
+// Size of the precomputed calibration table for LH 2, see lighthouseCalibrationTableInitV2()
+#define LIGHTHOUSE_CALIBRATION_TABLE_U_SIZE 13
+#define LIGHTHOUSE_CALIBRATION_TABLE_V_SIZE 11
+
+/**
+ * @brief Precomputed calibration correction for LH 2.
+ *
+ * The correction (corrected - raw angle) of both sweeps is sampled on a grid over u = (a1 + a2) / 2 and
+ * v = (a2 - a1) / 2 of the raw angles a1 and a2, that is roughly the azimuth and elevation seen from the base station,
+ * and interpolated with a cubic spline. The grid has one extra row/column on each side that is only used by the
+ * interpolation.
+ */
+typedef struct {
+  float correction[LIGHTHOUSE_CALIBRATION_TABLE_U_SIZE][LIGHTHOUSE_CALIBRATION_TABLE_V_SIZE][2];
+  bool valid;
+} lighthouseCalibrationTable_t;
+
 /**
  * @brief Initialize calibration structure from basestation ootx frame
  *
@@ -29,6 +48,27 @@ void lighthouseCalibrationApplyV1(const lighthouseCalibration_t* calib, const fl
  */
 void lighthouseCalibrationApplyV2(const lighthouseCalibration_t* calib, const float* rawAngles, float* correctedAngles);
 
+/**
+ * @brief Precompute the calibration correction for LH 2. This is expensive and should be done once when the
+ * calibration data is changed.
+ *
+ * @param table The table to initialize, table->valid is set to calib->valid
+ * @param calib Calibration object to use
+ */
+void lighthouseCalibrationTableInitV2(lighthouseCalibrationTable_t* table, const lighthouseCalibration_t* calib);
+
+/**
+ * @brief Apply basestation calibration to the two received angles for LH 2, using a precomputed table.
+ * Angles outside the range of the table, or an invalid table, fall back to lighthouseCalibrationApplyV2().
+ * The difference to lighthouseCalibrationApplyV2() is in the order of 1e-4 radians.
+ *
+ * @param table Precomputed table for calib
+ * @param calib Calibration object to use
+ * @param rawAngles Array containing the two raw measured angles
+ * @param correctedAngles Array containing the two corrected angles after applying calibration
+ */
+void lighthouseCalibrationApplyV2Table(const lighthouseCalibrationTable_t* table, const lighthouseCalibration_t* calib, const float* rawAngles, float* correctedAngles);
+
 /**
  * @brief Apply no basestation calibration to the two received angles, that is copy the raw angles
  *
@@ -27,6 +27,28 @@ typedef struct {
  */
 bool lighthouseGeometryGetPositionFromRayIntersection(const baseStationGeometry_t baseStations[2], float angles1[2], float angles2[2], vec3d position, float *position_delta);
 
+/**
+ * @brief Find the point closest to any number of rays, for instance from all sensors and all visible base stations,
+ * in the weighted least squares sense.
+ *
+ * The angular noise of a base station gives an error across the ray that grows with the distance, the rays are
+ * therefore weighted by the inverse square of the distance from the origin to the estimated position, on top of
+ * the weights passed in. Rays that are further than maxResidual from the solution are rejected, one at a time
+ * starting with the worst. The rays must come from at least two base stations, also after rejecting rays, otherwise
+ * no position is estimated.
+ *
+ * @param origins - the origins of the rays, that is base station positions
+ * @param rays - normalized vectors in the direction of the rays
+ * @param baseStations - the base station (0 - 31) that each ray comes from
+ * @param weights - (input/output) the weight of each ray, rejected rays are set to 0
+ * @param count - the number of rays
+ * @param maxResidual - the largest accepted distance between a ray and the position, in meters
+ * @param position - (output) the estimated position
+ * @param residual - (output) the weighted RMS distance between the used rays and the position
+ * @return int - the number of rays used, 0 if the position could not be estimated
+ */
+int lighthouseGeometryGetPositionFromRays(vec3d origins[], vec3d rays[], const uint8_t baseStations[], float weights[], const int count, const float maxResidual, vec3d position, float *residual);
+
 /**
  * @brief Get the base station position from the base station geometry in world reference frame. This position can be seen as the
  * point where the lazers originate from.
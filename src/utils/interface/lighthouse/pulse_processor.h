@@ -42,6 +42,8 @@
 #define PULSE_PROCESSOR_N_SENSORS 4
 #define PULSE_PROCRSSOR_N_CONCURRENT_BLOCKS 2
 #define PULSE_PROCESSOR_N_WORKSPACE (PULSE_PROCESSOR_N_SENSORS * PULSE_PROCRSSOR_N_CONCURRENT_BLOCKS)
+#define PULSE_PROCESSOR_V2_N_BLOCK_CANDIDATES 2
+#define PULSE_PROCESSOR_V2_N_CHANNELS 16
 
 #define PULSE_PROCESSOR_HISTORY_LENGTH 8
 #define PULSE_PROCESSOR_TIMESTAMP_BITWIDTH 24
@@ -164,7 +166,7 @@ typedef struct {
 
 /**
  * @brief Raw pulse data from the sensors. Data for pulses that are close in time and probably
- * comes from the same sweep. May contain pulse data from multiple base stations.
+ * comes from the same sweep of one base station.
  *
  */
 typedef struct {
@@ -191,16 +193,39 @@ typedef struct {
     pulseProcessorV2SweepBlock_t blocks[PULSE_PROCRSSOR_N_CONCURRENT_BLOCKS];
 } pulseProcessorV2BlockWorkspace_t;
 
+/**
+ * @brief The sensors that have been hit by an ongoing sweep from a base station that we do not track
+ *
+ */
+typedef struct {
+    uint32_t latestTimestamp;
+    uint8_t sensors;
+} pulseProcessorV2UntrackedSweep_t;
+
 /**
  * @brief Holds data for V2 base station decoding
  *
  */
 typedef struct {
+  // Pulses where the channel is not known yet. They are moved to a channel workspace when the sweep they belong
+  // to can be identified.
   pulseProcessorV2PulseWorkspace_t pulseWorkspace;
   pulseProcessorV2BlockWorkspace_t blockWorkspace;
 
-  // Latest block from each base station. Used to pair both blocks (sweeps) from one rotaion of the rotor.
-  pulseProcessorV2SweepBlock_t blocks[CONFIG_DECK_LIGHTHOUSE_MAX_N_BS];
+  // Pulses sorted by channel. Sweeps from multiple base stations that overlap in time are collected separately.
+  pulseProcessorV2PulseWorkspace_t channelWorkspaces[CONFIG_DECK_LIGHTHOUSE_MAX_N_BS];
+  // Bit field with the channel workspaces that contain pulses
+  uint16_t channelWorkspacesInUse;
+
+  // Ongoing sweeps from base stations with channels we do not track, indexed by channel. Used to avoid
+  // mixing up pulses from them with sweeps from tracked channels.
+  pulseProcessorV2UntrackedSweep_t untrackedSweeps[PULSE_PROCESSOR_V2_N_CHANNELS];
+  uint16_t untrackedSweepsInUse;
+
+  // Recent blocks from each base station, in a ring buffer per channel. Used to pair both blocks (sweeps) from one
+  // rotation of the rotor.
+  pulseProcessorV2SweepBlock_t blocks[CONFIG_DECK_LIGHTHOUSE_MAX_N_BS][PULSE_PROCESSOR_V2_N_BLOCK_CANDIDATES];
+  uint8_t nextBlockCandidate[CONFIG_DECK_LIGHTHOUSE_MAX_N_BS];
 
   // Timestamp of the rotor zero position for the latest processed slowbit
   uint32_t ootxTimestamps[CONFIG_DECK_LIGHTHOUSE_MAX_N_BS];
@@ -221,6 +246,10 @@ typedef struct pulseProcessor_s {
 
   ootxDecoderState_t ootxDecoder[CONFIG_DECK_LIGHTHOUSE_MAX_N_BS];
   lighthouseCalibration_t bsCalibration[CONFIG_DECK_LIGHTHOUSE_MAX_N_BS];
+  #ifdef CONFIG_DECK_LIGHTHOUSE_CALIBRATION_TABLE
+  // Precomputed from bsCalibration, see lighthouseCalibrationTableInitV2()
+  lighthouseCalibrationTable_t bsCalibrationTable[CONFIG_DECK_LIGHTHOUSE_MAX_N_BS];
+  #endif
   baseStationGeometry_t bsGeometry[CONFIG_DECK_LIGHTHOUSE_MAX_N_BS];
   baseStationGeometryCache_t bsGeoCache[CONFIG_DECK_LIGHTHOUSE_MAX_N_BS];
 
@@ -88,15 +88,13 @@ static void idealToDistortedV2(const lighthouseCalibration_t* calib, const float
 
 typedef void (* idealToDistortedFcn_t)(const lighthouseCalibration_t* calib, const float* ideal, float* distorted);
 
-static void lighthouseCalibrationApply(const lighthouseCalibration_t* calib, const float* rawAngles, float* correctedAngles, idealToDistortedFcn_t idealToDistorted) {
-  const double max_delta = 0.0005;
-
+static void lighthouseCalibrationInvert(const lighthouseCalibration_t* calib, const float* rawAngles, float* correctedAngles, idealToDistortedFcn_t idealToDistorted, const int maxIterations, const double max_delta) {
   // Use distorted angle as a starting point
   float* estmatedAngles = correctedAngles;
   estmatedAngles[0] = rawAngles[0];
   estmatedAngles[1] = rawAngles[1];
 
-  for (int i = 0; i < 5; i++) {
+  for (int i = 0; i < maxIterations; i++) {
     float currentDistortedAngles[2];
     idealToDistorted(calib, estmatedAngles, currentDistortedAngles);
 
@@ -112,6 +110,10 @@ static void lighthouseCalibrationApply(const lighthouseCalibration_t* calib, con
   }
 }
 
+static void lighthouseCalibrationApply(const lighthouseCalibration_t* calib, const float* rawAngles, float* correctedAngles, idealToDistortedFcn_t idealToDistorted) {
+  lighthouseCalibrationInvert(calib, rawAngles, correctedAngles, idealToDistorted, 5, 0.0005);
+}
+
 void lighthouseCalibrationApplyV1(const lighthouseCalibration_t* calib, const float* rawAngles, float* correctedAngles) {
   return lighthouseCalibrationApply(calib, rawAngles, correctedAngles, idealToDistortedV1);
 }
@@ -120,6 +122,82 @@ void lighthouseCalibrationApplyV2(const lighthouseCalibration_t* calib, const fl
   return lighthouseCalibrationApply(calib, rawAngles, correctedAngles, idealToDistortedV2);
 }
 
+// Range of the table, the outermost rows and columns are only used for interpolation
+static const float TABLE_U_MAX = 1.3f;
+static const float TABLE_V_MAX = 0.75f;
+static const float TABLE_U_STEP = 2.0f * TABLE_U_MAX / (LIGHTHOUSE_CALIBRATION_TABLE_U_SIZE - 1);
+static const float TABLE_V_STEP = 2.0f * TABLE_V_MAX / (LIGHTHOUSE_CALIBRATION_TABLE_V_SIZE - 1);
+
+void lighthouseCalibrationTableInitV2(lighthouseCalibrationTable_t* table, const lighthouseCalibration_t* calib) {
+  table->valid = false;
+  if (!calib->valid) {
+    return;
+  }
+
+  for (int i = 0; i < LIGHTHOUSE_CALIBRATION_TABLE_U_SIZE; i++) {
+    for (int j = 0; j < LIGHTHOUSE_CALIBRATION_TABLE_V_SIZE; j++) {
+      const float u = -TABLE_U_MAX + i * TABLE_U_STEP;
+      const float v = -TABLE_V_MAX + j * TABLE_V_STEP;
+      const float rawAngles[2] = {u - v, u + v};
+      float correctedAngles[2];
+
+      // Converge further than when applying the calibration, the table should not add to the error
+      lighthouseCalibrationInvert(calib, rawAngles, correctedAngles, idealToDistortedV2, 20, 0.000001);
+
+      table->correction[i][j][0] = correctedAngles[0] - rawAngles[0];
+      table->correction[i][j][1] = correctedAngles[1] - rawAngles[1];
+    }
+  }
+
+  table->valid = true;
+}
+
+// Catmull-Rom weights for the four samples around a point at fraction t between the two middle samples
+static void cubicWeights(const float t, float weights[4]) {
+  const float t2 = t * t;
+  const float t3 = t2 * t;
+  weights[0] = 0.5f * (-t3 + 2.0f * t2 - t);
+  weights[1] = 0.5f * (3.0f * t3 - 5.0f * t2 + 2.0f);
+  weights[2] = 0.5f * (-3.0f * t3 + 4.0f * t2 + t);
+  weights[3] = 0.5f * (t3 - t2);
+}
+
+void lighthouseCalibrationApplyV2Table(const lighthouseCalibrationTable_t* table, const lighthouseCalibration_t* calib, const float* rawAngles, float* correctedAngles) {
+  const float u = (rawAngles[0] + rawAngles[1]) / 2.0f;
+  const float v = (rawAngles[1] - rawAngles[0]) / 2.0f;
+
+  const float fu = (u + TABLE_U_MAX) / TABLE_U_STEP;
+  const float fv = (v + TABLE_V_MAX) / TABLE_V_STEP;
+
+  // The interpolation needs one sample on each side, outside that the table does not apply
+  const bool isInTable = (fu >= 1.0f && fu < LIGHTHOUSE_CALIBRATION_TABLE_U_SIZE - 2) &&
+                         (fv >= 1.0f && fv < LIGHTHOUSE_CALIBRATION_TABLE_V_SIZE - 2);
+  if (!table->valid || !isInTable) {
+    lighthouseCalibrationApplyV2(calib, rawAngles, correctedAngles);
+    return;
+  }
+
+  const int i = (int)fu;
+  const int j = (int)fv;
+  float wu[4];
+  float wv[4];
+  cubicWeights(fu - i, wu);
+  cubicWeights(fv - j, wv);
+
+  float correction[2] = {0.0f, 0.0f};
+  for (int a = 0; a < 4; a++) {
+    for (int b = 0; b < 4; b++) {
+      const float weight = wu[a] * wv[b];
+      const float* sample = table->correction[i - 1 + a][j - 1 + b];
+      correction[0] += weight * sample[0];
+      correction[1] += weight * sample[1];
+    }
+  }
+
+  correctedAngles[0] = rawAngles[0] + correction[0];
+  correctedAngles[1] = rawAngles[1] + correction[1];
+}
+
 void lighthouseCalibrationApplyNothing(const float rawAngles[2], float correctedAngles[2]) {
   correctedAngles[0] = rawAngles[0];
   correctedAngles[1] = rawAngles[1];
@@ -115,6 +115,149 @@ bool lighthouseGeometryGetPositionFromRayIntersection(const baseStationGeometry_
     return intersect_lines(origin1, ray1, origin2, ray2, position, position_delta);
 }
 
+// Distance from a point to a ray
+static float distanceToRay(const vec3d origin, const vec3d ray, const vec3d point) {
+  const vec3d w = {point[0] - origin[0], point[1] - origin[1], point[2] - origin[2]};
+  vec3d perpendicular;
+  vec_cross_product(w, ray, perpendicular);
+  return vec_length(perpendicular);
+}
+
+// Rays closer than this are not weighted higher, to avoid dividing by zero
+#define MIN_RAY_WEIGHT_DISTANCE 0.1f
+
+// Weight of a ray, divided by the squared distance from the origin to a point
+static float rangeWeight(const vec3d origin, const float weight, const vec3d rangeFrom) {
+  const vec3d range = {rangeFrom[0] - origin[0], rangeFrom[1] - origin[1], rangeFrom[2] - origin[2]};
+  return weight / fmaxf(vec_dot(range, range), MIN_RAY_WEIGHT_DISTANCE * MIN_RAY_WEIGHT_DISTANCE);
+}
+
+// Weighted least squares solution of the point closest to the rays. The point p minimizes
+// sum(w * |(I - r * r^T) * (p - o)|^2), which gives the linear system
+// sum(w * (I - r * r^T)) * p = sum(w * (I - r * r^T) * o)
+// If rangeFrom is given, the weights are also divided by the squared distance from the origins to rangeFrom.
+static bool solvePointClosestToRays(vec3d origins[], vec3d rays[], const float weights[], const int count, const float* rangeFrom, vec3d position) {
+  float A[3][3] = {0};
+  vec3d b = {0};
+
+  for (int i = 0; i < count; i++) {
+    float w = weights[i];
+    if (w <= 0.0f) {
+      continue;
+    }
+
+    if (rangeFrom) {
+      w = rangeWeight(origins[i], w, rangeFrom);
+    }
+
+    const float* r = rays[i];
+    for (int row = 0; row < 3; row++) {
+      for (int col = 0; col < 3; col++) {
+        const float m = ((row == col) ? 1.0f : 0.0f) - r[row] * r[col];
+        A[row][col] += w * m;
+        b[row] += w * m * origins[i][col];
+      }
+    }
+  }
+
+  // Solve the symmetric 3x3 system using the adjugate
+  const float c00 = A[1][1] * A[2][2] - A[1][2] * A[2][1];
+  const float c01 = A[1][2] * A[2][0] - A[1][0] * A[2][2];
+  const float c02 = A[1][0] * A[2][1] - A[1][1] * A[2][0];
+  const float det = A[0][0] * c00 + A[0][1] * c01 + A[0][2] * c02;
+
+  // The system is singular if all rays are parallel, scale the limit with the size of the matrix
+  const float scale = A[0][0] + A[1][1] + A[2][2];
+  if (!(fabsf(det) > 1e-6f * scale * scale * scale)) {
+    return false;
+  }
+
+  const float c11 = A[0][0] * A[2][2] - A[0][2] * A[2][0];
+  const float c12 = A[0][1] * A[2][0] - A[0][0] * A[2][1];
+  const float c22 = A[0][0] * A[1][1] - A[0][1] * A[1][0];
+
+  position[0] = (c00 * b[0] + c01 * b[1] + c02 * b[2]) / det;
+  position[1] = (c01 * b[0] + c11 * b[1] + c12 * b[2]) / det;
+  position[2] = (c02 * b[0] + c12 * b[1] + c22 * b[2]) / det;
+
+  return true;
+}
+
+// Bit map of the base stations that the used rays come from, optionally without one of the rays
+static uint32_t baseStationsOfRays(const uint8_t baseStations[], const float weights[], const int count, const int without) {
+  uint32_t baseStationMap = 0;
+  for (int i = 0; i < count; i++) {
+    if (weights[i] > 0.0f && i != without) {
+      baseStationMap |= (1u << baseStations[i]);
+    }
+  }
+
+  return baseStationMap;
+}
+
+// True if the rays come from at least two base stations, rays from one base station only do not give a position
+static bool hasTwoBaseStations(const uint32_t baseStationMap) {
+  return (baseStationMap & (baseStationMap - 1)) != 0;
+}
+
+int lighthouseGeometryGetPositionFromRays(vec3d origins[], vec3d rays[], const uint8_t baseStations[], float weights[], const int count, const float maxResidual, vec3d position, float *residual) {
+  int used = 0;
+  for (int i = 0; i < count; i++) {
+    if (weights[i] > 0.0f) {
+      used++;
+    }
+  }
+
+  if (!hasTwoBaseStations(baseStationsOfRays(baseStations, weights, count, -1))) {
+    return 0;
+  }
+
+  // First solution only using the weights passed in, to get the distances to the base stations
+  vec3d firstPosition;
+  if (!solvePointClosestToRays(origins, rays, weights, count, 0, firstPosition)) {
+    return 0;
+  }
+
+  while (true) {
+    if (!solvePointClosestToRays(origins, rays, weights, count, firstPosition, position)) {
+      return 0;
+    }
+
+    int worst = -1;
+    float worstDistance = maxResidual;
+    float weightedSum = 0.0f;
+    float weightSum = 0.0f;
+    for (int i = 0; i < count; i++) {
+      if (weights[i] <= 0.0f) {
+        continue;
+      }
+
+      const float distance = distanceToRay(origins[i], rays[i], position);
+      if (distance > worstDistance) {
+        worstDistance = distance;
+        worst = i;
+      }
+
+      const float w = rangeWeight(origins[i], weights[i], firstPosition);
+      weightedSum += w * distance * distance;
+      weightSum += w;
+    }
+
+    if (worst < 0) {
+      *residual = sqrtf(weightedSum / weightSum);
+      return used;
+    }
+
+    // The outlier can not be rejected if the rest of the rays come from one base station only
+    if (!hasTwoBaseStations(baseStationsOfRays(baseStations, weights, count, worst))) {
+      return 0;
+    }
+
+    weights[worst] = 0.0f;
+    used--;
+  }
+}
+
 void lighthouseGeometryGetBaseStationPosition(const baseStationGeometry_t* bs, vec3d baseStationPos) {
     // TODO: Make geometry adjustments within base station.
     vec3d rotated_origin_delta = {};
@@ -54,7 +54,11 @@ bool pulseProcessorApplyCalibration(pulseProcessor_t *state, pulseProcessorResul
     pulseProcessorBaseStationMeasuremnt_t* bsMeasurement = &sensorMeasurements[sensor].baseStatonMeasurements[baseStation];
     if (doApplyCalibration) {
       if (lighthouseBsTypeV2 == angles->measurementType) {
+        #ifdef CONFIG_DECK_LIGHTHOUSE_CALIBRATION_TABLE
+        lighthouseCalibrationApplyV2Table(&state->bsCalibrationTable[baseStation], calibrationData, bsMeasurement->angles, bsMeasurement->correctedAngles);
+        #else
         lighthouseCalibrationApplyV2(calibrationData, bsMeasurement->angles, bsMeasurement->correctedAngles);
+        #endif
       } else {
         lighthouseCalibrationApplyV1(calibrationData, bsMeasurement->angles, bsMeasurement->correctedAngles);
       }
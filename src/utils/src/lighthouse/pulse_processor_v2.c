@@ -43,10 +43,8 @@ static const uint8_t NO_CHANNEL = 0xff;
 static const int NO_SENSOR = -1;
 static const uint32_t NO_OFFSET = 0;
 
-#define V2_N_CHANNELS 16
-
 // The cycle times come from the base stations and are expressed in a 48 MHz clock, we use 24 MHz clock hence the "/ 2".
-static const uint32_t CYCLE_PERIODS[V2_N_CHANNELS] = {
+static const uint32_t CYCLE_PERIODS[PULSE_PROCESSOR_V2_N_CHANNELS] = {
     959000 / 2, 957000 / 2, 953000 / 2, 949000 / 2,
     947000 / 2, 943000 / 2, 941000 / 2, 939000 / 2,
     937000 / 2, 929000 / 2, 919000 / 2, 911000 / 2,
@@ -218,22 +216,196 @@ TESTABLE_STATIC void clearWorkspace(pulseProcessorV2PulseWorkspace_t* pulseWorks
     pulseWorkspace->slotsUsed = 0;
 }
 
-TESTABLE_STATIC bool processFrame(const pulseProcessorFrame_t* frameData, pulseProcessorV2PulseWorkspace_t* pulseWorkspace, pulseProcessorV2BlockWorkspace_t* blockWorkspace) {
-    int nrOfBlocks = 0;
+static int closeChannelWorkspace(pulseProcessorV2_t* v2, const uint8_t channel) {
+    pulseProcessorV2PulseWorkspace_t* pulseWorkspace = &v2->channelWorkspaces[channel];
+    const int nrOfBlocks = processWorkspace(pulseWorkspace, &v2->blockWorkspace);
+    clearWorkspace(pulseWorkspace);
+    v2->channelWorkspacesInUse &= ~(1 << channel);
 
+    return nrOfBlocks;
+}
+
+static bool isWorkspaceTimedOut(const pulseProcessorV2PulseWorkspace_t* pulseWorkspace, const uint32_t timestamp) {
     // Sensor timestamps may arrive in the wrong order, we need an abs() when checking the diff
-    const bool isFirstFrameInNewWorkspace = TS_ABS_DIFF_LARGER_THAN(frameData->timestamp, pulseWorkspace->latestTimestamp, MAX_TICKS_SENSOR_TO_SENSOR);
-    if (isFirstFrameInNewWorkspace) {
-        nrOfBlocks = processWorkspace(pulseWorkspace, blockWorkspace);
-        clearWorkspace(pulseWorkspace);
+    return TS_ABS_DIFF_LARGER_THAN(timestamp, pulseWorkspace->latestTimestamp, MAX_TICKS_SENSOR_TO_SENSOR);
+}
+
+/**
+ * @brief Close at most one channel workspace that does not get any more pulses. The workspace of the
+ * channel of the frame is closed first, since the frame is stored in it.
+ *
+ * @return The number of blocks in the block workspace
+ */
+static int closeTimedOutWorkspace(pulseProcessorV2_t* v2, const pulseProcessorFrame_t* frameData) {
+    const uint32_t timestamp = frameData->timestamp;
+
+    if (frameData->channelFound && frameData->channel < CONFIG_DECK_LIGHTHOUSE_MAX_N_BS) {
+        const uint8_t channel = frameData->channel;
+        if ((v2->channelWorkspacesInUse & (1 << channel)) && isWorkspaceTimedOut(&v2->channelWorkspaces[channel], timestamp)) {
+            return closeChannelWorkspace(v2, channel);
+        }
     }
 
-    pulseWorkspace->latestTimestamp = frameData->timestamp;
+    for (uint8_t channel = 0; v2->channelWorkspacesInUse >> channel; channel++) {
+        if ((v2->channelWorkspacesInUse & (1 << channel)) && isWorkspaceTimedOut(&v2->channelWorkspaces[channel], timestamp)) {
+            return closeChannelWorkspace(v2, channel);
+        }
+    }
+
+    return 0;
+}
+
+static uint8_t sensorsInWorkspace(const pulseProcessorV2PulseWorkspace_t* pulseWorkspace) {
+    uint8_t sensorMask = 0;
+    for (int i = 0; i < pulseWorkspace->slotsUsed; i++) {
+        sensorMask |= (1 << pulseWorkspace->slots[i].sensor);
+    }
+
+    return sensorMask;
+}
 
+static void storePulseInChannelWorkspace(const pulseProcessorFrame_t* frameData, pulseProcessorV2_t* v2, const uint8_t channel) {
+    pulseProcessorV2PulseWorkspace_t* pulseWorkspace = &v2->channelWorkspaces[channel];
+    pulseWorkspace->latestTimestamp = frameData->timestamp;
     if (! storePulse(frameData, pulseWorkspace)) {
         clearWorkspace(pulseWorkspace);
     }
 
+    v2->channelWorkspacesInUse |= (1 << channel);
+}
+
+static bool isUntrackedSweepOpen(const pulseProcessorV2_t* v2, const uint8_t channel, const uint32_t timestamp) {
+    return (v2->untrackedSweepsInUse & (1 << channel)) &&
+        ! TS_ABS_DIFF_LARGER_THAN(timestamp, v2->untrackedSweeps[channel].latestTimestamp, MAX_TICKS_SENSOR_TO_SENSOR);
+}
+
+/**
+ * @brief Count the ongoing sweeps, tracked and untracked, that have not hit a sensor yet.
+ *
+ * @param excludedChannel Channel to skip, or NO_CHANNEL
+ * @param trackedChannel Set to the channel of one of the tracked sweeps that was found
+ * @return The number of sweeps
+ */
+static int countSweepsWaitingForSensor(const pulseProcessorV2_t* v2, const uint8_t sensor, const uint32_t timestamp, const uint8_t excludedChannel, uint8_t* trackedChannel) {
+    const uint8_t sensorBit = (1 << sensor);
+    int count = 0;
+
+    for (uint8_t channel = 0; v2->channelWorkspacesInUse >> channel; channel++) {
+        const pulseProcessorV2PulseWorkspace_t* pulseWorkspace = &v2->channelWorkspaces[channel];
+        if (channel != excludedChannel && (v2->channelWorkspacesInUse & (1 << channel)) &&
+            ! isWorkspaceTimedOut(pulseWorkspace, timestamp) &&
+            (sensorsInWorkspace(pulseWorkspace) & sensorBit) == 0) {
+            *trackedChannel = channel;
+            count++;
+        }
+    }
+
+    for (uint8_t channel = CONFIG_DECK_LIGHTHOUSE_MAX_N_BS; v2->untrackedSweepsInUse >> channel; channel++) {
+        if (channel != excludedChannel && isUntrackedSweepOpen(v2, channel, timestamp) &&
+            (v2->untrackedSweeps[channel].sensors & sensorBit) == 0) {
+            count++;
+        }
+    }
+
+    return count;
+}
+
+/**
+ * @brief Move pending pulses, with unknown channel, to the sweep of a channel. A sweep hits each
+ * sensor once, pulses from sensors that already are in the sweep are from some other sweep and
+ * are left in the pending workspace. So are pulses that might belong to some other ongoing sweep.
+ *
+ * @param pulseWorkspace The workspace to move pulses to, or NULL to discard them
+ * @param sensorMask Sensors in the sweep, updated with the moved pulses
+ */
+static void movePendingPulses(pulseProcessorV2_t* v2, const uint8_t channel, pulseProcessorV2PulseWorkspace_t* pulseWorkspace, uint8_t* sensorMask, const uint32_t timestamp) {
+    pulseProcessorV2PulseWorkspace_t* pending = &v2->pulseWorkspace;
+    if (isWorkspaceTimedOut(pending, timestamp)) {
+        clearWorkspace(pending);
+        return;
+    }
+
+    int slotsLeft = 0;
+    for (int i = 0; i < pending->slotsUsed; i++) {
+        const pulseProcessorFrame_t* frame = &pending->slots[i];
+        const uint8_t sensorBit = (1 << frame->sensor);
+        uint8_t otherChannel;
+        const bool isAmbiguous = countSweepsWaitingForSensor(v2, frame->sensor, timestamp, channel, &otherChannel) > 0;
+        if ((*sensorMask & sensorBit) == 0 && ! isAmbiguous && (pulseWorkspace == NULL || storePulse(frame, pulseWorkspace))) {
+            *sensorMask |= sensorBit;
+        } else {
+            pending->slots[slotsLeft] = *frame;
+            slotsLeft++;
+        }
+    }
+    pending->slotsUsed = slotsLeft;
+}
+
+/**
+ * @brief Find the channel of a pulse where the FPGA did not decode the channel. The pulse belongs to
+ * an ongoing sweep if there is exactly one sweep that is waiting for the sensor.
+ *
+ * @return The channel, or NO_CHANNEL if it is unknown, ambiguous or not tracked
+ */
+static uint8_t findChannelOfPulse(const pulseProcessorV2_t* v2, const pulseProcessorFrame_t* frameData) {
+    uint8_t channel = NO_CHANNEL;
+    if (countSweepsWaitingForSensor(v2, frameData->sensor, frameData->timestamp, NO_CHANNEL, &channel) != 1) {
+        return NO_CHANNEL;
+    }
+
+    return channel;
+}
+
+static void storeUntrackedPulse(const pulseProcessorFrame_t* frameData, pulseProcessorV2_t* v2) {
+    const uint8_t channel = frameData->channel;
+    pulseProcessorV2UntrackedSweep_t* sweep = &v2->untrackedSweeps[channel];
+    if (! isUntrackedSweepOpen(v2, channel, frameData->timestamp)) {
+        sweep->sensors = 0;
+    }
+
+    movePendingPulses(v2, channel, NULL, &sweep->sensors, frameData->timestamp);
+    sweep->sensors |= (1 << frameData->sensor);
+    sweep->latestTimestamp = frameData->timestamp;
+    v2->untrackedSweepsInUse |= (1 << channel);
+}
+
+/**
+ * @brief Sort a frame into the workspace of its channel and process workspaces that are complete.
+ * Sweeps from multiple base stations may overlap in time, pulses are collected per channel to avoid
+ * mixing them up. Pulses with unknown channel are kept until a pulse with known channel arrives.
+ *
+ * @return The number of blocks in the block workspace of v2
+ */
+TESTABLE_STATIC int processFrame(const pulseProcessorFrame_t* frameData, pulseProcessorV2_t* v2) {
+    const int nrOfBlocks = closeTimedOutWorkspace(v2, frameData);
+
+    if (frameData->channelFound) {
+        if (frameData->channel < CONFIG_DECK_LIGHTHOUSE_MAX_N_BS) {
+            // Pulses with unknown channel, preceding this pulse, are probably from the same sweep
+            pulseProcessorV2PulseWorkspace_t* pulseWorkspace = &v2->channelWorkspaces[frameData->channel];
+            uint8_t sensorMask = sensorsInWorkspace(pulseWorkspace);
+            movePendingPulses(v2, frameData->channel, pulseWorkspace, &sensorMask, frameData->timestamp);
+            storePulseInChannelWorkspace(frameData, v2, frameData->channel);
+        } else if (frameData->channel < PULSE_PROCESSOR_V2_N_CHANNELS) {
+            storeUntrackedPulse(frameData, v2);
+        }
+    } else {
+        const uint8_t channel = findChannelOfPulse(v2, frameData);
+        if (channel != NO_CHANNEL) {
+            storePulseInChannelWorkspace(frameData, v2, channel);
+        } else {
+            pulseProcessorV2PulseWorkspace_t* pending = &v2->pulseWorkspace;
+            if (isWorkspaceTimedOut(pending, frameData->timestamp)) {
+                clearWorkspace(pending);
+            }
+
+            pending->latestTimestamp = frameData->timestamp;
+            if (! storePulse(frameData, pending)) {
+                clearWorkspace(pending);
+            }
+        }
+    }
+
     return nrOfBlocks;
 }
 
@@ -300,22 +472,31 @@ bool handleAngles(pulseProcessor_t *state, const pulseProcessorFrame_t* frameDat
 
     clearStaleAnglesAfterTimeout(angles);
 
-    int nrOfBlocks = processFrame(frameData, &state->v2.pulseWorkspace, &state->v2.blockWorkspace);
+    int nrOfBlocks = processFrame(frameData, &state->v2);
     for (int i = 0; i < nrOfBlocks; i++) {
         const pulseProcessorV2SweepBlock_t* block = &state->v2.blockWorkspace.blocks[i];
         const uint8_t channel = block->channel;
         if (channel < CONFIG_DECK_LIGHTHOUSE_MAX_N_BS) {
-            pulseProcessorV2SweepBlock_t* previousBlock = &state->v2.blocks[channel];
-            if (isBlockPairGood(block, previousBlock)) {
-                calculateAngles(block, previousBlock, angles);
-
-                *baseStation = channel;
-                *axis = sweepIdSecond;
-                angles->measurementType = lighthouseBsTypeV2;
+            bool isPaired = false;
+            for (int candidate = 0; candidate < PULSE_PROCESSOR_V2_N_BLOCK_CANDIDATES; candidate++) {
+                const pulseProcessorV2SweepBlock_t* previousBlock = &state->v2.blocks[channel][candidate];
+                if (isBlockPairGood(block, previousBlock)) {
+                    calculateAngles(block, previousBlock, angles);
+
+                    *baseStation = channel;
+                    *axis = sweepIdSecond;
+                    angles->measurementType = lighthouseBsTypeV2;
+
+                    anglesMeasured = true;
+                    isPaired = true;
+                    break;
+                }
+            }
 
-                anglesMeasured = true;
-            } else {
-                memcpy(previousBlock, block, sizeof(pulseProcessorV2SweepBlock_t));
+            if (! isPaired) {
+                uint8_t* next = &state->v2.nextBlockCandidate[channel];
+                memcpy(&state->v2.blocks[channel][*next], block, sizeof(pulseProcessorV2SweepBlock_t));
+                *next = (*next + 1) % PULSE_PROCESSOR_V2_N_BLOCK_CANDIDATES;
             }
         }
     }
@@ -0,0 +1,341 @@
+// File under test usdLogBuffer.h
+#include "usdLogBuffer.h"
+
+#include <string.h>
+#include "unity.h"
+
+#define EVENT_A 1
+#define EVENT_B 2
+// event id + ticks + payload
+#define RECORD_SIZE_A (2 + 8 + 2)
+#define RECORD_SIZE_B (2 + 8)
+
+static uint8_t data[64];
+static usdLogBuffer_t sut;
+
+static uint16_t recordSize(uint16_t eventId);
+static bool pushRecord(uint16_t eventId, uint64_t ticks, uint32_t* pendingOverruns);
+static uint64_t ticksOfFirstRecord();
+
+void setUp(void) {
+  memset(data, 0, sizeof(data));
+  usdLogBufferInit(&sut, data, 40, recordSize);
+}
+
+void testThatPushedDataCanBePeekedAcrossTheEndOfTheBuffer() {
+  // Fixture
+  ringBuffer_t ring;
+  ringBuffer_init(&ring, data, 8);
+  const uint8_t filler[6] = {0};
+  ringBuffer_push(&ring, filler, sizeof(filler));
+  ringBuffer_discard(&ring, sizeof(filler));
+
+  const uint8_t expected[5] = {1, 2, 3, 4, 5};
+  uint8_t actual[5] = {0};
+
+  // Test
+  bool pushed = ringBuffer_push(&ring, expected, sizeof(expected));
+  bool peeked = ringBuffer_peek(&ring, 0, actual, sizeof(actual));
+
+  // Assert
+  TEST_ASSERT_TRUE(pushed);
+  TEST_ASSERT_TRUE(peeked);
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(expected, actual, sizeof(expected));
+  TEST_ASSERT_EQUAL_UINT16(5, ring.size);
+}
+
+void testThatPopReturnsWrappedDataInTwoBlocks() {
+  // Fixture
+  ringBuffer_t ring;
+  ringBuffer_init(&ring, data, 8);
+  const uint8_t filler[6] = {0};
+  ringBuffer_push(&ring, filler, sizeof(filler));
+  ringBuffer_discard(&ring, sizeof(filler));
+
+  const uint8_t expected[5] = {1, 2, 3, 4, 5};
+  ringBuffer_push(&ring, expected, sizeof(expected));
+
+  const uint8_t* buf;
+  uint16_t size;
+
+  // Test
+  // Assert
+  TEST_ASSERT_TRUE(ringBuffer_pop_start(&ring, &buf, &size));
+  TEST_ASSERT_EQUAL_UINT16(2, size);
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(&expected[0], buf, 2);
+  ringBuffer_pop_done(&ring);
+
+  TEST_ASSERT_TRUE(ringBuffer_pop_start(&ring, &buf, &size));
+  TEST_ASSERT_EQUAL_UINT16(3, size);
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(&expected[2], buf, 3);
+  ringBuffer_pop_done(&ring);
+
+  TEST_ASSERT_FALSE(ringBuffer_pop_start(&ring, &buf, &size));
+}
+
+void testThatPushFailsWhenTheDataDoesNotFit() {
+  // Fixture
+  ringBuffer_t ring;
+  ringBuffer_init(&ring, data, 8);
+  const uint8_t bytes[6] = {0};
+  ringBuffer_push(&ring, bytes, sizeof(bytes));
+
+  // Test
+  bool actual = ringBuffer_push(&ring, bytes, sizeof(bytes));
+
+  // Assert
+  TEST_ASSERT_FALSE(actual);
+  TEST_ASSERT_EQUAL_UINT16(6, ring.size);
+}
+
+void testThatEventsOlderThanThePreTriggerTimeAreDiscarded() {
+  // Fixture
+  usdLogBufferSetTrigger(&sut, 1, 0);
+  uint32_t pendingOverruns = 0;
+  pushRecord(EVENT_A, 0, &pendingOverruns);
+  pushRecord(EVENT_B, 700, &pendingOverruns);
+  pushRecord(EVENT_A, 1500, &pendingOverruns);
+
+  // Test
+  uint32_t actual = usdLogBufferDiscardOldEvents(&sut, 1600, RECORD_SIZE_B);
+
+  // Assert
+  TEST_ASSERT_EQUAL_UINT32(1, actual);
+  TEST_ASSERT_EQUAL_UINT16(RECORD_SIZE_B + RECORD_SIZE_A, sut.ring.size);
+  TEST_ASSERT_EQUAL_UINT64(700, ticksOfFirstRecord());
+}
+
+void testThatTheOldestEventsAreDiscardedToMakeRoom() {
+  // Fixture
+  usdLogBufferSetTrigger(&sut, 1000, 0);
+  uint32_t pendingOverruns = 0;
+  pushRecord(EVENT_A, 0, &pendingOverruns);
+  pushRecord(EVENT_B, 1, &pendingOverruns);
+  pushRecord(EVENT_A, 2, &pendingOverruns);
+
+  // Test
+  uint32_t actual = usdLogBufferDiscardOldEvents(&sut, 3, RECORD_SIZE_A);
+
+  // Assert
+  TEST_ASSERT_EQUAL_UINT32(1, actual);
+  TEST_ASSERT_EQUAL_UINT16(RECORD_SIZE_B + RECORD_SIZE_A, sut.ring.size);
+  TEST_ASSERT_EQUAL_UINT64(1, ticksOfFirstRecord());
+}
+
+void testThatRecentEventsAreKeptWhenThereIsRoom() {
+  // Fixture
+  usdLogBufferSetTrigger(&sut, 1, 0);
+  uint32_t pendingOverruns = 0;
+  pushRecord(EVENT_A, 100, &pendingOverruns);
+  pushRecord(EVENT_B, 200, &pendingOverruns);
+
+  // Test
+  uint32_t actual = usdLogBufferDiscardOldEvents(&sut, 1100, RECORD_SIZE_A);
+
+  // Assert
+  TEST_ASSERT_EQUAL_UINT32(0, actual);
+  TEST_ASSERT_EQUAL_UINT16(RECORD_SIZE_A + RECORD_SIZE_B, sut.ring.size);
+}
+
+void testThatEventsNewerThanTheCurrentTimeAreNotDiscarded() {
+  // Fixture
+  usdLogBufferSetTrigger(&sut, 1, 0);
+  uint32_t pendingOverruns = 0;
+  pushRecord(EVENT_A, 2000, &pendingOverruns);
+
+  // Test
+  uint32_t actual = usdLogBufferDiscardOldEvents(&sut, 1999, RECORD_SIZE_A);
+
+  // Assert
+  TEST_ASSERT_EQUAL_UINT32(0, actual);
+  TEST_ASSERT_EQUAL_UINT16(RECORD_SIZE_A, sut.ring.size);
+}
+
+void testThatEventsAreDiscardedAcrossTheEndOfTheBuffer() {
+  // Fixture
+  usdLogBufferSetTrigger(&sut, 1000, 0);
+  uint32_t pendingOverruns = 0;
+  pushRecord(EVENT_A, 0, &pendingOverruns);
+  pushRecord(EVENT_A, 1, &pendingOverruns);
+  pushRecord(EVENT_A, 2, &pendingOverruns);
+  usdLogBufferDiscardOldEvents(&sut, 3, RECORD_SIZE_A);
+  // the record wraps around the end of the 40 byte buffer
+  pushRecord(EVENT_A, 3, &pendingOverruns);
+
+  // Test
+  uint32_t actual = usdLogBufferDiscardOldEvents(&sut, 4, 2 * RECORD_SIZE_A);
+
+  // Assert
+  TEST_ASSERT_EQUAL_UINT32(2, actual);
+  TEST_ASSERT_EQUAL_UINT64(3, ticksOfFirstRecord());
+}
+
+void testThatAnOverrunRecordIsWrittenBeforeTheNextRecordOfTheBlock() {
+  // Fixture
+  uint32_t pendingOverruns = 3;
+
+  // Test
+  bool actual = pushRecord(EVENT_A, 4711, &pendingOverruns);
+
+  // Assert
+  TEST_ASSERT_TRUE(actual);
+  TEST_ASSERT_EQUAL_UINT32(0, pendingOverruns);
+  TEST_ASSERT_EQUAL_UINT16(sizeof(usdLogOverrunRecord_t) + RECORD_SIZE_A, sut.ring.size);
+
+  usdLogOverrunRecord_t overrun;
+  ringBuffer_peek(&sut.ring, 0, &overrun, sizeof(overrun));
+  TEST_ASSERT_EQUAL_UINT16(USD_LOG_OVERRUN_EVENT_ID, overrun.eventId);
+  TEST_ASSERT_EQUAL_UINT64(4711, overrun.ticks);
+  TEST_ASSERT_EQUAL_UINT16(EVENT_A, overrun.lostEventId);
+  TEST_ASSERT_EQUAL_UINT32(3, overrun.count);
+
+  uint16_t eventId;
+  ringBuffer_peek(&sut.ring, sizeof(overrun), &eventId, sizeof(eventId));
+  TEST_ASSERT_EQUAL_UINT16(EVENT_A, eventId);
+}
+
+void testThatNothingIsPushedWhenTheRecordAndTheOverrunRecordDoNotFit() {
+  // Fixture
+  uint32_t pendingOverruns = 0;
+  pushRecord(EVENT_A, 0, &pendingOverruns);
+  pushRecord(EVENT_A, 1, &pendingOverruns);
+  pendingOverruns = 2;
+
+  // Test
+  bool actual = usdLogBufferBeginRecord(&sut, EVENT_A, 2, RECORD_SIZE_A, &pendingOverruns);
+
+  // Assert
+  TEST_ASSERT_FALSE(actual);
+  TEST_ASSERT_EQUAL_UINT32(2, pendingOverruns);
+  TEST_ASSERT_EQUAL_UINT16(2 * RECORD_SIZE_A, sut.ring.size);
+}
+
+void testThatNoOverrunRecordIsWrittenBeforeTheTrigger() {
+  // Fixture
+  usdLogBufferSetTrigger(&sut, 1000, 1000);
+  uint32_t pendingOverruns = 3;
+
+  // Test
+  bool actual = pushRecord(EVENT_A, 0, &pendingOverruns);
+
+  // Assert
+  TEST_ASSERT_TRUE(actual);
+  TEST_ASSERT_EQUAL_UINT32(3, pendingOverruns);
+  TEST_ASSERT_EQUAL_UINT16(RECORD_SIZE_A, sut.ring.size);
+}
+
+void testThatTheBufferIsNotWaitingForATriggerWithoutTrigger() {
+  // Fixture
+  // Test
+  bool actual = usdLogBufferIsWaitingForTrigger(&sut);
+
+  // Assert
+  TEST_ASSERT_FALSE(actual);
+}
+
+void testThatTheBufferIsWaitingUntilTheTriggerFires() {
+  // Fixture
+  usdLogBufferSetTrigger(&sut, 1000, 1000);
+
+  // Test
+  // Assert
+  TEST_ASSERT_TRUE(usdLogBufferIsWaitingForTrigger(&sut));
+  usdLogBufferTrigger(&sut, 1234);
+  TEST_ASSERT_FALSE(usdLogBufferIsWaitingForTrigger(&sut));
+  TEST_ASSERT_EQUAL_UINT64(1234, sut.triggerTicks);
+}
+
+void testThatOnlyTheFirstTriggerSetsTheTriggerTime() {
+  // Fixture
+  usdLogBufferSetTrigger(&sut, 1000, 1000);
+  usdLogBufferTrigger(&sut, 1234);
+
+  // Test
+  usdLogBufferTrigger(&sut, 5678);
+
+  // Assert
+  TEST_ASSERT_EQUAL_UINT64(1234, sut.triggerTicks);
+}
+
+void testThatResetEmptiesTheBufferAndArmsTheTrigger() {
+  // Fixture
+  usdLogBufferSetTrigger(&sut, 1000, 1000);
+  uint32_t pendingOverruns = 0;
+  pushRecord(EVENT_A, 0, &pendingOverruns);
+  usdLogBufferTrigger(&sut, 1234);
+
+  // Test
+  usdLogBufferReset(&sut);
+
+  // Assert
+  TEST_ASSERT_EQUAL_UINT16(0, sut.ring.size);
+  TEST_ASSERT_TRUE(usdLogBufferIsWaitingForTrigger(&sut));
+}
+
+void testThatLoggingContinuesUntilThePostTriggerTimeHasPassed() {
+  // Fixture
+  usdLogBufferSetTrigger(&sut, 1000, 2000);
+
+  // Test
+  // Assert
+  TEST_ASSERT_FALSE(usdLogBufferIsPostTriggerDone(&sut, 5000000));
+  usdLogBufferTrigger(&sut, 1000000);
+  TEST_ASSERT_FALSE(usdLogBufferIsPostTriggerDone(&sut, 3000000));
+  TEST_ASSERT_TRUE(usdLogBufferIsPostTriggerDone(&sut, 3000001));
+}
+
+void testThatLoggingDoesNotStopWhenTheTriggerIsNewerThanTheCurrentTime() {
+  // Fixture
+  usdLogBufferSetTrigger(&sut, 1000, 2000);
+  usdLogBufferTrigger(&sut, 1000000);
+
+  // Test
+  bool actual = usdLogBufferIsPostTriggerDone(&sut, 999999);
+
+  // Assert
+  TEST_ASSERT_FALSE(actual);
+}
+
+void testThatLoggingDoesNotStopWithoutTrigger() {
+  // Fixture
+  usdLogBufferTrigger(&sut, 1000000);
+
+  // Test
+  bool actual = usdLogBufferIsPostTriggerDone(&sut, 5000000);
+
+  // Assert
+  TEST_ASSERT_FALSE(actual);
+}
+
+// Helpers ////////////////////////////////////////////////
+
+static uint16_t recordSize(uint16_t eventId) {
+  switch (eventId) {
+    case EVENT_A:
+      return RECORD_SIZE_A;
+    case EVENT_B:
+      return RECORD_SIZE_B;
+    default:
+      return 0;
+  }
+}
+
+static bool pushRecord(uint16_t eventId, uint64_t ticks, uint32_t* pendingOverruns) {
+  const uint16_t size = recordSize(eventId);
+  if (!usdLogBufferBeginRecord(&sut, eventId, ticks, size, pendingOverruns)) {
+    return false;
+  }
+
+  const uint8_t payload[2] = {0xAB, 0xCD};
+  const uint16_t payloadSize = size - RECORD_SIZE_B;
+  if (payloadSize) {
+    ringBuffer_push(&sut.ring, payload, payloadSize);
+  }
+  return true;
+}
+
+static uint64_t ticksOfFirstRecord() {
+  uint64_t ticks;
+  ringBuffer_peek(&sut.ring, sizeof(uint16_t), &ticks, sizeof(ticks));
+  return ticks;
+}
@@ -0,0 +1,625 @@
+// File under test kalman_core.c
+#include "kalman_core.h"
+#include "physicalConstants.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "unity.h"
+
+#include "mock_cfassert.h"
+
+// Build the arm dsp math lib and use the "real thing" instead of mocking calls to it
+// @BUILD_LIB ARM_DSP_MATH
+
+// #define SHOW_OUTPUT
+
+// The tests are layout agnostic and access the covariance matrix through KC_COV(). To test the packed covariance
+// layout, run the tests with DEFINES=CONFIG_ESTIMATOR_KALMAN_PACKED_COVARIANCE
+
+#define BENCHMARK_ITERATIONS 10000
+
+static kalmanCoreData_t dense;
+static kalmanCoreData_t sparse;
+static kalmanCoreParams_t params;
+
+static float randomFloat(float min, float max);
+static void populateWithRandomCovariance(kalmanCoreData_t* this);
+static void copyCoreData(kalmanCoreData_t* dest, const kalmanCoreData_t* src);
+static void assertCoreDataEqual(const kalmanCoreData_t* expected, const kalmanCoreData_t* actual, const float tolerance);
+static float predictLinearMeasurement(const kalmanCoreData_t* this, const float* h);
+static void referenceScalarUpdate(float P[KC_STATE_DIM][KC_STATE_DIM], float S[KC_STATE_DIM], const float* h, float error, float stdMeasNoise);
+static void referenceDynamicsMatrix(const kalmanCoreData_t* this, const Axis3f* gyro, float dt, float A[KC_STATE_DIM][KC_STATE_DIM]);
+static void referenceTransform(float P[KC_STATE_DIM][KC_STATE_DIM], float A[KC_STATE_DIM][KC_STATE_DIM]);
+static void assertCovarianceEqual(float expected[KC_STATE_DIM][KC_STATE_DIM], const kalmanCoreData_t* actual, const float tolerance);
+
+void setUp(void) {
+  srand(4711);
+
+  kalmanCoreDefaultParams(&params);
+  kalmanCoreInit(&dense, &params);
+  populateWithRandomCovariance(&dense);
+  copyCoreData(&sparse, &dense);
+}
+
+void tearDown(void) {
+  // Empty
+}
+
+void testThatSparseScalarUpdateIsEquivalentToDenseForSingleElementH() {
+#ifdef CONFIG_ESTIMATOR_KALMAN_PACKED_COVARIANCE
+  TEST_IGNORE_MESSAGE("The dense scalar update is not available with packed covariance");
+#else
+  // Fixture
+  float h[KC_STATE_DIM] = {0};
+  arm_matrix_instance_f32 H = {1, KC_STATE_DIM, h};
+  h[KC_STATE_Z] = 1.0f;
+
+  // Test
+  kalmanCoreScalarUpdateDense(&dense, &H, 0.3f, 0.1f);
+  kalmanCoreScalarUpdateSparse(&sparse, &H, 0.3f, 0.1f);
+
+  // Assert
+  assertCoreDataEqual(&dense, &sparse, 1e-5f);
+#endif
+}
+
+void testThatSparseScalarUpdateIsEquivalentToDenseForTdoaLikeH() {
+#ifdef CONFIG_ESTIMATOR_KALMAN_PACKED_COVARIANCE
+  TEST_IGNORE_MESSAGE("The dense scalar update is not available with packed covariance");
+#else
+  // Fixture
+  float h[KC_STATE_DIM] = {0};
+  arm_matrix_instance_f32 H = {1, KC_STATE_DIM, h};
+  h[KC_STATE_X] = 0.57f;
+  h[KC_STATE_Y] = -0.21f;
+  h[KC_STATE_Z] = 0.79f;
+
+  // Test
+  kalmanCoreScalarUpdateDense(&dense, &H, -0.12f, 0.15f);
+  kalmanCoreScalarUpdateSparse(&sparse, &H, -0.12f, 0.15f);
+
+  // Assert
+  assertCoreDataEqual(&dense, &sparse, 1e-5f);
+#endif
+}
+
+void testThatSparseScalarUpdateIsEquivalentToDenseForFullH() {
+#ifdef CONFIG_ESTIMATOR_KALMAN_PACKED_COVARIANCE
+  TEST_IGNORE_MESSAGE("The dense scalar update is not available with packed covariance");
+#else
+  // Fixture
+  float h[KC_STATE_DIM];
+  arm_matrix_instance_f32 H = {1, KC_STATE_DIM, h};
+  for (int i = 0; i < KC_STATE_DIM; i++) {
+    h[i] = randomFloat(-1.0f, 1.0f);
+  }
+
+  // Test
+  kalmanCoreScalarUpdateDense(&dense, &H, 0.05f, 0.2f);
+  kalmanCoreScalarUpdateSparse(&sparse, &H, 0.05f, 0.2f);
+
+  // Assert
+  assertCoreDataEqual(&dense, &sparse, 1e-5f);
+#endif
+}
+
+void testThatSparseScalarUpdateIsEquivalentToDenseForSequenceOfUpdates() {
+#ifdef CONFIG_ESTIMATOR_KALMAN_PACKED_COVARIANCE
+  TEST_IGNORE_MESSAGE("The dense scalar update is not available with packed covariance");
+#else
+  // Fixture
+  float h[KC_STATE_DIM];
+  arm_matrix_instance_f32 H = {1, KC_STATE_DIM, h};
+
+  // Test
+  for (int n = 0; n < 100; n++) {
+    memset(h, 0, sizeof(h));
+    for (int k = 0; k < 3; k++) {
+      h[rand() % KC_STATE_DIM] = randomFloat(-1.0f, 1.0f);
+    }
+    const float error = randomFloat(-0.1f, 0.1f);
+    const float stdDev = randomFloat(0.05f, 0.5f);
+
+    kalmanCoreScalarUpdateDense(&dense, &H, error, stdDev);
+    kalmanCoreScalarUpdateSparse(&sparse, &H, error, stdDev);
+  }
+
+  // Assert
+  assertCoreDataEqual(&dense, &sparse, 1e-4f);
+#endif
+}
+
+void testThatSparseScalarUpdateMatchesReference() {
+  // Fixture
+  float h[KC_STATE_DIM] = {0};
+  arm_matrix_instance_f32 H = {1, KC_STATE_DIM, h};
+  h[KC_STATE_X] = 0.57f;
+  h[KC_STATE_Y] = -0.21f;
+  h[KC_STATE_D2] = 0.79f;
+
+  float expectedP[KC_STATE_DIM][KC_STATE_DIM];
+  float expectedS[KC_STATE_DIM];
+  kalmanCoreGetCovarianceMatrix(&sparse, expectedP);
+  memcpy(expectedS, sparse.S, sizeof(expectedS));
+  referenceScalarUpdate(expectedP, expectedS, h, -0.12f, 0.15f);
+
+  // Test
+  kalmanCoreScalarUpdateSparse(&sparse, &H, -0.12f, 0.15f);
+
+  // Assert
+  assertCovarianceEqual(expectedP, &sparse, 1e-5f);
+  for (int i = 0; i < KC_STATE_DIM; i++) {
+    TEST_ASSERT_FLOAT_WITHIN(1e-5f, expectedS[i], sparse.S[i]);
+  }
+}
+
+void testThatPredictedCovarianceMatchesReference() {
+  // Fixture
+  Axis3f acc = {.x = 0.1f, .y = -0.2f, .z = 1.1f};
+  Axis3f gyro = {.x = 0.8f, .y = -0.5f, .z = 1.3f};
+  const float dt = 0.002f;
+  sparse.S[KC_STATE_PX] = 0.4f;
+  sparse.S[KC_STATE_PY] = -0.3f;
+  sparse.S[KC_STATE_PZ] = 0.2f;
+
+  float A[KC_STATE_DIM][KC_STATE_DIM];
+  float expected[KC_STATE_DIM][KC_STATE_DIM];
+  referenceDynamicsMatrix(&sparse, &gyro, dt, A);
+  kalmanCoreGetCovarianceMatrix(&sparse, expected);
+  referenceTransform(expected, A);
+
+  // Test
+  kalmanCorePredict(&sparse, &acc, &gyro, dt, true);
+
+  // Assert
+  assertCovarianceEqual(expected, &sparse, 1e-5f);
+}
+
+void testThatPredictedCovarianceMatchesReferenceForArbitraryAttitudeAndVelocity() {
+  // Fixture
+  Axis3f acc = {.x = 0.0f, .y = 0.0f, .z = 1.0f};
+  Axis3f gyro = {.x = randomFloat(-3.0f, 3.0f), .y = randomFloat(-3.0f, 3.0f), .z = randomFloat(-3.0f, 3.0f)};
+  const float dt = 0.01f;
+  for (int i = 0; i < 3; i++) {
+    sparse.S[KC_STATE_PX + i] = randomFloat(-2.0f, 2.0f);
+    for (int j = 0; j < 3; j++) {
+      sparse.R[i][j] = randomFloat(-1.0f, 1.0f);
+    }
+  }
+
+  float A[KC_STATE_DIM][KC_STATE_DIM];
+  float expected[KC_STATE_DIM][KC_STATE_DIM];
+  referenceDynamicsMatrix(&sparse, &gyro, dt, A);
+  kalmanCoreGetCovarianceMatrix(&sparse, expected);
+  referenceTransform(expected, A);
+
+  // Test
+  kalmanCorePredict(&sparse, &acc, &gyro, dt, false);
+
+  // Assert
+  assertCovarianceEqual(expected, &sparse, 1e-5f);
+}
+
+void testBenchmarkPredictAgainstDenseCovariancePropagation() {
+  // Fixture
+  Axis3f acc = {.x = 0.1f, .y = -0.2f, .z = 1.1f};
+  Axis3f gyro = {.x = 0.8f, .y = -0.5f, .z = 1.3f};
+  const float dt = 0.002f;
+
+  float A[KC_STATE_DIM][KC_STATE_DIM];
+  float AT[KC_STATE_DIM][KC_STATE_DIM];
+  float AP[KC_STATE_DIM][KC_STATE_DIM];
+  float P[KC_STATE_DIM][KC_STATE_DIM];
+  arm_matrix_instance_f32 Am = {KC_STATE_DIM, KC_STATE_DIM, (float*)A};
+  arm_matrix_instance_f32 ATm = {KC_STATE_DIM, KC_STATE_DIM, (float*)AT};
+  arm_matrix_instance_f32 APm = {KC_STATE_DIM, KC_STATE_DIM, (float*)AP};
+  arm_matrix_instance_f32 Pm = {KC_STATE_DIM, KC_STATE_DIM, (float*)P};
+  kalmanCoreGetCovarianceMatrix(&dense, P);
+  referenceDynamicsMatrix(&dense, &gyro, dt, A);
+
+  // Test
+  // The dense propagation as implemented before the block sparse kernel, A P A' with full matrix multiplications
+  clock_t start = clock();
+  for (int i = 0; i < BENCHMARK_ITERATIONS; i++) {
+    arm_mat_mult_f32(&Am, &Pm, &APm);
+    arm_mat_trans_f32(&Am, &ATm);
+    arm_mat_mult_f32(&APm, &ATm, &Pm);
+  }
+  clock_t denseTime = clock() - start;
+
+  // The full prediction step, including the state update
+  start = clock();
+  for (int i = 0; i < BENCHMARK_ITERATIONS; i++) {
+    kalmanCorePredict(&sparse, &acc, &gyro, dt, true);
+  }
+  clock_t predictTime = clock() - start;
+
+  // Assert
+#ifdef SHOW_OUTPUT
+  printf("Covariance propagation, dense: %.3f us, full predict step (block sparse): %.3f us\n",
+    1e6 * (double)denseTime / CLOCKS_PER_SEC / BENCHMARK_ITERATIONS,
+    1e6 * (double)predictTime / CLOCKS_PER_SEC / BENCHMARK_ITERATIONS);
+#else
+  (void)denseTime;
+  (void)predictTime;
+#endif
+}
+
+void testThatSetAndGetCovarianceMatrixRoundTrips() {
+  // Fixture
+  float expected[KC_STATE_DIM][KC_STATE_DIM];
+  float actual[KC_STATE_DIM][KC_STATE_DIM];
+  kalmanCoreGetCovarianceMatrix(&sparse, expected);
+
+  // Test
+  kalmanCoreSetCovarianceMatrix(&dense, expected);
+  kalmanCoreGetCovarianceMatrix(&dense, actual);
+
+  // Assert
+  for (int i = 0; i < KC_STATE_DIM; i++) {
+    for (int j = 0; j < KC_STATE_DIM; j++) {
+      TEST_ASSERT_EQUAL_FLOAT(expected[i][j], actual[i][j]);
+    }
+  }
+}
+
+void testThatSparseScalarUpdateKeepsCovarianceSymmetric() {
+  // Fixture
+  float h[KC_STATE_DIM] = {0};
+  arm_matrix_instance_f32 H = {1, KC_STATE_DIM, h};
+  h[KC_STATE_X] = 0.3f;
+  h[KC_STATE_PY] = 0.4f;
+
+  // Test
+  kalmanCoreScalarUpdateSparse(&sparse, &H, 0.1f, 0.1f);
+
+  // Assert
+  for (int i = 0; i < KC_STATE_DIM; i++) {
+    for (int j = 0; j < KC_STATE_DIM; j++) {
+      TEST_ASSERT_EQUAL_FLOAT(KC_COV(&sparse, i, j), KC_COV(&sparse, j, i));
+    }
+  }
+}
+
+void testBenchmarkSparseScalarUpdateAgainstDense() {
+#ifdef CONFIG_ESTIMATOR_KALMAN_PACKED_COVARIANCE
+  TEST_IGNORE_MESSAGE("The dense scalar update is not available with packed covariance");
+#else
+  // Fixture
+  float h[KC_STATE_DIM] = {0};
+  arm_matrix_instance_f32 H = {1, KC_STATE_DIM, h};
+  h[KC_STATE_X] = 0.57f;
+  h[KC_STATE_Y] = -0.21f;
+  h[KC_STATE_Z] = 0.79f;
+
+  // Test
+  clock_t start = clock();
+  for (int i = 0; i < BENCHMARK_ITERATIONS; i++) {
+    kalmanCoreScalarUpdateDense(&dense, &H, 0.0f, 0.15f);
+  }
+  clock_t denseTime = clock() - start;
+
+  start = clock();
+  for (int i = 0; i < BENCHMARK_ITERATIONS; i++) {
+    kalmanCoreScalarUpdateSparse(&sparse, &H, 0.0f, 0.15f);
+  }
+  clock_t sparseTime = clock() - start;
+
+  // Assert
+#ifdef SHOW_OUTPUT
+  printf("Scalar update, dense: %.3f us/update, sparse: %.3f us/update\n",
+    1e6 * (double)denseTime / CLOCKS_PER_SEC / BENCHMARK_ITERATIONS,
+    1e6 * (double)sparseTime / CLOCKS_PER_SEC / BENCHMARK_ITERATIONS);
+#else
+  (void)denseTime;
+  (void)sparseTime;
+#endif
+
+  assertCoreDataEqual(&dense, &sparse, 1e-4f);
+#endif
+}
+
+void testThatBatchUpdateIsEquivalentToSequentialUpdatesOfLinearMeasurements() {
+  // Fixture
+  kalmanCoreBatch_t batch = {.rows = 0};
+  float measurements[KC_BATCH_MAX_ROWS];
+
+  for (int r = 0; r < KC_BATCH_MAX_ROWS; r++) {
+    for (int k = 0; k < 3; k++) {
+      batch.h[r][rand() % KC_STATE_DIM] = randomFloat(-1.0f, 1.0f);
+    }
+    measurements[r] = randomFloat(-0.5f, 0.5f);
+    batch.stdMeasNoise[r] = randomFloat(0.05f, 0.5f);
+    batch.error[r] = measurements[r] - predictLinearMeasurement(&dense, batch.h[r]);
+    batch.rows++;
+  }
+
+  // Test
+  for (int r = 0; r < batch.rows; r++) {
+    arm_matrix_instance_f32 H = {1, KC_STATE_DIM, batch.h[r]};
+    const float error = measurements[r] - predictLinearMeasurement(&dense, batch.h[r]);
+    kalmanCoreScalarUpdateSparse(&dense, &H, error, batch.stdMeasNoise[r]);
+  }
+
+  kalmanCoreUpdateBatch(&sparse, &batch);
+
+  // Assert
+  assertCoreDataEqual(&dense, &sparse, 1e-4f);
+}
+
+void testThatScalarUpdatesAreCollectedWhileBatchIsActive() {
+  // Fixture
+  kalmanCoreBatch_t batch;
+  float h[KC_STATE_DIM] = {0};
+  arm_matrix_instance_f32 H = {1, KC_STATE_DIM, h};
+  h[KC_STATE_Y] = 1.0f;
+
+  kalmanCoreData_t expected;
+  copyCoreData(&expected, &sparse);
+
+  // Test
+  kalmanCoreBatchBegin(&sparse, &batch);
+  kalmanCoreScalarUpdate(&sparse, &H, 0.2f, 0.1f);
+  kalmanCoreScalarUpdate(&sparse, &H, 0.3f, 0.1f);
+
+  // Assert
+  TEST_ASSERT_EQUAL_INT(2, batch.rows);
+  assertCoreDataEqual(&expected, &sparse, 0.0f);
+}
+
+void testThatCollectedUpdatesAreAppliedWhenBatchEnds() {
+  // Fixture
+  kalmanCoreBatch_t batch;
+  float h[KC_STATE_DIM] = {0};
+  arm_matrix_instance_f32 H = {1, KC_STATE_DIM, h};
+  h[KC_STATE_Y] = 1.0f;
+
+  kalmanCoreBatch_t expectedBatch = {.rows = 1};
+  expectedBatch.h[0][KC_STATE_Y] = 1.0f;
+  expectedBatch.error[0] = 0.2f;
+  expectedBatch.stdMeasNoise[0] = 0.1f;
+  kalmanCoreUpdateBatch(&dense, &expectedBatch);
+
+  // Test
+  kalmanCoreBatchBegin(&sparse, &batch);
+  kalmanCoreScalarUpdate(&sparse, &H, 0.2f, 0.1f);
+  kalmanCoreBatchEnd(&sparse);
+
+  // Assert
+  TEST_ASSERT_NULL(sparse.batch);
+  TEST_ASSERT_EQUAL_INT(0, batch.rows);
+  assertCoreDataEqual(&dense, &sparse, 1e-6f);
+}
+
+void testThatBatchIsFlushedWhenFull() {
+  // Fixture
+  kalmanCoreBatch_t batch;
+  float h[KC_STATE_DIM] = {0};
+  arm_matrix_instance_f32 H = {1, KC_STATE_DIM, h};
+  h[KC_STATE_Z] = 1.0f;
+
+  const float stateZBefore = sparse.S[KC_STATE_Z];
+
+  // Test
+  kalmanCoreBatchBegin(&sparse, &batch);
+  for (int r = 0; r < KC_BATCH_MAX_ROWS + 1; r++) {
+    kalmanCoreScalarUpdate(&sparse, &H, 0.1f, 0.1f);
+  }
+
+  // Assert
+  TEST_ASSERT_EQUAL_INT(1, batch.rows);
+  TEST_ASSERT_TRUE(sparse.S[KC_STATE_Z] != stateZBefore);
+}
+
+void testBenchmarkBatchUpdateOfLighthouseCycle() {
+  // Fixture
+  // 8 sweep angles, each with a 3 element H
+  kalmanCoreBatch_t batch = {.rows = KC_BATCH_MAX_ROWS};
+  for (int r = 0; r < KC_BATCH_MAX_ROWS; r++) {
+    batch.h[r][KC_STATE_X] = randomFloat(-1.0f, 1.0f);
+    batch.h[r][KC_STATE_Y] = randomFloat(-1.0f, 1.0f);
+    batch.h[r][KC_STATE_Z] = randomFloat(-1.0f, 1.0f);
+    batch.error[r] = 0.0f;
+    batch.stdMeasNoise[r] = 0.1f;
+  }
+
+  // Test
+  clock_t start = clock();
+  for (int i = 0; i < BENCHMARK_ITERATIONS / KC_BATCH_MAX_ROWS; i++) {
+    for (int r = 0; r < batch.rows; r++) {
+      arm_matrix_instance_f32 H = {1, KC_STATE_DIM, batch.h[r]};
+      kalmanCoreScalarUpdateSparse(&dense, &H, batch.error[r], batch.stdMeasNoise[r]);
+    }
+  }
+  clock_t sequentialTime = clock() - start;
+
+  start = clock();
+  for (int i = 0; i < BENCHMARK_ITERATIONS / KC_BATCH_MAX_ROWS; i++) {
+    kalmanCoreUpdateBatch(&sparse, &batch);
+  }
+  clock_t batchTime = clock() - start;
+
+  // Assert
+#ifdef SHOW_OUTPUT
+  printf("Lighthouse cycle (%d rows), sequential sparse: %.3f us, batch: %.3f us\n", KC_BATCH_MAX_ROWS,
+    1e6 * (double)sequentialTime / CLOCKS_PER_SEC / (BENCHMARK_ITERATIONS / KC_BATCH_MAX_ROWS),
+    1e6 * (double)batchTime / CLOCKS_PER_SEC / (BENCHMARK_ITERATIONS / KC_BATCH_MAX_ROWS));
+#else
+  (void)sequentialTime;
+  (void)batchTime;
+#endif
+
+  assertCoreDataEqual(&dense, &sparse, 1e-4f);
+}
+
+// Helpers ///////////////////////////////////////////////////////////////
+
+static float randomFloat(float min, float max) {
+  return min + (max - min) * (rand() / (float)RAND_MAX);
+}
+
+// Creates a symmetric positive definite covariance matrix P = LL' + D
+static void populateWithRandomCovariance(kalmanCoreData_t* this) {
+  float L[KC_STATE_DIM][KC_STATE_DIM];
+  float P[KC_STATE_DIM][KC_STATE_DIM];
+  for (int i = 0; i < KC_STATE_DIM; i++) {
+    for (int j = 0; j < KC_STATE_DIM; j++) {
+      L[i][j] = (j <= i) ? randomFloat(-0.3f, 0.3f) : 0.0f;
+    }
+  }
+
+  for (int i = 0; i < KC_STATE_DIM; i++) {
+    for (int j = 0; j < KC_STATE_DIM; j++) {
+      float sum = 0.0f;
+      for (int k = 0; k < KC_STATE_DIM; k++) {
+        sum += L[i][k] * L[j][k];
+      }
+      P[i][j] = sum;
+    }
+    P[i][i] += 0.01f;
+  }
+
+  kalmanCoreSetCovarianceMatrix(this, P);
+}
+
+static void copyCoreData(kalmanCoreData_t* dest, const kalmanCoreData_t* src) {
+  memcpy(dest, src, sizeof(kalmanCoreData_t));
+#ifndef CONFIG_ESTIMATOR_KALMAN_PACKED_COVARIANCE
+  dest->Pm.pData = (float*)dest->P;
+#endif
+}
+
+static void assertCoreDataEqual(const kalmanCoreData_t* expected, const kalmanCoreData_t* actual, const float tolerance) {
+  for (int i = 0; i < KC_STATE_DIM; i++) {
+    TEST_ASSERT_FLOAT_WITHIN(tolerance, expected->S[i], actual->S[i]);
+    for (int j = 0; j < KC_STATE_DIM; j++) {
+      TEST_ASSERT_FLOAT_WITHIN(tolerance, KC_COV(expected, i, j), KC_COV(actual, i, j));
+    }
+  }
+}
+
+static float predictLinearMeasurement(const kalmanCoreData_t* this, const float* h) {
+  float result = 0.0f;
+  for (int i = 0; i < KC_STATE_DIM; i++) {
+    result += h[i] * this->S[i];
+  }
+  return result;
+}
+
+static void assertCovarianceEqual(float expected[KC_STATE_DIM][KC_STATE_DIM], const kalmanCoreData_t* actual, const float tolerance) {
+  for (int i = 0; i < KC_STATE_DIM; i++) {
+    for (int j = 0; j < KC_STATE_DIM; j++) {
+      TEST_ASSERT_FLOAT_WITHIN(tolerance, expected[i][j], KC_COV(actual, i, j));
+    }
+  }
+}
+
+// Textbook Joseph form update on full matrices, P = (I - KH)P(I - KH)' + KRK'
+static void referenceScalarUpdate(float P[KC_STATE_DIM][KC_STATE_DIM], float S[KC_STATE_DIM], const float* h, float error, float stdMeasNoise) {
+  const float R = stdMeasNoise * stdMeasNoise;
+
+  float PHT[KC_STATE_DIM];
+  float HPHR = R;
+  for (int i = 0; i < KC_STATE_DIM; i++) {
+    PHT[i] = 0.0f;
+    for (int k = 0; k < KC_STATE_DIM; k++) {
+      PHT[i] += P[i][k] * h[k];
+    }
+    HPHR += h[i] * PHT[i];
+  }
+
+  float K[KC_STATE_DIM];
+  for (int i = 0; i < KC_STATE_DIM; i++) {
+    K[i] = PHT[i] / HPHR;
+    S[i] += K[i] * error;
+  }
+
+  float IKH[KC_STATE_DIM][KC_STATE_DIM];
+  for (int i = 0; i < KC_STATE_DIM; i++) {
+    for (int j = 0; j < KC_STATE_DIM; j++) {
+      IKH[i][j] = (i == j ? 1.0f : 0.0f) - K[i] * h[j];
+    }
+  }
+
+  referenceTransform(P, IKH);
+  for (int i = 0; i < KC_STATE_DIM; i++) {
+    for (int j = 0; j < KC_STATE_DIM; j++) {
+      P[i][j] += K[i] * R * K[j];
+    }
+  }
+}
+
+// The linearized dynamics, as described in kalmanCorePredict()
+static void referenceDynamicsMatrix(const kalmanCoreData_t* this, const Axis3f* gyro, float dt, float A[KC_STATE_DIM][KC_STATE_DIM]) {
+  memset(A, 0, sizeof(float) * KC_STATE_DIM * KC_STATE_DIM);
+  for (int i = 0; i < KC_STATE_DIM; i++) {
+    A[i][i] = 1.0f;
+  }
+
+  const float* S = this->S;
+  for (int i = 0; i < 3; i++) {
+    // position from body-frame velocity
+    for (int j = 0; j < 3; j++) {
+      A[KC_STATE_X + i][KC_STATE_PX + j] = this->R[i][j] * dt;
+    }
+
+    // position from attitude error
+    A[KC_STATE_X + i][KC_STATE_D0] = (S[KC_STATE_PY] * this->R[i][2] - S[KC_STATE_PZ] * this->R[i][1]) * dt;
+    A[KC_STATE_X + i][KC_STATE_D1] = (-S[KC_STATE_PX] * this->R[i][2] + S[KC_STATE_PZ] * this->R[i][0]) * dt;
+    A[KC_STATE_X + i][KC_STATE_D2] = (S[KC_STATE_PX] * this->R[i][1] - S[KC_STATE_PY] * this->R[i][0]) * dt;
+  }
+
+  // body-frame velocity from body-frame velocity
+  A[KC_STATE_PY][KC_STATE_PX] = -gyro->z * dt;
+  A[KC_STATE_PZ][KC_STATE_PX] = gyro->y * dt;
+  A[KC_STATE_PX][KC_STATE_PY] = gyro->z * dt;
+  A[KC_STATE_PZ][KC_STATE_PY] = -gyro->x * dt;
+  A[KC_STATE_PX][KC_STATE_PZ] = -gyro->y * dt;
+  A[KC_STATE_PY][KC_STATE_PZ] = gyro->x * dt;
+
+  // body-frame velocity from attitude error
+  A[KC_STATE_PY][KC_STATE_D0] = -GRAVITY_MAGNITUDE * this->R[2][2] * dt;
+  A[KC_STATE_PZ][KC_STATE_D0] = GRAVITY_MAGNITUDE * this->R[2][1] * dt;
+  A[KC_STATE_PX][KC_STATE_D1] = GRAVITY_MAGNITUDE * this->R[2][2] * dt;
+  A[KC_STATE_PZ][KC_STATE_D1] = -GRAVITY_MAGNITUDE * this->R[2][0] * dt;
+  A[KC_STATE_PX][KC_STATE_D2] = -GRAVITY_MAGNITUDE * this->R[2][1] * dt;
+  A[KC_STATE_PY][KC_STATE_D2] = GRAVITY_MAGNITUDE * this->R[2][0] * dt;
+
+  // attitude error from attitude error
+  const float d0 = gyro->x * dt / 2;
+  const float d1 = gyro->y * dt / 2;
+  const float d2 = gyro->z * dt / 2;
+  A[KC_STATE_D0][KC_STATE_D0] = 1 - d1 * d1 / 2 - d2 * d2 / 2;
+  A[KC_STATE_D0][KC_STATE_D1] = d2 + d0 * d1 / 2;
+  A[KC_STATE_D0][KC_STATE_D2] = -d1 + d0 * d2 / 2;
+  A[KC_STATE_D1][KC_STATE_D0] = -d2 + d0 * d1 / 2;
+  A[KC_STATE_D1][KC_STATE_D1] = 1 - d0 * d0 / 2 - d2 * d2 / 2;
+  A[KC_STATE_D1][KC_STATE_D2] = d0 + d1 * d2 / 2;
+  A[KC_STATE_D2][KC_STATE_D0] = d1 + d0 * d2 / 2;
+  A[KC_STATE_D2][KC_STATE_D1] = -d0 + d1 * d2 / 2;
+  A[KC_STATE_D2][KC_STATE_D2] = 1 - d0 * d0 / 2 - d1 * d1 / 2;
+}
+
+// P = APA'
+static void referenceTransform(float P[KC_STATE_DIM][KC_STATE_DIM], float A[KC_STATE_DIM][KC_STATE_DIM]) {
+  float AP[KC_STATE_DIM][KC_STATE_DIM];
+  for (int i = 0; i < KC_STATE_DIM; i++) {
+    for (int j = 0; j < KC_STATE_DIM; j++) {
+      AP[i][j] = 0.0f;
+      for (int k = 0; k < KC_STATE_DIM; k++) {
+        AP[i][j] += A[i][k] * P[k][j];
+      }
+    }
+  }
+
+  for (int i = 0; i < KC_STATE_DIM; i++) {
+    for (int j = 0; j < KC_STATE_DIM; j++) {
+      P[i][j] = 0.0f;
+      for (int k = 0; k < KC_STATE_DIM; k++) {
+        P[i][j] += AP[i][k] * A[j][k];
+      }
+    }
+  }
+}
@@ -0,0 +1,246 @@
+// File under test kalman_history.c
+#include "kalman_history.h"
+#include "kalman_core.h"
+#include "mm_position.h"
+#include "physicalConstants.h"
+
+#include <math.h>
+
+#include "unity.h"
+
+#include "mock_cfassert.h"
+#include "mock_outlierFilter.h"
+
+// Build the arm dsp math lib and use the "real thing" instead of mocking calls to it
+// @BUILD_LIB ARM_DSP_MATH
+
+// #define SHOW_OUTPUT
+
+#define PREDICT_INTERVAL_US 10000
+#define PREDICT_DT (PREDICT_INTERVAL_US / 1e6f)
+#define MEASUREMENT_STD_DEV 0.01f
+
+static kalmanHistory_t history;
+static kalmanCoreData_t coreData;
+static kalmanCoreParams_t params;
+static OutlierFilterLhState_t sweepOutlierFilterState;
+
+static bool fuse(kalmanCoreData_t* this, measurement_t* m);
+static measurement_t positionMeasurement(float x, uint64_t timestamp);
+static void predict(kalmanCoreData_t* this, kalmanHistory_t* withHistory, float accX, uint64_t timestamp);
+static void assertCoreDataEqual(const kalmanCoreData_t* expected, const kalmanCoreData_t* actual, const float tolerance);
+
+static const Axis3f noRotation = {.x = 0.0f, .y = 0.0f, .z = 0.0f};
+
+void setUp(void) {
+  kalmanCoreDefaultParams(&params);
+  kalmanCoreInit(&coreData, &params);
+  sweepOutlierFilterState = (OutlierFilterLhState_t){0};
+  kalmanHistoryInit(&history, fuse, &sweepOutlierFilterState);
+
+  outlierFilterTdoaGetState_Ignore();
+  outlierFilterTdoaSetState_Ignore();
+}
+
+void tearDown(void) {
+  // Empty
+}
+
+void testThatCurrentMeasurementIsFusedWithoutReplay() {
+  // Fixture
+  predict(&coreData, &history, 0.0f, 1000000);
+  measurement_t m = positionMeasurement(0.5f, 1001000);
+
+  // Test
+  const bool updated = kalmanHistoryAddMeasurement(&history, &coreData, &m, 0);
+  const bool replayed = kalmanHistoryReplay(&history, &coreData);
+
+  // Assert
+  TEST_ASSERT_TRUE(updated);
+  TEST_ASSERT_FALSE(replayed);
+  TEST_ASSERT_TRUE(coreData.S[KC_STATE_X] > 0.4f);
+}
+
+void testThatDelayedMeasurementIsEquivalentToTimelyMeasurement() {
+  // Fixture
+  // The expected filter gets the measurement when it is taken, in step 2
+  kalmanCoreData_t expected;
+  kalmanCoreInit(&expected, &params);
+
+  const float acc[] = {1.0f, 2.0f, -1.0f, 0.5f, 0.0f, -2.0f};
+  const uint64_t measurementTime = 2 * PREDICT_INTERVAL_US + 3000;
+
+  // Test
+  for (int i = 0; i < 6; i++) {
+    const uint64_t now = i * PREDICT_INTERVAL_US;
+
+    predict(&expected, NULL, acc[i], now);
+    predict(&coreData, &history, acc[i], now);
+
+    if (i == 2) {
+      measurement_t m = positionMeasurement(0.3f, measurementTime);
+      kalmanCoreUpdateWithPosition(&expected, &m.data.position);
+    }
+    if (i == 5) {
+      // Enqueued in step 5, 3 steps after it was taken
+      measurement_t m = positionMeasurement(0.3f, now + 1000);
+      kalmanHistoryAddMeasurement(&history, &coreData, &m, now + 1000 - measurementTime);
+      TEST_ASSERT_TRUE(kalmanHistoryReplay(&history, &coreData));
+    }
+
+    if (i < 5) {
+      kalmanCoreFinalize(&expected, 0);
+      kalmanCoreFinalize(&coreData, 0);
+    }
+  }
+
+  // Assert
+  assertCoreDataEqual(&expected, &coreData, 1e-5f);
+  TEST_ASSERT_EQUAL_UINT32(1, history.replayCount);
+  TEST_ASSERT_EQUAL_UINT32(0, history.tooOldCount);
+}
+
+void testThatMeasurementOlderThanHistoryIsFusedAtOldestStep() {
+  // Fixture
+  for (int i = 0; i < KALMAN_HISTORY_STEPS + 2; i++) {
+    predict(&coreData, &history, 0.0f, (i + 1) * PREDICT_INTERVAL_US);
+    kalmanCoreFinalize(&coreData, 0);
+  }
+
+  const uint64_t now = (KALMAN_HISTORY_STEPS + 2) * PREDICT_INTERVAL_US + 1000;
+  measurement_t m = positionMeasurement(0.2f, now);
+
+  // Test
+  kalmanHistoryAddMeasurement(&history, &coreData, &m, (KALMAN_HISTORY_STEPS + 1) * PREDICT_INTERVAL_US);
+  const bool replayed = kalmanHistoryReplay(&history, &coreData);
+
+  // Assert
+  TEST_ASSERT_TRUE(replayed);
+  TEST_ASSERT_EQUAL_UINT32(1, history.tooOldCount);
+  TEST_ASSERT_TRUE(coreData.S[KC_STATE_X] > 0.1f);
+}
+
+void testThatReplayValidatesEachMeasurementOnceInTheOutlierFilter() {
+  // Fixture
+  // The fuse function opens the sweep outlier filter window one step for each measurement it validates
+  predict(&coreData, &history, 0.0f, PREDICT_INTERVAL_US);
+  measurement_t timely = positionMeasurement(0.1f, PREDICT_INTERVAL_US + 1000);
+  kalmanHistoryAddMeasurement(&history, &coreData, &timely, 0);
+  kalmanCoreFinalize(&coreData, 0);
+
+  predict(&coreData, &history, 0.0f, 2 * PREDICT_INTERVAL_US);
+  measurement_t delayed = positionMeasurement(0.1f, 2 * PREDICT_INTERVAL_US + 1000);
+
+  // Test
+  kalmanHistoryAddMeasurement(&history, &coreData, &delayed, PREDICT_INTERVAL_US);
+  const bool replayed = kalmanHistoryReplay(&history, &coreData);
+
+  // Assert
+  // The timely measurement is fused twice, but the filter is rewound before the replay
+  TEST_ASSERT_TRUE(replayed);
+  TEST_ASSERT_EQUAL_INT32(2, sweepOutlierFilterState.openingWindow);
+}
+
+void testThatReplayReducesPositionLagDuringAggressiveFlight() {
+  // Fixture
+  // Oscillation in x with 1 m amplitude at 1 Hz, peak acceleration of almost 40 m/s^2. Position measurements are
+  // taken at 100 Hz and delayed by 40 ms. The accelerometer has a bias, so the filter must rely on the measurements.
+  const float amplitude = 1.0f;
+  const float omega = 2.0f * (float)M_PI;
+  const float accBias = 0.5f;
+  const uint32_t delay = 40000;
+
+  kalmanCoreData_t uncompensated;
+  kalmanCoreInit(&uncompensated, &params);
+
+  double errorSqSumUncompensated = 0.0;
+  double errorSqSumCompensated = 0.0;
+  int samples = 0;
+
+  // Test
+  for (int i = 1; i <= 300; i++) {
+    const uint64_t now = (uint64_t)i * PREDICT_INTERVAL_US;
+    const float t = now / 1e6f;
+    const float tMid = t - PREDICT_DT / 2.0f;
+    const float accX = -amplitude * omega * omega * sinf(omega * tMid) + accBias;
+
+    predict(&uncompensated, NULL, accX, now);
+    predict(&coreData, &history, accX, now);
+
+    const float tMeasurement = t - delay / 1e6f;
+    if (tMeasurement > 0.0f) {
+      measurement_t m = positionMeasurement(amplitude * sinf(omega * tMeasurement), now);
+
+      kalmanCoreUpdateWithPosition(&uncompensated, &m.data.position);
+
+      kalmanHistoryAddMeasurement(&history, &coreData, &m, delay);
+      kalmanHistoryReplay(&history, &coreData);
+    }
+
+    kalmanCoreFinalize(&uncompensated, 0);
+    kalmanCoreFinalize(&coreData, 0);
+
+    // Skip the first second while the filters converge
+    if (t > 1.0f) {
+      const float truth = amplitude * sinf(omega * t);
+      errorSqSumUncompensated += powf(uncompensated.S[KC_STATE_X] - truth, 2);
+      errorSqSumCompensated += powf(coreData.S[KC_STATE_X] - truth, 2);
+      samples++;
+    }
+  }
+
+  const double rmsUncompensated = sqrt(errorSqSumUncompensated / samples);
+  const double rmsCompensated = sqrt(errorSqSumCompensated / samples);
+
+  // Assert
+#ifdef SHOW_OUTPUT
+  printf("Position RMS error, uncompensated: %.4f m, compensated: %.4f m, replays: %lu\n", rmsUncompensated, rmsCompensated, (unsigned long)history.replayCount);
+#endif
+
+  TEST_ASSERT_TRUE(rmsCompensated < 0.25 * rmsUncompensated);
+}
+
+// Helpers ///////////////////////////////////////////////////////////////
+
+static bool fuse(kalmanCoreData_t* this, measurement_t* m) {
+  TEST_ASSERT_EQUAL(MeasurementTypePosition, m->type);
+  sweepOutlierFilterState.openingWindow++;
+  kalmanCoreUpdateWithPosition(this, &m->data.position);
+  return true;
+}
+
+static measurement_t positionMeasurement(float x, uint64_t timestamp) {
+  measurement_t m = {
+    .type = MeasurementTypePosition,
+    .timestamp = timestamp,
+  };
+  m.data.position.x = x;
+  m.data.position.y = 0.0f;
+  m.data.position.z = 0.0f;
+  m.data.position.stdDev = MEASUREMENT_STD_DEV;
+
+  return m;
+}
+
+// Predict and add process noise, with or without history. The acceleration is in the world frame, gravity is added.
+static void predict(kalmanCoreData_t* this, kalmanHistory_t* withHistory, float accX, uint64_t timestamp) {
+  Axis3f acc = {.x = accX, .y = 0.0f, .z = GRAVITY_MAGNITUDE};
+  Axis3f gyro = noRotation;
+
+  if (withHistory) {
+    kalmanHistoryPredict(withHistory, this, &acc, &gyro, PREDICT_DT, false, timestamp);
+    kalmanHistoryAddProcessNoise(withHistory, this, &params, PREDICT_DT);
+  } else {
+    kalmanCorePredict(this, &acc, &gyro, PREDICT_DT, false);
+    kalmanCoreAddProcessNoise(this, &params, PREDICT_DT);
+  }
+}
+
+static void assertCoreDataEqual(const kalmanCoreData_t* expected, const kalmanCoreData_t* actual, const float tolerance) {
+  for (int i = 0; i < KC_STATE_DIM; i++) {
+    TEST_ASSERT_FLOAT_WITHIN(tolerance, expected->S[i], actual->S[i]);
+    for (int j = 0; j < KC_STATE_DIM; j++) {
+      TEST_ASSERT_FLOAT_WITHIN(tolerance, KC_COV(expected, i, j), KC_COV(actual, i, j));
+    }
+  }
+}
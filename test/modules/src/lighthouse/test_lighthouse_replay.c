@@ -0,0 +1,515 @@
+// @IGNORE_IF_NOT CONFIG_DECK_LIGHTHOUSE
+// @BUILD_LIB ARM_DSP_MATH
+
+// File under test lighthouse_core.c
+//
+// Replay of recorded lighthouse deck data on the host. The frames are decoded and processed by the same functions as in
+// lighthouseCoreTask(): decodeUartFrame() and processUartFrame(), that does pulse processing, calibration and sweep
+// angle measurements. The time spent in each of the two steps is measured.
+//
+// A recording is the raw byte stream from the UART of the lighthouse deck (12 byte frames, including the 0xff sync
+// frames), for instance captured with a serial adapter on the deck UART at 230400 baud. Replay it with
+//
+//   LH_REPLAY_FILE=recording.bin make unit FILES=test/modules/src/lighthouse/test_lighthouse_replay.c
+//
+// Optional environment variables
+//   LH_REPLAY_OUTPUT=out.txt   Write all measurements that are passed to the estimator to out.txt, for regression
+//                              diffing between firmware versions
+//   LH_REPLAY_GEOMETRY=geo.txt Base station geometry, one line per base station: "bs x y z r00 r01 r02 ... r22".
+//                              Sweep angle measurements are only generated for base stations with geometry.
+//   LH_REPLAY_TYPE=1           The recording is from lighthouse V1 base stations, the default is V2
+//   LH_REPLAY_NO_CALIBRATION=1 Use ideal calibration data until calibration data is decoded from the recording
+//
+// Calibration data is decoded from the recording, as on the Crazyflie, which requires recordings that are long
+// enough to contain the full OOTX message (about 20 seconds). No measurements are generated before that, unless
+// LH_REPLAY_NO_CALIBRATION is set.
+
+#define _POSIX_C_SOURCE 199309L
+
+#include "lighthouse_core.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "unity.h"
+#include "pulse_processor.h"
+#include "pulse_processor_v1.h"
+#include "pulse_processor_v2.h"
+#include "ootx_decoder.h"
+#include "lighthouse_calibration.h"
+#include "lighthouse_geometry.h"
+#include "lighthouse_position_est.h"
+#include "lighthouse_state.h"
+#include "physicalConstants.h"
+#include "mock_system.h"
+#include "mock_lighthouse_transmit.h"
+#include "mock_lighthouse_deck_flasher.h"
+#include "mock_uart1.h"
+#include "mock_statsCnt.h"
+#include "mock_cfassert.h"
+#include "mock_crtp_localization_service.h"
+#include "mock_lighthouse_storage.h"
+#include "mock_estimator.h"
+#include "mock_estimator_kalman.h"
+#include "mock_mem.h"
+#include "mock_usec_time.h"
+
+// #define SHOW_OUTPUT
+
+#define UART_FRAME_LENGTH 12
+
+// Measurements generated by one frame, 2 sweeps for each sensor and a yaw error
+#define MAX_MEASUREMENTS_PER_FRAME (2 * PULSE_PROCESSOR_N_SENSORS + 1)
+
+typedef enum {
+  stageUartFrameDecoding = 0,
+  stageFrameProcessing,
+  stageCount,
+} replayStage_t;
+
+static const char* stageNames[stageCount] = {
+  "UART frame decoding",
+  "frame processing",
+};
+
+typedef struct {
+  int frames;
+  int syncFrames;
+  int invalidFrames;
+  // Angle sets with calibration data, as sent to the ground
+  int angleSets;
+  int sweepAngles;
+  int yawErrors;
+  uint64_t stageNs[stageCount];
+  uint64_t totalNs;
+} replayStats_t;
+
+// Functions under test
+bool decodeUartFrame(const char data[], lighthouseUartFrame_t *frame);
+void processUartFrame(pulseProcessor_t *appState, pulseProcessorResult_t* angles, const lighthouseUartFrame_t* frame, const bool previousWasSyncFrame, const uint32_t now_ms);
+
+// Dummy mocks timer
+uint32_t xTaskGetTickCount() {return 0;}
+void vTaskDelay(const uint32_t ignore) {}
+
+static pulseProcessorResult_t angles;
+
+// Replay time, derived from the timestamps of the frames
+static uint32_t latestTimestamp;
+static uint64_t replayTicks;
+
+static measurement_t frameMeasurements[MAX_MEASUREMENTS_PER_FRAME];
+static int frameMeasurementCount;
+static int angleSetCount;
+static float latestSweepAngles[CONFIG_DECK_LIGHTHOUSE_MAX_N_BS][PULSE_PROCESSOR_N_SENSORS][PULSE_PROCESSOR_N_SWEEPS];
+
+static const float cfPosition[3] = {0.0f, 0.0f, 0.0f};
+
+static void replay(const uint8_t* data, const size_t length, FILE* output, replayStats_t* stats);
+static void printStats(const replayStats_t* stats);
+static uint8_t* readFile(FILE* file, size_t* length);
+static bool readGeometry(const char* fileName);
+static size_t writeLh2Recording(uint8_t* data, const size_t maxLength, const uint8_t channel, const uint32_t offsets[PULSE_PROCESSOR_N_SWEEPS][PULSE_PROCESSOR_N_SENSORS], const int rotations);
+static void setIdealCalibration(const uint8_t baseStation);
+static void setIdealCalibrationAndGeometry(const uint8_t baseStation);
+static void locSrvSendLighthouseAngleCallback(int basestation, pulseProcessorResult_t* angles, int cmock_num_calls);
+static void estimatorEnqueueCallback(const measurement_t *measurement, int cmock_num_calls);
+static uint64_t usecTimestampCallback(int cmock_num_calls);
+static void estimatorKalmanGetEstimatedPosCallback(point_t* pos, int cmock_num_calls);
+static void estimatorKalmanGetEstimatedRotCallback(float* rotationMatrix, int cmock_num_calls);
+
+void setUp(void) {
+  memset(&lighthouseCoreState, 0, sizeof(lighthouseCoreState));
+  memset(&angles, 0, sizeof(angles));
+  memset(latestSweepAngles, 0, sizeof(latestSweepAngles));
+  latestTimestamp = 0;
+  replayTicks = 0;
+  frameMeasurementCount = 0;
+  angleSetCount = 0;
+
+  lighthouseCoreSetSystemType(lighthouseBsTypeV2);
+
+  lighthouseTransmitProcessFrame_Ignore();
+  lighthouseStoragePersistCalibDataBackground_Ignore();
+  locSrvSendLighthouseAngle_StubWithCallback(locSrvSendLighthouseAngleCallback);
+  estimatorEnqueue_StubWithCallback(estimatorEnqueueCallback);
+  estimatorKalmanGetEstimatedPos_StubWithCallback(estimatorKalmanGetEstimatedPosCallback);
+  estimatorKalmanGetEstimatedRot_StubWithCallback(estimatorKalmanGetEstimatedRotCallback);
+  usecTimestamp_StubWithCallback(usecTimestampCallback);
+}
+
+void tearDown(void) {
+  // Empty
+}
+
+void testThatSyntheticRecordingIsReplayedToSweepAngles() {
+  // Fixture
+  const uint8_t channel = 0;
+  const int rotations = 10;
+  const uint32_t offsets[PULSE_PROCESSOR_N_SWEEPS][PULSE_PROCESSOR_N_SENSORS] = {
+    {160000, 160040, 160100, 160140},
+    {320000, 320060, 320080, 320140},
+  };
+
+  static uint8_t data[20000];
+  const size_t length = writeLh2Recording(data, sizeof(data), channel, offsets, rotations);
+
+  FILE* file = tmpfile();
+  fwrite(data, 1, length, file);
+  rewind(file);
+  size_t readLength = 0;
+  uint8_t* recording = readFile(file, &readLength);
+  fclose(file);
+
+  setIdealCalibrationAndGeometry(channel);
+  replayStats_t stats;
+
+  // Test
+  replay(recording, readLength, NULL, &stats);
+  free(recording);
+
+  // Assert
+  // The last rotation is not processed since there is no following frame that ends the block
+  TEST_ASSERT_EQUAL(length, readLength);
+  TEST_ASSERT_EQUAL(rotations * 2 * PULSE_PROCESSOR_N_SENSORS, stats.frames);
+  TEST_ASSERT_EQUAL(rotations - 1, stats.syncFrames);
+  TEST_ASSERT_EQUAL(0, stats.invalidFrames);
+  TEST_ASSERT_EQUAL(rotations - 1, stats.angleSets);
+  TEST_ASSERT_EQUAL((rotations - 1) * 2 * PULSE_PROCESSOR_N_SENSORS, stats.sweepAngles);
+
+  // Cycle period of the first channel, see pulse_processor_v2.c
+  const float period = 959000 / 2;
+  for (int sensor = 0; sensor < PULSE_PROCESSOR_N_SENSORS; sensor++) {
+    const float expected0 = (offsets[0][sensor] * 2 * M_PI_F / period) - M_PI_F + M_PI_F / 3.0f;
+    const float expected1 = (offsets[1][sensor] * 2 * M_PI_F / period) - M_PI_F - M_PI_F / 3.0f;
+    TEST_ASSERT_FLOAT_WITHIN(0.00001f, expected0, latestSweepAngles[channel][sensor][0]);
+    TEST_ASSERT_FLOAT_WITHIN(0.00001f, expected1, latestSweepAngles[channel][sensor][1]);
+  }
+
+#ifdef SHOW_OUTPUT
+  printStats(&stats);
+#endif
+}
+
+void testThatReplayResynchronizesAfterCorruptData() {
+  // Fixture
+  const uint8_t channel = 1;
+  const int rotations = 10;
+  const uint32_t offsets[PULSE_PROCESSOR_N_SWEEPS][PULSE_PROCESSOR_N_SENSORS] = {
+    {160000, 160040, 160100, 160140},
+    {320000, 320060, 320080, 320140},
+  };
+
+  static uint8_t data[20000];
+  const size_t corruptLength = 5;
+  const size_t length = writeLh2Recording(&data[corruptLength], sizeof(data) - corruptLength, channel, offsets, rotations);
+
+  // Garbage that looks like a partial frame before the first sync frame
+  memset(data, 0x55, corruptLength);
+  // Corrupt the padding of the first frame, the replay must wait for the sync frame of the next rotation
+  data[corruptLength + UART_FRAME_LENGTH + 5] = 0x10;
+
+  setIdealCalibrationAndGeometry(channel);
+  replayStats_t stats;
+
+  // Test
+  replay(data, corruptLength + length, NULL, &stats);
+
+  // Assert
+  TEST_ASSERT_EQUAL(1, stats.invalidFrames);
+  TEST_ASSERT_EQUAL(rotations - 2, stats.angleSets);
+}
+
+void testReplayOfRecordedFile() {
+  // Fixture
+  const char* fileName = getenv("LH_REPLAY_FILE");
+  if (fileName == NULL) {
+    TEST_IGNORE_MESSAGE("Set LH_REPLAY_FILE to replay a recording");
+  }
+
+  FILE* file = fopen(fileName, "rb");
+  TEST_ASSERT_NOT_NULL_MESSAGE(file, "Can not open LH_REPLAY_FILE");
+  size_t length = 0;
+  uint8_t* recording = readFile(file, &length);
+  fclose(file);
+
+  const char* type = getenv("LH_REPLAY_TYPE");
+  if (type && strcmp(type, "1") == 0) {
+    lighthouseCoreSetSystemType(lighthouseBsTypeV1);
+  }
+
+  if (getenv("LH_REPLAY_NO_CALIBRATION")) {
+    for (int baseStation = 0; baseStation < CONFIG_DECK_LIGHTHOUSE_MAX_N_BS; baseStation++) {
+      setIdealCalibration(baseStation);
+    }
+  }
+
+  const char* geometryFileName = getenv("LH_REPLAY_GEOMETRY");
+  if (geometryFileName) {
+    TEST_ASSERT_TRUE_MESSAGE(readGeometry(geometryFileName), "Can not read LH_REPLAY_GEOMETRY");
+  }
+
+  FILE* output = NULL;
+  const char* outputFileName = getenv("LH_REPLAY_OUTPUT");
+  if (outputFileName) {
+    output = fopen(outputFileName, "w");
+    TEST_ASSERT_NOT_NULL_MESSAGE(output, "Can not open LH_REPLAY_OUTPUT");
+  }
+
+  replayStats_t stats;
+
+  // Test
+  replay(recording, length, output, &stats);
+
+  // Assert
+  free(recording);
+  if (output) {
+    fclose(output);
+  }
+
+  printStats(&stats);
+  TEST_ASSERT_TRUE(stats.frames > 0);
+}
+
+// Helpers ///////////////////////////////////////////////////////////////
+
+static uint64_t nowNs() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+static void advanceReplayTime(const uint32_t timestamp) {
+  // Frames are not strictly ordered in time, ignore steps backwards
+  const uint32_t delta = TS_DIFF(timestamp, latestTimestamp);
+  if (delta < (1 << (PULSE_PROCESSOR_TIMESTAMP_BITWIDTH - 1))) {
+    replayTicks += delta;
+    latestTimestamp = timestamp;
+  }
+}
+
+static void writeMeasurements(const int frameIndex, FILE* output, replayStats_t* stats) {
+  for (int i = 0; i < frameMeasurementCount; i++) {
+    const measurement_t* measurement = &frameMeasurements[i];
+
+    if (measurement->type == MeasurementTypeSweepAngle) {
+      const sweepAngleMeasurement_t* sweep = &measurement->data.sweepAngle;
+      latestSweepAngles[sweep->basestationId][sweep->sensorId][sweep->sweepId] = sweep->measuredSweepAngle;
+      stats->sweepAngles++;
+      if (output) {
+        fprintf(output, "%d sweep %d %d %d %.6f\n", frameIndex, sweep->basestationId, sweep->sensorId, sweep->sweepId, (double)sweep->measuredSweepAngle);
+      }
+    } else if (measurement->type == MeasurementTypeYawError) {
+      stats->yawErrors++;
+      if (output) {
+        fprintf(output, "%d yaw %.6f\n", frameIndex, (double)measurement->data.yawError.yawError);
+      }
+    }
+  }
+
+  frameMeasurementCount = 0;
+}
+
+// Same flow as lighthouseCoreTask(), reading from the recording instead of the UART
+static void replay(const uint8_t* data, const size_t length, FILE* output, replayStats_t* stats) {
+  memset(stats, 0, sizeof(replayStats_t));
+  const uint64_t start = nowNs();
+
+  lighthouseUartFrame_t frame;
+  size_t index = 0;
+  int syncCounter = 0;
+  bool synchronized = false;
+  bool previousWasSyncFrame = false;
+
+  while (index < length) {
+    if (!synchronized) {
+      // As waitForUartSynchFrame()
+      syncCounter = (data[index] == 0xff) ? syncCounter + 1 : 0;
+      synchronized = (syncCounter == UART_FRAME_LENGTH);
+      previousWasSyncFrame = false;
+      index++;
+      continue;
+    }
+
+    if (index + UART_FRAME_LENGTH > length) {
+      break;
+    }
+
+    const uint64_t decodeStart = nowNs();
+    const bool isFrameValid = decodeUartFrame((const char*)&data[index], &frame);
+    stats->stageNs[stageUartFrameDecoding] += nowNs() - decodeStart;
+    index += UART_FRAME_LENGTH;
+
+    if (!isFrameValid) {
+      stats->invalidFrames++;
+      synchronized = false;
+      syncCounter = 0;
+      continue;
+    }
+
+    if (frame.isSyncFrame) {
+      stats->syncFrames++;
+    } else {
+      advanceReplayTime(frame.data.timestamp);
+    }
+
+    const uint64_t processingStart = nowNs();
+    processUartFrame(&lighthouseCoreState, &angles, &frame, previousWasSyncFrame, replayTicks / 24000);
+    stats->stageNs[stageFrameProcessing] += nowNs() - processingStart;
+
+    if (!frame.isSyncFrame) {
+      writeMeasurements(stats->frames, output, stats);
+      stats->frames++;
+    }
+
+    previousWasSyncFrame = frame.isSyncFrame;
+  }
+
+  stats->angleSets = angleSetCount;
+  stats->totalNs = nowNs() - start;
+}
+
+static void printStats(const replayStats_t* stats) {
+  const double seconds = stats->totalNs / 1e9;
+  const int frames = stats->frames > 0 ? stats->frames : 1;
+
+  printf("Replayed %d frames (%d sync, %d invalid) in %.3f s, %.0f frames/s\n", stats->frames, stats->syncFrames, stats->invalidFrames, seconds, stats->frames / seconds);
+  printf("Angle sets: %d, sweep angles: %d, yaw errors: %d\n", stats->angleSets, stats->sweepAngles, stats->yawErrors);
+  for (int stage = 0; stage < stageCount; stage++) {
+    printf("  %-20s %8.1f ns/frame %10.3f ms\n", stageNames[stage], (double)stats->stageNs[stage] / frames, stats->stageNs[stage] / 1e6);
+  }
+}
+
+static uint8_t* readFile(FILE* file, size_t* length) {
+  size_t capacity = 4096;
+  uint8_t* data = malloc(capacity);
+  *length = 0;
+
+  size_t bytesRead;
+  while ((bytesRead = fread(&data[*length], 1, capacity - *length, file)) > 0) {
+    *length += bytesRead;
+    if (*length == capacity) {
+      capacity *= 2;
+      data = realloc(data, capacity);
+    }
+  }
+
+  return data;
+}
+
+static bool readGeometry(const char* fileName) {
+  FILE* file = fopen(fileName, "r");
+  if (file == NULL) {
+    return false;
+  }
+
+  int baseStation;
+  baseStationGeometry_t geometry;
+  memset(&geometry, 0, sizeof(geometry));
+  geometry.valid = true;
+
+  while (fscanf(file, "%d %f %f %f %f %f %f %f %f %f %f %f %f", &baseStation,
+                &geometry.origin[0], &geometry.origin[1], &geometry.origin[2],
+                &geometry.mat[0][0], &geometry.mat[0][1], &geometry.mat[0][2],
+                &geometry.mat[1][0], &geometry.mat[1][1], &geometry.mat[1][2],
+                &geometry.mat[2][0], &geometry.mat[2][1], &geometry.mat[2][2]) == 13) {
+    if (baseStation >= 0 && baseStation < CONFIG_DECK_LIGHTHOUSE_MAX_N_BS) {
+      lighthousePositionSetGeometryData(baseStation, &geometry);
+    }
+  }
+
+  fclose(file);
+  return true;
+}
+
+static void writeUartFrame(uint8_t* data, const uint8_t sensor, const uint8_t channel, const uint32_t offset, const uint32_t timestamp) {
+  memset(data, 0, UART_FRAME_LENGTH);
+
+  data[0] = (channel << 3) | sensor;
+  // Offset is sent in a 6 MHz clock
+  const uint32_t offset6MHz = offset / 4;
+  memcpy(&data[3], &offset6MHz, 3);
+  const uint32_t maskedTimestamp = timestamp & PULSE_PROCESSOR_TIMESTAMP_BITMASK;
+  memcpy(&data[9], &maskedTimestamp, 3);
+}
+
+// Writes the frames from the given number of rotations of a V2 base station, each rotation starts with a sync frame as
+// the deck sends them regularly. The offsets
+// (in 24 MHz ticks) of each sensor in the two sweeps must be in increasing order, and the offset of sensor 0 must be
+// a multiple of 4 since the deck sends offsets in a 6 MHz clock.
+static size_t writeLh2Recording(uint8_t* data, const size_t maxLength, const uint8_t channel, const uint32_t offsets[PULSE_PROCESSOR_N_SWEEPS][PULSE_PROCESSOR_N_SENSORS], const int rotations) {
+  // See pulse_processor_v2.c
+  const uint32_t cyclePeriods[] = {959000 / 2, 957000 / 2};
+  const uint32_t period = cyclePeriods[channel];
+
+  size_t length = 0;
+  TEST_ASSERT_TRUE(maxLength >= UART_FRAME_LENGTH * rotations * (1 + PULSE_PROCESSOR_N_SWEEPS * PULSE_PROCESSOR_N_SENSORS));
+
+  uint32_t timestamp0 = 1000000;
+  for (int rotation = 0; rotation < rotations; rotation++) {
+    memset(&data[length], 0xff, UART_FRAME_LENGTH);
+    length += UART_FRAME_LENGTH;
+
+    for (int sweep = 0; sweep < PULSE_PROCESSOR_N_SWEEPS; sweep++) {
+      for (int sensor = 0; sensor < PULSE_PROCESSOR_N_SENSORS; sensor++) {
+        // The offset is only decoded for one of the sensors in a sweep
+        const uint32_t offset = (sensor == 0) ? offsets[sweep][sensor] : 0;
+        writeUartFrame(&data[length], sensor, channel, offset, timestamp0 + offsets[sweep][sensor]);
+        length += UART_FRAME_LENGTH;
+      }
+    }
+
+    timestamp0 += period;
+  }
+
+  return length;
+}
+
+static void setIdealCalibration(const uint8_t baseStation) {
+  lighthouseCalibration_t calibration;
+  memset(&calibration, 0, sizeof(calibration));
+  calibration.valid = true;
+  lighthouseCoreSetCalibrationData(baseStation, &calibration);
+}
+
+static void setIdealCalibrationAndGeometry(const uint8_t baseStation) {
+  setIdealCalibration(baseStation);
+
+  baseStationGeometry_t geometry = {
+    .origin = {-2.0f, 0.0f, 2.0f},
+    .mat = {{1.0f, 0.0f, 0.0f}, {0.0f, 1.0f, 0.0f}, {0.0f, 0.0f, 1.0f}},
+    .valid = true,
+  };
+  lighthousePositionSetGeometryData(baseStation, &geometry);
+}
+
+static void locSrvSendLighthouseAngleCallback(int basestation, pulseProcessorResult_t* angles, int cmock_num_calls) {
+  angleSetCount++;
+}
+
+static void estimatorEnqueueCallback(const measurement_t *measurement, int cmock_num_calls) {
+  // Copied to a buffer and written to the output after the time measurement
+  if (frameMeasurementCount < MAX_MEASUREMENTS_PER_FRAME) {
+    frameMeasurements[frameMeasurementCount] = *measurement;
+    frameMeasurementCount++;
+  }
+}
+
+static uint64_t usecTimestampCallback(int cmock_num_calls) {
+  return replayTicks / 24;
+}
+
+static void estimatorKalmanGetEstimatedPosCallback(point_t* pos, int cmock_num_calls) {
+  pos->x = cfPosition[0];
+  pos->y = cfPosition[1];
+  pos->z = cfPosition[2];
+}
+
+static void estimatorKalmanGetEstimatedRotCallback(float* rotationMatrix, int cmock_num_calls) {
+  const float identity[9] = {1.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 1.0f};
+  memcpy(rotationMatrix, identity, sizeof(identity));
+}
@@ -0,0 +1,249 @@
+// File under test log_compression.c
+#include "log_compression.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "unity.h"
+
+// #define SHOW_OUTPUT
+
+#ifdef SHOW_OUTPUT
+#include <stdio.h>
+#endif
+
+// Payload of a log packet, after the block id and the time stamp
+#define PAYLOAD_LEN 26
+
+typedef struct {
+  uint32_t value[LOG_COMPRESSION_MAX_VARIABLES];
+  bool isValid[LOG_COMPRESSION_MAX_VARIABLES];
+  int lastSequence;
+} decoder_t;
+
+static logCompressionState_t state;
+static decoder_t decoder;
+
+static void decoderInit(decoder_t* this);
+static void decode(decoder_t* this, const uint8_t* length, const int count, const uint8_t* packet, const int size);
+static void writeValue(uint8_t* data, uint32_t value, const int length);
+static int layoutLength(const uint8_t* length, const int count);
+static void assertDecodedValues(const decoder_t* this, const uint8_t* length, const int count, const uint8_t* values);
+
+void setUp(void) {
+  decoderInit(&decoder);
+  srand(42);
+}
+
+void tearDown(void) {
+  // Empty
+}
+
+void testThatValuesOfAllLengthsRoundTrip() {
+  // Fixture
+  const uint8_t length[] = {1, 2, 4, 4, 2, 1, 4};
+  const int count = sizeof(length);
+  uint8_t values[LOG_COMPRESSION_MAX_LEN];
+  uint32_t current[7] = {250, 65000, 0xfffffff0, 0x3f800000, 0x3c00, 0, 12345};
+  uint8_t packet[PAYLOAD_LEN];
+
+  logCompressionInit(&state, length, count);
+
+  for (int i = 0; i < 200; i++) {
+    // Random steps, that also wrap around the range of the variables
+    for (int v = 0; v < count; v++) {
+      current[v] += (rand() % 41) - 20;
+      writeValue(&values[layoutLength(length, v)], current[v], length[v]);
+    }
+
+    // Test
+    const int size = logCompressionEncode(&state, values, packet, PAYLOAD_LEN);
+    decode(&decoder, length, count, packet, size);
+
+    // Assert
+    TEST_ASSERT_TRUE(size <= PAYLOAD_LEN);
+    assertDecodedValues(&decoder, length, count, values);
+  }
+}
+
+void testThatSmoothSignalsAreCompressed() {
+  // Fixture
+  // 20 variables logged as FP16 would need 40 bytes, more than one packet
+  uint8_t length[20];
+  const int count = sizeof(length);
+  for (int v = 0; v < count; v++) {
+    length[v] = 2;
+  }
+  uint8_t values[LOG_COMPRESSION_MAX_LEN];
+  uint8_t packet[PAYLOAD_LEN];
+
+  logCompressionInit(&state, length, count);
+
+  int totalSize = 0;
+  const int packets = 1000;
+
+  for (int i = 0; i < packets; i++) {
+    for (int v = 0; v < count; v++) {
+      // Sine in 1/1000 units, sampled at 100 Hz
+      const int16_t value = (int16_t)(1000.0f * sinf(i * 0.01f * (1.0f + v * 0.1f)));
+      writeValue(&values[2 * v], (uint16_t)value, 2);
+    }
+
+    // Test
+    const int size = logCompressionEncode(&state, values, packet, PAYLOAD_LEN);
+    decode(&decoder, length, count, packet, size);
+
+    totalSize += size;
+
+    // Assert
+    // All variables fit in a delta packet
+    if ((packet[0] & LOG_COMPRESSION_KEYFRAME_FLAG) == 0) {
+      assertDecodedValues(&decoder, length, count, values);
+    }
+  }
+
+  // Assert
+  const float bytesPerVariable = (float)totalSize / (packets * count);
+#ifdef SHOW_OUTPUT
+  printf("Bytes per variable: %f (uncompressed 2)\n", bytesPerVariable);
+#endif
+  TEST_ASSERT_TRUE(bytesPerVariable < 1.2f);
+}
+
+void testThatKeyframeIsSplitOverPacketsIfItDoesNotFit() {
+  // Fixture
+  // Large values, a keyframe needs 5 bytes per variable
+  const uint8_t length[] = {4, 4, 4, 4, 4, 4, 4, 4, 4, 4};
+  const int count = sizeof(length);
+  uint8_t values[LOG_COMPRESSION_MAX_LEN];
+  uint8_t packet[PAYLOAD_LEN];
+
+  for (int v = 0; v < count; v++) {
+    writeValue(&values[4 * v], 0x80000000 + v, 4);
+  }
+
+  logCompressionInit(&state, length, count);
+
+  // Test
+  int keyframePackets = 0;
+  for (int i = 0; i < 4; i++) {
+    const int size = logCompressionEncode(&state, values, packet, PAYLOAD_LEN);
+    decode(&decoder, length, count, packet, size);
+
+    if (packet[0] & LOG_COMPRESSION_KEYFRAME_FLAG) {
+      keyframePackets++;
+    }
+  }
+
+  // Assert
+  TEST_ASSERT_EQUAL(3, keyframePackets);
+  assertDecodedValues(&decoder, length, count, values);
+}
+
+void testThatDecoderRecoversAtKeyframeAfterLostPacket() {
+  // Fixture
+  const uint8_t length[] = {2, 2, 2, 2};
+  const int count = sizeof(length);
+  uint8_t values[LOG_COMPRESSION_MAX_LEN];
+  uint8_t packet[PAYLOAD_LEN];
+
+  logCompressionInit(&state, length, count);
+
+  // Test
+  bool wasInvalidated = false;
+  for (int i = 0; i < 3 * LOG_COMPRESSION_KEYFRAME_INTERVAL; i++) {
+    for (int v = 0; v < count; v++) {
+      writeValue(&values[2 * v], i * (v + 1), 2);
+    }
+
+    const int size = logCompressionEncode(&state, values, packet, PAYLOAD_LEN);
+    if (i == 3) {
+      // Lost packet
+      continue;
+    }
+    decode(&decoder, length, count, packet, size);
+
+    if (i > 3 && i < LOG_COMPRESSION_KEYFRAME_INTERVAL) {
+      wasInvalidated |= !decoder.isValid[0];
+    }
+  }
+
+  // Assert
+  TEST_ASSERT_TRUE(wasInvalidated);
+  assertDecodedValues(&decoder, length, count, values);
+}
+
+// Helpers ///////////////////////////////////////////////////////////////
+
+static void decoderInit(decoder_t* this) {
+  memset(this, 0, sizeof(decoder_t));
+  this->lastSequence = -1;
+}
+
+static uint32_t mask(const int length) {
+  return (length == 4) ? 0xffffffff : ((1u << (8 * length)) - 1);
+}
+
+// Reference decoder, mirrors tools/log/cflogcompression.py
+static void decode(decoder_t* this, const uint8_t* length, const int count, const uint8_t* packet, const int size) {
+  const bool isKeyframe = packet[0] & LOG_COMPRESSION_KEYFRAME_FLAG;
+  const int sequence = packet[0] & LOG_COMPRESSION_SEQUENCE_MASK;
+
+  if (this->lastSequence >= 0 && sequence != ((this->lastSequence + 1) & LOG_COMPRESSION_SEQUENCE_MASK)) {
+    for (int v = 0; v < count; v++) {
+      this->isValid[v] = false;
+    }
+  }
+  this->lastSequence = sequence;
+
+  int variable = packet[1];
+  int index = LOG_COMPRESSION_HEADER_LEN;
+  while (index < size) {
+    uint32_t encoded = 0;
+    int shift = 0;
+    uint8_t byte;
+    do {
+      byte = packet[index++];
+      encoded |= (uint32_t)(byte & 0x7f) << shift;
+      shift += 7;
+    } while (byte & 0x80);
+
+    const int32_t difference = (int32_t)(encoded >> 1) ^ -(int32_t)(encoded & 1);
+    if (isKeyframe) {
+      this->value[variable] = (uint32_t)difference & mask(length[variable]);
+      this->isValid[variable] = true;
+    } else {
+      this->value[variable] = (this->value[variable] + (uint32_t)difference) & mask(length[variable]);
+    }
+
+    variable = (variable + 1) % count;
+  }
+}
+
+static void writeValue(uint8_t* data, uint32_t value, const int length) {
+  for (int i = 0; i < length; i++) {
+    data[i] = value & 0xff;
+    value >>= 8;
+  }
+}
+
+static int layoutLength(const uint8_t* length, const int count) {
+  int result = 0;
+  for (int i = 0; i < count; i++) {
+    result += length[i];
+  }
+  return result;
+}
+
+static void assertDecodedValues(const decoder_t* this, const uint8_t* length, const int count, const uint8_t* values) {
+  for (int v = 0; v < count; v++) {
+    const int offset = layoutLength(length, v);
+    uint32_t expected = 0;
+    memcpy(&expected, &values[offset], length[v]);
+
+    TEST_ASSERT_TRUE(this->isValid[v]);
+    TEST_ASSERT_EQUAL_HEX32(expected, this->value[v]);
+  }
+}
@@ -69,6 +69,30 @@ void testThatSamplesAreRejectedWhenTdoaIsGreaterButNegativeThanDistanceBetweenAn
 }
 
 
+void testThatTdoaStepsFilterGivesSameResultAfterStateIsRestored() {
+  // Fixture
+  tdoa.distanceDiff = 1.0;
+  vector_t jacobian = {.x = 1.0, .y = 0.0, .z = 0.0};
+  point_t estPos = {.x = 2.0, .y = 1.0, .z = 1.0};
+
+  OutlierFilterTdoaState_t saved;
+  outlierFilterTdoaGetState(&saved);
+
+  bool expected[20];
+  for (int i = 0; i < 20; i++) {
+    expected[i] = outlierFilterValidateTdoaSteps(&tdoa, 0.1f * i, &jacobian, &estPos);
+  }
+
+  // Test
+  outlierFilterTdoaSetState(&saved);
+
+  // Assert
+  for (int i = 0; i < 20; i++) {
+    TEST_ASSERT_EQUAL(expected[i], outlierFilterValidateTdoaSteps(&tdoa, 0.1f * i, &jacobian, &estPos));
+  }
+}
+
+
 // Lighthouse filter tests ----------------------------------------------------------
 
 #define LH_DISTANCE 4
@@ -5,6 +5,8 @@
 #include <string.h>
 #include <limits.h>
 #include <errno.h>
+#include <stdio.h>
+#include <time.h>
 
 #include "unity.h"
 
@@ -13,6 +15,8 @@
 #include "mock_storage.h"
 #include "crc32.h"
 
+// #define SHOW_OUTPUT
+
 // linker symbols mock
 int _sdata;
 int _edata;
@@ -458,3 +462,223 @@ void testPersistentGetStateWithNonExistingParameter(void) {
   TEST_ASSERT_EQUAL_UINT8(testPk.size, replyPk.size);
   TEST_ASSERT_EQUAL_UINT8_ARRAY(&testPk.data[0], &replyPk.data[0], replyPk.size);
 }
+
+#define LARGE_TOC_GROUPS 30
+#define LARGE_TOC_VARIABLES_PER_GROUP 16
+#define LARGE_TOC_LEN (LARGE_TOC_GROUPS * (LARGE_TOC_VARIABLES_PER_GROUP + 2))
+#define BENCHMARK_ROUNDS 20
+
+static struct param_s largeToc[LARGE_TOC_LEN];
+static char largeTocNames[LARGE_TOC_LEN][16];
+static uint8_t largeTocValue;
+
+// A TOC with groups that are not sorted by name, as placed by the linker
+static void initLargeToc() {
+  int index = 0;
+  for (int g = 0; g < LARGE_TOC_GROUPS; g++) {
+    const int groupNumber = (g * 7) % LARGE_TOC_GROUPS;
+
+    sprintf(largeTocNames[index], "group%02d", groupNumber);
+    largeToc[index] = (struct param_s){.type = PARAM_GROUP | PARAM_START, .name = largeTocNames[index]};
+    index++;
+
+    for (int v = 0; v < LARGE_TOC_VARIABLES_PER_GROUP; v++) {
+      sprintf(largeTocNames[index], "var%02d", v);
+      largeToc[index] = (struct param_s){.type = PARAM_UINT8, .name = largeTocNames[index], .address = &largeTocValue};
+      index++;
+    }
+
+    sprintf(largeTocNames[index], "stop_group%02d", groupNumber);
+    largeToc[index] = (struct param_s){.type = PARAM_GROUP | PARAM_STOP, .name = largeTocNames[index]};
+    index++;
+  }
+
+  _param_start = largeToc;
+  _param_stop = largeToc + LARGE_TOC_LEN;
+  paramLogicInit();
+}
+
+// The lookup as it was done before the TOC was indexed
+static paramVarId_t linearGetVarId(const char* group, const char* name) {
+  paramVarId_t varId = {0xffffu, 0xffffu};
+  const char* currgroup = "";
+  uint16_t id = 0;
+
+  for (uint16_t index = 0; index < LARGE_TOC_LEN; index++) {
+    if (largeToc[index].type & PARAM_GROUP) {
+      if (largeToc[index].type & PARAM_START) {
+        currgroup = largeToc[index].name;
+      }
+    } else {
+      if (!strcmp(group, currgroup) && !strcmp(name, largeToc[index].name)) {
+        varId.index = index;
+        varId.id = id;
+        return varId;
+      }
+      id++;
+    }
+  }
+
+  return varId;
+}
+
+void testGetVarIdOfNonExistingVariable(void) {
+  // Fixture
+  initLargeToc();
+
+  // Test
+  paramVarId_t unknownGroup = paramGetVarId("group99", "var00");
+  paramVarId_t unknownName = paramGetVarId("group00", "var99");
+  paramVarId_t groupName = paramGetVarId("group00", "group00");
+
+  // Assert
+  TEST_ASSERT_FALSE(PARAM_VARID_IS_VALID(unknownGroup));
+  TEST_ASSERT_FALSE(PARAM_VARID_IS_VALID(unknownName));
+  TEST_ASSERT_FALSE(PARAM_VARID_IS_VALID(groupName));
+}
+
+void testGetTocItemOfLargeToc(void) {
+  // Fixture
+  initLargeToc();
+  crtpSendPacketBlock_StubWithCallback(crtpReply);
+
+  // Id of the 4th variable of the 3rd group in the TOC
+  const uint16_t id = 2 * LARGE_TOC_VARIABLES_PER_GROUP + 3;
+  CRTPPacket testPk;
+  testPk.data[0] = 2; // CMD_GET_ITEM_V2
+  memcpy(&testPk.data[1], &id, 2);
+
+  // Test
+  paramTOCProcess(&testPk, 2);
+
+  // Assert
+  TEST_ASSERT_EQUAL_UINT8(PARAM_UINT8, replyPk.data[3]);
+  TEST_ASSERT_EQUAL_STRING("group14", (char*)&replyPk.data[4]);
+  TEST_ASSERT_EQUAL_STRING("var03", (char*)&replyPk.data[4 + strlen("group14") + 1]);
+}
+
+// A TOC where groups with the same name are spread out, as the deck drivers
+// that all add their parameters to the deck group
+static struct param_s duplicateGroupsToc[] = {
+  {.type = PARAM_GROUP | PARAM_START, .name = "deck"},
+  {.type = PARAM_UINT8, .name = "bcFlow2", .address = &myUint8},
+  {.type = PARAM_GROUP | PARAM_STOP, .name = "stop_deck"},
+  {.type = PARAM_GROUP | PARAM_START, .name = "alpha"},
+  {.type = PARAM_UINT8, .name = "bcFlow2", .address = &myUint8},
+  {.type = PARAM_GROUP | PARAM_STOP, .name = "stop_alpha"},
+  {.type = PARAM_GROUP | PARAM_START, .name = "deck"},
+  {.type = PARAM_UINT8, .name = "bcLoco", .address = &myUint8},
+  {.type = PARAM_GROUP | PARAM_STOP, .name = "stop_deck"},
+  {.type = PARAM_GROUP | PARAM_START, .name = "zeta"},
+  {.type = PARAM_UINT8, .name = "bcLoco", .address = &myUint8},
+  {.type = PARAM_GROUP | PARAM_STOP, .name = "stop_zeta"},
+  {.type = PARAM_GROUP | PARAM_START, .name = "deck"},
+  {.type = PARAM_UINT8, .name = "bcZRanger", .address = &myUint8},
+  {.type = PARAM_UINT8, .name = "bcLoco", .address = &myUint8},
+  {.type = PARAM_GROUP | PARAM_STOP, .name = "stop_deck"},
+};
+
+void testGetVarIdInGroupsWithTheSameName(void) {
+  // Fixture
+  _param_start = duplicateGroupsToc;
+  _param_stop = duplicateGroupsToc + sizeof(duplicateGroupsToc) / sizeof(duplicateGroupsToc[0]);
+  paramLogicInit();
+
+  // Test
+  paramVarId_t first = paramGetVarId("deck", "bcFlow2");
+  paramVarId_t second = paramGetVarId("deck", "bcLoco");
+  paramVarId_t third = paramGetVarId("deck", "bcZRanger");
+  paramVarId_t unknown = paramGetVarId("deck", "bcMissing");
+
+  // Assert
+  TEST_ASSERT_EQUAL_UINT16(1, first.index);
+  TEST_ASSERT_EQUAL_UINT16(0, first.id);
+  // The first variable with the name, in TOC order
+  TEST_ASSERT_EQUAL_UINT16(7, second.index);
+  TEST_ASSERT_EQUAL_UINT16(2, second.id);
+  TEST_ASSERT_EQUAL_UINT16(13, third.index);
+  TEST_ASSERT_EQUAL_UINT16(4, third.id);
+  TEST_ASSERT_FALSE(PARAM_VARID_IS_VALID(unknown));
+}
+
+void testWriteByNameInGroupsWithTheSameName(void) {
+  // Fixture
+  _param_start = duplicateGroupsToc;
+  _param_stop = duplicateGroupsToc + sizeof(duplicateGroupsToc) / sizeof(duplicateGroupsToc[0]);
+  paramLogicInit();
+  crtpSendPacketBlock_StubWithCallback(crtpReply);
+  myUint8 = 0;
+
+  CRTPPacket testPk;
+  memset(&testPk, 0, sizeof(testPk));
+  testPk.size = 0;
+  testPk.data[testPk.size++] = 0; // MISC_SETBYNAME
+  strcpy((char*)&testPk.data[testPk.size], "deck");
+  testPk.size += strlen("deck") + 1;
+  strcpy((char*)&testPk.data[testPk.size], "bcZRanger");
+  testPk.size += strlen("bcZRanger") + 1;
+  testPk.data[testPk.size++] = PARAM_UINT8;
+  testPk.data[testPk.size++] = 42;
+
+  // Test
+  paramSetByName(&testPk);
+
+  // Assert
+  TEST_ASSERT_EQUAL_UINT8(42, myUint8);
+  TEST_ASSERT_EQUAL_UINT8(0, replyPk.data[1 + strlen("deck") + 1 + strlen("bcZRanger") + 1]);
+}
+
+void testBenchmarkNameLookupOfLargeToc(void) {
+  // Fixture
+  initLargeToc();
+  char* groups[LARGE_TOC_LEN];
+  char* names[LARGE_TOC_LEN];
+  paramVarId_t expected[LARGE_TOC_LEN];
+  int count = 0;
+
+  for (int index = 0; index < LARGE_TOC_LEN; index++) {
+    if (!(largeToc[index].type & PARAM_GROUP)) {
+      paramVarId_t varId = {.id = count, .index = index};
+      paramGetGroupAndName(varId, &groups[count], &names[count]);
+      expected[count] = varId;
+      count++;
+    }
+  }
+
+  // Test
+  uint32_t checksum = 0;
+  clock_t start = clock();
+  for (int round = 0; round < BENCHMARK_ROUNDS; round++) {
+    for (int i = 0; i < count; i++) {
+      checksum += linearGetVarId(groups[i], names[i]).index;
+    }
+  }
+  clock_t linearTime = clock() - start;
+
+  start = clock();
+  for (int round = 0; round < BENCHMARK_ROUNDS; round++) {
+    for (int i = 0; i < count; i++) {
+      checksum += paramGetVarId(groups[i], names[i]).index;
+    }
+  }
+  clock_t indexedTime = clock() - start;
+
+  // Assert
+#ifdef SHOW_OUTPUT
+  printf("Resolving %d param names, linear: %.1f us, indexed: %.1f us\n", count,
+    1e6 * (double)linearTime / CLOCKS_PER_SEC / BENCHMARK_ROUNDS,
+    1e6 * (double)indexedTime / CLOCKS_PER_SEC / BENCHMARK_ROUNDS);
+#else
+  (void)linearTime;
+  (void)indexedTime;
+#endif
+
+  TEST_ASSERT_EQUAL_INT(LARGE_TOC_GROUPS * LARGE_TOC_VARIABLES_PER_GROUP, count);
+  for (int i = 0; i < count; i++) {
+    paramVarId_t actual = paramGetVarId(groups[i], names[i]);
+    TEST_ASSERT_EQUAL_UINT16(expected[i].id, actual.id);
+    TEST_ASSERT_EQUAL_UINT16(expected[i].index, actual.index);
+    TEST_ASSERT_EQUAL_UINT16(expected[i].index, linearGetVarId(groups[i], names[i]).index);
+  }
+  TEST_ASSERT_TRUE(checksum > 0);
+}
@@ -0,0 +1,161 @@
+// File under test peer_localization.c
+#include "peer_localization.h"
+
+#include <stdint.h>
+
+#include "unity.h"
+
+// An id that is not used to fill the table
+#define NEW_ID 255
+
+static uint32_t now;
+
+uint32_t xTaskGetTickCount() {
+  return now;
+}
+
+static void tellPosition(int id, float x);
+static int countFreshNeighbors(uint32_t maxAge);
+
+void setUp(void) {
+  now = 10000;
+  peerLocalizationInit();
+}
+
+void tearDown(void) {
+  // Empty
+}
+
+void testThatPositionCanBeLookedUpById() {
+  // Fixture
+  tellPosition(7, 1.0f);
+  tellPosition(200, 2.0f);
+  tellPosition(7, 3.0f);
+
+  // Test
+  peerLocalizationOtherPosition_t *actual7 = peerLocalizationGetPositionByID(7);
+  peerLocalizationOtherPosition_t *actual200 = peerLocalizationGetPositionByID(200);
+
+  // Assert
+  TEST_ASSERT_NOT_NULL(actual7);
+  TEST_ASSERT_EQUAL_UINT8(7, actual7->id);
+  TEST_ASSERT_EQUAL_FLOAT(3.0f, actual7->pos.x);
+  TEST_ASSERT_NOT_NULL(actual200);
+  TEST_ASSERT_EQUAL_FLOAT(2.0f, actual200->pos.x);
+  TEST_ASSERT_EQUAL_INT(2, countFreshNeighbors(UINT32_MAX));
+}
+
+void testThatUnknownIdIsNotFound() {
+  // Fixture
+  tellPosition(7, 1.0f);
+
+  // Test
+  // Assert
+  TEST_ASSERT_NULL(peerLocalizationGetPositionByID(8));
+  TEST_ASSERT_NULL(peerLocalizationGetPositionByID(0));
+  TEST_ASSERT_FALSE(peerLocalizationIsIDActive(8));
+}
+
+void testThatIdIsNotActiveWhenPositionIsStale() {
+  // Fixture
+  tellPosition(7, 1.0f);
+
+  // Test
+  const bool activeWhenFresh = peerLocalizationIsIDActive(7);
+  now += PEER_LOCALIZATION_STALE_AGE + 1;
+  const bool activeWhenStale = peerLocalizationIsIDActive(7);
+
+  // Assert
+  TEST_ASSERT_TRUE(activeWhenFresh);
+  TEST_ASSERT_FALSE(activeWhenStale);
+}
+
+void testThatNewNeighborIsRejectedWhenTableIsFullOfFreshNeighbors() {
+  // Fixture
+  if (PEER_LOCALIZATION_MAX_NEIGHBORS == 255) {
+    TEST_IGNORE_MESSAGE("Every id fits in the table");
+  }
+  for (int id = 1; id <= PEER_LOCALIZATION_MAX_NEIGHBORS; id++) {
+    tellPosition(id, id);
+  }
+
+  // Test
+  positionMeasurement_t pos = {.x = 1.0f, .y = 0.0f, .z = 0.0f};
+  const bool actual = peerLocalizationTellPosition(NEW_ID, &pos);
+
+  // Assert
+  TEST_ASSERT_FALSE(actual);
+  TEST_ASSERT_NULL(peerLocalizationGetPositionByID(NEW_ID));
+}
+
+void testThatStaleNeighborIsReplacedWhenTableIsFull() {
+  // Fixture
+  if (PEER_LOCALIZATION_MAX_NEIGHBORS == 255) {
+    TEST_IGNORE_MESSAGE("Every id fits in the table");
+  }
+  for (int id = 1; id <= PEER_LOCALIZATION_MAX_NEIGHBORS; id++) {
+    tellPosition(id, id);
+    now += 10;
+  }
+  now += PEER_LOCALIZATION_STALE_AGE - 15;
+
+  // Test
+  // Neighbor 1 is the oldest stale neighbor
+  positionMeasurement_t pos = {.x = 100.0f, .y = 0.0f, .z = 0.0f};
+  const bool actual = peerLocalizationTellPosition(NEW_ID, &pos);
+
+  // Assert
+  TEST_ASSERT_TRUE(actual);
+  TEST_ASSERT_NULL(peerLocalizationGetPositionByID(1));
+  TEST_ASSERT_NOT_NULL(peerLocalizationGetPositionByID(2));
+  TEST_ASSERT_EQUAL_FLOAT(100.0f, peerLocalizationGetPositionByID(NEW_ID)->pos.x);
+}
+
+void testThatIteratorOnlyYieldsFreshNeighbors() {
+  // Fixture
+  tellPosition(1, 1.0f);
+  now += 100;
+  tellPosition(2, 2.0f);
+  now += 100;
+  tellPosition(3, 3.0f);
+
+  // Test
+  // Assert
+  TEST_ASSERT_EQUAL_INT(3, countFreshNeighbors(200));
+  TEST_ASSERT_EQUAL_INT(2, countFreshNeighbors(150));
+  TEST_ASSERT_EQUAL_INT(1, countFreshNeighbors(0));
+}
+
+void testThatManyIdsCanBeTrackedWithChurn() {
+  // Fixture
+  // Neighbors come and go over the full id space
+  int accepted = 0;
+
+  // Test
+  for (int id = 1; id <= 255; id++) {
+    positionMeasurement_t pos = {.x = id, .y = 0.0f, .z = 0.0f};
+    accepted += peerLocalizationTellPosition(id, &pos);
+    now += PEER_LOCALIZATION_STALE_AGE / PEER_LOCALIZATION_MAX_NEIGHBORS + 1;
+  }
+
+  // Assert
+  TEST_ASSERT_EQUAL_INT(255, accepted);
+  TEST_ASSERT_EQUAL_FLOAT(255.0f, peerLocalizationGetPositionByID(255)->pos.x);
+}
+
+// Helpers ///////////////////////////////////////////////////////////////
+
+static void tellPosition(int id, float x) {
+  positionMeasurement_t pos = {.x = x, .y = 0.0f, .z = 0.0f};
+  TEST_ASSERT_TRUE(peerLocalizationTellPosition(id, &pos));
+}
+
+static int countFreshNeighbors(uint32_t maxAge) {
+  int count = 0;
+  peerLocalizationIterator_t it;
+  peerLocalizationIteratorInit(&it, maxAge);
+  while (peerLocalizationIteratorNext(&it) != NULL) {
+    count++;
+  }
+  return count;
+}
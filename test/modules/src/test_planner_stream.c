@@ -0,0 +1,196 @@
+// File under test planner_stream.c
+#include "planner_stream.h"
+
+#include <string.h>
+
+#include "unity.h"
+#include "planner.h"
+#include "pptraj.h"
+#include "pptraj_compressed.h"
+
+#define RING_CAPACITY 4
+#define PIECE_DURATION 1.0f
+#define T0 10.0f
+
+static struct planner planner;
+static struct planner_stream stream;
+static struct poly4d ring[RING_CAPACITY];
+
+// Number of pieces written to the ring so far
+static int written;
+
+// Helpers
+static void writePieces(int n);
+static void assertPositionAt(float expected, float t);
+
+
+void setUp(void) {
+  plan_init(&planner);
+
+  memset(&stream, 0, sizeof(stream));
+  memset(ring, 0, sizeof(ring));
+  plan_stream_define(&stream, ring, RING_CAPACITY);
+  written = 0;
+}
+
+void tearDown(void) {
+  // Empty
+}
+
+
+void testThatAppendedPiecesArePlayedInOrder() {
+  // Fixture
+  writePieces(2);
+  plan_stream_append(&stream, &planner, 2, false);
+  plan_stream_start(&stream, &planner, 1.0f, false, vzero(), T0);
+
+  // Test
+  writePieces(1);
+  plan_stream_append(&stream, &planner, 1, false);
+
+  // Assert
+  for (float t = 0.0f; t < 3.0f; t += 0.1f) {
+    assertPositionAt(t, T0 + t);
+  }
+  TEST_ASSERT_TRUE(stream.isPlaying);
+  TEST_ASSERT_EQUAL_UINT32(2, stream.playedPieces);
+  TEST_ASSERT_EQUAL_UINT8(RING_CAPACITY - 1, stream.freeSlots);
+}
+
+void testThatStreamIsPlayedAcrossTheEndOfTheRing() {
+  // Fixture
+  writePieces(RING_CAPACITY);
+  plan_stream_append(&stream, &planner, RING_CAPACITY, false);
+  plan_stream_start(&stream, &planner, 1.0f, false, vzero(), T0);
+
+  // Test, Assert
+  // Keep the ring full while flying through it three times
+  for (float t = 0.0f; t < 3 * RING_CAPACITY; t += 0.1f) {
+    assertPositionAt(t, T0 + t);
+
+    int free = stream.freeSlots;
+    if (free > 0) {
+      writePieces(free);
+      plan_stream_append(&stream, &planner, free, false);
+    }
+  }
+  TEST_ASSERT_TRUE(stream.isPlaying);
+  TEST_ASSERT_EQUAL_UINT16(0, stream.underruns);
+}
+
+void testThatPlannerIsNotFinishedWhenWindowEndsAtTheEndOfTheRing() {
+  // Fixture
+  // Play until the head is close to the end of the ring, so that the played window ends at the end of the ring while
+  // there are more pieces at the start of it
+  writePieces(RING_CAPACITY - 1);
+  plan_stream_append(&stream, &planner, RING_CAPACITY - 1, false);
+  plan_stream_start(&stream, &planner, 1.0f, false, vzero(), T0);
+  assertPositionAt(RING_CAPACITY - 1.5f, T0 + RING_CAPACITY - 1.5f);
+
+  writePieces(2);
+  plan_stream_append(&stream, &planner, 2, true);
+  TEST_ASSERT_EQUAL_INT(RING_CAPACITY, stream.head + stream.trajectory.n_pieces);
+
+  // Test
+  float t = T0 + RING_CAPACITY + 0.5f;
+  plan_stream_advance(&stream, &planner, t);
+  bool actual = plan_is_finished(&planner, t);
+
+  // Assert
+  TEST_ASSERT_FALSE(actual);
+  assertPositionAt(RING_CAPACITY + 0.5f, t);
+}
+
+void testThatUnderrunStopsAndHovers() {
+  // Fixture
+  writePieces(2);
+  plan_stream_append(&stream, &planner, 2, false);
+  plan_stream_start(&stream, &planner, 1.0f, false, vzero(), T0);
+
+  // Test
+  for (float t = 0.0f; t < 2.0f; t += 0.1f) {
+    assertPositionAt(t, T0 + t);
+  }
+  float t = T0 + 2.05f;
+  plan_stream_advance(&stream, &planner, t);
+
+  // Assert
+  TEST_ASSERT_FALSE(stream.isPlaying);
+  TEST_ASSERT_EQUAL_UINT16(1, stream.underruns);
+  TEST_ASSERT_EQUAL_UINT8(RING_CAPACITY, stream.freeSlots);
+  TEST_ASSERT_EQUAL_PTR(&planner.planned_trajectory, planner.trajectory);
+
+  // Stops smoothly, half the stop duration at the velocity at the end of the last piece
+  float stopped = t + PLAN_STREAM_STOP_DURATION;
+  TEST_ASSERT_TRUE(plan_is_finished(&planner, stopped));
+  struct traj_eval ev = plan_current_goal(&planner, stopped);
+  TEST_ASSERT_FLOAT_WITHIN(1e-4, 2.0f + PLAN_STREAM_STOP_DURATION / 2.0f, ev.pos.x);
+  TEST_ASSERT_FLOAT_WITHIN(1e-4, 0.0f, ev.vel.x);
+}
+
+void testThatClosedStreamEndsAndCanBeDefinedAgain() {
+  // Fixture
+  writePieces(2);
+  plan_stream_append(&stream, &planner, 2, true);
+  plan_stream_start(&stream, &planner, 1.0f, false, vzero(), T0);
+
+  // Test
+  for (float t = 0.0f; t < 2.0f; t += 0.1f) {
+    assertPositionAt(t, T0 + t);
+  }
+  float t = T0 + 2.05f;
+  plan_stream_advance(&stream, &planner, t);
+
+  // Assert
+  TEST_ASSERT_FALSE(stream.isPlaying);
+  TEST_ASSERT_EQUAL_UINT16(0, stream.underruns);
+  TEST_ASSERT_EQUAL_UINT32(2, stream.playedPieces);
+
+  // The planner does not depend on the ring any more, so it can be defined and written again
+  plan_stream_define(&stream, ring, RING_CAPACITY);
+  memset(ring, 0, sizeof(ring));
+  struct traj_eval ev = plan_current_goal(&planner, t + PLAN_STREAM_STOP_DURATION);
+  TEST_ASSERT_FLOAT_WITHIN(1e-4, 2.0f + PLAN_STREAM_STOP_DURATION / 2.0f, ev.pos.x);
+
+  written = 0;
+  writePieces(1);
+  plan_stream_append(&stream, &planner, 1, true);
+  plan_stream_start(&stream, &planner, 1.0f, false, vzero(), t);
+  TEST_ASSERT_TRUE(stream.isPlaying);
+  assertPositionAt(0.5f, t + 0.5f);
+}
+
+void testThatStreamIsNotPlayingWhenPreempted() {
+  // Fixture
+  writePieces(2);
+  plan_stream_append(&stream, &planner, 2, false);
+  plan_stream_start(&stream, &planner, 1.0f, false, vzero(), T0);
+
+  // Test
+  plan_go_to(&planner, false, mkvec(1, 1, 1), 0, 1.0f, T0 + 0.5f);
+  plan_stream_advance(&stream, &planner, T0 + 0.6f);
+
+  // Assert
+  TEST_ASSERT_FALSE(stream.isPlaying);
+  TEST_ASSERT_EQUAL_UINT16(0, stream.underruns);
+}
+
+
+// Helpers /////////////////////////////////////////////////////////////////////////////////
+
+// Write pieces that fly along the x axis at 1 m/s, such that x is the time since the start of the stream
+static void writePieces(int n) {
+  for (int i = 0; i < n; i++) {
+    struct poly4d* piece = &ring[written % RING_CAPACITY];
+    memset(piece, 0, sizeof(*piece));
+    polylinear(piece->p[0], PIECE_DURATION, written * PIECE_DURATION, (written + 1) * PIECE_DURATION);
+    piece->duration = PIECE_DURATION;
+    written++;
+  }
+}
+
+static void assertPositionAt(float expected, float t) {
+  plan_stream_advance(&stream, &planner, t);
+  struct traj_eval ev = plan_current_goal(&planner, t);
+  TEST_ASSERT_FLOAT_WITHIN(1e-4, expected, ev.pos.x);
+}
@@ -1,9 +1,11 @@
 // File under test pptraj.h and pptraj_compressed.h
 #include "pptraj.h"
 #include "pptraj_compressed.h"
+#include "planner.h"
 
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "unity.h"
 
@@ -250,6 +252,7 @@ void testFigure8Evaluation(void) {
   traj.n_pieces = sizeof(figure8_pieces) / sizeof(figure8_pieces[0]);
   traj.pieces = figure8_pieces;
   traj.shift = mkvec(-1, 2, 3);
+  traj.piece_start = NULL;
 
   // Test
   duration = piecewise_duration(&traj);
@@ -388,6 +391,7 @@ void testCompressedFigure8RandomOrderQueries(void) {
   traj.n_pieces = sizeof(figure8_pieces) / sizeof(figure8_pieces[0]);
   traj.pieces = figure8_pieces;
   traj.shift = mkvec(-1, 2, 3);
+  traj.piece_start = NULL;
 
   piecewise_compressed_load(&ctraj, figure8_compressed_pieces);
   ctraj.t_begin = 2;
@@ -431,3 +435,556 @@ void testCompressedFigure8RandomOrderQueries(void) {
   printf("Maximum difference = %.4f\n", maxdiff);
 #endif
 }
+
+#define LONG_TRAJECTORY_PIECES 250
+#define BENCHMARK_EVALUATIONS 20000
+
+static struct poly4d long_trajectory_pieces[LONG_TRAJECTORY_PIECES];
+static float piece_start[LONG_TRAJECTORY_PIECES + 1];
+
+static void assertTrajEvalEqual(struct traj_eval const *expected, struct traj_eval const *actual) {
+  TEST_ASSERT_FLOAT_WITHIN(1e-4, expected->pos.x, actual->pos.x);
+  TEST_ASSERT_FLOAT_WITHIN(1e-4, expected->pos.y, actual->pos.y);
+  TEST_ASSERT_FLOAT_WITHIN(1e-4, expected->pos.z, actual->pos.z);
+  TEST_ASSERT_FLOAT_WITHIN(1e-4, expected->yaw, actual->yaw);
+  TEST_ASSERT_FLOAT_WITHIN(1e-3, expected->vel.x, actual->vel.x);
+  TEST_ASSERT_FLOAT_WITHIN(1e-3, expected->vel.y, actual->vel.y);
+  TEST_ASSERT_FLOAT_WITHIN(1e-3, expected->acc.x, actual->acc.x);
+  TEST_ASSERT_FLOAT_WITHIN(1e-3, expected->acc.y, actual->acc.y);
+}
+
+// Repeat the figure 8 pieces to build a long trajectory
+static void initLongTrajectory(struct piecewise_traj *traj, int n_pieces) {
+  const int figure8_n_pieces = sizeof(figure8_pieces) / sizeof(figure8_pieces[0]);
+  for (int i = 0; i < n_pieces; i++) {
+    long_trajectory_pieces[i] = figure8_pieces[i % figure8_n_pieces];
+  }
+
+  traj->t_begin = 1;
+  traj->timescale = 1;
+  traj->shift = vzero();
+  traj->n_pieces = n_pieces;
+  traj->pieces = long_trajectory_pieces;
+  traj->piece_start = NULL;
+}
+
+static clock_t benchmarkMonotonicEvaluation(struct piecewise_traj *traj) {
+  const float dt = piecewise_duration(traj) / BENCHMARK_EVALUATIONS;
+  float sum = 0;
+  struct piecewise_cursor cursor;
+  piecewise_cursor_reset(&cursor);
+
+  clock_t start = clock();
+  for (int i = 0; i < BENCHMARK_EVALUATIONS; i++) {
+    struct traj_eval ev = piecewise_eval_with_cursor(traj, &cursor, traj->t_begin + i * dt);
+    sum += ev.pos.x;
+  }
+  clock_t time = clock() - start;
+
+  TEST_ASSERT(!isnan(sum));
+  return time;
+}
+
+void testIndexedEvaluationMatchesLinearEvaluation(void) {
+  // Fixture
+  struct piecewise_traj linear;
+  struct piecewise_traj indexed;
+  float piece_start_short[sizeof(figure8_pieces) / sizeof(figure8_pieces[0]) + 1];
+
+  linear.t_begin = 2;
+  linear.timescale = 1.5;
+  linear.shift = mkvec(-1, 2, 3);
+  linear.n_pieces = sizeof(figure8_pieces) / sizeof(figure8_pieces[0]);
+  linear.pieces = figure8_pieces;
+  linear.piece_start = NULL;
+
+  indexed = linear;
+  piecewise_build_index(&indexed, piece_start_short);
+
+  struct piecewise_cursor cursor;
+  struct piecewise_cursor cursor_reversed;
+  piecewise_cursor_reset(&cursor);
+  piecewise_cursor_reset(&cursor_reversed);
+
+  const float duration = piecewise_duration(&linear);
+  TEST_ASSERT_FLOAT_WITHIN(1e-4, duration, piecewise_duration(&indexed));
+
+  // Test
+  // Monotonic time, as when flying the trajectory
+  for (float t = linear.t_begin - 0.5f; t < linear.t_begin + duration + 0.5f; t += 0.01f) {
+    struct traj_eval expected = piecewise_eval(&linear, t);
+    struct traj_eval actual = piecewise_eval(&indexed, t);
+    assertTrajEvalEqual(&expected, &actual);
+    actual = piecewise_eval_with_cursor(&indexed, &cursor, t);
+    assertTrajEvalEqual(&expected, &actual);
+
+    expected = piecewise_eval_reversed(&linear, t);
+    actual = piecewise_eval_reversed(&indexed, t);
+    assertTrajEvalEqual(&expected, &actual);
+    actual = piecewise_eval_reversed_with_cursor(&indexed, &cursor_reversed, t);
+    assertTrajEvalEqual(&expected, &actual);
+  }
+
+  // Random order
+  for (int i = 0; i < 1000; i++) {
+    const float t = linear.t_begin + (rand() / (float)RAND_MAX) * (duration + 1) - 0.5f;
+
+    struct traj_eval expected = piecewise_eval(&linear, t);
+    struct traj_eval actual = piecewise_eval(&indexed, t);
+    assertTrajEvalEqual(&expected, &actual);
+    actual = piecewise_eval_with_cursor(&indexed, &cursor, t);
+    assertTrajEvalEqual(&expected, &actual);
+
+    expected = piecewise_eval_reversed(&linear, t);
+    actual = piecewise_eval_reversed(&indexed, t);
+    assertTrajEvalEqual(&expected, &actual);
+    actual = piecewise_eval_reversed_with_cursor(&indexed, &cursor_reversed, t);
+    assertTrajEvalEqual(&expected, &actual);
+  }
+
+  // Assert
+  // Assert in loops
+}
+
+void testThatMonotonicIndexedEvaluationFindsPiecesWithoutSearching(void) {
+  // Fixture
+  struct piecewise_traj traj;
+  initLongTrajectory(&traj, LONG_TRAJECTORY_PIECES);
+  piecewise_build_index(&traj, piece_start);
+
+  struct piecewise_cursor cursor;
+  piecewise_cursor_reset(&cursor);
+
+  const float dt = piecewise_duration(&traj) / BENCHMARK_EVALUATIONS;
+
+  // Test
+  for (int i = 0; i < BENCHMARK_EVALUATIONS; i++) {
+    piecewise_eval_with_cursor(&traj, &cursor, traj.t_begin + i * dt);
+  }
+
+  // Assert
+  // Every lookup is answered by the cursor or the piece after it
+  TEST_ASSERT_EQUAL_UINT32(0, cursor.searches);
+  TEST_ASSERT_EQUAL_INT(LONG_TRAJECTORY_PIECES - 1, cursor.piece);
+}
+
+void testThatRandomOrderIndexedEvaluationSearchesForPieces(void) {
+  // Fixture
+  struct piecewise_traj traj;
+  initLongTrajectory(&traj, LONG_TRAJECTORY_PIECES);
+  piecewise_build_index(&traj, piece_start);
+
+  struct piecewise_cursor cursor;
+  piecewise_cursor_reset(&cursor);
+
+  const float duration = piecewise_duration(&traj);
+
+  // Test
+  srand(17);
+  for (int i = 0; i < 1000; i++) {
+    piecewise_eval_with_cursor(&traj, &cursor, traj.t_begin + (rand() / (float)RAND_MAX) * duration);
+  }
+
+  // Assert
+  TEST_ASSERT_TRUE(cursor.searches > 0);
+  TEST_ASSERT_TRUE(cursor.searches <= 1000);
+}
+
+void testBenchmarkIndexedEvaluationOfShortAndLongTrajectories(void) {
+  // Fixture
+  struct piecewise_traj traj;
+
+  // Test
+  initLongTrajectory(&traj, 10);
+  piecewise_build_index(&traj, piece_start);
+  clock_t shortIndexedTime = benchmarkMonotonicEvaluation(&traj);
+
+  initLongTrajectory(&traj, LONG_TRAJECTORY_PIECES);
+  clock_t longLinearTime = benchmarkMonotonicEvaluation(&traj);
+
+  piecewise_build_index(&traj, piece_start);
+  clock_t longIndexedTime = benchmarkMonotonicEvaluation(&traj);
+
+  // Assert
+#ifdef SHOW_OUTPUT
+  printf("Evaluation time, 10 pieces indexed: %.3f us, %d pieces linear: %.3f us, %d pieces indexed: %.3f us\n",
+    1e6 * (double)shortIndexedTime / CLOCKS_PER_SEC / BENCHMARK_EVALUATIONS,
+    LONG_TRAJECTORY_PIECES, 1e6 * (double)longLinearTime / CLOCKS_PER_SEC / BENCHMARK_EVALUATIONS,
+    LONG_TRAJECTORY_PIECES, 1e6 * (double)longIndexedTime / CLOCKS_PER_SEC / BENCHMARK_EVALUATIONS);
+#else
+  (void)shortIndexedTime;
+  (void)longLinearTime;
+  (void)longIndexedTime;
+#endif
+}
+
+#define FIGURE8_COMPRESSED_HEADER_SIZE 8
+#define FIGURE8_COMPRESSED_TERMINATOR_SIZE 3
+#define LONG_COMPRESSED_REPETITIONS 20
+
+static uint8_t long_compressed_pieces[FIGURE8_COMPRESSED_HEADER_SIZE + FIGURE8_COMPRESSED_TERMINATOR_SIZE +
+  LONG_COMPRESSED_REPETITIONS * (sizeof(figure8_compressed_pieces) - FIGURE8_COMPRESSED_HEADER_SIZE - FIGURE8_COMPRESSED_TERMINATOR_SIZE)];
+static struct piecewise_traj_compressed_index_entry compressed_index[LONG_TRAJECTORY_PIECES + 1];
+
+static void assertTrajEvalWithin(float tolerance, struct traj_eval const *expected, struct traj_eval const *actual) {
+  TEST_ASSERT_FLOAT_WITHIN(tolerance, expected->pos.x, actual->pos.x);
+  TEST_ASSERT_FLOAT_WITHIN(tolerance, expected->pos.y, actual->pos.y);
+  TEST_ASSERT_FLOAT_WITHIN(tolerance, expected->pos.z, actual->pos.z);
+  TEST_ASSERT_FLOAT_WITHIN(tolerance, expected->yaw, actual->yaw);
+  TEST_ASSERT_FLOAT_WITHIN(tolerance, expected->vel.x, actual->vel.x);
+  TEST_ASSERT_FLOAT_WITHIN(tolerance, expected->vel.y, actual->vel.y);
+  TEST_ASSERT_FLOAT_WITHIN(tolerance, expected->vel.z, actual->vel.z);
+}
+
+// Repeat the pieces of the compressed figure 8 to build a long compressed trajectory
+static void initLongCompressedTrajectory(struct piecewise_traj_compressed *traj) {
+  const int body_size = sizeof(figure8_compressed_pieces) - FIGURE8_COMPRESSED_HEADER_SIZE - FIGURE8_COMPRESSED_TERMINATOR_SIZE;
+  uint8_t *ptr = long_compressed_pieces;
+
+  memcpy(ptr, figure8_compressed_pieces, FIGURE8_COMPRESSED_HEADER_SIZE);
+  ptr += FIGURE8_COMPRESSED_HEADER_SIZE;
+  for (int i = 0; i < LONG_COMPRESSED_REPETITIONS; i++) {
+    memcpy(ptr, figure8_compressed_pieces + FIGURE8_COMPRESSED_HEADER_SIZE, body_size);
+    ptr += body_size;
+  }
+  memcpy(ptr, figure8_compressed_pieces + sizeof(figure8_compressed_pieces) - FIGURE8_COMPRESSED_TERMINATOR_SIZE, FIGURE8_COMPRESSED_TERMINATOR_SIZE);
+
+  piecewise_compressed_load(traj, long_compressed_pieces);
+  traj->t_begin = 1;
+}
+
+static clock_t benchmarkRandomOrderCompressedEvaluation(struct piecewise_traj_compressed *traj) {
+  const float duration = piecewise_compressed_duration(traj);
+  float sum = 0;
+
+  srand(17);
+  clock_t start = clock();
+  for (int i = 0; i < BENCHMARK_EVALUATIONS; i++) {
+    const float t = traj->t_begin + (rand() / (float)RAND_MAX) * duration;
+    struct traj_eval ev = piecewise_compressed_eval(traj, t);
+    sum += ev.pos.x;
+  }
+  clock_t time = clock() - start;
+
+  TEST_ASSERT(!isnan(sum));
+  return time;
+}
+
+static clock_t benchmarkReversedPlannerEvaluation(struct planner *planner, struct piecewise_traj_compressed *traj) {
+  const float dt = piecewise_compressed_duration(traj) / BENCHMARK_EVALUATIONS;
+  float sum = 0;
+
+  clock_t start = clock();
+  for (int i = 0; i < BENCHMARK_EVALUATIONS; i++) {
+    struct traj_eval ev = plan_current_goal(planner, traj->t_begin + i * dt);
+    sum += ev.pos.x;
+  }
+  clock_t time = clock() - start;
+
+  TEST_ASSERT(!isnan(sum));
+  return time;
+}
+
+void testCompressedIndexedEvaluationMatchesSequentialEvaluation(void) {
+  // Fixture
+  struct piecewise_traj_compressed sequential;
+  struct piecewise_traj_compressed indexed;
+
+  piecewise_compressed_load(&sequential, figure8_compressed_pieces);
+  sequential.t_begin = 2;
+  sequential.shift = mkvec(-1, 2, 3);
+
+  piecewise_compressed_load(&indexed, figure8_compressed_pieces);
+  indexed.t_begin = 2;
+  indexed.shift = mkvec(-1, 2, 3);
+  const int entries = piecewise_compressed_build_index(&indexed, compressed_index, LONG_TRAJECTORY_PIECES + 1);
+
+  const float duration = piecewise_compressed_duration(&sequential);
+
+  // Test
+  // Monotonic time, as when flying the trajectory
+  for (float t = sequential.t_begin - 0.5f; t < sequential.t_begin + duration + 0.5f; t += 0.01f) {
+    struct traj_eval expected = piecewise_compressed_eval(&sequential, t);
+    struct traj_eval actual = piecewise_compressed_eval(&indexed, t);
+    assertTrajEvalWithin(1e-3, &expected, &actual);
+  }
+
+  // Random order
+  for (int i = 0; i < 1000; i++) {
+    const float t = sequential.t_begin + (rand() / (float)RAND_MAX) * (duration + 1) - 0.5f;
+
+    struct traj_eval expected = piecewise_compressed_eval(&sequential, t);
+    struct traj_eval actual = piecewise_compressed_eval(&indexed, t);
+    assertTrajEvalWithin(1e-3, &expected, &actual);
+  }
+
+  // Assert
+  TEST_ASSERT_EQUAL_INT(sizeof(figure8_pieces) / sizeof(figure8_pieces[0]) + 1, entries);
+  TEST_ASSERT_FLOAT_WITHIN(1e-4, duration, piecewise_compressed_duration(&indexed));
+}
+
+void testCompressedSparseIndexMatchesSequentialEvaluation(void) {
+  // Fixture
+  struct piecewise_traj_compressed sequential;
+  struct piecewise_traj_compressed indexed;
+
+  piecewise_compressed_load(&sequential, figure8_compressed_pieces);
+  sequential.t_begin = 2;
+
+  piecewise_compressed_load(&indexed, figure8_compressed_pieces);
+  indexed.t_begin = 2;
+  const int entries = piecewise_compressed_build_index(&indexed, compressed_index, 3);
+
+  const float duration = piecewise_compressed_duration(&sequential);
+
+  // Test
+  for (float t = sequential.t_begin - 0.5f; t < sequential.t_begin + duration + 0.5f; t += 0.01f) {
+    struct traj_eval expected = piecewise_compressed_eval(&sequential, t);
+    struct traj_eval actual = piecewise_compressed_eval(&indexed, t);
+    assertTrajEvalWithin(1e-3, &expected, &actual);
+
+    expected = piecewise_compressed_eval_reversed(&sequential, t);
+    actual = piecewise_compressed_eval_reversed(&indexed, t);
+    assertTrajEvalWithin(1e-3, &expected, &actual);
+  }
+
+  // Assert
+  TEST_ASSERT_EQUAL_INT(3, entries);
+  TEST_ASSERT_EQUAL_PTR(compressed_index, indexed.index);
+}
+
+void testCompressedIndexIsNotUsedWithoutRoomForTwoEntries(void) {
+  // Fixture
+  struct piecewise_traj_compressed traj;
+  piecewise_compressed_load(&traj, figure8_compressed_pieces);
+
+  // Test
+  const int entries = piecewise_compressed_build_index(&traj, compressed_index, 1);
+
+  // Assert
+  TEST_ASSERT_EQUAL_INT(-1, entries);
+  TEST_ASSERT_NULL(traj.index);
+  TEST_ASSERT(!isnan(piecewise_compressed_eval(&traj, 1.0f).pos.x));
+}
+
+void testThatPlannerIndexesCompressedTrajectoryThatFillsTheTrajectoryMemory(void) {
+  // Fixture
+  // The header, the smallest possible pieces and the terminator
+  static uint8_t data[TRAJECTORY_MEMORY_SIZE];
+  const int n_pieces = (TRAJECTORY_MEMORY_SIZE - FIGURE8_COMPRESSED_HEADER_SIZE - FIGURE8_COMPRESSED_TERMINATOR_SIZE) / PIECEWISE_COMPRESSED_MIN_PIECE_SIZE;
+  uint8_t *ptr = data;
+  memset(ptr, 0, FIGURE8_COMPRESSED_HEADER_SIZE);
+  ptr += FIGURE8_COMPRESSED_HEADER_SIZE;
+  for (int i = 0; i < n_pieces; i++) {
+    // all coordinates constant, 100 ms
+    ptr[0] = 0;
+    ptr[1] = 100;
+    ptr[2] = 0;
+    ptr += PIECEWISE_COMPRESSED_MIN_PIECE_SIZE;
+  }
+  memset(ptr, 0, FIGURE8_COMPRESSED_TERMINATOR_SIZE);
+
+  struct planner planner;
+  struct piecewise_traj_compressed traj;
+  plan_init(&planner);
+  piecewise_compressed_load(&traj, data);
+  traj.t_begin = 1;
+
+  // Test
+  plan_start_compressed_trajectory(&planner, &traj, true, false, vzero());
+
+  // Assert
+  TEST_ASSERT_NOT_NULL(traj.index);
+  TEST_ASSERT_TRUE(traj.n_index_entries <= PLAN_MAX_INDEXED_COMPRESSED_PIECES + 1);
+  TEST_ASSERT_TRUE(n_pieces <= PLAN_COMPRESSED_INDEX_MAX_STRIDE * (traj.n_index_entries - 1));
+  TEST_ASSERT_FLOAT_WITHIN(1e-3, 0.1f * n_pieces, piecewise_compressed_duration(&traj));
+}
+
+void testCompressedTimescaledAndReversedEvaluationMatchesUncompressed(void) {
+  // Fixture
+  struct piecewise_traj traj;
+  struct piecewise_traj_compressed ctraj;
+
+  traj.t_begin = 2;
+  traj.timescale = 1.5;
+  traj.shift = mkvec(-1, 2, 3);
+  traj.n_pieces = sizeof(figure8_pieces) / sizeof(figure8_pieces[0]);
+  traj.pieces = figure8_pieces;
+  traj.piece_start = NULL;
+
+  piecewise_compressed_load(&ctraj, figure8_compressed_pieces);
+  ctraj.t_begin = 2;
+  ctraj.timescale = 1.5;
+  ctraj.shift = mkvec(-1, 2, 3);
+  piecewise_compressed_build_index(&ctraj, compressed_index, LONG_TRAJECTORY_PIECES + 1);
+
+  const float duration = piecewise_compressed_duration(&ctraj);
+
+  // Test
+  for (float t = ctraj.t_begin; t < ctraj.t_begin + duration + 0.5f; t += 0.01f) {
+    struct traj_eval expected = piecewise_eval(&traj, t);
+    struct traj_eval actual = piecewise_compressed_eval(&ctraj, t);
+    assertTrajEvalWithin(0.02, &expected, &actual);
+
+    expected = piecewise_eval_reversed(&traj, t);
+    actual = piecewise_compressed_eval_reversed(&ctraj, t);
+    assertTrajEvalWithin(0.02, &expected, &actual);
+  }
+
+  // Assert
+  TEST_ASSERT_FLOAT_WITHIN(0.01, piecewise_duration(&traj), duration);
+}
+
+void testBenchmarkCompressedIndexedSeekAgainstSequentialDecoding(void) {
+  // Fixture
+  struct piecewise_traj_compressed traj;
+  struct planner planner;
+  plan_init(&planner);
+
+  // Test
+  initLongCompressedTrajectory(&traj);
+  clock_t sequentialTime = benchmarkRandomOrderCompressedEvaluation(&traj);
+
+  // Reversed playback in the planner, with the index that the planner builds, and without an index
+  plan_start_compressed_trajectory(&planner, &traj, true, false, vzero());
+  const int entries = traj.n_index_entries;
+  clock_t indexedReversedTime = benchmarkReversedPlannerEvaluation(&planner, &traj);
+  clock_t indexedTime = benchmarkRandomOrderCompressedEvaluation(&traj);
+
+  traj.index = NULL;
+  clock_t sequentialReversedTime = benchmarkReversedPlannerEvaluation(&planner, &traj);
+
+  // Assert
+#ifdef SHOW_OUTPUT
+  printf("Compressed evaluation time, %d index entries, random order sequential: %.3f us, indexed: %.3f us, "
+    "reversed in planner sequential: %.3f us, indexed: %.3f us\n",
+    entries,
+    1e6 * (double)sequentialTime / CLOCKS_PER_SEC / BENCHMARK_EVALUATIONS,
+    1e6 * (double)indexedTime / CLOCKS_PER_SEC / BENCHMARK_EVALUATIONS,
+    1e6 * (double)sequentialReversedTime / CLOCKS_PER_SEC / BENCHMARK_EVALUATIONS,
+    1e6 * (double)indexedReversedTime / CLOCKS_PER_SEC / BENCHMARK_EVALUATIONS);
+#else
+  (void)sequentialTime;
+  (void)indexedTime;
+  (void)sequentialReversedTime;
+  (void)indexedReversedTime;
+#endif
+
+  TEST_ASSERT_TRUE(entries > 0);
+}
+
+#define RANDOM_BEZIER_PIECES 200
+#define RANDOM_BEZIER_EVALUATIONS 50
+#define FULL_PIECE_SIZE (3 + 4 * 7 * 2)
+
+static int16_t randomCoordinate(int range) {
+  return (int16_t)(rand() % (2 * range + 1) - range);
+}
+
+static void appendInt16(uint8_t **ptr, int16_t value) {
+  (*ptr)[0] = value & 0xff;
+  (*ptr)[1] = (value >> 8) & 0xff;
+  *ptr += 2;
+}
+
+// Evaluates a Bezier curve given by m + 1 control points in double precision
+static double bernstein(const double *points, int m, double s) {
+  double result = 0;
+  double binomial = 1;
+  for (int i = 0; i <= m; i++) {
+    result += binomial * pow(s, i) * pow(1 - s, m - i) * points[i];
+    binomial = binomial * (m - i) / (i + 1);
+  }
+  return result;
+}
+
+// Evaluates a Bezier curve of degree 7 and its first two time derivatives in
+// double precision, by evaluating the Bezier curves of the differences of the
+// control points
+static void bezierReference(const int16_t *control_points, double duration, double t, double result[3]) {
+  double points[8];
+  const double s = t / duration;
+  double factor = 1e-3;
+
+  for (int i = 0; i < 8; i++) {
+    points[i] = control_points[i];
+  }
+
+  for (int k = 0; k < 3; k++) {
+    const int m = 7 - k;
+    result[k] = factor * bernstein(points, m, s);
+
+    factor *= m / duration;
+    for (int i = 0; i < m; i++) {
+      points[i] = points[i + 1] - points[i];
+    }
+  }
+}
+
+void testCompressedFixedPointEvaluationHasBoundedError(void) {
+  // Fixture
+  static uint8_t data[8 + FULL_PIECE_SIZE + 3];
+  int16_t control_points[3][8];
+  struct piecewise_traj_compressed traj;
+  double maxPosError = 0, maxVelError = 0, maxAccError = 0;
+
+  srand(42);
+
+  // Test
+  for (int p = 0; p < RANDOM_BEZIER_PIECES; p++) {
+    // A single piece with full storage for all coordinates, up to 2 m from the
+    // origin and with control points up to 20 cm apart
+    const uint16_t duration_in_msec = 500 + rand() % 2500;
+    for (int coordinate = 0; coordinate < 3; coordinate++) {
+      control_points[coordinate][0] = randomCoordinate(2000);
+      for (int i = 1; i < 8; i++) {
+        control_points[coordinate][i] = control_points[coordinate][i - 1] + randomCoordinate(200);
+      }
+    }
+
+    uint8_t *ptr = data;
+    for (int coordinate = 0; coordinate < 3; coordinate++) {
+      appendInt16(&ptr, control_points[coordinate][0]);
+    }
+    appendInt16(&ptr, 0);
+    *ptr++ = 0x3f;
+    appendInt16(&ptr, duration_in_msec);
+    for (int coordinate = 0; coordinate < 3; coordinate++) {
+      for (int i = 1; i < 8; i++) {
+        appendInt16(&ptr, control_points[coordinate][i]);
+      }
+    }
+    *ptr++ = 0x00;
+    appendInt16(&ptr, 0);
+
+    piecewise_compressed_load(&traj, data);
+    const double duration = duration_in_msec / 1000.0;
+
+    for (int e = 0; e < RANDOM_BEZIER_EVALUATIONS; e++) {
+      const float t = (rand() / (float)RAND_MAX) * duration_in_msec / 1000.0f;
+      struct traj_eval actual = piecewise_compressed_eval(&traj, t);
+      const float pos[3] = { actual.pos.x, actual.pos.y, actual.pos.z };
+      const float vel[3] = { actual.vel.x, actual.vel.y, actual.vel.z };
+      const float acc[3] = { actual.acc.x, actual.acc.y, actual.acc.z };
+
+      for (int coordinate = 0; coordinate < 3; coordinate++) {
+        double expected[3];
+        bezierReference(control_points[coordinate], duration, t, expected);
+        maxPosError = MAX(maxPosError, fabs(pos[coordinate] - expected[0]));
+        maxVelError = MAX(maxVelError, fabs(vel[coordinate] - expected[1]));
+        maxAccError = MAX(maxAccError, fabs(acc[coordinate] - expected[2]));
+      }
+    }
+  }
+
+  // Assert
+#ifdef SHOW_OUTPUT
+  printf("Maximum fixed point error, position: %.6f m, velocity: %.6f m/s, acceleration: %.6f m/s^2\n",
+    maxPosError, maxVelError, maxAccError);
+#endif
+
+  // One rounding error per level of de Casteljau's algorithm is 7 / 256 mm in position
+  TEST_ASSERT_TRUE(maxPosError < 1e-4);
+  TEST_ASSERT_TRUE(maxVelError < 1e-3);
+  TEST_ASSERT_TRUE(maxAccError < 1e-2);
+}
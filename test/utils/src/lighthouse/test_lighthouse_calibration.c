@@ -0,0 +1,212 @@
+// @IGNORE_IF_NOT CONFIG_DECK_LIGHTHOUSE
+
+// File under test lighthouse_calibration.c
+#include "lighthouse_calibration.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "unity.h"
+
+#include "mock_cfassert.h"
+
+
+// Build the arm dsp math lib and use the "real thing" instead of mocking calls to it
+// @BUILD_LIB ARM_DSP_MATH
+
+// #define SHOW_OUTPUT
+
+#ifdef SHOW_OUTPUT
+#include <stdio.h>
+#endif
+
+// Largest allowed difference between the table and the iterative solution, radians
+#define MAX_TABLE_ERROR 0.0002f
+
+static lighthouseCalibration_t calib;
+static lighthouseCalibrationTable_t table;
+
+static double now();
+static float randomInRange(const float min, const float max);
+static void randomCalibration(lighthouseCalibration_t* calibration);
+static void randomAngles(float* angles, const float maxU, const float maxV);
+
+void setUp(void) {
+  srand(42);
+  memset(&calib, 0, sizeof(calib));
+  memset(&table, 0, sizeof(table));
+}
+
+void tearDown(void) {
+  // Empty
+}
+
+void testThatTableIsNotValidForInvalidCalibration() {
+  // Fixture
+  randomCalibration(&calib);
+  calib.valid = false;
+  table.valid = true;
+
+  // Test
+  lighthouseCalibrationTableInitV2(&table, &calib);
+
+  // Assert
+  TEST_ASSERT_FALSE(table.valid);
+}
+
+void testThatTableIsCloseToIterativeSolution() {
+  float maxError = 0.0f;
+
+  for (int c = 0; c < 20; c++) {
+    // Fixture
+    randomCalibration(&calib);
+    lighthouseCalibrationTableInitV2(&table, &calib);
+    TEST_ASSERT_TRUE(table.valid);
+
+    for (int i = 0; i < 500; i++) {
+      float rawAngles[2];
+      randomAngles(rawAngles, 1.05f, 0.58f);
+
+      float expected[2];
+      float actual[2];
+
+      // Test
+      lighthouseCalibrationApplyV2(&calib, rawAngles, expected);
+      lighthouseCalibrationApplyV2Table(&table, &calib, rawAngles, actual);
+
+      // Assert
+      for (int a = 0; a < 2; a++) {
+        const float error = fabsf(expected[a] - actual[a]);
+        maxError = fmaxf(maxError, error);
+        TEST_ASSERT_FLOAT_WITHIN(MAX_TABLE_ERROR, expected[a], actual[a]);
+      }
+    }
+  }
+
+#ifdef SHOW_OUTPUT
+  printf("Max difference table - iterative: %e rad\n", maxError);
+#endif
+}
+
+void testThatAnglesOutsideTableUseIterativeSolution() {
+  // Fixture
+  randomCalibration(&calib);
+  lighthouseCalibrationTableInitV2(&table, &calib);
+
+  // Beyond the range of the table in u and in v
+  const float rawAngles[][2] = {{1.3f, 1.4f}, {-1.4f, -1.2f}, {-0.7f, 0.7f}, {0.8f, -0.6f}};
+
+  for (int i = 0; i < 4; i++) {
+    float expected[2];
+    float actual[2];
+
+    // Test
+    lighthouseCalibrationApplyV2(&calib, rawAngles[i], expected);
+    lighthouseCalibrationApplyV2Table(&table, &calib, rawAngles[i], actual);
+
+    // Assert
+    TEST_ASSERT_EQUAL_FLOAT(expected[0], actual[0]);
+    TEST_ASSERT_EQUAL_FLOAT(expected[1], actual[1]);
+  }
+}
+
+void testThatInvalidTableUsesIterativeSolution() {
+  // Fixture
+  randomCalibration(&calib);
+  lighthouseCalibrationTableInitV2(&table, &calib);
+  table.valid = false;
+
+  const float rawAngles[2] = {0.1f, 0.3f};
+  float expected[2];
+  float actual[2];
+
+  // Test
+  lighthouseCalibrationApplyV2(&calib, rawAngles, expected);
+  lighthouseCalibrationApplyV2Table(&table, &calib, rawAngles, actual);
+
+  // Assert
+  TEST_ASSERT_EQUAL_FLOAT(expected[0], actual[0]);
+  TEST_ASSERT_EQUAL_FLOAT(expected[1], actual[1]);
+}
+
+void testBenchmarkTableAgainstIterativeSolution() {
+  // Fixture
+  const int count = 20000;
+  randomCalibration(&calib);
+
+  double start = now();
+  lighthouseCalibrationTableInitV2(&table, &calib);
+  const double initTime = now() - start;
+
+  float* rawAngles = malloc(sizeof(float) * 2 * count);
+  for (int i = 0; i < count; i++) {
+    randomAngles(&rawAngles[2 * i], 1.05f, 0.58f);
+  }
+
+  // Test
+  float iterativeSum = 0.0f;
+  float tableSum = 0.0f;
+  float corrected[2];
+
+  start = now();
+  for (int i = 0; i < count; i++) {
+    lighthouseCalibrationApplyV2(&calib, &rawAngles[2 * i], corrected);
+    iterativeSum += corrected[0] + corrected[1];
+  }
+  const double iterativeTime = now() - start;
+
+  start = now();
+  for (int i = 0; i < count; i++) {
+    lighthouseCalibrationApplyV2Table(&table, &calib, &rawAngles[2 * i], corrected);
+    tableSum += corrected[0] + corrected[1];
+  }
+  const double tableTime = now() - start;
+
+  free(rawAngles);
+
+  // Assert
+#ifdef SHOW_OUTPUT
+  printf("Table init: %.1f us\n", initTime * 1e6);
+  printf("Iterative: %.1f ns/call, table: %.1f ns/call\n", iterativeTime * 1e9 / count, tableTime * 1e9 / count);
+#else
+  (void)initTime;
+  (void)iterativeTime;
+  (void)tableTime;
+#endif
+  TEST_ASSERT_FLOAT_WITHIN(2 * count * MAX_TABLE_ERROR, iterativeSum, tableSum);
+}
+
+// Helpers ///////////////////////////////////////////////////////////////
+
+static double now() {
+  return (double)clock() / CLOCKS_PER_SEC;
+}
+
+static float randomInRange(const float min, const float max) {
+  return min + (max - min) * (float)rand() / (float)RAND_MAX;
+}
+
+// Calibration parameters in the range of what base stations report
+static void randomCalibration(lighthouseCalibration_t* calibration) {
+  for (int i = 0; i < 2; i++) {
+    lighthouseCalibrationSweep_t* sweep = &calibration->sweep[i];
+    sweep->phase = randomInRange(-0.05f, 0.05f);
+    sweep->tilt = randomInRange(-0.05f, 0.05f);
+    sweep->curve = randomInRange(-0.05f, 0.05f);
+    sweep->gibmag = randomInRange(-0.02f, 0.02f);
+    sweep->gibphase = randomInRange(-3.14f, 3.14f);
+    sweep->ogeemag = randomInRange(-0.5f, 0.5f);
+    sweep->ogeephase = randomInRange(-3.14f, 3.14f);
+  }
+
+  calibration->uid = rand();
+  calibration->valid = true;
+}
+
+static void randomAngles(float* angles, const float maxU, const float maxV) {
+  const float u = randomInRange(-maxU, maxU);
+  const float v = randomInRange(-maxV, maxV);
+  angles[0] = u - v;
+  angles[1] = u + v;
+}
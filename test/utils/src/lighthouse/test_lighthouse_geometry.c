@@ -3,8 +3,10 @@
 // File under test lighthouse_geometry.c
 #include "lighthouse_geometry.h"
 
+#include <math.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include "unity.h"
 
 #include "mock_cfassert.h"
@@ -13,7 +15,28 @@
 // Build the arm dsp math lib and use the "real thing" instead of mocking calls to it
 // @BUILD_LIB ARM_DSP_MATH
 
+// #define SHOW_OUTPUT
+
+#ifdef SHOW_OUTPUT
+#include <stdio.h>
+#endif
+
+// Synthetic hall with base stations along the walls, see setUpHall()
+#define HALL_N_BS 8
+#define HALL_N_SENSORS 4
+#define HALL_MAX_RAYS (HALL_N_BS * HALL_N_SENSORS)
+
+static baseStationGeometry_t hall[HALL_N_BS];
+
+static void setUpHall();
+static void anglesToPoint(const baseStationGeometry_t* bs, const vec3d point, float angles[2]);
+static float randomInRange(const float min, const float max);
+static float randomNoise(const float stdDev);
+static float distance(const vec3d a, const vec3d b);
+
 void setUp(void) {
+  srand(42);
+  setUpHall();
 }
 
 void testThatBaseStationPositionIsExtracted() {
@@ -259,3 +282,338 @@ void testThatYawDeltaIsNotCalculatedForSmallIntersectionPointVector() {
   // Assert
   TEST_ASSERT_FALSE(actualResult);
 }
+
+void testThatPositionFromTwoRaysIsSameAsRayIntersection() {
+  // Fixture
+  // Rays that almost cross, at about the same distance from the base stations
+  const baseStationGeometry_t baseStations[2] = {hall[0], hall[2]};
+  const vec3d point = {5.0f, 3.0f, 1.0f};
+  float angles1[2];
+  float angles2[2];
+  anglesToPoint(&hall[0], point, angles1);
+  anglesToPoint(&hall[2], point, angles2);
+  angles1[0] += 0.002f;
+  angles2[1] -= 0.002f;
+
+  vec3d expected;
+  float delta;
+  lighthouseGeometryGetPositionFromRayIntersection(baseStations, angles1, angles2, expected, &delta);
+
+  vec3d origins[2];
+  vec3d rays[2];
+  const uint8_t rayBaseStations[2] = {0, 2};
+  float weights[2] = {1.0f, 1.0f};
+  lighthouseGeometryGetBaseStationPosition(&hall[0], origins[0]);
+  lighthouseGeometryGetRay(&hall[0], angles1[0], angles1[1], rays[0]);
+  lighthouseGeometryGetBaseStationPosition(&hall[2], origins[1]);
+  lighthouseGeometryGetRay(&hall[2], angles2[0], angles2[1], rays[1]);
+
+  vec3d actual;
+  float residual;
+
+  // Test
+  const int actualUsed = lighthouseGeometryGetPositionFromRays(origins, rays, rayBaseStations, weights, 2, 1.0f, actual, &residual);
+
+  // Assert
+  TEST_ASSERT_EQUAL_INT(2, actualUsed);
+  TEST_ASSERT_FLOAT_ARRAY_WITHIN(0.0001f, expected, actual, vec3d_size);
+  TEST_ASSERT_FLOAT_WITHIN(0.0001f, delta / 2.0f, residual);
+}
+
+void testThatPositionFromParallelRaysIsNotFound() {
+  // Fixture
+  vec3d origins[2] = {{0, 0, 0}, {0, 1, 0}};
+  vec3d rays[2] = {{1, 0, 0}, {1, 0, 0}};
+  const uint8_t baseStations[2] = {0, 1};
+  float weights[2] = {1.0f, 1.0f};
+
+  vec3d actual;
+  float residual;
+
+  // Test
+  const int actualUsed = lighthouseGeometryGetPositionFromRays(origins, rays, baseStations, weights, 2, 1.0f, actual, &residual);
+
+  // Assert
+  TEST_ASSERT_EQUAL_INT(0, actualUsed);
+}
+
+void testThatRaysWithZeroWeightAreNotUsed() {
+  // Fixture
+  vec3d origins[3] = {{0, 0, 0}, {0, 1, 0}, {5, 5, 5}};
+  vec3d rays[3] = {{1, 0, 0}, {0, -1, 0}, {0, 0, 1}};
+  const uint8_t baseStations[3] = {0, 1, 2};
+  float weights[3] = {1.0f, 1.0f, 0.0f};
+
+  vec3d actual;
+  float residual;
+
+  const vec3d expected = {0, 0, 0};
+
+  // Test
+  const int actualUsed = lighthouseGeometryGetPositionFromRays(origins, rays, baseStations, weights, 3, 1.0f, actual, &residual);
+
+  // Assert
+  TEST_ASSERT_EQUAL_INT(2, actualUsed);
+  TEST_ASSERT_FLOAT_ARRAY_WITHIN(0.0001f, expected, actual, vec3d_size);
+  TEST_ASSERT_FLOAT_WITHIN(0.0001f, 0.0f, residual);
+}
+
+void testThatOutlierRayIsRejected() {
+  // Fixture
+  const vec3d point = {4.0f, 6.0f, 1.0f};
+  vec3d origins[HALL_N_BS];
+  vec3d rays[HALL_N_BS];
+  uint8_t baseStations[HALL_N_BS];
+  float weights[HALL_N_BS];
+
+  for (int bs = 0; bs < HALL_N_BS; bs++) {
+    float angles[2];
+    anglesToPoint(&hall[bs], point, angles);
+    if (bs == 5) {
+      // Reflection
+      angles[0] += 0.1f;
+    }
+
+    lighthouseGeometryGetBaseStationPosition(&hall[bs], origins[bs]);
+    lighthouseGeometryGetRay(&hall[bs], angles[0], angles[1], rays[bs]);
+    baseStations[bs] = bs;
+    weights[bs] = 1.0f;
+  }
+
+  vec3d actual;
+  float residual;
+
+  // Test
+  const int actualUsed = lighthouseGeometryGetPositionFromRays(origins, rays, baseStations, weights, HALL_N_BS, 0.02f, actual, &residual);
+
+  // Assert
+  TEST_ASSERT_EQUAL_INT(HALL_N_BS - 1, actualUsed);
+  TEST_ASSERT_EQUAL_FLOAT(0.0f, weights[5]);
+  TEST_ASSERT_FLOAT_ARRAY_WITHIN(0.001f, point, actual, vec3d_size);
+  TEST_ASSERT_FLOAT_WITHIN(0.001f, 0.0f, residual);
+}
+
+void testThatOutlierRayIsNotRejectedWhenRaysFromOneBaseStationWouldBeLeft() {
+  // Fixture
+  // Four sensors see base station 0, one sensor sees a reflection from base station 2
+  const vec3d point = {4.0f, 6.0f, 1.0f};
+  // The rays from base station 0 go to points that are far enough apart for the rays to only cross at the base
+  // station, which would be the solution without the ray from base station 2
+  const float sensorOffsets[5][2] = {{-0.05f, -0.05f}, {0.05f, -0.05f}, {-0.05f, 0.05f}, {0.05f, 0.05f}, {0.0f, 0.0f}};
+  vec3d origins[5];
+  vec3d rays[5];
+  const uint8_t baseStations[5] = {0, 0, 0, 0, 2};
+  float weights[5];
+
+  for (int ray = 0; ray < 5; ray++) {
+    const int bs = baseStations[ray];
+    const vec3d sensor = {point[0] + sensorOffsets[ray][0], point[1] + sensorOffsets[ray][1], point[2]};
+    float angles[2];
+    anglesToPoint(&hall[bs], sensor, angles);
+    if (bs == 2) {
+      // Reflection
+      angles[0] += 0.1f;
+    }
+
+    lighthouseGeometryGetBaseStationPosition(&hall[bs], origins[ray]);
+    lighthouseGeometryGetRay(&hall[bs], angles[0], angles[1], rays[ray]);
+    weights[ray] = 1.0f;
+  }
+
+  vec3d actual;
+  float residual;
+
+  // Test
+  const int actualUsed = lighthouseGeometryGetPositionFromRays(origins, rays, baseStations, weights, 5, 0.02f, actual, &residual);
+
+  // Assert
+  TEST_ASSERT_EQUAL_INT(0, actualUsed);
+}
+
+void testThatOutlierRayIsRejectedWhenTheBaseStationHasMoreRays() {
+  // Fixture
+  // Base station 2 is seen by two sensors, one of them gets a reflection
+  const vec3d point = {4.0f, 6.0f, 1.0f};
+  vec3d origins[4];
+  vec3d rays[4];
+  const uint8_t baseStations[4] = {0, 0, 2, 2};
+  float weights[4];
+
+  for (int ray = 0; ray < 4; ray++) {
+    const int bs = baseStations[ray];
+    float angles[2];
+    anglesToPoint(&hall[bs], point, angles);
+    if (ray == 3) {
+      // Reflection
+      angles[0] += 0.1f;
+    }
+
+    lighthouseGeometryGetBaseStationPosition(&hall[bs], origins[ray]);
+    lighthouseGeometryGetRay(&hall[bs], angles[0], angles[1], rays[ray]);
+    weights[ray] = 1.0f;
+  }
+
+  vec3d actual;
+  float residual;
+
+  // Test
+  const int actualUsed = lighthouseGeometryGetPositionFromRays(origins, rays, baseStations, weights, 4, 0.02f, actual, &residual);
+
+  // Assert
+  TEST_ASSERT_EQUAL_INT(3, actualUsed);
+  TEST_ASSERT_EQUAL_FLOAT(0.0f, weights[3]);
+  TEST_ASSERT_FLOAT_ARRAY_WITHIN(0.001f, point, actual, vec3d_size);
+}
+
+void testThatRaysFromOneBaseStationDoNotGiveAPosition() {
+  // Fixture
+  vec3d origins[2] = {{0, 0, 0}, {0, 0, 0}};
+  vec3d rays[2] = {{1, 0, 0}, {0, 1, 0}};
+  const uint8_t baseStations[2] = {1, 1};
+  float weights[2] = {1.0f, 1.0f};
+
+  vec3d actual;
+  float residual;
+
+  // Test
+  const int actualUsed = lighthouseGeometryGetPositionFromRays(origins, rays, baseStations, weights, 2, 1.0f, actual, &residual);
+
+  // Assert
+  TEST_ASSERT_EQUAL_INT(0, actualUsed);
+}
+
+void testThatAllBaseStationsAreMoreAccurateThanCrossingBeams() {
+  // Fixture
+  const int count = 1000;
+  const float angleStdDev = 0.0005f;
+
+  double crossingBeamsError = 0.0;
+  double allRaysError = 0.0;
+  double crossingBeamsTime = 0.0;
+  double allRaysTime = 0.0;
+
+  for (int i = 0; i < count; i++) {
+    const vec3d point = {randomInRange(1.0f, 9.0f), randomInRange(1.0f, 9.0f), randomInRange(0.0f, 2.0f)};
+
+    // One ray per base station and sensor, the sensors are all at the same point for simplicity
+    vec3d origins[HALL_MAX_RAYS];
+    vec3d rays[HALL_MAX_RAYS];
+    uint8_t baseStations[HALL_MAX_RAYS];
+    float weights[HALL_MAX_RAYS];
+    float angles[HALL_MAX_RAYS][2];
+    for (int bs = 0; bs < HALL_N_BS; bs++) {
+      for (int sensor = 0; sensor < HALL_N_SENSORS; sensor++) {
+        const int ray = bs * HALL_N_SENSORS + sensor;
+        anglesToPoint(&hall[bs], point, angles[ray]);
+        angles[ray][0] += randomNoise(angleStdDev);
+        angles[ray][1] += randomNoise(angleStdDev);
+
+        lighthouseGeometryGetBaseStationPosition(&hall[bs], origins[ray]);
+        lighthouseGeometryGetRay(&hall[bs], angles[ray][0], angles[ray][1], rays[ray]);
+        baseStations[ray] = bs;
+        weights[ray] = 1.0f;
+      }
+    }
+
+    // Test
+    // Crossing beams, averaged over the sensors, with the two first base stations
+    clock_t start = clock();
+    vec3d crossingBeamsPosition = {0};
+    for (int sensor = 0; sensor < HALL_N_SENSORS; sensor++) {
+      vec3d position;
+      float delta;
+      lighthouseGeometryGetPositionFromRayIntersection(hall, angles[sensor], angles[HALL_N_SENSORS + sensor], position, &delta);
+      for (int axis = 0; axis < 3; axis++) {
+        crossingBeamsPosition[axis] += position[axis] / HALL_N_SENSORS;
+      }
+    }
+    crossingBeamsTime += (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    start = clock();
+    vec3d allRaysPosition;
+    float residual;
+    const int used = lighthouseGeometryGetPositionFromRays(origins, rays, baseStations, weights, HALL_MAX_RAYS, 0.05f, allRaysPosition, &residual);
+    allRaysTime += (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    TEST_ASSERT_TRUE(used > HALL_MAX_RAYS / 2);
+
+    crossingBeamsError += distance(point, crossingBeamsPosition);
+    allRaysError += distance(point, allRaysPosition);
+  }
+
+  // Assert
+  crossingBeamsError /= count;
+  allRaysError /= count;
+
+#ifdef SHOW_OUTPUT
+  printf("Mean error crossing beams (2 base stations): %.2f mm, %.2f us\n", crossingBeamsError * 1000, crossingBeamsTime * 1e6 / count);
+  printf("Mean error all rays (%d base stations): %.2f mm, %.2f us\n", HALL_N_BS, allRaysError * 1000, allRaysTime * 1e6 / count);
+#endif
+
+  TEST_ASSERT_TRUE(allRaysError < crossingBeamsError / 2);
+  TEST_ASSERT_TRUE(allRaysError < 0.003);
+}
+
+// Helpers ///////////////////////////////////////////////////////////////
+
+// Base stations along the walls of a 10 x 10 m hall, 3 m above the floor, facing the center and tilted down
+static void setUpHall() {
+  const vec3d center = {5.0f, 5.0f, 1.0f};
+  const float positions[HALL_N_BS][2] = {{0, 0}, {5, 0}, {10, 0}, {10, 5}, {10, 10}, {5, 10}, {0, 10}, {0, 5}};
+
+  for (int bs = 0; bs < HALL_N_BS; bs++) {
+    baseStationGeometry_t* geo = &hall[bs];
+    geo->origin[0] = positions[bs][0];
+    geo->origin[1] = positions[bs][1];
+    geo->origin[2] = 3.0f;
+
+    const float dx = center[0] - geo->origin[0];
+    const float dy = center[1] - geo->origin[1];
+    const float yaw = atan2f(dy, dx);
+    const float pitch = atan2f(geo->origin[2] - center[2], sqrtf(dx * dx + dy * dy));
+
+    // Rotation around z (yaw) followed by rotation around y (pitch down)
+    const float cy = cosf(yaw), sy = sinf(yaw), cp = cosf(pitch), sp = sinf(pitch);
+    const mat3d mat = {
+      {cy * cp, -sy, cy * sp},
+      {sy * cp, cy, sy * sp},
+      {-sp, 0, cp},
+    };
+    memcpy(geo->mat, mat, sizeof(mat));
+    geo->valid = true;
+  }
+}
+
+// The inverse of lighthouseGeometryGetRay()
+static void anglesToPoint(const baseStationGeometry_t* bs, const vec3d point, float angles[2]) {
+  const vec3d d = {point[0] - bs->origin[0], point[1] - bs->origin[1], point[2] - bs->origin[2]};
+
+  // Rotate into the base station reference frame
+  vec3d local;
+  for (int i = 0; i < 3; i++) {
+    local[i] = bs->mat[0][i] * d[0] + bs->mat[1][i] * d[1] + bs->mat[2][i] * d[2];
+  }
+
+  angles[0] = atan2f(local[1], local[0]);
+  angles[1] = atan2f(local[2], local[0]);
+}
+
+static float randomInRange(const float min, const float max) {
+  return min + (max - min) * (float)rand() / (float)RAND_MAX;
+}
+
+// Approximately normal distributed noise
+static float randomNoise(const float stdDev) {
+  float sum = 0.0f;
+  for (int i = 0; i < 12; i++) {
+    sum += randomInRange(0.0f, 1.0f);
+  }
+  return (sum - 6.0f) * stdDev;
+}
+
+static float distance(const vec3d a, const vec3d b) {
+  const float dx = a[0] - b[0];
+  const float dy = a[1] - b[1];
+  const float dz = a[2] - b[2];
+  return sqrtf(dx * dx + dy * dy + dz * dz);
+}
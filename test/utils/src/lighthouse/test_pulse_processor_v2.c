@@ -3,8 +3,10 @@
 // File under test pulse_processor_v2.c
 #include "pulse_processor_v2.h"
 
+#include <math.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include "unity.h"
 
 #include "mock_ootx_decoder.h"
@@ -15,13 +17,19 @@
 
 // Functions under test
 void clearWorkspace(pulseProcessorV2PulseWorkspace_t* pulseWorkspace);
-int processFrame(const pulseProcessorFrame_t* frameData, pulseProcessorV2PulseWorkspace_t* pulseWorkspace, pulseProcessorV2BlockWorkspace_t* blockWorkspace);
+int processFrame(const pulseProcessorFrame_t* frameData, pulseProcessorV2_t* v2);
 bool storePulse(const pulseProcessorFrame_t* frameData, pulseProcessorV2PulseWorkspace_t* pulseWorkspace);
 void augmentFramesInWorkspace(pulseProcessorV2PulseWorkspace_t* pulseWorkspace);
 bool processWorkspaceBlock(const pulseProcessorFrame_t slots[], pulseProcessorV2SweepBlock_t* block);
 bool isBlockPairGood(const pulseProcessorV2SweepBlock_t* latest, const pulseProcessorV2SweepBlock_t* storage);
 bool handleCalibrationData(pulseProcessor_t *state, const pulseProcessorFrame_t* frameData);
 
+// #define SHOW_OUTPUT
+
+#ifdef SHOW_OUTPUT
+#include <stdio.h>
+#endif
+
 // Helpers
 static void addDefaultFrames();
 static void setChannel(uint8_t channel);
@@ -32,11 +40,14 @@ static void setUpOotxDecoderProcessBitCallCounter();
 static void setUpSlowbitFrame();
 static void clearSlowbitState();
 static void validateProcessFrame(int expectedNrOfBlocks, uint8_t sensor, uint32_t timestamp, uint32_t offset, uint8_t channel, bool channelFound);
+static int generateFrameStream(const int nrOfChannels, const float duration, pulseProcessorFrame_t* frames, const int maxFrames);
+static void expectedAngles(const int channel, const int sensor, float angles[2]);
+static double measureAngles(const pulseProcessorFrame_t* frames, const int nrOfFrames, int measurementsPerChannel[], int* wrongMeasurements);
 
 static pulseProcessor_t state;
 static pulseProcessorV2PulseWorkspace_t ws;
 static pulseProcessorV2SweepBlock_t block;
-static pulseProcessorV2BlockWorkspace_t blockWorkspace;
+static pulseProcessorV2_t v2;
 
 static pulseProcessorFrame_t slowbitFrame;
 static int nrOfCallsToOotxDecoderProcessBit;
@@ -554,7 +565,7 @@ void testThatNonFullSlowbitMessageIsNotReported() {
 // Recording with one base station in a random orientation
 void testRecordedSequence1Bs_1() {
     // Fixture
-    clearWorkspace(&ws);
+    memset(&v2, 0, sizeof(v2));
 
     // Test and assert
     validateProcessFrame(0, 0, 2156620, 0,      0, false);
@@ -580,7 +591,7 @@ void testRecordedSequence1Bs_1() {
 
 void testIssue901Data() {
     // Fixture
-    clearWorkspace(&ws);
+    memset(&v2, 0, sizeof(v2));
 
     // Test and assert
     validateProcessFrame(0, 1, 0xc53a8f, 0,      0, false);
@@ -597,6 +608,71 @@ void testIssue901Data() {
 
 
 
+// Dense multi channel streams ///////////////////////////////////////////
+
+// Cycle periods of the channels in 24 MHz ticks, see pulse_processor_v2.c
+static const uint32_t STREAM_CYCLE_PERIODS[] = {
+    959000 / 2, 957000 / 2, 953000 / 2, 949000 / 2,
+    947000 / 2, 943000 / 2, 941000 / 2, 939000 / 2,
+    937000 / 2, 929000 / 2, 919000 / 2, 911000 / 2,
+    907000 / 2, 901000 / 2, 893000 / 2, 887000 / 2
+};
+#define STREAM_MAX_CHANNELS 16
+#define STREAM_MAX_FRAMES 20000
+
+static pulseProcessorFrame_t streamFrames[STREAM_MAX_FRAMES];
+
+// Where the base station sweeps hit the sensors, as the fraction of the cycle from the start of the rotation
+static float streamSweepOffset[STREAM_MAX_CHANNELS][PULSE_PROCESSOR_N_SWEEPS][PULSE_PROCESSOR_N_SENSORS];
+
+void testThatAnglesAreMeasuredFromOneBaseStation() {
+    // Fixture
+    const float duration = 1.0f;
+    const int nrOfFrames = generateFrameStream(1, duration, streamFrames, STREAM_MAX_FRAMES);
+    int measurements[STREAM_MAX_CHANNELS] = {0};
+    int wrongMeasurements = 0;
+
+    // Test
+    measureAngles(streamFrames, nrOfFrames, measurements, &wrongMeasurements);
+
+    // Assert
+    const int rotations = duration * 24000000 / STREAM_CYCLE_PERIODS[0];
+    TEST_ASSERT_INT_WITHIN(2, rotations, measurements[0]);
+    TEST_ASSERT_EQUAL_INT(0, wrongMeasurements);
+}
+
+void testThatAnglesAreMeasuredFromAllBaseStationsInDenseStream() {
+    // Fixture
+    // All 16 channels are sweeping, only the first CONFIG_DECK_LIGHTHOUSE_MAX_N_BS are decoded
+    const float duration = 1.0f;
+    const int nrOfFrames = generateFrameStream(STREAM_MAX_CHANNELS, duration, streamFrames, STREAM_MAX_FRAMES);
+    int measurements[STREAM_MAX_CHANNELS] = {0};
+    int wrongMeasurements = 0;
+
+    // Test
+    const double time = measureAngles(streamFrames, nrOfFrames, measurements, &wrongMeasurements);
+
+    // Assert
+    int totalRotations = 0;
+    int totalMeasurements = 0;
+    for (int channel = 0; channel < CONFIG_DECK_LIGHTHOUSE_MAX_N_BS && channel < STREAM_MAX_CHANNELS; channel++) {
+        const int rotations = duration * 24000000 / STREAM_CYCLE_PERIODS[channel];
+        totalRotations += rotations;
+        totalMeasurements += measurements[channel];
+        TEST_ASSERT_TRUE(measurements[channel] <= rotations + 1);
+    }
+
+#ifdef SHOW_OUTPUT
+    printf("Dense stream: %d frames, %.1f%% of rotations measured, %d wrong, %.0f ns per frame\n", nrOfFrames,
+        100.0 * totalMeasurements / totalRotations, wrongMeasurements, time * 1e9 / nrOfFrames);
+#endif
+
+    TEST_ASSERT_TRUE(totalMeasurements > totalRotations * 0.8);
+    // A sweep where the FPGA does not decode the channel for the first sensor can not always be told apart from
+    // other sweeps at the same time
+    TEST_ASSERT_TRUE(wrongMeasurements < totalMeasurements * 0.02);
+}
+
 // Helpers ------------------------------------------------
 
 static void validateProcessFrame(int expectedNrOfBlocks, uint8_t sensor, uint32_t timestamp, uint32_t offset, uint8_t channel, bool channelFound) {
@@ -607,7 +683,7 @@ static void validateProcessFrame(int expectedNrOfBlocks, uint8_t sensor, uint32_
     frameData.channel = channel;
     frameData.channelFound = channelFound;
 
-    int actual = processFrame(&frameData, &ws, &blockWorkspace);
+    int actual = processFrame(&frameData, &v2);
 
     char errorMsg[200];
     sprintf(errorMsg, "Failed for timestamp=%ul", timestamp);
@@ -687,3 +763,109 @@ static void clearSlowbitState() {
         state.bsCalibration[i].valid = false;
     }
 }
+
+// Generates the frames from base stations on the first nrOfChannels channels, sorted in time. The Crazyflie is not
+// moving and the angles of each channel are given by expectedAngles().
+static int generateFrameStream(const int nrOfChannels, const float duration, pulseProcessorFrame_t* frames, const int maxFrames) {
+    // Time in ticks, not wrapped
+    static uint64_t frameTime[STREAM_MAX_FRAMES];
+    int nrOfFrames = 0;
+
+    srand(4711);
+    for (int channel = 0; channel < nrOfChannels; channel++) {
+        // Sweep 1 hits in the first half of the cycle, and sweep 2 a bit later
+        const float sweep1 = 0.25f + 0.15f * rand() / RAND_MAX;
+        const float sweep2 = sweep1 + 0.2f + 0.15f * rand() / RAND_MAX;
+        for (int sensor = 0; sensor < PULSE_PROCESSOR_N_SENSORS; sensor++) {
+            // The sensors are hit within about 1000 ticks
+            streamSweepOffset[channel][0][sensor] = sweep1 + 0.002f * rand() / RAND_MAX;
+            streamSweepOffset[channel][1][sensor] = sweep2 + 0.002f * rand() / RAND_MAX;
+        }
+    }
+
+    for (int channel = 0; channel < nrOfChannels; channel++) {
+        const uint32_t period = STREAM_CYCLE_PERIODS[channel];
+        const uint64_t endTime = duration * 24000000;
+        for (uint64_t start = rand() % period; start + period < endTime; start += period) {
+            for (int sweep = 0; sweep < PULSE_PROCESSOR_N_SWEEPS; sweep++) {
+                // The FPGA finds the offset on one of the sensors, and fails to decode the channel for some sensors
+                const int sensorWithOffset = rand() % PULSE_PROCESSOR_N_SENSORS;
+                for (int sensor = 0; sensor < PULSE_PROCESSOR_N_SENSORS; sensor++) {
+                    TEST_ASSERT_TRUE(nrOfFrames < maxFrames);
+                    pulseProcessorFrame_t* frame = &frames[nrOfFrames];
+                    const uint32_t offset = streamSweepOffset[channel][sweep][sensor] * period;
+
+                    memset(frame, 0, sizeof(pulseProcessorFrame_t));
+                    frame->sensor = sensor;
+                    frame->timestamp = (start + offset) & PULSE_PROCESSOR_TIMESTAMP_BITMASK;
+                    frame->offset = (sensor == sensorWithOffset) ? offset : NO_OFFSET;
+                    frame->channel = channel;
+                    frame->channelFound = (sensor == sensorWithOffset) || (rand() % 4 != 0);
+                    frameTime[nrOfFrames] = start + offset;
+                    nrOfFrames++;
+                }
+            }
+        }
+    }
+
+    // Sort in time, insertion sort is fast enough since the frames of each channel already are sorted
+    for (int i = 1; i < nrOfFrames; i++) {
+        const pulseProcessorFrame_t frame = frames[i];
+        const uint64_t time = frameTime[i];
+        int j = i - 1;
+        while (j >= 0 && frameTime[j] > time) {
+            frames[j + 1] = frames[j];
+            frameTime[j + 1] = frameTime[j];
+            j--;
+        }
+        frames[j + 1] = frame;
+        frameTime[j + 1] = time;
+    }
+
+    return nrOfFrames;
+}
+
+static void expectedAngles(const int channel, const int sensor, float angles[2]) {
+    angles[0] = streamSweepOffset[channel][0][sensor] * 2 * PI - PI + PI / 3.0f;
+    angles[1] = streamSweepOffset[channel][1][sensor] * 2 * PI - PI - PI / 3.0f;
+}
+
+// Feeds the frames to the pulse processor, counts the measurements per channel and the measurements with wrong angles.
+// Returns the time used by the pulse processor.
+static double measureAngles(const pulseProcessorFrame_t* frames, const int nrOfFrames, int measurementsPerChannel[], int* wrongMeasurements) {
+    static pulseProcessorResult_t angles;
+    memset(&state, 0, sizeof(state));
+    memset(&angles, 0, sizeof(angles));
+    usecTimestamp_IgnoreAndReturn(0);
+    pulseProcessorClear_Ignore();
+    ootxDecoderProcessBit_IgnoreAndReturn(false);
+
+    double time = 0.0;
+    for (int i = 0; i < nrOfFrames; i++) {
+        int baseStation;
+        int axis;
+        bool calibDataIsDecoded;
+
+        const clock_t start = clock();
+        const bool anglesMeasured = pulseProcessorV2ProcessPulse(&state, &frames[i], &angles, &baseStation, &axis, &calibDataIsDecoded);
+        time += (double)(clock() - start) / CLOCKS_PER_SEC;
+
+        if (anglesMeasured) {
+            measurementsPerChannel[baseStation]++;
+            bool isWrong = false;
+            for (int sensor = 0; sensor < PULSE_PROCESSOR_N_SENSORS; sensor++) {
+                float expected[2];
+                expectedAngles(baseStation, sensor, expected);
+                const pulseProcessorBaseStationMeasuremnt_t* measurement = &angles.sensorMeasurementsLh2[sensor].baseStatonMeasurements[baseStation];
+                isWrong |= fabsf(expected[0] - measurement->angles[0]) > 0.0001f;
+                isWrong |= fabsf(expected[1] - measurement->angles[1]) > 0.0001f;
+            }
+
+            if (isWrong) {
+                (*wrongMeasurements)++;
+            }
+        }
+    }
+
+    return time;
+}
@@ -0,0 +1,135 @@
+#!/usr/bin/env python
+
+import time
+
+import numpy as np
+import cffirmware
+
+# Set to True to print the benchmark results
+SHOW_OUTPUT = False
+
+
+def test_that_far_away_neighbors_do_not_change_the_setpoint():
+    # Fixture
+    params = make_params()
+    near = [0.8, 0.2, 1.0, -0.6, 0.9, 1.2]
+    far = grid_of_neighbors(10, spacing=1.0, exclude_radius=3.0)
+
+    # Test
+    expected = update_setpoint(params, near)
+    actual = update_setpoint(params, near + far)
+
+    # Assert
+    assert np.allclose(expected, actual, atol=1e-6)
+
+
+def test_that_max_neighbors_keeps_the_closest_neighbors():
+    # Fixture
+    params = make_params()
+    params.maxNeighbors = 1
+    closest = [0.8, 0.2, 1.0]
+    second = [-0.6, 0.9, 1.0]
+
+    # Test
+    expected = update_setpoint(make_params(), closest)
+    actual = update_setpoint(params, second + closest)
+
+    # Assert
+    assert np.allclose(expected, actual, atol=1e-6)
+
+
+def test_that_far_away_neighbors_are_left_out_of_the_cell():
+    # Fixture
+    params = make_params()
+    grid = grid_of_neighbors(10, spacing=1.0, exclude_radius=0.7)
+
+    # Test
+    expected, expected_kept = update_setpoint_with_kept_neighbors(params, grid[:3 * 10])
+    actual, actual_kept = update_setpoint_with_kept_neighbors(params, grid)
+
+    # Assert
+    # Only the neighbors close to us constrain the cell, so the cell is the
+    # same, and as cheap to use, for a dense swarm
+    assert expected_kept < 10
+    assert actual_kept == expected_kept
+    assert np.allclose(expected, actual, atol=1e-6)
+
+
+def test_benchmark_dense_swarm():
+    # Fixture
+    params = make_params()
+    grid = grid_of_neighbors(10, spacing=1.0, exclude_radius=0.7)
+    iterations = 200
+
+    # Test
+    durations = {}
+    for n in [10, 25, 50, 100]:
+        others = grid[:3 * n]
+        start = time.perf_counter()
+        for _ in range(iterations):
+            update_setpoint(params, others)
+        durations[n] = (time.perf_counter() - start) / iterations
+
+    # Assert
+    # Timing depends on the host, so this only shows the results
+    if SHOW_OUTPUT:
+        for n, duration in durations.items():
+            print('{} neighbors: {:.1f} us'.format(n, duration * 1e6))
+
+
+#
+# Helpers
+#
+
+def make_params():
+    params = cffirmware.collision_avoidance_params_t()
+    params.ellipsoidRadii = cffirmware.mkvec(0.3, 0.3, 0.9)
+    params.bboxMin = cffirmware.mkvec(-np.inf, -np.inf, -np.inf)
+    params.bboxMax = cffirmware.mkvec(np.inf, np.inf, np.inf)
+    params.horizonSecs = 1.0
+    params.maxSpeed = 0.5
+    params.sidestepThreshold = 0.25
+    params.maxPeerLocAgeMillis = 5000
+    params.voronoiProjectionTolerance = 1e-5
+    params.voronoiProjectionMaxIters = 100
+    params.maxNeighbors = 0
+    return params
+
+
+def grid_of_neighbors(size, spacing, exclude_radius):
+    # Neighbors in the plane z = 1, closest first, around our position (0, 0, 1)
+    offset = (size - 1) * spacing / 2.0 + 0.5 * spacing
+    positions = [np.array([i * spacing - offset, j * spacing - offset, 1.0])
+                 for i in range(size) for j in range(size)]
+    positions = [p for p in positions if np.linalg.norm(p[:2]) > exclude_radius]
+    positions.sort(key=lambda p: np.linalg.norm(p[:2]))
+    return [float(v) for p in positions for v in p]
+
+
+def update_setpoint(params, others):
+    position, _ = update_setpoint_with_kept_neighbors(params, others)
+    return position
+
+
+def update_setpoint_with_kept_neighbors(params, others):
+    state = cffirmware.state_t()
+    state.position.x = 0.0
+    state.position.y = 0.0
+    state.position.z = 1.0
+
+    setpoint = cffirmware.setpoint_t()
+    setpoint.mode.x = cffirmware.modeAbs
+    setpoint.position.x = 1.0
+    setpoint.position.y = 0.5
+    setpoint.position.z = 1.0
+
+    collision_state = cffirmware.collision_avoidance_state_t()
+    collision_state.lastFeasibleSetPosition = cffirmware.mkvec(np.nan, np.nan, np.nan)
+
+    sensors = cffirmware.sensorData_t()
+
+    cffirmware.collisionAvoidanceUpdateSetpointWrap(
+        params, collision_state, others, setpoint, sensors, state)
+
+    position = np.array([setpoint.position.x, setpoint.position.y, setpoint.position.z])
+    return position, collision_state.nNeighbors
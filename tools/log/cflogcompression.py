@@ -0,0 +1,104 @@
+# -*- coding: utf-8 -*-
+"""
+Reference decoder for compressed log blocks, see src/modules/interface/log_compression.h
+
+Usage:
+    decoder = CompressedBlockDecoder(['float', 'fp16', 'int16_t'])
+    for packet in packets:
+        # packet is the CRTP payload, starting with the block id
+        timestamp, values = decoder.decode(packet)
+
+Variables that are not known yet, before the first keyframe or after a lost
+packet, are decoded as None.
+"""
+import argparse
+import struct
+
+KEYFRAME_FLAG = 0x80
+SEQUENCE_MASK = 0x7f
+
+# Log type name to struct format
+TYPES = {
+    'uint8_t': 'B',
+    'uint16_t': 'H',
+    'uint32_t': 'I',
+    'int8_t': 'b',
+    'int16_t': 'h',
+    'int32_t': 'i',
+    'float': 'f',
+    'fp16': 'e',
+}
+
+
+def _unzigzag(value):
+    return (value >> 1) ^ -(value & 1)
+
+
+def _read_varint(data, idx):
+    value = 0
+    shift = 0
+    while True:
+        byte = data[idx]
+        idx += 1
+        value |= (byte & 0x7f) << shift
+        shift += 7
+        if not byte & 0x80:
+            return value, idx
+
+
+class CompressedBlockDecoder:
+    def __init__(self, types):
+        self._formats = ['<' + TYPES[t] for t in types]
+        self._masks = [(1 << (8 * struct.calcsize(f))) - 1 for f in self._formats]
+        self._raw = [None] * len(types)
+        self._last_sequence = None
+
+    def decode(self, packet):
+        """Decode a log packet, returns the timestamp in ms and the values"""
+        timestamp = packet[1] | (packet[2] << 8) | (packet[3] << 16)
+        flags = packet[4]
+        variable = packet[5]
+        is_keyframe = bool(flags & KEYFRAME_FLAG)
+        sequence = flags & SEQUENCE_MASK
+
+        if self._last_sequence is not None and \
+                sequence != (self._last_sequence + 1) & SEQUENCE_MASK:
+            # Lost packet, wait for a keyframe
+            self._raw = [None] * len(self._raw)
+        self._last_sequence = sequence
+
+        idx = 6
+        while idx < len(packet):
+            encoded, idx = _read_varint(packet, idx)
+            difference = _unzigzag(encoded)
+            mask = self._masks[variable]
+            if is_keyframe:
+                self._raw[variable] = difference & mask
+            elif self._raw[variable] is not None:
+                self._raw[variable] = (self._raw[variable] + difference) & mask
+            variable = (variable + 1) % len(self._raw)
+
+        return timestamp, [self._to_value(i) for i in range(len(self._raw))]
+
+    def _to_value(self, variable):
+        raw = self._raw[variable]
+        if raw is None:
+            return None
+        fmt = self._formats[variable]
+        size = struct.calcsize(fmt)
+        return struct.unpack(fmt, raw.to_bytes(size, 'little'))[0]
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(
+        description='Decode compressed log packets, one hex encoded packet per line')
+    parser.add_argument('filename')
+    parser.add_argument('types', nargs='+', choices=TYPES.keys())
+    args = parser.parse_args()
+
+    decoder = CompressedBlockDecoder(args.types)
+    with open(args.filename) as f:
+        for line in f:
+            line = line.strip()
+            if line:
+                print(*decoder.decode(bytes.fromhex(line)))